@@ -0,0 +1,807 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+/*
+ * Each buddy's counts are kept in memory and in <buddy dir>/.activity: for
+ * every log, how many bytes of it have been counted and when its last message
+ * was, so that a log that grows only needs its new lines read; then messages
+ * and bytes for every day, and messages for every hour of the day.  A log
+ * that shrinks or goes away cannot be taken back out of the daily totals, so
+ * its buddy is counted over from scratch.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "logactivity.h"
+#include "logfile.h"
+
+#define ACTIVITY_FILE     ".activity"
+#define ACTIVITY_VERSION  1
+#define DAY_SECONDS       (24 * 60 * 60)
+
+typedef struct {
+	guint32 messages;
+	guint64 bytes;
+} DayCounts;
+
+typedef struct {
+	GHashTable *days;       /**< date -> DayCounts                        */
+	guint64     hours[24];
+	guint64     messages;
+	guint64     bytes;
+} Counts;
+
+typedef struct {
+	gint64  counted;        /**< Bytes of the log counted so far          */
+	gint64  mtime;
+	guint32 day;            /**< Days after the log began, of its last message */
+	guint32 tod;            /**< Time of day of its last message, in seconds   */
+} ActivityLog;
+
+typedef struct {
+	char       *dir;
+	GHashTable *logs;       /**< File name -> ActivityLog                 */
+	Counts      counts;
+	gboolean    dirty;      /**< Changed since it was last written out    */
+} BuddyActivity;
+
+typedef enum {
+	JOB_SYNC,
+	JOB_UPDATE,
+	JOB_REMOVE,
+	JOB_QUIT
+} LogActivityJobType;
+
+typedef struct {
+	LogActivityJobType type;
+	char              *path;
+	LogWarmup         *warmup;  /**< Of a sync, or NULL */
+} LogActivityJob;
+
+struct _LogActivity {
+	GMutex       lock;          /**< Guards buddies and complete           */
+	GHashTable  *buddies;       /**< Buddy log directory -> BuddyActivity  */
+	gboolean     complete;      /**< A full sync has finished once         */
+	GAsyncQueue *jobs;
+	GThread     *thread;
+	volatile gint quit;
+};
+
+static void
+counts_init(Counts *counts)
+{
+	memset(counts, 0, sizeof(*counts));
+	counts->days = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+}
+
+static void
+counts_clear(Counts *counts)
+{
+	g_hash_table_destroy(counts->days);
+	counts->days = NULL;
+}
+
+static void
+counts_add_day(Counts *counts, gint32 date, guint32 messages, guint64 bytes)
+{
+	DayCounts *day = g_hash_table_lookup(counts->days, GINT_TO_POINTER(date));
+
+	if (day == NULL) {
+		day = g_new0(DayCounts, 1);
+		g_hash_table_insert(counts->days, GINT_TO_POINTER(date), day);
+	}
+	day->messages += messages;
+	day->bytes += bytes;
+	counts->messages += messages;
+	counts->bytes += bytes;
+}
+
+static void
+counts_add(Counts *counts, const Counts *more)
+{
+	GHashTableIter iter;
+	gpointer date;
+	DayCounts *day;
+	guint i;
+
+	g_hash_table_iter_init(&iter, more->days);
+	while (g_hash_table_iter_next(&iter, &date, (gpointer *)&day))
+		counts_add_day(counts, GPOINTER_TO_INT(date), day->messages, day->bytes);
+	for (i = 0; i < 24; i++)
+		counts->hours[i] += more->hours[i];
+}
+
+static void
+buddy_free(BuddyActivity *b)
+{
+	g_free(b->dir);
+	g_hash_table_destroy(b->logs);
+	counts_clear(&b->counts);
+	g_free(b);
+}
+
+/* Called with the lock held */
+static void
+buddy_reset(BuddyActivity *b)
+{
+	g_hash_table_remove_all(b->logs);
+	counts_clear(&b->counts);
+	counts_init(&b->counts);
+	b->dirty = TRUE;
+}
+
+/* Counting */
+
+static gint32
+date_of(const struct tm *start, guint32 day)
+{
+	struct tm tm = *start;
+
+	/* Noon keeps daylight saving changes from moving the date */
+	tm.tm_mday += day;
+	tm.tm_hour = 12;
+	tm.tm_min = tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	mktime(&tm);
+
+	return (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+}
+
+/*
+ * Parses the time stamp that starts a message, "(12:34:56)" with perhaps a
+ * date before the time or AM/PM after it.  p is at the '('.
+ */
+static gboolean
+parse_stamp(const char *p, const char *end, guint32 *tod)
+{
+	const char *close = memchr(p, ')', MIN(end - p, 40));
+	const char *s;
+	int h, m, sec;
+
+	if (close == NULL)
+		return FALSE;
+
+	for (s = p + 1; s + 7 <= close; s++) {
+		if (!g_ascii_isdigit(*s) || (s[1] != ':' && s[2] != ':') ||
+		    sscanf(s, "%2d:%2d:%2d", &h, &m, &sec) != 3)
+			continue;
+		if (g_strstr_len(s, close - s, "PM") != NULL && h < 12)
+			h += 12;
+		else if (g_strstr_len(s, close - s, "AM") != NULL && h == 12)
+			h = 0;
+		if (h > 23 || m > 59 || sec > 60)
+			return FALSE;
+		*tod = h * 3600 + m * 60 + sec;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Counts the messages in the complete lines of buf, carrying on from the
+ * day and time of the message before them.  Returns how many bytes it used.
+ */
+static gsize
+count_lines(const char *buf, gsize len, LogFormat format, const struct tm *start,
+            guint32 *day, guint32 *tod, Counts *counts)
+{
+	const char *p = buf, *end = buf + len, *eol, *q, *gt;
+	gint32 date = date_of(start, *day);
+	guint32 t;
+
+	while (p < end && (eol = memchr(p, '\n', end - p)) != NULL) {
+		q = p;
+		while (q < eol) {
+			if (format == LOG_FORMAT_HTML && *q == '<' &&
+			    (gt = memchr(q, '>', eol - q)) != NULL)
+				q = gt + 1;
+			else if (*q == ' ' || *q == '\t')
+				q++;
+			else
+				break;
+		}
+
+		if (q < eol && *q == '(' && parse_stamp(q, eol, &t)) {
+			/* A time well before the last one is past midnight */
+			if (t + DAY_SECONDS / 2 < *tod) {
+				(*day)++;
+				date = date_of(start, *day);
+			}
+			*tod = t;
+			counts_add_day(counts, date, 1, eol - p);
+			counts->hours[t / 3600 % 24]++;
+		}
+		p = eol + 1;
+	}
+
+	return p - buf;
+}
+
+/*
+ * Counts whatever part of the log at path has not been counted yet.  Returns
+ * FALSE if the log has shrunk and its buddy has to be counted over.
+ */
+static gboolean
+count_log(LogActivity *activity, BuddyActivity *b, const char *path, time_t time,
+          LogFormat format)
+{
+	char *name = g_path_get_basename(path);
+	ActivityLog *log = g_hash_table_lookup(b->logs, name);
+	ActivityLog next;
+	gint64 size, mtime;
+	GBytes *bytes;
+	const char *buf;
+	gsize len;
+	struct tm start;
+	Counts more;
+
+	if (!log_file_stat(path, &size, &mtime) || (log != NULL && size == log->counted)) {
+		g_free(name);
+		return TRUE;
+	}
+	if (log != NULL && size < log->counted) {
+		g_free(name);
+		return FALSE;
+	}
+
+	localtime_r(&time, &start);
+	if (log != NULL) {
+		next = *log;
+	} else {
+		memset(&next, 0, sizeof(next));
+		next.tod = start.tm_hour * 3600 + start.tm_min * 60 + start.tm_sec;
+	}
+
+	if ((bytes = log_file_load(path)) == NULL) {
+		g_free(name);
+		return TRUE;
+	}
+	buf = g_bytes_get_data(bytes, &len);
+	len = MIN(len, (gsize)size);
+
+	counts_init(&more);
+	if (buf != NULL && (gsize)next.counted < len)
+		next.counted += count_lines(buf + next.counted, len - next.counted, format,
+		                            &start, &next.day, &next.tod, &more);
+	next.mtime = mtime;
+	g_bytes_unref(bytes);
+
+	g_mutex_lock(&activity->lock);
+	if (log == NULL) {
+		log = g_new(ActivityLog, 1);
+		g_hash_table_insert(b->logs, name, log);
+		name = NULL;
+	}
+	*log = next;
+	counts_add(&b->counts, &more);
+	b->dirty = TRUE;
+	g_mutex_unlock(&activity->lock);
+
+	counts_clear(&more);
+	g_free(name);
+	return TRUE;
+}
+
+/* Storage */
+
+static void
+put_u32(GByteArray *out, guint32 v)
+{
+	g_byte_array_append(out, (guint8 *)&v, sizeof(v));
+}
+
+static void
+put_u64(GByteArray *out, guint64 v)
+{
+	g_byte_array_append(out, (guint8 *)&v, sizeof(v));
+}
+
+static gboolean
+get_bytes(const guint8 **p, const guint8 *end, void *v, gsize len)
+{
+	if ((gsize)(end - *p) < len)
+		return FALSE;
+	memcpy(v, *p, len);
+	*p += len;
+	return TRUE;
+}
+
+/* Called with the lock held */
+static void
+buddy_write(BuddyActivity *b)
+{
+	GByteArray *out = g_byte_array_new();
+	char *path = g_build_filename(b->dir, ACTIVITY_FILE, NULL);
+	GHashTableIter iter;
+	gpointer key, value;
+	guint i;
+
+	g_byte_array_append(out, (const guint8 *)"LVAC", 4);
+	put_u32(out, ACTIVITY_VERSION);
+	for (i = 0; i < 24; i++)
+		put_u64(out, b->counts.hours[i]);
+
+	put_u32(out, g_hash_table_size(b->logs));
+	g_hash_table_iter_init(&iter, b->logs);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		const ActivityLog *log = value;
+		guint32 len = strlen(key);
+
+		put_u64(out, log->counted);
+		put_u64(out, log->mtime);
+		put_u32(out, log->day);
+		put_u32(out, log->tod);
+		put_u32(out, len);
+		g_byte_array_append(out, key, len);
+	}
+
+	put_u32(out, g_hash_table_size(b->counts.days));
+	g_hash_table_iter_init(&iter, b->counts.days);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		const DayCounts *day = value;
+
+		put_u32(out, GPOINTER_TO_INT(key));
+		put_u32(out, day->messages);
+		put_u64(out, day->bytes);
+	}
+
+	g_file_set_contents(path, (const char *)out->data, out->len, NULL);
+	b->dirty = FALSE;
+	g_byte_array_free(out, TRUE);
+	g_free(path);
+}
+
+static gboolean
+buddy_read(BuddyActivity *b)
+{
+	char *path = g_build_filename(b->dir, ACTIVITY_FILE, NULL);
+	char *contents = NULL;
+	gsize len;
+	const guint8 *p, *end;
+	guint32 version, n, i;
+	gboolean ok = FALSE;
+
+	if (!g_file_get_contents(path, &contents, &len, NULL))
+		goto out;
+
+	p = (const guint8 *)contents;
+	end = p + len;
+	if (len < 4 || memcmp(p, "LVAC", 4) != 0)
+		goto out;
+	p += 4;
+	if (!get_bytes(&p, end, &version, 4) || version != ACTIVITY_VERSION ||
+	    !get_bytes(&p, end, b->counts.hours, sizeof(b->counts.hours)) ||
+	    !get_bytes(&p, end, &n, 4))
+		goto out;
+
+	for (i = 0; i < n; i++) {
+		ActivityLog *log = g_new(ActivityLog, 1);
+		guint32 nlen;
+
+		if (!get_bytes(&p, end, &log->counted, 8) ||
+		    !get_bytes(&p, end, &log->mtime, 8) ||
+		    !get_bytes(&p, end, &log->day, 4) ||
+		    !get_bytes(&p, end, &log->tod, 4) ||
+		    !get_bytes(&p, end, &nlen, 4) ||
+		    (gsize)(end - p) < nlen) {
+			g_free(log);
+			goto out;
+		}
+		g_hash_table_insert(b->logs, g_strndup((const char *)p, nlen), log);
+		p += nlen;
+	}
+
+	if (!get_bytes(&p, end, &n, 4))
+		goto out;
+	for (i = 0; i < n; i++) {
+		guint32 date, messages;
+		guint64 bytes;
+
+		if (!get_bytes(&p, end, &date, 4) ||
+		    !get_bytes(&p, end, &messages, 4) ||
+		    !get_bytes(&p, end, &bytes, 8))
+			goto out;
+		counts_add_day(&b->counts, date, messages, bytes);
+	}
+	ok = TRUE;
+
+out:
+	/* Whatever is there is unusable; count the buddy over */
+	if (!ok)
+		buddy_reset(b);
+	g_free(contents);
+	g_free(path);
+	return ok;
+}
+
+/* Syncing */
+
+static BuddyActivity *
+buddy_get(LogActivity *activity, const char *dir)
+{
+	BuddyActivity *b;
+
+	g_mutex_lock(&activity->lock);
+	b = g_hash_table_lookup(activity->buddies, dir);
+	g_mutex_unlock(&activity->lock);
+	if (b != NULL)
+		return b;
+
+	b = g_new0(BuddyActivity, 1);
+	b->dir = g_strdup(dir);
+	b->logs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	counts_init(&b->counts);
+	buddy_read(b);
+
+	g_mutex_lock(&activity->lock);
+	g_hash_table_insert(activity->buddies, b->dir, b);
+	g_mutex_unlock(&activity->lock);
+
+	return b;
+}
+
+typedef struct {
+	LogActivity   *activity;
+	BuddyActivity *buddy;
+	GHashTable    *seen;      /**< File names of the logs there are */
+	gboolean       shrunk;
+} SyncDir;
+
+static gboolean
+sync_log_cb(const char *protocol, const char *account, const char *buddy,
+            const char *path, time_t time, LogFormat format, gpointer data)
+{
+	SyncDir *sync = data;
+
+	g_hash_table_add(sync->seen, g_path_get_basename(path));
+	if (!count_log(sync->activity, sync->buddy, path, time, format)) {
+		sync->shrunk = TRUE;
+		return FALSE;
+	}
+	return !g_atomic_int_get(&sync->activity->quit);
+}
+
+static void
+sync_dir(LogActivity *activity, const char *dir)
+{
+	SyncDir sync;
+	GHashTableIter iter;
+	gpointer name;
+	gboolean stale = FALSE;
+
+	sync.activity = activity;
+	sync.buddy = buddy_get(activity, dir);
+	sync.seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	sync.shrunk = FALSE;
+
+	log_file_walk_buddy(dir, sync_log_cb, &sync);
+	if (g_atomic_int_get(&activity->quit)) {
+		g_hash_table_destroy(sync.seen);
+		return;
+	}
+
+	g_hash_table_iter_init(&iter, sync.buddy->logs);
+	while (!stale && g_hash_table_iter_next(&iter, &name, NULL))
+		stale = !g_hash_table_contains(sync.seen, name);
+
+	if (sync.shrunk || stale) {
+		g_mutex_lock(&activity->lock);
+		buddy_reset(sync.buddy);
+		g_mutex_unlock(&activity->lock);
+		g_hash_table_remove_all(sync.seen);
+		log_file_walk_buddy(dir, sync_log_cb, &sync);
+	}
+	g_hash_table_destroy(sync.seen);
+
+	g_mutex_lock(&activity->lock);
+	if (sync.buddy->dirty)
+		buddy_write(sync.buddy);
+	g_mutex_unlock(&activity->lock);
+}
+
+static gboolean
+sync_dir_cb(const char *protocol, const char *account, const char *buddy,
+            const char *dir, gpointer data)
+{
+	gpointer *args = data;
+	LogActivity *activity = args[0];
+	LogWarmup *warmup = args[2];
+
+	sync_dir(activity, dir);
+	g_hash_table_add(args[1], g_strdup(dir));
+
+	if (warmup != NULL && !log_warmup_yield(warmup, args[3]))
+		return FALSE;
+	return !g_atomic_int_get(&activity->quit);
+}
+
+static void
+sync_tree(LogActivity *activity, const char *logdir, LogWarmup *warmup)
+{
+	GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GHashTableIter iter;
+	gpointer dir;
+	gint64 busy_since = 0;
+	gpointer args[4];
+
+	args[0] = activity;
+	args[1] = seen;
+	args[2] = warmup;
+	args[3] = &busy_since;
+	if (!log_file_walk_dirs(logdir, sync_dir_cb, args)) {
+		g_hash_table_destroy(seen);
+		return;
+	}
+
+	/* Buddies whose log directories have gone */
+	g_mutex_lock(&activity->lock);
+	g_hash_table_iter_init(&iter, activity->buddies);
+	while (g_hash_table_iter_next(&iter, &dir, NULL))
+		if (!g_hash_table_contains(seen, dir))
+			g_hash_table_iter_remove(&iter);
+	activity->complete = TRUE;
+	g_mutex_unlock(&activity->lock);
+
+	g_hash_table_destroy(seen);
+}
+
+static void
+update_file(LogActivity *activity, const char *path)
+{
+	char *dir = g_path_get_dirname(path);
+	char *name = g_path_get_basename(path);
+	BuddyActivity *b;
+	time_t time;
+	LogFormat format;
+
+	if (!log_file_parse_name(name, &time, &format)) {
+		g_free(dir);
+		g_free(name);
+		return;
+	}
+
+	b = buddy_get(activity, dir);
+	if (!count_log(activity, b, path, time, format)) {
+		sync_dir(activity, dir);
+	} else {
+		g_mutex_lock(&activity->lock);
+		if (b->dirty)
+			buddy_write(b);
+		g_mutex_unlock(&activity->lock);
+	}
+
+	g_free(dir);
+	g_free(name);
+}
+
+static gpointer
+activity_thread(gpointer data)
+{
+	LogActivity *activity = data;
+	LogActivityJob *job;
+	gboolean running = TRUE;
+
+	while (running && (job = g_async_queue_pop(activity->jobs)) != NULL) {
+		switch (job->type) {
+		case JOB_SYNC:
+			sync_tree(activity, job->path, job->warmup);
+			break;
+		case JOB_UPDATE:
+			update_file(activity, job->path);
+			break;
+		case JOB_REMOVE:
+		{
+			char *dir = g_path_get_dirname(job->path);
+
+			sync_dir(activity, dir);
+			g_free(dir);
+			break;
+		}
+		case JOB_QUIT:
+			running = FALSE;
+			break;
+		}
+		g_free(job->path);
+		g_free(job);
+	}
+
+	return NULL;
+}
+
+static void
+push_job(LogActivity *activity, LogActivityJobType type, const char *path)
+{
+	LogActivityJob *job = g_new0(LogActivityJob, 1);
+
+	job->type = type;
+	job->path = g_strdup(path);
+	g_async_queue_push(activity->jobs, job);
+}
+
+LogActivity *
+log_activity_open(void)
+{
+	LogActivity *activity = g_new0(LogActivity, 1);
+
+	g_mutex_init(&activity->lock);
+	activity->buddies = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	                                          (GDestroyNotify)buddy_free);
+	activity->jobs = g_async_queue_new();
+	activity->thread = g_thread_new("logactivity", activity_thread, activity);
+
+	return activity;
+}
+
+void
+log_activity_close(LogActivity *activity)
+{
+	GHashTableIter iter;
+	BuddyActivity *b;
+
+	if (activity == NULL)
+		return;
+
+	g_atomic_int_set(&activity->quit, 1);
+	push_job(activity, JOB_QUIT, NULL);
+	g_thread_join(activity->thread);
+
+	while (g_async_queue_length(activity->jobs) > 0) {
+		LogActivityJob *job = g_async_queue_pop(activity->jobs);
+		g_free(job->path);
+		g_free(job);
+	}
+	g_async_queue_unref(activity->jobs);
+
+	/* A sync cut short may have counted logs it did not get to save */
+	g_hash_table_iter_init(&iter, activity->buddies);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&b))
+		if (b->dirty)
+			buddy_write(b);
+
+	g_hash_table_destroy(activity->buddies);
+	g_mutex_clear(&activity->lock);
+	g_free(activity);
+}
+
+void
+log_activity_sync(LogActivity *activity, const char *logdir, LogWarmup *warmup)
+{
+	LogActivityJob *job = g_new0(LogActivityJob, 1);
+
+	job->type = JOB_SYNC;
+	job->path = g_strdup(logdir);
+	job->warmup = warmup;
+	g_async_queue_push(activity->jobs, job);
+}
+
+void
+log_activity_update_file(LogActivity *activity, const char *path)
+{
+	push_job(activity, JOB_UPDATE, path);
+}
+
+void
+log_activity_remove_file(LogActivity *activity, const char *path)
+{
+	push_job(activity, JOB_REMOVE, path);
+}
+
+gboolean
+log_activity_is_ready(LogActivity *activity)
+{
+	gboolean ready;
+
+	g_mutex_lock(&activity->lock);
+	ready = activity->complete;
+	g_mutex_unlock(&activity->lock);
+
+	return ready;
+}
+
+/* Reports */
+
+static int
+day_compare(gconstpointer a, gconstpointer b)
+{
+	const LogActivityDay *d1 = a, *d2 = b;
+
+	return d1->date < d2->date ? -1 : d1->date > d2->date;
+}
+
+static int
+buddy_compare(gconstpointer a, gconstpointer b)
+{
+	const LogActivityBuddy *b1 = *(LogActivityBuddy **)a;
+	const LogActivityBuddy *b2 = *(LogActivityBuddy **)b;
+
+	if (b1->messages != b2->messages)
+		return b1->messages > b2->messages ? -1 : 1;
+	return strcmp(b1->dir, b2->dir);
+}
+
+static void
+buddy_report_free(LogActivityBuddy *buddy)
+{
+	g_free(buddy->dir);
+	g_free(buddy);
+}
+
+/* Called with the lock held */
+static void
+report_add(LogActivityReport *report, Counts *sum, const BuddyActivity *b)
+{
+	LogActivityBuddy *buddy;
+
+	if (b->counts.messages == 0)
+		return;
+
+	counts_add(sum, &b->counts);
+	buddy = g_new(LogActivityBuddy, 1);
+	buddy->dir = g_strdup(b->dir);
+	buddy->messages = b->counts.messages;
+	buddy->bytes = b->counts.bytes;
+	g_ptr_array_add(report->buddies, buddy);
+}
+
+LogActivityReport *
+log_activity_report(LogActivity *activity, GPtrArray *dirs)
+{
+	LogActivityReport *report = g_new0(LogActivityReport, 1);
+	GHashTableIter iter;
+	BuddyActivity *b;
+	Counts sum;
+	gpointer date;
+	DayCounts *counts;
+	guint i;
+
+	report->days = g_array_new(FALSE, FALSE, sizeof(LogActivityDay));
+	report->buddies = g_ptr_array_new_with_free_func((GDestroyNotify)buddy_report_free);
+	counts_init(&sum);
+
+	g_mutex_lock(&activity->lock);
+	if (dirs == NULL) {
+		g_hash_table_iter_init(&iter, activity->buddies);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&b))
+			report_add(report, &sum, b);
+	} else {
+		for (i = 0; i < dirs->len; i++)
+			if ((b = g_hash_table_lookup(activity->buddies,
+			                             g_ptr_array_index(dirs, i))) != NULL)
+				report_add(report, &sum, b);
+	}
+	g_mutex_unlock(&activity->lock);
+
+	g_hash_table_iter_init(&iter, sum.days);
+	while (g_hash_table_iter_next(&iter, &date, (gpointer *)&counts)) {
+		LogActivityDay day;
+
+		day.date = GPOINTER_TO_INT(date);
+		day.messages = counts->messages;
+		day.bytes = counts->bytes;
+		g_array_append_val(report->days, day);
+	}
+	g_array_sort(report->days, day_compare);
+	g_ptr_array_sort(report->buddies, buddy_compare);
+	memcpy(report->hours, sum.hours, sizeof(report->hours));
+	report->messages = sum.messages;
+	report->bytes = sum.bytes;
+	counts_clear(&sum);
+
+	return report;
+}
+
+void
+log_activity_report_free(LogActivityReport *report)
+{
+	if (report == NULL)
+		return;
+
+	g_array_free(report->days, TRUE);
+	g_ptr_array_free(report->buddies, TRUE);
+	g_free(report);
+}
@@ -0,0 +1,75 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGACTIVITY_H_
+#define _LOGVIEWER_LOGACTIVITY_H_
+
+#include <glib.h>
+
+#include "logwarmup.h"
+
+/**
+ * How much was said with each buddy: messages and bytes per day and messages
+ * per hour of the day.  The counts are kept in a small file, .activity, in
+ * each buddy's log directory.  Logs are only read when they are new or have
+ * grown, and then only the part not yet counted, so the counts stay current
+ * as conversations are logged.
+ *
+ * All counting is done by a worker thread owned by LogActivity; the other
+ * calls may be made from the main thread at any time.
+ */
+typedef struct _LogActivity LogActivity;
+typedef struct _LogActivityReport LogActivityReport;
+
+typedef struct {
+	gint32  date;       /**< year * 10000 + month (1-12) * 100 + day, local */
+	guint32 messages;
+	guint64 bytes;
+} LogActivityDay;
+
+typedef struct {
+	char   *dir;        /**< The buddy's log directory                      */
+	guint64 messages;
+	guint64 bytes;
+} LogActivityBuddy;
+
+struct _LogActivityReport {
+	GArray    *days;      /**< LogActivityDay, oldest first                 */
+	GPtrArray *buddies;   /**< LogActivityBuddy, most messages first        */
+	guint64    hours[24]; /**< Messages by the local hour they were sent in */
+	guint64    messages;
+	guint64    bytes;
+};
+
+LogActivity *log_activity_open(void);
+
+/** Stops the worker, writes out any counts not yet saved and frees it. */
+void log_activity_close(LogActivity *activity);
+
+/**
+ * Brings the counts for every buddy under logdir up to date in the
+ * background, reading only logs that are new or have grown.  The work
+ * yields to warmup between logs, if it is given.
+ */
+void log_activity_sync(LogActivity *activity, const char *logdir, LogWarmup *warmup);
+
+/** Counts whatever has been appended to the log at path since it was last counted. */
+void log_activity_update_file(LogActivity *activity, const char *path);
+
+/** Takes a log that has been deleted out of its buddy's counts. */
+void log_activity_remove_file(LogActivity *activity, const char *path);
+
+/** Whether every buddy has been counted at least once. */
+gboolean log_activity_is_ready(LogActivity *activity);
+
+/**
+ * Adds up the counts of the buddy log directories in dirs, or of every buddy
+ * if dirs is NULL.
+ */
+LogActivityReport *log_activity_report(LogActivity *activity, GPtrArray *dirs);
+
+void log_activity_report_free(LogActivityReport *report);
+
+#endif /* _LOGVIEWER_LOGACTIVITY_H_ */
@@ -0,0 +1,495 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+/*
+ * An archive is laid out as
+ *
+ *   header | frame 0 | frame 1 | ... | padding | toc | names
+ *
+ * where each frame is one log compressed with zlib on its own, the toc holds
+ * an ArchiveEntry per log sorted by name, and names holds the log file names,
+ * each followed by a NUL.  The header is written last, so an archive cut
+ * short is never taken for a whole one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <zlib.h>
+
+#include "logarchive.h"
+#include "logfile.h"
+
+#define LOG_ARCHIVE_VERSION  1
+#define LOG_ARCHIVE_QUIET    (24 * 60 * 60)  /* logs younger than this stay loose */
+
+typedef struct {
+	char    magic[4];
+	guint32 version;
+	guint32 n_logs;
+	guint32 reserved;
+	guint64 toc_off;
+	guint64 names_off;
+} ArchiveHeader;
+
+typedef struct {
+	guint64 offset;     /**< Of the compressed frame              */
+	guint32 clen;       /**< Compressed length                    */
+	guint32 len;        /**< Length of the log                    */
+	gint64  time;       /**< When the conversation started        */
+	gint64  mtime;      /**< Of the file the log was packed from  */
+	guint32 name_off;   /**< Into names                           */
+	guint32 name_len;
+} ArchiveEntry;
+
+struct _LogArchive {
+	GMappedFile        *file;
+	const guint8       *data;
+	guint               n_logs;
+	const ArchiveEntry *toc;
+	const char         *names;
+};
+
+gboolean
+log_archive_parse_name(const char *name, int *year, int *month)
+{
+	int y, m, n = 0;
+
+	if (sscanf(name, "%4d-%2d%n", &y, &m, &n) != 2 || n != 7 ||
+	    strcmp(name + n, LOG_ARCHIVE_SUFFIX) != 0 || m < 1 || m > 12)
+		return FALSE;
+
+	if (year != NULL)
+		*year = y;
+	if (month != NULL)
+		*month = m - 1;
+	return TRUE;
+}
+
+char *
+log_archive_path_for(const char *path)
+{
+	char *dir = g_path_get_dirname(path);
+	char *name = g_path_get_basename(path);
+	char *month = g_strndup(name, 7);
+	char *archive;
+
+	/* Logs are named YYYY-MM-DD.HHMMSS... */
+	archive = g_strconcat(dir, G_DIR_SEPARATOR_S, month, LOG_ARCHIVE_SUFFIX, NULL);
+	g_free(month);
+	g_free(name);
+	g_free(dir);
+	return archive;
+}
+
+/* Reading */
+
+LogArchive *
+log_archive_open(const char *path)
+{
+	LogArchive *archive;
+	const ArchiveHeader *header;
+	GMappedFile *file;
+	gsize len;
+	guint32 i;
+
+	if ((file = g_mapped_file_new(path, FALSE, NULL)) == NULL)
+		return NULL;
+
+	len = g_mapped_file_get_length(file);
+	header = (const ArchiveHeader *)g_mapped_file_get_contents(file);
+	if (len < sizeof(*header) || memcmp(header->magic, "LVPK", 4) != 0 ||
+	    header->version != LOG_ARCHIVE_VERSION || header->toc_off % 8 != 0 ||
+	    header->toc_off + (guint64)header->n_logs * sizeof(ArchiveEntry) > header->names_off ||
+	    header->names_off > len) {
+		g_mapped_file_unref(file);
+		return NULL;
+	}
+
+	archive = g_new0(LogArchive, 1);
+	archive->file = file;
+	archive->data = (const guint8 *)header;
+	archive->n_logs = header->n_logs;
+	archive->toc = (const ArchiveEntry *)(archive->data + header->toc_off);
+	archive->names = (const char *)(archive->data + header->names_off);
+
+	/* Check every entry once so the getters can trust the table */
+	for (i = 0; i < archive->n_logs; i++) {
+		const ArchiveEntry *e = &archive->toc[i];
+
+		if (header->names_off + e->name_off + e->name_len >= len ||
+		    archive->names[e->name_off + e->name_len] != '\0' ||
+		    e->offset < sizeof(*header) || e->offset + e->clen > header->toc_off) {
+			log_archive_close(archive);
+			return NULL;
+		}
+	}
+
+	return archive;
+}
+
+void
+log_archive_close(LogArchive *archive)
+{
+	if (archive == NULL)
+		return;
+	g_mapped_file_unref(archive->file);
+	g_free(archive);
+}
+
+guint
+log_archive_get_n_logs(const LogArchive *archive)
+{
+	return archive->n_logs;
+}
+
+const char *
+log_archive_get_name(const LogArchive *archive, guint i)
+{
+	return archive->names + archive->toc[i].name_off;
+}
+
+time_t
+log_archive_get_time(const LogArchive *archive, guint i)
+{
+	return archive->toc[i].time;
+}
+
+gint64
+log_archive_get_size(const LogArchive *archive, guint i)
+{
+	return archive->toc[i].len;
+}
+
+gint64
+log_archive_get_mtime(const LogArchive *archive, guint i)
+{
+	return archive->toc[i].mtime;
+}
+
+gint
+log_archive_find(const LogArchive *archive, const char *name)
+{
+	guint lo = 0, hi = archive->n_logs;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(log_archive_get_name(archive, mid), name);
+
+		if (cmp == 0)
+			return mid;
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return -1;
+}
+
+GBytes *
+log_archive_read(const LogArchive *archive, guint i)
+{
+	const ArchiveEntry *e = &archive->toc[i];
+	uLongf len = e->len;
+	guint8 *buf = g_malloc(MAX(e->len, 1));
+
+	if (uncompress(buf, &len, archive->data + e->offset, e->clen) != Z_OK ||
+	    len != e->len) {
+		g_free(buf);
+		return NULL;
+	}
+	return g_bytes_new_take(buf, len);
+}
+
+/* Opens the archive a log would be in and finds it there */
+static LogArchive *
+open_for(const char *path, gint *i)
+{
+	char *apath = log_archive_path_for(path);
+	char *name = g_path_get_basename(path);
+	LogArchive *archive = log_archive_open(apath);
+
+	if (archive != NULL && (*i = log_archive_find(archive, name)) < 0) {
+		log_archive_close(archive);
+		archive = NULL;
+	}
+	g_free(name);
+	g_free(apath);
+	return archive;
+}
+
+GBytes *
+log_archive_load(const char *path)
+{
+	LogArchive *archive;
+	GBytes *bytes;
+	gint i;
+
+	if ((archive = open_for(path, &i)) == NULL)
+		return NULL;
+	bytes = log_archive_read(archive, i);
+	log_archive_close(archive);
+	return bytes;
+}
+
+gboolean
+log_archive_stat(const char *path, gint64 *size, gint64 *mtime)
+{
+	LogArchive *archive;
+	gint i;
+
+	if ((archive = open_for(path, &i)) == NULL)
+		return FALSE;
+	*size = log_archive_get_size(archive, i);
+	*mtime = log_archive_get_mtime(archive, i);
+	log_archive_close(archive);
+	return TRUE;
+}
+
+/* Packing */
+
+typedef struct {
+	char         *name;
+	char         *path;     /**< Of a loose log; NULL if already packed */
+	gint          packed;   /**< Its position in the old archive        */
+	gint64        mtime;
+} PackItem;
+
+static void
+pack_item_free(PackItem *item)
+{
+	g_free(item->name);
+	g_free(item->path);
+	g_free(item);
+}
+
+static gint
+pack_item_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp((*(PackItem **)a)->name, (*(PackItem **)b)->name);
+}
+
+/* Writes a log's frame at the end of fp and fills in its entry */
+static gboolean
+pack_write_log(FILE *fp, PackItem *item, const LogArchive *old, ArchiveEntry *e)
+{
+	char *buf;
+	gsize len;
+	guint8 *frame;
+	uLongf clen;
+	gboolean ok;
+
+	e->offset = ftello(fp);
+	e->mtime = item->mtime;
+
+	if (item->path == NULL) {
+		/* Already compressed; copied over as it is */
+		const ArchiveEntry *o = &old->toc[item->packed];
+
+		e->clen = o->clen;
+		e->len = o->len;
+		return fwrite(old->data + o->offset, 1, o->clen, fp) == o->clen;
+	}
+
+	if (!g_file_get_contents(item->path, &buf, &len, NULL))
+		return FALSE;
+	clen = compressBound(len);
+	frame = g_malloc(clen);
+	ok = len <= G_MAXUINT32 && compress2(frame, &clen, (guint8 *)buf, len, 6) == Z_OK &&
+	     fwrite(frame, 1, clen, fp) == clen;
+	e->clen = clen;
+	e->len = len;
+	g_free(frame);
+	g_free(buf);
+	return ok;
+}
+
+/*
+ * Writes items, sorted by name, to archive through a temporary file.  The
+ * loose logs are only removed once the archive holding them is in place.
+ */
+static gboolean
+pack_write(const char *archive, GPtrArray *items, const LogArchive *old)
+{
+	char *tmp = g_strconcat(archive, ".tmp", NULL);
+	FILE *fp = g_fopen(tmp, "wb");
+	GString *names = g_string_new(NULL);
+	ArchiveEntry *toc = g_new0(ArchiveEntry, items->len);
+	static const guint8 zeros[8];
+	ArchiveHeader header;
+	gsize pad;
+	guint i;
+	gboolean ok = fp != NULL;
+
+	memset(&header, 0, sizeof(header));
+	if (ok)
+		ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+	for (i = 0; ok && i < items->len; i++) {
+		PackItem *item = g_ptr_array_index(items, i);
+		time_t time = 0;
+
+		log_file_parse_name(item->name, &time, NULL);
+		toc[i].time = time;
+		toc[i].name_off = names->len;
+		toc[i].name_len = strlen(item->name);
+		g_string_append_len(names, item->name, toc[i].name_len + 1);
+		ok = pack_write_log(fp, item, old, &toc[i]);
+	}
+
+	if (ok) {
+		header.toc_off = ftello(fp);
+		pad = (8 - header.toc_off % 8) % 8;
+		header.toc_off += pad;
+		header.names_off = header.toc_off + items->len * sizeof(ArchiveEntry);
+		memcpy(header.magic, "LVPK", 4);
+		header.version = LOG_ARCHIVE_VERSION;
+		header.n_logs = items->len;
+
+		ok = fwrite(zeros, 1, pad, fp) == pad &&
+		     fwrite(toc, sizeof(ArchiveEntry), items->len, fp) == items->len &&
+		     fwrite(names->str, 1, names->len, fp) == names->len &&
+		     fseek(fp, 0, SEEK_SET) == 0 &&
+		     fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		     fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	}
+	if (fp != NULL && fclose(fp) != 0)
+		ok = FALSE;
+	if (ok)
+		ok = g_rename(tmp, archive) == 0;
+	if (!ok)
+		g_unlink(tmp);
+
+	g_free(toc);
+	g_string_free(names, TRUE);
+	g_free(tmp);
+	return ok;
+}
+
+/* Packs the loose logs of one month of dir into its archive */
+static guint
+pack_month(const char *dir, const char *month, GPtrArray *loose)
+{
+	char *archive = g_strconcat(dir, G_DIR_SEPARATOR_S, month, LOG_ARCHIVE_SUFFIX, NULL);
+	LogArchive *old = log_archive_open(archive);
+	GPtrArray *items = g_ptr_array_new_with_free_func((GDestroyNotify)pack_item_free);
+	GHashTable *names = g_hash_table_new(g_str_hash, g_str_equal);
+	guint i, packed = 0;
+
+	for (i = 0; i < loose->len; i++) {
+		PackItem *item = g_ptr_array_index(loose, i);
+
+		g_hash_table_add(names, item->name);
+		g_ptr_array_add(items, item);
+	}
+	/* A loose log also in the archive was left behind by an earlier run */
+	for (i = 0; old != NULL && i < old->n_logs; i++) {
+		PackItem *item;
+
+		if (g_hash_table_contains(names, log_archive_get_name(old, i)))
+			continue;
+		item = g_new0(PackItem, 1);
+		item->name = g_strdup(log_archive_get_name(old, i));
+		item->packed = i;
+		item->mtime = log_archive_get_mtime(old, i);
+		g_ptr_array_add(items, item);
+	}
+	g_ptr_array_sort(items, pack_item_compare);
+
+	if (pack_write(archive, items, old)) {
+		for (i = 0; i < loose->len; i++)
+			g_unlink(((PackItem *)g_ptr_array_index(loose, i))->path);
+		packed = loose->len;
+	}
+
+	/* items has them now */
+	g_ptr_array_set_free_func(loose, NULL);
+	g_hash_table_destroy(names);
+	g_ptr_array_free(items, TRUE);
+	log_archive_close(old);
+	g_free(archive);
+	return packed;
+}
+
+typedef struct {
+	gint64         before;    /**< YYYYMM of the first month left loose */
+	gint64         now;
+	volatile gint *cancel;
+	guint          packed;
+} CompactArgs;
+
+static gboolean
+compact_dir_cb(const char *protocol, const char *account, const char *buddy,
+               const char *dir, gpointer data)
+{
+	CompactArgs *args = data;
+	GHashTable *months = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                           (GDestroyNotify)g_ptr_array_unref);
+	GHashTableIter iter;
+	gpointer month, loose;
+	GDir *d;
+	const char *name;
+
+	if ((d = g_dir_open(dir, 0, NULL)) == NULL)
+		return TRUE;
+
+	while ((name = g_dir_read_name(d)) != NULL) {
+		PackItem *item;
+		GPtrArray *list;
+		GStatBuf st;
+		char *path;
+		int year, mon;
+
+		if (!log_file_parse_name(name, NULL, NULL) ||
+		    sscanf(name, "%4d-%2d", &year, &mon) != 2 ||
+		    year * 100 + mon - 1 >= args->before)
+			continue;
+
+		path = g_build_filename(dir, name, NULL);
+		if (g_stat(path, &st) != 0 || st.st_mtime > args->now - LOG_ARCHIVE_QUIET) {
+			g_free(path);
+			continue;
+		}
+
+		item = g_new0(PackItem, 1);
+		item->name = g_strdup(name);
+		item->path = path;
+		item->mtime = st.st_mtime;
+
+		month = g_strndup(name, 7);
+		if ((list = g_hash_table_lookup(months, month)) == NULL) {
+			list = g_ptr_array_new_with_free_func((GDestroyNotify)pack_item_free);
+			g_hash_table_insert(months, month, list);
+		} else {
+			g_free(month);
+		}
+		g_ptr_array_add(list, item);
+	}
+	g_dir_close(d);
+
+	g_hash_table_iter_init(&iter, months);
+	while (g_hash_table_iter_next(&iter, &month, &loose) &&
+	       !g_atomic_int_get(args->cancel))
+		args->packed += pack_month(dir, month, loose);
+
+	g_hash_table_destroy(months);
+	return !g_atomic_int_get(args->cancel);
+}
+
+guint
+log_archive_compact(const char *logdir, int year, int month, volatile gint *cancel)
+{
+	CompactArgs args;
+
+	args.before = year * 100 + month;
+	args.now = time(NULL);
+	args.cancel = cancel;
+	args.packed = 0;
+	log_file_walk_dirs(logdir, compact_dir_cb, &args);
+
+	return args.packed;
+}
@@ -0,0 +1,66 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGARCHIVE_H_
+#define _LOGVIEWER_LOGARCHIVE_H_
+
+#include <time.h>
+#include <glib.h>
+
+/**
+ * A month of one buddy's logs packed into a single file, YYYY-MM.logpack, in
+ * the buddy's log directory.  Each log is compressed on its own so any one
+ * can be read without the others, and a table of contents at the end gives
+ * the name, size and modification time each log had as a file.
+ *
+ * A packed log keeps the path it had as a file, as if it were still there;
+ * log_file_load() and log_file_stat() find it in its archive.  Nothing here
+ * calls into libpurple, so archives may be read from any thread.
+ */
+typedef struct _LogArchive LogArchive;
+
+#define LOG_ARCHIVE_SUFFIX ".logpack"
+
+/** Parses an archive's file name; year and month (0-11) may be NULL. */
+gboolean log_archive_parse_name(const char *name, int *year, int *month);
+
+/** The archive a log at path would be packed into. */
+char *log_archive_path_for(const char *path);
+
+/** Returns NULL if path is not a readable archive. */
+LogArchive *log_archive_open(const char *path);
+
+void log_archive_close(LogArchive *archive);
+
+guint log_archive_get_n_logs(const LogArchive *archive);
+
+/** The file name the log had, which sorts the logs by time. */
+const char *log_archive_get_name(const LogArchive *archive, guint i);
+time_t log_archive_get_time(const LogArchive *archive, guint i);
+gint64 log_archive_get_size(const LogArchive *archive, guint i);
+gint64 log_archive_get_mtime(const LogArchive *archive, guint i);
+
+/** The position of the log called name, or -1. */
+gint log_archive_find(const LogArchive *archive, const char *name);
+
+/** Uncompresses the log, or returns NULL if it is damaged. */
+GBytes *log_archive_read(const LogArchive *archive, guint i);
+
+/** Reads a packed log by the path it had as a file. */
+GBytes *log_archive_load(const char *path);
+
+/** Looks up a packed log by the path it had as a file. */
+gboolean log_archive_stat(const char *path, gint64 *size, gint64 *mtime);
+
+/**
+ * Packs the logs of every month before year/month (0-11) under logdir into
+ * archives, merging them into any archive already there, and removes the
+ * files.  Logs written to in the last day are left alone.  Stops early once
+ * cancel is set.  Returns how many logs were packed.
+ */
+guint log_archive_compact(const char *logdir, int year, int month,
+                          volatile gint *cancel);
+
+#endif /* _LOGVIEWER_LOGARCHIVE_H_ */
@@ -0,0 +1,480 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+/*
+ * Times the viewer's work on a log tree without a window, as a log tree
+ * written by loggen, and prints the throughput and latencies of each step:
+ *
+ *   logbench [--rounds N] LOGDIR
+ *
+ * The steps are the ones behind the window: finding the buddies, marking a
+ * buddy's calendar, looking up a day, searching every log and reading a log
+ * to show it.  The index is built once in a scratch directory, and then
+ * looked up and searched with like the window does.  The MB/s of searches is
+ * of the bytes they read, which with the index is only the logs it names.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib/gstdio.h>
+
+#include "logbuddies.h"
+#include "logfile.h"
+#include "logindex.h"
+#include "logquery.h"
+#include "logsearch.h"
+#include "logtimeline.h"
+
+#define DAY_LOOKUPS  100000      /* random days looked up per round     */
+#define RENDERS      500         /* random logs read and decoded per round */
+
+static const char *queries[] = {
+	"TICKET-4242",
+	"coffee meeting",
+	"\"example.com/page\"",
+	"deploy OR reboot",
+	"from:buddy0 crash",
+	"with:buddy3 NOT lunch",
+	"nothinglikethis"
+};
+
+typedef struct {
+	const char *name;
+	GArray     *ns;       /**< gint64 nanoseconds, one per operation */
+	gint64      bytes;    /**< Read by all operations, or 0          */
+} Timing;
+
+typedef struct {
+	char        *path;
+	time_t       time;
+	LogFormat    format;
+} BenchLog;
+
+typedef struct {
+	GMainLoop   *loop;
+	guint        count;
+} Waiter;
+
+static gint64
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+timing_init(Timing *timing, const char *name)
+{
+	timing->name = name;
+	timing->ns = g_array_new(FALSE, FALSE, sizeof(gint64));
+	timing->bytes = 0;
+}
+
+static void
+timing_add(Timing *timing, gint64 ns)
+{
+	g_array_append_val(timing->ns, ns);
+}
+
+static int
+compare_ns(gconstpointer a, gconstpointer b)
+{
+	gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double
+percentile_us(GArray *ns, double p)
+{
+	guint i = (guint)(p * (ns->len - 1) + 0.5);
+
+	return g_array_index(ns, gint64, i) / 1000.0;
+}
+
+static void
+timing_report(Timing *timing)
+{
+	gint64 total = 0;
+	guint i;
+
+	if (timing->ns->len == 0)
+		return;
+
+	for (i = 0; i < timing->ns->len; i++)
+		total += g_array_index(timing->ns, gint64, i);
+	g_array_sort(timing->ns, compare_ns);
+
+	printf("%-10s %8u %10.1f %12.1f %10.1f %10.1f %10.1f %10.1f",
+	       timing->name, timing->ns->len, total / 1e6,
+	       timing->ns->len / (total / 1e9),
+	       percentile_us(timing->ns, 0.50), percentile_us(timing->ns, 0.90),
+	       percentile_us(timing->ns, 0.99), percentile_us(timing->ns, 1.0));
+	if (timing->bytes > 0)
+		printf(" %8.1f", timing->bytes / (total / 1e9) / (1 << 20));
+	printf("\n");
+
+	g_array_free(timing->ns, TRUE);
+}
+
+/* Finding the buddies */
+
+static void
+buddies_found_cb(LogBuddyScan *scan, GPtrArray *dirs, gpointer data)
+{
+	Waiter *waiter = data;
+
+	waiter->count += dirs->len;
+}
+
+static void
+buddies_done_cb(LogBuddyScan *scan, gpointer data)
+{
+	Waiter *waiter = data;
+
+	g_main_loop_quit(waiter->loop);
+}
+
+static guint
+bench_buddies(const char *logdir, Timing *timing)
+{
+	Waiter waiter = { g_main_loop_new(NULL, FALSE), 0 };
+	LogBuddyScan *scan;
+	gint64 start = now_ns();
+
+	scan = log_buddy_scan_start(logdir, buddies_found_cb, buddies_done_cb, &waiter);
+	g_main_loop_run(waiter.loop);
+	timing_add(timing, now_ns() - start);
+
+	log_buddy_scan_free(scan);
+	g_main_loop_unref(waiter.loop);
+	return waiter.count;
+}
+
+/* The calendar */
+
+static void
+bench_log_free(BenchLog *log)
+{
+	g_free(log->path);
+	g_free(log);
+}
+
+static gboolean
+collect_cb(const char *protocol, const char *account, const char *buddy,
+           const char *path, time_t time, LogFormat format, gpointer data)
+{
+	GHashTable *by_dir = data;
+	char *dir = g_path_get_dirname(path);
+	GPtrArray *logs = g_hash_table_lookup(by_dir, dir);
+	BenchLog *log = g_new0(BenchLog, 1);
+
+	if (logs == NULL) {
+		logs = g_ptr_array_new_with_free_func((GDestroyNotify)bench_log_free);
+		g_hash_table_insert(by_dir, dir, logs);
+	} else
+		g_free(dir);
+
+	log->path = g_strdup(path);
+	log->time = time;
+	log->format = format;
+	g_ptr_array_add(logs, log);
+	return TRUE;
+}
+
+/* Builds one buddy's timeline and marks every month it spans, as paging
+ * through the calendar does */
+static LogTimeline *
+build_timeline(GPtrArray *logs, Timing *timing)
+{
+	LogTimeline *timeline;
+	int year, month, day, y, m;
+	gint64 start = now_ns();
+	guint32 marked = 0;
+	guint i;
+
+	timeline = log_timeline_new(NULL);
+	for (i = 0; i < logs->len; i++) {
+		BenchLog *log = g_ptr_array_index(logs, i);
+
+		log_timeline_add(timeline, log->time, NULL, log);
+	}
+
+	if (log_timeline_latest(timeline, &year, &month, &day)) {
+		struct tm tm;
+		time_t first = log_timeline_get_time(timeline, 0);
+
+		localtime_r(&first, &tm);
+		for (y = tm.tm_year + 1900, m = tm.tm_mon;
+		     y < year || (y == year && m <= month); m = (m + 1) % 12, y += (m == 0))
+			marked |= log_timeline_month_mask(timeline, y, m);
+	}
+	timing_add(timing, now_ns() - start);
+
+	/* Keeps the marking from being optimized away */
+	if (marked == 0 && logs->len > 0)
+		fprintf(stderr, "no days marked\n");
+	return timeline;
+}
+
+static void
+bench_days(GPtrArray *timelines, GRand *rand, Timing *timing)
+{
+	guint i, n = 0;
+
+	for (i = 0; i < DAY_LOOKUPS; i++) {
+		LogTimeline *timeline = g_ptr_array_index(timelines,
+			g_rand_int_range(rand, 0, timelines->len));
+		time_t t = log_timeline_get_time(timeline,
+			g_rand_int_range(rand, 0, log_timeline_length(timeline)));
+		struct tm tm;
+		guint first;
+		gint64 start;
+
+		localtime_r(&t, &tm);
+		start = now_ns();
+		n += log_timeline_day(timeline, tm.tm_year + 1900, tm.tm_mon,
+		                      tm.tm_mday, &first);
+		timing_add(timing, now_ns() - start);
+	}
+
+	if (n < DAY_LOOKUPS)
+		fprintf(stderr, "a day with logs came up empty\n");
+}
+
+/* Searching */
+
+static void
+search_hits_cb(LogSearch *search, GPtrArray *hits, gpointer data)
+{
+	Waiter *waiter = data;
+
+	waiter->count += hits->len;
+}
+
+static void
+search_done_cb(LogSearch *search, gpointer data)
+{
+	Waiter *waiter = data;
+
+	g_main_loop_quit(waiter->loop);
+}
+
+static guint
+bench_search(const char *logdir, const char *query, LogIndex *index,
+             Timing *timing)
+{
+	Waiter waiter = { g_main_loop_new(NULL, FALSE), 0 };
+	LogSearch *search;
+	LogStatsCounters stats;
+	gint64 start = now_ns();
+
+	/* No cache, so every log, or every one the index names, is read */
+	search = log_search_start(logdir, query, NULL, index, search_hits_cb,
+	                          search_done_cb, &waiter);
+	g_main_loop_run(waiter.loop);
+	timing_add(timing, now_ns() - start);
+
+	log_search_get_stats(search, &stats);
+	timing->bytes += stats.bytes;
+
+	log_search_free(search);
+	g_main_loop_unref(waiter.loop);
+	return waiter.count;
+}
+
+/* The index */
+
+static LogIndex *
+bench_index_build(const char *logdir, const char *dir, Timing *timing)
+{
+	LogIndex *index = log_index_open(dir);
+	gint64 start = now_ns();
+
+	log_index_sync(index, logdir, NULL);
+	while (!log_index_is_ready(index))
+		g_usleep(1000);
+	timing_add(timing, now_ns() - start);
+	return index;
+}
+
+static void
+bench_index_lookup(LogIndex *index, const char *query, Timing *timing)
+{
+	LogQuery *parsed = log_query_parse(query);
+	GPtrArray *hits;
+	gint64 start;
+
+	if (parsed == NULL || log_query_get_literal(parsed) == NULL) {
+		log_query_free(parsed);
+		return;
+	}
+	start = now_ns();
+	hits = log_index_query(index, log_query_get_literal(parsed));
+	timing_add(timing, now_ns() - start);
+
+	if (hits != NULL)
+		g_ptr_array_free(hits, TRUE);
+	log_query_free(parsed);
+}
+
+/* Removes the scratch index, which holds nothing but files */
+static void
+remove_index_dir(const char *dir)
+{
+	GDir *d = g_dir_open(dir, 0, NULL);
+	const char *name;
+
+	while (d != NULL && (name = g_dir_read_name(d)) != NULL) {
+		char *path = g_build_filename(dir, name, NULL);
+
+		g_unlink(path);
+		g_free(path);
+	}
+	if (d != NULL)
+		g_dir_close(d);
+	g_rmdir(dir);
+}
+
+/* Showing a log */
+
+static void
+bench_render(GPtrArray *all, GRand *rand, Timing *timing)
+{
+	guint i;
+
+	for (i = 0; i < RENDERS; i++) {
+		BenchLog *log = g_ptr_array_index(all, g_rand_int_range(rand, 0, all->len));
+		gint64 start = now_ns();
+		GBytes *bytes = log_file_load(log->path);
+		char *text;
+
+		if (bytes == NULL) {
+			fprintf(stderr, "%s: could not be read\n", log->path);
+			continue;
+		}
+		text = log_file_decode(g_bytes_get_data(bytes, NULL),
+		                       g_bytes_get_size(bytes), log->format);
+		timing->bytes += g_bytes_get_size(bytes);
+		g_bytes_unref(bytes);
+		g_free(text);
+		timing_add(timing, now_ns() - start);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *logdir = NULL;
+	guint rounds = 3, n_buddies = 0, i, r;
+	GHashTable *by_dir;
+	GHashTableIter iter;
+	GPtrArray *logs, *all, *timelines;
+	GRand *rand;
+	gint64 total_bytes = 0;
+	LogIndex *index;
+	char *index_dir;
+	Timing buddies, calendar, days, search, render, build, lookup, isearch;
+
+	for (i = 1; i < (guint)argc; i++) {
+		if (strcmp(argv[i], "--rounds") == 0 && i + 1 < (guint)argc)
+			rounds = strtoul(argv[++i], NULL, 10);
+		else if (argv[i][0] != '-' && logdir == NULL)
+			logdir = argv[i];
+		else
+			break;
+	}
+	if (i < (guint)argc || logdir == NULL || rounds == 0) {
+		fprintf(stderr, "usage: %s [--rounds N] LOGDIR\n", argv[0]);
+		return 2;
+	}
+
+	by_dir = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                               (GDestroyNotify)g_ptr_array_unref);
+	log_file_walk(logdir, collect_cb, by_dir);
+	all = g_ptr_array_new();
+	g_hash_table_iter_init(&iter, by_dir);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&logs)) {
+		for (i = 0; i < logs->len; i++) {
+			BenchLog *log = g_ptr_array_index(logs, i);
+			gint64 size, mtime;
+
+			g_ptr_array_add(all, log);
+			if (log_file_stat(log->path, &size, &mtime))
+				total_bytes += size;
+		}
+	}
+	if (all->len == 0) {
+		fprintf(stderr, "%s: no logs found\n", logdir);
+		return 1;
+	}
+
+	timing_init(&buddies, "buddies");
+	timing_init(&calendar, "calendar");
+	timing_init(&days, "day");
+	timing_init(&search, "search");
+	timing_init(&render, "render");
+	timing_init(&build, "index");
+	timing_init(&lookup, "lookup");
+	timing_init(&isearch, "isearch");
+	rand = g_rand_new_with_seed(1);
+
+	index_dir = g_dir_make_tmp("logbench-XXXXXX", NULL);
+	if (index_dir == NULL) {
+		fprintf(stderr, "no scratch directory for the index\n");
+		return 1;
+	}
+	index = bench_index_build(logdir, index_dir, &build);
+	build.bytes = total_bytes;
+
+	for (r = 0; r < rounds; r++) {
+		n_buddies = bench_buddies(logdir, &buddies);
+
+		timelines = g_ptr_array_new_with_free_func((GDestroyNotify)log_timeline_free);
+		g_hash_table_iter_init(&iter, by_dir);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&logs))
+			g_ptr_array_add(timelines, build_timeline(logs, &calendar));
+		bench_days(timelines, rand, &days);
+		g_ptr_array_free(timelines, TRUE);
+
+		for (i = 0; i < G_N_ELEMENTS(queries); i++) {
+			guint hits = bench_search(logdir, queries[i], NULL, &search);
+			guint indexed = bench_search(logdir, queries[i], index, &isearch);
+
+			bench_index_lookup(index, queries[i], &lookup);
+			if (r == 0)
+				printf("%-24s %u hits\n", queries[i], hits);
+			if (indexed != hits)
+				fprintf(stderr, "%s: %u hits with the index\n", queries[i], indexed);
+		}
+
+		bench_render(all, rand, &render);
+	}
+
+	printf("%s: %u logs, %.1f MB, %u buddies, %u rounds\n\n", logdir, all->len,
+	       total_bytes / (double)(1 << 20), n_buddies, rounds);
+	printf("%-10s %8s %10s %12s %10s %10s %10s %10s %8s\n", "step", "count",
+	       "total ms", "ops/s", "p50 us", "p90 us", "p99 us", "max us", "MB/s");
+	timing_report(&buddies);
+	timing_report(&calendar);
+	timing_report(&days);
+	timing_report(&search);
+	timing_report(&render);
+	timing_report(&build);
+	timing_report(&lookup);
+	timing_report(&isearch);
+
+	log_index_close(index);
+	remove_index_dir(index_dir);
+	g_free(index_dir);
+	g_rand_free(rand);
+	g_ptr_array_free(all, TRUE);
+	g_hash_table_destroy(by_dir);
+	return 0;
+}
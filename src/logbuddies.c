@@ -0,0 +1,248 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#include <string.h>
+
+#include "logarchive.h"
+#include "logbuddies.h"
+#include "logfile.h"
+#include "logstats.h"
+
+#define DIR_BATCH_SIZE   64
+#define DIR_BATCH_USEC   (50 * 1000)
+
+struct _LogBuddyScan {
+	volatile gint ref;
+	volatile gint cancelled;
+
+	char      *logdir;
+	gint64     n_listed;    /**< Directories listed, by the thread only */
+
+	GMutex     lock;        /**< Guards dirs, finished, done, idle_id   */
+	GPtrArray *dirs;        /**< Waiting to be handed to the main loop  */
+	gboolean   finished;
+	gboolean   done;        /**< done_cb has been made                  */
+	guint      idle_id;
+
+	LogBuddyScanFunc     found_cb;
+	LogBuddyScanDoneFunc done_cb;
+	gpointer             data;
+};
+
+void
+log_buddy_dir_free(LogBuddyDir *dir)
+{
+	g_free(dir->account_dir);
+	g_free(dir->buddy);
+	g_free(dir);
+}
+
+static LogBuddyScan *
+log_buddy_scan_ref(LogBuddyScan *scan)
+{
+	g_atomic_int_inc(&scan->ref);
+	return scan;
+}
+
+static void
+log_buddy_scan_unref(LogBuddyScan *scan)
+{
+	if (!g_atomic_int_dec_and_test(&scan->ref))
+		return;
+
+	g_ptr_array_free(scan->dirs, TRUE);
+	g_mutex_clear(&scan->lock);
+	g_free(scan->logdir);
+	g_free(scan);
+}
+
+static gboolean
+deliver_cb(gpointer data)
+{
+	LogBuddyScan *scan = data;
+	GPtrArray *dirs;
+	gboolean report_done;
+
+	g_mutex_lock(&scan->lock);
+	dirs = scan->dirs;
+	scan->dirs = g_ptr_array_new_with_free_func((GDestroyNotify)log_buddy_dir_free);
+	report_done = scan->finished && !scan->done;
+	scan->done |= scan->finished;
+	scan->idle_id = 0;
+	g_mutex_unlock(&scan->lock);
+
+	if (!g_atomic_int_get(&scan->cancelled)) {
+		if (dirs->len > 0 && scan->found_cb != NULL)
+			scan->found_cb(scan, dirs, scan->data);
+		if (report_done && scan->done_cb != NULL &&
+		    !g_atomic_int_get(&scan->cancelled))
+			scan->done_cb(scan, scan->data);
+	}
+	g_ptr_array_free(dirs, TRUE);
+
+	return FALSE;
+}
+
+static void
+flush_dirs(LogBuddyScan *scan, GPtrArray *found, gboolean finished)
+{
+	guint i;
+
+	g_mutex_lock(&scan->lock);
+	for (i = 0; i < found->len; i++)
+		g_ptr_array_add(scan->dirs, g_ptr_array_index(found, i));
+	scan->finished = finished;
+	if (scan->idle_id == 0)
+		scan->idle_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, deliver_cb,
+		                                log_buddy_scan_ref(scan),
+		                                (GDestroyNotify)log_buddy_scan_unref);
+	g_mutex_unlock(&scan->lock);
+
+	/* The shared array owns them now */
+	g_ptr_array_set_free_func(found, NULL);
+	g_ptr_array_set_size(found, 0);
+	g_ptr_array_set_free_func(found, (GDestroyNotify)log_buddy_dir_free);
+}
+
+static gboolean
+has_logs(const char *dir)
+{
+	GDir *d;
+	const char *name;
+	gboolean found = FALSE;
+
+	if ((d = g_dir_open(dir, 0, NULL)) == NULL)
+		return FALSE;
+	while (!found && (name = g_dir_read_name(d)) != NULL)
+		found = log_file_parse_name(name, NULL, NULL) ||
+		        log_archive_parse_name(name, NULL, NULL);
+	g_dir_close(d);
+
+	return found;
+}
+
+static void
+scan_account(LogBuddyScan *scan, const char *adir, GPtrArray *found,
+             gint64 *last_flush)
+{
+	GDir *buddies;
+	const char *buddy;
+
+	if ((buddies = g_dir_open(adir, 0, NULL)) == NULL)
+		return;
+
+	while (!g_atomic_int_get(&scan->cancelled) &&
+	       (buddy = g_dir_read_name(buddies)) != NULL) {
+		char *bdir;
+		gint64 now;
+
+		/* Chats and the system log are not IM conversations */
+		if (g_str_has_suffix(buddy, ".chat") || strcmp(buddy, ".system") == 0)
+			continue;
+
+		bdir = g_build_filename(adir, buddy, NULL);
+		scan->n_listed++;
+		if (has_logs(bdir)) {
+			LogBuddyDir *dir = g_new(LogBuddyDir, 1);
+
+			dir->account_dir = g_strdup(adir);
+			dir->buddy = g_strdup(buddy);
+			g_ptr_array_add(found, dir);
+		}
+		g_free(bdir);
+
+		now = g_get_monotonic_time();
+		if (found->len >= DIR_BATCH_SIZE ||
+		    (found->len > 0 && now - *last_flush >= DIR_BATCH_USEC)) {
+			flush_dirs(scan, found, FALSE);
+			*last_flush = now;
+		}
+	}
+	g_dir_close(buddies);
+}
+
+static gpointer
+scan_thread(gpointer data)
+{
+	LogBuddyScan *scan = data;
+	GPtrArray *found = g_ptr_array_new_with_free_func((GDestroyNotify)log_buddy_dir_free);
+	gint64 last_flush = g_get_monotonic_time();
+	GDir *protocols, *accounts;
+	const char *protocol, *account;
+	LogStatsCounters list = { 0 };
+	LogStatsTimer timer;
+
+	log_stats_timer_start(&timer);
+
+	if ((protocols = g_dir_open(scan->logdir, 0, NULL)) != NULL) {
+		while (!g_atomic_int_get(&scan->cancelled) &&
+		       (protocol = g_dir_read_name(protocols)) != NULL) {
+			char *pdir = g_build_filename(scan->logdir, protocol, NULL);
+
+			if ((accounts = g_dir_open(pdir, 0, NULL)) != NULL) {
+				while (!g_atomic_int_get(&scan->cancelled) &&
+				       (account = g_dir_read_name(accounts)) != NULL) {
+					char *adir = g_build_filename(pdir, account, NULL);
+
+					scan->n_listed++;
+					scan_account(scan, adir, found, &last_flush);
+					g_free(adir);
+				}
+				g_dir_close(accounts);
+			}
+			g_free(pdir);
+		}
+		g_dir_close(protocols);
+	}
+
+	list.calls = scan->n_listed;
+	list.wall = log_stats_now() - timer.wall;
+	list.cpu = log_stats_cpu_now() - timer.cpu;
+	log_stats_add(LOG_STATS_LIST, &list);
+
+	flush_dirs(scan, found, TRUE);
+	g_ptr_array_free(found, TRUE);
+	log_buddy_scan_unref(scan);
+
+	return NULL;
+}
+
+LogBuddyScan *
+log_buddy_scan_start(const char *logdir, LogBuddyScanFunc found_cb,
+                     LogBuddyScanDoneFunc done_cb, gpointer data)
+{
+	LogBuddyScan *scan = g_new0(LogBuddyScan, 1);
+
+	scan->ref = 1;
+	scan->logdir = g_strdup(logdir);
+	scan->found_cb = found_cb;
+	scan->done_cb = done_cb;
+	scan->data = data;
+	scan->dirs = g_ptr_array_new_with_free_func((GDestroyNotify)log_buddy_dir_free);
+	g_mutex_init(&scan->lock);
+
+	g_thread_unref(g_thread_new("logbuddies", scan_thread,
+	                            log_buddy_scan_ref(scan)));
+
+	return scan;
+}
+
+void
+log_buddy_scan_free(LogBuddyScan *scan)
+{
+	if (scan == NULL)
+		return;
+
+	g_atomic_int_set(&scan->cancelled, 1);
+
+	g_mutex_lock(&scan->lock);
+	if (scan->idle_id != 0) {
+		g_source_remove(scan->idle_id);
+		scan->idle_id = 0;
+	}
+	g_mutex_unlock(&scan->lock);
+
+	log_buddy_scan_unref(scan);
+}
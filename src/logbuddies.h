@@ -0,0 +1,38 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGBUDDIES_H_
+#define _LOGVIEWER_LOGBUDDIES_H_
+
+#include <glib.h>
+
+typedef struct _LogBuddyScan LogBuddyScan;
+typedef struct _LogBuddyDir LogBuddyDir;
+
+struct _LogBuddyDir {
+	char *account_dir;   /**< logdir/protocol/account                  */
+	char *buddy;         /**< The buddy's directory name, still escaped */
+};
+
+/** Receives a batch of buddy directories on the main loop.  The array is freed afterwards. */
+typedef void (*LogBuddyScanFunc)(LogBuddyScan *scan, GPtrArray *dirs, gpointer data);
+
+/** Called on the main loop once the whole tree has been looked at. */
+typedef void (*LogBuddyScanDoneFunc)(LogBuddyScan *scan, gpointer data);
+
+/**
+ * Looks for every buddy directory under logdir holding at least one IM log,
+ * on a thread of its own.  Only directory entries are read, and a buddy
+ * directory is left as soon as one log turns up in it.
+ */
+LogBuddyScan *log_buddy_scan_start(const char *logdir, LogBuddyScanFunc found_cb,
+                                   LogBuddyScanDoneFunc done_cb, gpointer data);
+
+/** Stops the scan if it is still running and releases it.  No callback follows. */
+void log_buddy_scan_free(LogBuddyScan *scan);
+
+void log_buddy_dir_free(LogBuddyDir *dir);
+
+#endif /* _LOGVIEWER_LOGBUDDIES_H_ */
@@ -0,0 +1,217 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#include <string.h>
+
+#include "logcache.h"
+
+typedef struct {
+	gint64       size;
+	gint64       mtime;
+	char        *snippet;
+	LogMatchPos *positions;
+	guint        n_positions;
+} LogCacheFile;
+
+struct _LogCacheResult {
+	volatile gint ref;
+	time_t      started;
+	GHashTable *hits;      /**< Path to the LogCacheFile it was read as */
+	gsize       bytes;     /**< Roughly what the hits take up           */
+};
+
+struct _LogCache {
+	volatile gint ref;
+	GMutex      lock;
+	GHashTable *results;   /**< Query to LogCacheResult                 */
+	GQueue      order;     /**< Queries, most recently used first       */
+	guint       max_results;
+	gsize       bytes;     /**< Of the results held                     */
+	gsize       max_bytes;
+};
+
+static void
+log_cache_file_free(LogCacheFile *file)
+{
+	g_free(file->snippet);
+	g_free(file->positions);
+	g_free(file);
+}
+
+LogCacheResult *
+log_cache_result_new(time_t started)
+{
+	LogCacheResult *result = g_new0(LogCacheResult, 1);
+
+	result->ref = 1;
+	result->started = started;
+	result->hits = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                     (GDestroyNotify)log_cache_file_free);
+	return result;
+}
+
+LogCacheResult *
+log_cache_result_ref(LogCacheResult *result)
+{
+	g_atomic_int_inc(&result->ref);
+	return result;
+}
+
+void
+log_cache_result_unref(LogCacheResult *result)
+{
+	if (result == NULL || !g_atomic_int_dec_and_test(&result->ref))
+		return;
+	g_hash_table_destroy(result->hits);
+	g_free(result);
+}
+
+void
+log_cache_result_add(LogCacheResult *result, const char *path,
+                     gint64 size, gint64 mtime, const char *snippet,
+                     const LogMatchPos *positions, guint n_positions)
+{
+	LogCacheFile *file = g_new(LogCacheFile, 1);
+
+	file->size = size;
+	file->mtime = mtime;
+	file->snippet = g_strdup(snippet);
+	file->positions = n_positions > 0 ?
+		g_memdup(positions, n_positions * sizeof(LogMatchPos)) : NULL;
+	file->n_positions = n_positions;
+	g_hash_table_replace(result->hits, g_strdup(path), file);
+
+	/* The strings, the file and a hash table node each */
+	result->bytes += strlen(path) + 1 + (snippet ? strlen(snippet) + 1 : 0) +
+	                 n_positions * sizeof(LogMatchPos) + sizeof(*file) +
+	                 4 * sizeof(gpointer);
+}
+
+gboolean
+log_cache_result_check(const LogCacheResult *result, const char *path,
+                       gint64 size, gint64 mtime, gboolean *found,
+                       const char **snippet,
+                       const LogMatchPos **positions, guint *n_positions)
+{
+	LogCacheFile *file = g_hash_table_lookup(result->hits, path);
+
+	*snippet = NULL;
+	*positions = NULL;
+	*n_positions = 0;
+
+	if (file != NULL) {
+		if (file->size != size || file->mtime != mtime)
+			return FALSE;
+		*found = TRUE;
+		*snippet = file->snippet;
+		*positions = file->positions;
+		*n_positions = file->n_positions;
+		return TRUE;
+	}
+
+	/*
+	 * Not a hit.  Unless it has been written to since the scan began it
+	 * still is not; mtimes are only good to the second, so a log touched in
+	 * that very second is read again.
+	 */
+	if (mtime >= (gint64)result->started)
+		return FALSE;
+	*found = FALSE;
+	return TRUE;
+}
+
+guint
+log_cache_result_get_n_hits(const LogCacheResult *result)
+{
+	return g_hash_table_size(result->hits);
+}
+
+LogCache *
+log_cache_new(guint max_results, gsize max_bytes)
+{
+	LogCache *cache = g_new0(LogCache, 1);
+
+	cache->ref = 1;
+	g_mutex_init(&cache->lock);
+	cache->results = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                       (GDestroyNotify)log_cache_result_unref);
+	g_queue_init(&cache->order);
+	cache->max_results = MAX(max_results, 1);
+	cache->max_bytes = max_bytes;
+	return cache;
+}
+
+LogCache *
+log_cache_ref(LogCache *cache)
+{
+	g_atomic_int_inc(&cache->ref);
+	return cache;
+}
+
+void
+log_cache_unref(LogCache *cache)
+{
+	if (cache == NULL || !g_atomic_int_dec_and_test(&cache->ref))
+		return;
+	/* The queue borrows its strings from the table */
+	g_queue_clear(&cache->order);
+	g_hash_table_destroy(cache->results);
+	g_mutex_clear(&cache->lock);
+	g_free(cache);
+}
+
+LogCacheResult *
+log_cache_lookup(LogCache *cache, const char *query)
+{
+	LogCacheResult *result = NULL;
+	gpointer key, value;
+
+	g_mutex_lock(&cache->lock);
+	if (g_hash_table_lookup_extended(cache->results, query, &key, &value)) {
+		g_queue_remove(&cache->order, key);
+		g_queue_push_head(&cache->order, key);
+		result = log_cache_result_ref(value);
+	}
+	g_mutex_unlock(&cache->lock);
+
+	return result;
+}
+
+/* Called with the lock held */
+static void
+log_cache_drop(LogCache *cache, gpointer key)
+{
+	LogCacheResult *result = g_hash_table_lookup(cache->results, key);
+
+	cache->bytes -= result->bytes;
+	g_queue_remove(&cache->order, key);
+	g_hash_table_remove(cache->results, key);
+}
+
+void
+log_cache_store(LogCache *cache, const char *query, LogCacheResult *result)
+{
+	gpointer key;
+	char *copy;
+
+	g_mutex_lock(&cache->lock);
+	if (g_hash_table_lookup_extended(cache->results, query, &key, NULL))
+		log_cache_drop(cache, key);
+
+	if (result->bytes > cache->max_bytes) {
+		g_mutex_unlock(&cache->lock);
+		log_cache_result_unref(result);
+		return;
+	}
+	while (g_queue_get_length(&cache->order) >= cache->max_results ||
+	       cache->bytes + result->bytes > cache->max_bytes)
+		log_cache_drop(cache, g_queue_peek_tail(&cache->order));
+
+	copy = g_strdup(query);
+	g_hash_table_insert(cache->results, copy, result);
+	g_queue_push_head(&cache->order, copy);
+	cache->bytes += result->bytes;
+	g_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,78 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGCACHE_H_
+#define _LOGVIEWER_LOGCACHE_H_
+
+#include <time.h>
+#include <glib.h>
+
+#include "logmatch.h"
+
+/**
+ * The outcome of a completed scan for one query: when the scan started, and
+ * the logs the query was found in, each with the size and modification time
+ * it had when it was read and where in it the query was.  A log that has not
+ * been touched since the scan started need not be read again to know whether
+ * the query is in it.  Results are immutable once stored and may be looked at
+ * from any thread.
+ */
+typedef struct _LogCacheResult LogCacheResult;
+
+/**
+ * A few recent results, the least recently used dropped first.  A running
+ * search holds a reference, so the cache outlives it.
+ */
+typedef struct _LogCache LogCache;
+
+/**
+ * Keeps up to max_results results taking up to about max_bytes between
+ * them; a result bigger than that on its own is not kept at all.
+ */
+LogCache *log_cache_new(guint max_results, gsize max_bytes);
+
+LogCache *log_cache_ref(LogCache *cache);
+
+void log_cache_unref(LogCache *cache);
+
+/** The stored result for query, with a reference held, or NULL. */
+LogCacheResult *log_cache_lookup(LogCache *cache, const char *query);
+
+/**
+ * Stores result for query, replacing any older one, and takes the reference.
+ * A result too big to keep is dropped, and any older one with it.
+ */
+void log_cache_store(LogCache *cache, const char *query, LogCacheResult *result);
+
+/** An empty result for a scan starting at started. */
+LogCacheResult *log_cache_result_new(time_t started);
+
+LogCacheResult *log_cache_result_ref(LogCacheResult *result);
+
+void log_cache_result_unref(LogCacheResult *result);
+
+/**
+ * Records a hit while the result is built up; not safe once it is shared.
+ * snippet and the n_positions LogMatchPos at positions are copied; they are
+ * NULL and 0 if it is not known where the query is.
+ */
+void log_cache_result_add(LogCacheResult *result, const char *path,
+                          gint64 size, gint64 mtime, const char *snippet,
+                          const LogMatchPos *positions, guint n_positions);
+
+/**
+ * Whether the result still tells if the query is in path, given the size and
+ * modification time it has now; if so, found is set to the answer, and for a
+ * hit snippet, positions and n_positions to what was recorded with it.
+ * Those belong to the result.
+ */
+gboolean log_cache_result_check(const LogCacheResult *result, const char *path,
+                                gint64 size, gint64 mtime, gboolean *found,
+                                const char **snippet,
+                                const LogMatchPos **positions, guint *n_positions);
+
+guint log_cache_result_get_n_hits(const LogCacheResult *result);
+
+#endif /* _LOGVIEWER_LOGCACHE_H_ */
@@ -0,0 +1,723 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+/*
+ * An export runs as three stages.  The export thread lists each buddy's logs
+ * in order and reads them, staying at most EXPORT_WINDOW logs and
+ * EXPORT_READ_AHEAD bytes ahead of the writer.  A pool of threads converts
+ * what was read to the output format, in whatever order they get to it.  The
+ * writer thread takes the converted logs back in the order they were read
+ * and writes them out.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "logexport.h"
+#include "logfile.h"
+
+#define EXPORT_WINDOW       64          /* logs read but not yet written       */
+#define EXPORT_READ_AHEAD   (16 << 20)  /* bytes of them, unless it is just one */
+#define PROGRESS_USEC       (100 * 1000)
+
+typedef struct {
+	char     *path;
+	time_t    time;
+	LogFormat format;
+} ExportLog;
+
+typedef struct {
+	guint64   seq;          /**< Position in the output                   */
+	ExportLog log;
+	char     *protocol;     /**< Unescaped, as shown                      */
+	char     *account;
+	char     *buddy;
+	GBytes   *bytes;        /**< What was read, until converted            */
+	gsize     size;
+	GString  *out;          /**< What to write, once converted             */
+} ExportJob;
+
+struct _LogExport {
+	volatile gint ref;
+	volatile gint cancelled;
+	volatile gint failed;   /**< error is set                             */
+
+	char           *logdir;
+	GPtrArray      *dirs;   /**< Buddy directories, or NULL for every one */
+	time_t          from;
+	time_t          to;
+	LogExportFormat format;
+	char           *path;
+	FILE           *fp;     /**< The temporary file, written by the writer */
+	GThreadPool    *pool;   /**< Converts logs to format                  */
+
+	GMutex     lock;        /**< Guards everything below                  */
+	GCond      cond;
+	ExportJob *slots[EXPORT_WINDOW]; /**< Converted logs, by seq          */
+	guint64    n_read;      /**< Logs handed to the pool                  */
+	guint64    n_written;
+	gsize      held;        /**< Bytes read and not yet written           */
+	gboolean   all_read;
+	guint      total;
+	char      *error;
+	gboolean   finished;
+	gboolean   done;        /**< done_cb has been made                    */
+	guint      idle_id;
+	gint64     last_progress;
+
+	LogExportProgressFunc progress_cb;
+	LogExportDoneFunc     done_cb;
+	gpointer              data;
+};
+
+static void
+export_log_clear(ExportLog *log)
+{
+	g_free(log->path);
+}
+
+static void
+job_free(ExportJob *job)
+{
+	export_log_clear(&job->log);
+	g_free(job->protocol);
+	g_free(job->account);
+	g_free(job->buddy);
+	if (job->bytes != NULL)
+		g_bytes_unref(job->bytes);
+	if (job->out != NULL)
+		g_string_free(job->out, TRUE);
+	g_free(job);
+}
+
+static LogExport *
+log_export_ref(LogExport *export)
+{
+	g_atomic_int_inc(&export->ref);
+	return export;
+}
+
+static void
+log_export_unref(LogExport *export)
+{
+	guint i;
+
+	if (!g_atomic_int_dec_and_test(&export->ref))
+		return;
+
+	for (i = 0; i < EXPORT_WINDOW; i++)
+		if (export->slots[i] != NULL)
+			job_free(export->slots[i]);
+	if (export->dirs != NULL)
+		g_ptr_array_free(export->dirs, TRUE);
+	g_mutex_clear(&export->lock);
+	g_cond_clear(&export->cond);
+	g_free(export->logdir);
+	g_free(export->path);
+	g_free(export->error);
+	g_free(export);
+}
+
+static gboolean
+stopped(LogExport *export)
+{
+	return g_atomic_int_get(&export->cancelled) || g_atomic_int_get(&export->failed);
+}
+
+/* Reporting to the main loop */
+
+static gboolean
+deliver_cb(gpointer data)
+{
+	LogExport *export = data;
+	guint written, total;
+	gboolean report_done;
+	char *error;
+
+	g_mutex_lock(&export->lock);
+	written = export->n_written;
+	total = export->total;
+	report_done = export->finished && !export->done;
+	export->done |= export->finished;
+	error = g_strdup(export->error);
+	export->idle_id = 0;
+	g_mutex_unlock(&export->lock);
+
+	if (!g_atomic_int_get(&export->cancelled)) {
+		if (export->progress_cb != NULL)
+			export->progress_cb(export, written, total, export->data);
+		if (report_done && export->done_cb != NULL &&
+		    !g_atomic_int_get(&export->cancelled))
+			export->done_cb(export, error, export->data);
+	}
+	g_free(error);
+
+	return FALSE;
+}
+
+/* Called with export->lock held */
+static void
+schedule_delivery(LogExport *export)
+{
+	export->last_progress = g_get_monotonic_time();
+	if (export->idle_id == 0)
+		export->idle_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, deliver_cb,
+		                                  log_export_ref(export),
+		                                  (GDestroyNotify)log_export_unref);
+}
+
+/* Stops the export with the first thing to go wrong */
+static void
+export_fail(LogExport *export, const char *format, ...)
+{
+	va_list args;
+
+	g_mutex_lock(&export->lock);
+	if (export->error == NULL) {
+		va_start(args, format);
+		export->error = g_strdup_vprintf(format, args);
+		va_end(args);
+		g_atomic_int_set(&export->failed, 1);
+	}
+	g_cond_broadcast(&export->cond);
+	g_mutex_unlock(&export->lock);
+}
+
+/* Converting */
+
+static void
+append_json_string(GString *out, const char *key, const char *s, gboolean last)
+{
+	g_string_append_printf(out, "\"%s\":\"", key);
+	for (; *s != '\0'; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\') {
+			g_string_append_c(out, '\\');
+			g_string_append_c(out, c);
+		} else if (c == '\n') {
+			g_string_append(out, "\\n");
+		} else if (c == '\t') {
+			g_string_append(out, "\\t");
+		} else if (c < 0x20) {
+			g_string_append_printf(out, "\\u%04x", c);
+		} else {
+			g_string_append_c(out, c);
+		}
+	}
+	g_string_append(out, last ? "\"" : "\",");
+}
+
+/* p is at an '&'; returns where the text goes on after the entity */
+static const char *
+append_entity(GString *out, const char *p)
+{
+	static const struct {
+		const char *name;
+		const char *text;
+	} entities[] = {
+		{ "amp;", "&" }, { "lt;", "<" }, { "gt;", ">" },
+		{ "quot;", "\"" }, { "apos;", "'" }, { "nbsp;", " " }
+	};
+	const char *digits;
+	char *end;
+	gulong c;
+	guint i;
+
+	if (p[1] == '#') {
+		digits = p[2] == 'x' || p[2] == 'X' ? p + 3 : p + 2;
+		c = strtoul(digits, &end, digits == p + 2 ? 10 : 16);
+		if (end > digits && *end == ';' && g_unichar_validate(c)) {
+			g_string_append_unichar(out, c);
+			return end + 1;
+		}
+	}
+	for (i = 0; i < G_N_ELEMENTS(entities); i++) {
+		gsize len = strlen(entities[i].name);
+
+		if (strncmp(p + 1, entities[i].name, len) == 0) {
+			g_string_append(out, entities[i].text);
+			return p + 1 + len;
+		}
+	}
+	g_string_append_c(out, '&');
+	return p + 1;
+}
+
+/* The text of a log, without its header line or any markup */
+static char *
+plain_text(GBytes *bytes, LogFormat format)
+{
+	const char *buf, *body, *end, *p, *tag_end;
+	GString *out;
+	char *valid;
+	gsize len;
+
+	if (bytes == NULL || (buf = g_bytes_get_data(bytes, &len)) == NULL)
+		return g_strdup("");
+
+	body = memchr(buf, '\n', len);
+	body = body == NULL ? buf : body + 1;
+	end = buf + len;
+	valid = g_utf8_validate(body, end - body, NULL) ?
+	        g_strndup(body, end - body) : log_file_salvage_utf8(body, end - body);
+	out = g_string_sized_new(strlen(valid));
+
+	for (p = valid; *p != '\0'; ) {
+		if (*p == '\r') {
+			p++;
+		} else if (format != LOG_FORMAT_HTML) {
+			g_string_append_c(out, *p++);
+		} else if (*p == '<') {
+			/* Line breaks are the only markup that shows as text */
+			if ((tag_end = strchr(p, '>')) == NULL)
+				break;
+			if (g_ascii_strncasecmp(p + 1, "br", 2) == 0 && !g_ascii_isalnum(p[3]))
+				g_string_append_c(out, '\n');
+			p = tag_end + 1;
+		} else if (*p == '&') {
+			p = append_entity(out, p);
+		} else if (*p == '\n') {
+			p++;
+		} else {
+			g_string_append_c(out, *p++);
+		}
+	}
+
+	g_free(valid);
+	return g_string_free(out, FALSE);
+}
+
+static void
+convert_json(GString *out, ExportJob *job)
+{
+	char *text = plain_text(job->bytes, job->log.format);
+	char when[64];
+	struct tm tm;
+
+	localtime_r(&job->log.time, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S%z", &tm);
+
+	g_string_append_c(out, '{');
+	append_json_string(out, "time", when, FALSE);
+	g_string_append_printf(out, "\"timestamp\":%" G_GINT64_FORMAT ",",
+	                       (gint64)job->log.time);
+	append_json_string(out, "protocol", job->protocol, FALSE);
+	append_json_string(out, "account", job->account, FALSE);
+	append_json_string(out, "buddy", job->buddy, FALSE);
+	append_json_string(out, "format",
+	                   job->log.format == LOG_FORMAT_TXT ? "txt" : "html", FALSE);
+	append_json_string(out, "path", job->log.path, FALSE);
+	append_json_string(out, "text", text, TRUE);
+	g_string_append(out, "}\n");
+
+	g_free(text);
+}
+
+static void
+convert_text(GString *out, ExportJob *job)
+{
+	char *text = plain_text(job->bytes, job->log.format);
+	char when[64];
+	struct tm tm;
+
+	localtime_r(&job->log.time, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+	/* The header line the loggers write, which the text leaves out */
+	g_string_append_printf(out, "Conversation with %s at %s on %s (%s)\n%s",
+	                       job->buddy, when, job->account, job->protocol, text);
+	if (out->len > 0 && out->str[out->len - 1] != '\n')
+		g_string_append_c(out, '\n');
+	g_string_append_c(out, '\n');
+
+	g_free(text);
+}
+
+static void
+convert_html(GString *out, ExportJob *job)
+{
+	const char *buf = NULL;
+	char *body, *end, *buddy, *account, *protocol;
+	gsize len = 0;
+	char when[64];
+	struct tm tm;
+
+	if (job->bytes != NULL)
+		buf = g_bytes_get_data(job->bytes, &len);
+	body = log_file_decode(buf, len, job->log.format);
+
+	/* Each html log closes a document of its own */
+	if (job->log.format == LOG_FORMAT_HTML && (end = g_strrstr(body, "</body>")) != NULL)
+		*end = '\0';
+
+	localtime_r(&job->log.time, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+	buddy = g_markup_escape_text(job->buddy, -1);
+	account = g_markup_escape_text(job->account, -1);
+	protocol = g_markup_escape_text(job->protocol, -1);
+
+	g_string_append_printf(out,
+		"<h2>%s &#8212; %s</h2>\n<p class=\"account\">%s (%s)</p>\n"
+		"<div class=\"log %s\">\n%s\n</div>\n",
+		buddy, when, account, protocol,
+		job->log.format == LOG_FORMAT_TXT ? "txt" : "html", body);
+
+	g_free(buddy);
+	g_free(account);
+	g_free(protocol);
+	g_free(body);
+}
+
+static void
+convert_job(gpointer data, gpointer user_data)
+{
+	ExportJob *job = data;
+	LogExport *export = user_data;
+
+	if (!stopped(export)) {
+		job->out = g_string_sized_new(job->size + 256);
+		if (export->format == LOG_EXPORT_JSON)
+			convert_json(job->out, job);
+		else if (export->format == LOG_EXPORT_TEXT)
+			convert_text(job->out, job);
+		else
+			convert_html(job->out, job);
+	}
+	if (job->bytes != NULL) {
+		g_bytes_unref(job->bytes);
+		job->bytes = NULL;
+	}
+
+	g_mutex_lock(&export->lock);
+	export->slots[job->seq % EXPORT_WINDOW] = job;
+	g_cond_broadcast(&export->cond);
+	g_mutex_unlock(&export->lock);
+}
+
+/* Writing */
+
+static const char html_header[] =
+	"<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n"
+	"<title>Conversation logs</title>\n<style>\n"
+	"h2 { margin-bottom: 0; }\n"
+	".account { margin-top: 0; color: #666; }\n"
+	".txt { white-space: pre-wrap; }\n"
+	"</style>\n</head>\n<body>\n";
+static const char html_footer[] = "</body>\n</html>\n";
+
+static gboolean
+write_string(LogExport *export, const char *s, gsize len)
+{
+	if (fwrite(s, 1, len, export->fp) == len)
+		return TRUE;
+
+	export_fail(export, "Could not write to %s: %s", export->path, g_strerror(errno));
+	return FALSE;
+}
+
+static gpointer
+write_thread(gpointer data)
+{
+	LogExport *export = data;
+	ExportJob *job;
+	gint64 now;
+
+	g_mutex_lock(&export->lock);
+	for (;;) {
+		job = export->slots[export->n_written % EXPORT_WINDOW];
+		if (stopped(export) ||
+		    (job == NULL && export->all_read && export->n_written == export->n_read))
+			break;
+		if (job == NULL) {
+			g_cond_wait(&export->cond, &export->lock);
+			continue;
+		}
+		export->slots[export->n_written % EXPORT_WINDOW] = NULL;
+		g_mutex_unlock(&export->lock);
+
+		if (job->out != NULL)
+			write_string(export, job->out->str, job->out->len);
+
+		g_mutex_lock(&export->lock);
+		export->n_written++;
+		export->held -= job->size;
+		g_cond_broadcast(&export->cond);
+		now = g_get_monotonic_time();
+		if (now - export->last_progress >= PROGRESS_USEC)
+			schedule_delivery(export);
+		job_free(job);
+	}
+	g_mutex_unlock(&export->lock);
+
+	return NULL;
+}
+
+/* Reading */
+
+static gboolean
+in_range(LogExport *export, time_t time)
+{
+	return (export->from == 0 || time >= export->from) &&
+	       (export->to == 0 || time < export->to);
+}
+
+static gboolean
+count_log_cb(const char *protocol, const char *account, const char *buddy,
+             const char *path, time_t time, LogFormat format, gpointer data)
+{
+	gpointer *args = data;
+	LogExport *export = args[0];
+
+	if (in_range(export, time))
+		(*(guint *)args[1])++;
+	return !stopped(export);
+}
+
+static gboolean
+collect_log_cb(const char *protocol, const char *account, const char *buddy,
+               const char *path, time_t time, LogFormat format, gpointer data)
+{
+	gpointer *args = data;
+	LogExport *export = args[0];
+	ExportLog log;
+
+	if (in_range(export, time)) {
+		log.path = g_strdup(path);
+		log.time = time;
+		log.format = format;
+		g_array_append_val((GArray *)args[1], log);
+	}
+	return !stopped(export);
+}
+
+static int
+log_compare(gconstpointer a, gconstpointer b)
+{
+	const ExportLog *l1 = a, *l2 = b;
+
+	if (l1->time != l2->time)
+		return l1->time < l2->time ? -1 : 1;
+	return strcmp(l1->path, l2->path);
+}
+
+static char *
+unescape(const char *name)
+{
+	char *s = g_uri_unescape_string(name, NULL);
+
+	return s != NULL ? s : g_strdup(name);
+}
+
+/* Waits for room ahead of the writer and hands log to the pool */
+static gboolean
+feed(LogExport *export, ExportLog *log, char **names)
+{
+	ExportJob *job;
+
+	g_mutex_lock(&export->lock);
+	while (!stopped(export) &&
+	       (export->n_read - export->n_written >= EXPORT_WINDOW ||
+	        (export->held >= EXPORT_READ_AHEAD && export->n_read > export->n_written)))
+		g_cond_wait(&export->cond, &export->lock);
+	g_mutex_unlock(&export->lock);
+
+	if (stopped(export))
+		return FALSE;
+
+	job = g_new0(ExportJob, 1);
+	job->log = *log;
+	log->path = NULL;
+	job->protocol = g_strdup(names[0]);
+	job->account = g_strdup(names[1]);
+	job->buddy = g_strdup(names[2]);
+	/* A log that cannot be read is still listed, with nothing in it */
+	job->bytes = log_file_load(job->log.path);
+	job->size = job->bytes != NULL ? g_bytes_get_size(job->bytes) : 0;
+
+	g_mutex_lock(&export->lock);
+	job->seq = export->n_read++;
+	export->held += job->size;
+	g_mutex_unlock(&export->lock);
+
+	g_thread_pool_push(export->pool, job, NULL);
+	return TRUE;
+}
+
+static gboolean
+feed_dir(LogExport *export, const char *dir)
+{
+	GArray *logs = g_array_new(FALSE, FALSE, sizeof(ExportLog));
+	char *adir = g_path_get_dirname(dir);
+	char *pdir = g_path_get_dirname(adir);
+	char *escaped[3];
+	char *names[3];
+	gpointer args[2];
+	gboolean keep_going = TRUE;
+	guint i;
+
+	args[0] = export;
+	args[1] = logs;
+	log_file_walk_buddy(dir, collect_log_cb, args);
+	g_array_sort(logs, log_compare);
+
+	escaped[0] = g_path_get_basename(pdir);
+	escaped[1] = g_path_get_basename(adir);
+	escaped[2] = g_path_get_basename(dir);
+	for (i = 0; i < 3; i++)
+		names[i] = unescape(escaped[i]);
+
+	for (i = 0; keep_going && i < logs->len; i++)
+		keep_going = feed(export, &g_array_index(logs, ExportLog, i), names);
+
+	for (i = 0; i < logs->len; i++)
+		export_log_clear(&g_array_index(logs, ExportLog, i));
+	g_array_free(logs, TRUE);
+	for (i = 0; i < 3; i++) {
+		g_free(escaped[i]);
+		g_free(names[i]);
+	}
+	g_free(adir);
+	g_free(pdir);
+	return keep_going && !stopped(export);
+}
+
+static gboolean
+add_dir_cb(const char *protocol, const char *account, const char *buddy,
+           const char *dir, gpointer data)
+{
+	g_ptr_array_add(data, g_strdup(dir));
+	return TRUE;
+}
+
+static gpointer
+export_thread(gpointer data)
+{
+	LogExport *export = data;
+	char *tmp = g_strconcat(export->path, ".tmp", NULL);
+	GThread *writer;
+	gpointer args[2];
+	gboolean ok;
+	guint i, total = 0;
+
+	if (export->dirs == NULL) {
+		export->dirs = g_ptr_array_new_with_free_func(g_free);
+		log_file_walk_dirs(export->logdir, add_dir_cb, export->dirs);
+	}
+
+	/* Only to say how far along it is */
+	args[0] = export;
+	args[1] = &total;
+	for (i = 0; i < export->dirs->len && !stopped(export); i++)
+		log_file_walk_buddy(g_ptr_array_index(export->dirs, i), count_log_cb, args);
+	g_mutex_lock(&export->lock);
+	export->total = total;
+	schedule_delivery(export);
+	g_mutex_unlock(&export->lock);
+
+	if ((export->fp = g_fopen(tmp, "wb")) == NULL) {
+		export_fail(export, "Could not create %s: %s", tmp, g_strerror(errno));
+	} else {
+		if (export->format == LOG_EXPORT_HTML)
+			write_string(export, html_header, strlen(html_header));
+
+		writer = g_thread_new("logexport-write", write_thread, export);
+		for (i = 0; i < export->dirs->len; i++)
+			if (!feed_dir(export, g_ptr_array_index(export->dirs, i)))
+				break;
+
+		g_mutex_lock(&export->lock);
+		export->all_read = TRUE;
+		g_cond_broadcast(&export->cond);
+		g_mutex_unlock(&export->lock);
+		g_thread_join(writer);
+
+		if (!stopped(export) && export->format == LOG_EXPORT_HTML)
+			write_string(export, html_footer, strlen(html_footer));
+		ok = fflush(export->fp) == 0;
+		ok = fclose(export->fp) == 0 && ok;
+		export->fp = NULL;
+		if (!ok && !stopped(export))
+			export_fail(export, "Could not write to %s: %s", export->path,
+			            g_strerror(errno));
+	}
+
+	/* Waits for conversions still going, which were of no use anyway */
+	g_thread_pool_free(export->pool, FALSE, TRUE);
+	export->pool = NULL;
+
+	ok = !stopped(export);
+	if (ok && g_rename(tmp, export->path) != 0) {
+		export_fail(export, "Could not create %s: %s", export->path, g_strerror(errno));
+		ok = FALSE;
+	}
+	if (!ok)
+		g_unlink(tmp);
+	g_free(tmp);
+
+	g_mutex_lock(&export->lock);
+	export->finished = TRUE;
+	schedule_delivery(export);
+	g_mutex_unlock(&export->lock);
+	log_export_unref(export);
+
+	return NULL;
+}
+
+LogExport *
+log_export_start(const char *logdir, GPtrArray *dirs, time_t from, time_t to,
+                 LogExportFormat format, const char *path,
+                 LogExportProgressFunc progress_cb, LogExportDoneFunc done_cb,
+                 gpointer data)
+{
+	LogExport *export = g_new0(LogExport, 1);
+	guint i;
+
+	export->ref = 1;
+	export->logdir = g_strdup(logdir);
+	if (dirs != NULL) {
+		export->dirs = g_ptr_array_new_with_free_func(g_free);
+		for (i = 0; i < dirs->len; i++)
+			g_ptr_array_add(export->dirs, g_strdup(g_ptr_array_index(dirs, i)));
+	}
+	export->from = from;
+	export->to = to;
+	export->format = format;
+	export->path = g_strdup(path);
+	export->progress_cb = progress_cb;
+	export->done_cb = done_cb;
+	export->data = data;
+	g_mutex_init(&export->lock);
+	g_cond_init(&export->cond);
+	export->pool = g_thread_pool_new(convert_job, export,
+	                                 CLAMP(g_get_num_processors(), 1, 16), FALSE, NULL);
+
+	g_thread_unref(g_thread_new("logexport", export_thread, log_export_ref(export)));
+
+	return export;
+}
+
+void
+log_export_free(LogExport *export)
+{
+	if (export == NULL)
+		return;
+
+	g_atomic_int_set(&export->cancelled, 1);
+
+	g_mutex_lock(&export->lock);
+	if (export->idle_id != 0) {
+		g_source_remove(export->idle_id);
+		export->idle_id = 0;
+	}
+	g_cond_broadcast(&export->cond);
+	g_mutex_unlock(&export->lock);
+
+	log_export_unref(export);
+}
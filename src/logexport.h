@@ -0,0 +1,54 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGEXPORT_H_
+#define _LOGVIEWER_LOGEXPORT_H_
+
+#include <time.h>
+#include <glib.h>
+
+/**
+ * Writes many logs into one file, off the main loop.  Logs are read a few
+ * at a time ahead of the writer, converted on a pool of threads and written
+ * in order, so memory stays the same however many logs are exported.
+ */
+typedef struct _LogExport LogExport;
+
+typedef enum {
+	LOG_EXPORT_JSON = 0,    /**< A JSON object per log, one per line      */
+	LOG_EXPORT_TEXT,        /**< Plain text, each log under a heading     */
+	LOG_EXPORT_HTML         /**< A single HTML document                   */
+} LogExportFormat;
+
+/** Called on the main loop as logs are written, at most a few times a second. */
+typedef void (*LogExportProgressFunc)(LogExport *export, guint done, guint total,
+                                      gpointer data);
+
+/**
+ * Called on the main loop once the export is over.  error is NULL if every
+ * log was written, and says what went wrong otherwise.
+ */
+typedef void (*LogExportDoneFunc)(LogExport *export, const char *error,
+                                  gpointer data);
+
+/**
+ * Starts exporting the logs in dirs, an array of buddy log directories, or
+ * of every buddy under logdir if dirs is NULL, to the file at path.  Only
+ * logs begun at from or later and before to are exported; either may be 0
+ * to leave that end open.  Each buddy's logs come out oldest first.  The
+ * file appears at path only once it is complete.
+ */
+LogExport *log_export_start(const char *logdir, GPtrArray *dirs,
+                            time_t from, time_t to, LogExportFormat format,
+                            const char *path, LogExportProgressFunc progress_cb,
+                            LogExportDoneFunc done_cb, gpointer data);
+
+/**
+ * Cancels the export if it is still running and releases it.  No callback
+ * is made for it once this returns, and no file is left behind.
+ */
+void log_export_free(LogExport *export);
+
+#endif /* _LOGVIEWER_LOGEXPORT_H_ */
@@ -0,0 +1,385 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include <glib/gstdio.h>
+
+#include "logarchive.h"
+#include "logfile.h"
+
+/* Days since the epoch for a proleptic Gregorian date. */
+static gint64
+days_from_civil(int y, int m, int d)
+{
+	int era, yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return (gint64)era * 146097 + doe - 719468;
+}
+
+gboolean
+log_file_parse_name(const char *name, time_t *time, LogFormat *format)
+{
+	struct tm tm;
+	time_t t;
+	int year, mon, mday, hour, min, sec, consumed = 0;
+	const char *rest, *ext;
+	LogFormat fmt;
+
+	ext = strrchr(name, '.');
+	if (ext == NULL)
+		return FALSE;
+	if (strcmp(ext, ".html") == 0)
+		fmt = LOG_FORMAT_HTML;
+	else if (strcmp(ext, ".txt") == 0)
+		fmt = LOG_FORMAT_TXT;
+	else
+		return FALSE;
+
+	if (sscanf(name, "%4d-%2d-%2d.%2d%2d%2d%n",
+	           &year, &mon, &mday, &hour, &min, &sec, &consumed) != 6 ||
+	    consumed != 17)
+		return FALSE;
+
+	rest = name + consumed;
+	if ((*rest == '+' || *rest == '-') &&
+	    g_ascii_isdigit(rest[1]) && g_ascii_isdigit(rest[2]) &&
+	    g_ascii_isdigit(rest[3]) && g_ascii_isdigit(rest[4])) {
+		/* Written with %z, so the name pins down the exact instant. */
+		int offset = ((rest[1] - '0') * 10 + (rest[2] - '0')) * 3600 +
+		             ((rest[3] - '0') * 10 + (rest[4] - '0')) * 60;
+
+		if (*rest == '-')
+			offset = -offset;
+		t = days_from_civil(year, mon, mday) * 86400 +
+		    hour * 3600 + min * 60 + sec - offset;
+	} else {
+		memset(&tm, 0, sizeof(tm));
+		tm.tm_year = year - 1900;
+		tm.tm_mon = mon - 1;
+		tm.tm_mday = mday;
+		tm.tm_hour = hour;
+		tm.tm_min = min;
+		tm.tm_sec = sec;
+		tm.tm_isdst = -1;
+		t = mktime(&tm);
+	}
+
+	if (time != NULL)
+		*time = t;
+	if (format != NULL)
+		*format = fmt;
+	return TRUE;
+}
+
+GMappedFile *
+log_file_map(const char *path)
+{
+	GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+
+#ifdef POSIX_MADV_SEQUENTIAL
+	/* The mapping starts at the top of the file, so it is page aligned */
+	if (file != NULL && g_mapped_file_get_length(file) > 0)
+		posix_madvise(g_mapped_file_get_contents(file),
+		              g_mapped_file_get_length(file), POSIX_MADV_SEQUENTIAL);
+#endif
+	return file;
+}
+
+GBytes *
+log_file_load(const char *path)
+{
+	GMappedFile *file = log_file_map(path);
+	GBytes *bytes;
+
+	if (file == NULL)
+		return log_archive_load(path);
+	bytes = g_mapped_file_get_bytes(file);
+	g_mapped_file_unref(file);
+	return bytes;
+}
+
+gboolean
+log_file_stat(const char *path, gint64 *size, gint64 *mtime)
+{
+	GStatBuf st;
+
+	if (g_stat(path, &st) != 0)
+		return log_archive_stat(path, size, mtime);
+	*size = st.st_size;
+	*mtime = st.st_mtime;
+	return TRUE;
+}
+
+/*
+ * Reports the logs packed in an archive, except any also found loose, which
+ * are left over from packing that was cut short.
+ */
+static gboolean
+walk_archive(const char *protocol, const char *account, const char *buddy,
+             const char *dir, const char *name, GHashTable *loose,
+             LogFileWalkFunc func, gpointer data)
+{
+	char *path = g_build_filename(dir, name, NULL);
+	LogArchive *archive = log_archive_open(path);
+	gboolean keep_going = TRUE;
+	guint i;
+
+	g_free(path);
+	if (archive == NULL)
+		return TRUE;
+
+	for (i = 0; keep_going && i < log_archive_get_n_logs(archive); i++) {
+		const char *log = log_archive_get_name(archive, i);
+		LogFormat format;
+
+		if (g_hash_table_contains(loose, log) ||
+		    !log_file_parse_name(log, NULL, &format))
+			continue;
+
+		path = g_build_filename(dir, log, NULL);
+		keep_going = func(protocol, account, buddy, path,
+		                  log_archive_get_time(archive, i), format, data);
+		g_free(path);
+	}
+	log_archive_close(archive);
+
+	return keep_going;
+}
+
+static gboolean
+walk_buddy(const char *protocol, const char *account, const char *buddy,
+           const char *dir, gpointer data)
+{
+	gpointer *args = data;
+	LogFileWalkFunc func = (LogFileWalkFunc)args[0];
+	GHashTable *loose = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GSList *archives = NULL, *l;
+	GDir *d;
+	const char *name;
+	gboolean keep_going = TRUE;
+
+	if ((d = g_dir_open(dir, 0, NULL)) == NULL) {
+		g_hash_table_destroy(loose);
+		return TRUE;
+	}
+
+	while (keep_going && (name = g_dir_read_name(d)) != NULL) {
+		time_t time;
+		LogFormat format;
+		char *path;
+
+		if (log_archive_parse_name(name, NULL, NULL)) {
+			archives = g_slist_prepend(archives, g_strdup(name));
+			continue;
+		}
+		if (!log_file_parse_name(name, &time, &format))
+			continue;
+
+		g_hash_table_add(loose, g_strdup(name));
+		path = g_build_filename(dir, name, NULL);
+		keep_going = func(protocol, account, buddy, path, time, format, args[1]);
+		g_free(path);
+	}
+	g_dir_close(d);
+
+	for (l = archives; keep_going && l != NULL; l = l->next)
+		keep_going = walk_archive(protocol, account, buddy, dir, l->data,
+		                          loose, func, args[1]);
+
+	g_slist_free_full(archives, g_free);
+	g_hash_table_destroy(loose);
+	return keep_going;
+}
+
+/* Like purple_utf8_salvage(), which may not be called off the main thread */
+char *
+log_file_salvage_utf8(const char *buf, gsize len)
+{
+	GString *out = g_string_sized_new(len);
+	const char *p = buf, *end = buf + len, *bad;
+
+	while (!g_utf8_validate(p, end - p, &bad)) {
+		g_string_append_len(out, p, bad - p);
+		g_string_append_c(out, '?');
+		p = bad + 1;
+	}
+	g_string_append_len(out, p, end - p);
+	return g_string_free(out, FALSE);
+}
+
+/* Escapes txt and strips carriage returns from the log text at body */
+static char *
+decode_body(const char *body, const char *end, LogFormat format)
+{
+	char *read, *from, *to;
+
+	if (format == LOG_FORMAT_TXT) {
+		if (g_utf8_validate(body, end - body, NULL)) {
+			read = g_markup_escape_text(body, end - body);
+		} else {
+			char *valid = log_file_salvage_utf8(body, end - body);
+
+			read = g_markup_escape_text(valid, -1);
+			g_free(valid);
+		}
+	} else {
+		read = g_strndup(body, end - body);
+	}
+
+	for (from = to = read; *from != '\0'; from++)
+		if (*from != '\r')
+			*to++ = *from;
+	*to = '\0';
+
+	return read;
+}
+
+char *
+log_file_decode(const char *buf, gsize len, LogFormat format)
+{
+	const char *body;
+
+	/* An empty file maps to NULL */
+	if (buf == NULL)
+		return g_strdup("");
+
+	/* The first line is the logger's header */
+	body = memchr(buf, '\n', len);
+	body = body == NULL ? buf : body + 1;
+
+	return decode_body(body, buf + len, format);
+}
+
+char *
+log_file_decode_more(const char *buf, gsize len, LogFormat format)
+{
+	return decode_body(buf, buf + len, format);
+}
+
+gsize
+log_file_decode_entity(const char *name, gsize len, char out[8])
+{
+	static const struct {
+		const char *name;
+		const char *text;
+	} entities[] = {
+		{ "amp", "&" }, { "lt", "<" }, { "gt", ">" },
+		{ "quot", "\"" }, { "apos", "'" }, { "nbsp", " " }
+	};
+	guint i;
+
+	if (len > 1 && name[0] == '#') {
+		char digits[10];
+		gunichar c;
+
+		/* strtoull would run on past the name */
+		if (len >= sizeof(digits))
+			return 0;
+		memcpy(digits, name, len);
+		digits[len] = '\0';
+		c = digits[1] == 'x' || digits[1] == 'X' ?
+		    g_ascii_strtoull(digits + 2, NULL, 16) :
+		    g_ascii_strtoull(digits + 1, NULL, 10);
+		return c == 0 ? 0 : g_unichar_to_utf8(c, out);
+	}
+	for (i = 0; i < G_N_ELEMENTS(entities); i++) {
+		if (strlen(entities[i].name) == len &&
+		    strncmp(entities[i].name, name, len) == 0) {
+			strcpy(out, entities[i].text);
+			return strlen(out);
+		}
+	}
+	return 0;
+}
+
+gboolean
+log_file_walk_dirs(const char *logdir, LogFileDirFunc func, gpointer data)
+{
+	GDir *protocols, *accounts, *buddies;
+	const char *protocol, *account, *buddy;
+	gboolean keep_going = TRUE;
+
+	if ((protocols = g_dir_open(logdir, 0, NULL)) == NULL)
+		return TRUE;
+
+	while (keep_going && (protocol = g_dir_read_name(protocols)) != NULL) {
+		char *pdir = g_build_filename(logdir, protocol, NULL);
+
+		if ((accounts = g_dir_open(pdir, 0, NULL)) == NULL) {
+			g_free(pdir);
+			continue;
+		}
+		while (keep_going && (account = g_dir_read_name(accounts)) != NULL) {
+			char *adir = g_build_filename(pdir, account, NULL);
+
+			if ((buddies = g_dir_open(adir, 0, NULL)) == NULL) {
+				g_free(adir);
+				continue;
+			}
+			while (keep_going && (buddy = g_dir_read_name(buddies)) != NULL) {
+				char *bdir;
+
+				/* Chats and the system log are not IM conversations */
+				if (g_str_has_suffix(buddy, ".chat") ||
+				    strcmp(buddy, ".system") == 0)
+					continue;
+
+				bdir = g_build_filename(adir, buddy, NULL);
+				keep_going = func(protocol, account, buddy, bdir, data);
+				g_free(bdir);
+			}
+			g_dir_close(buddies);
+			g_free(adir);
+		}
+		g_dir_close(accounts);
+		g_free(pdir);
+	}
+	g_dir_close(protocols);
+
+	return keep_going;
+}
+
+gboolean
+log_file_walk(const char *logdir, LogFileWalkFunc func, gpointer data)
+{
+	gpointer args[2];
+
+	args[0] = (gpointer)func;
+	args[1] = data;
+	return log_file_walk_dirs(logdir, walk_buddy, args);
+}
+
+gboolean
+log_file_walk_buddy(const char *dir, LogFileWalkFunc func, gpointer data)
+{
+	char *adir = g_path_get_dirname(dir);
+	char *pdir = g_path_get_dirname(adir);
+	char *protocol = g_path_get_basename(pdir);
+	char *account = g_path_get_basename(adir);
+	char *buddy = g_path_get_basename(dir);
+	gpointer args[2];
+	gboolean keep_going;
+
+	args[0] = (gpointer)func;
+	args[1] = data;
+	keep_going = walk_buddy(protocol, account, buddy, dir, args);
+
+	g_free(adir);
+	g_free(pdir);
+	g_free(protocol);
+	g_free(account);
+	g_free(buddy);
+	return keep_going;
+}
@@ -0,0 +1,89 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGFILE_H_
+#define _LOGVIEWER_LOGFILE_H_
+
+#include <time.h>
+#include <glib.h>
+
+typedef enum {
+	LOG_FORMAT_UNKNOWN = 0,
+	LOG_FORMAT_HTML,
+	LOG_FORMAT_TXT
+} LogFormat;
+
+/**
+ * Called by log_file_walk() for every IM log file found.  protocol, account
+ * and buddy are the (escaped) directory names making up the log's location.
+ * Return FALSE to stop the walk.
+ */
+typedef gboolean (*LogFileWalkFunc)(const char *protocol, const char *account,
+                                    const char *buddy, const char *path,
+                                    time_t time, LogFormat format, gpointer data);
+
+/**
+ * Called by log_file_walk_dirs() for every buddy's log directory.  Return
+ * FALSE to stop the walk.
+ */
+typedef gboolean (*LogFileDirFunc)(const char *protocol, const char *account,
+                                   const char *buddy, const char *dir, gpointer data);
+
+/**
+ * Parses a log file name as written by the html and txt loggers.  time and
+ * format may be NULL.
+ */
+gboolean log_file_parse_name(const char *name, time_t *time, LogFormat *format);
+
+/**
+ * Maps a log read-only for one front-to-back pass, hinting the kernel to read
+ * ahead and drop pages behind.  Returns NULL if it cannot be opened.
+ */
+GMappedFile *log_file_map(const char *path);
+
+/**
+ * The bytes of the log at path, mapped if it is a file of its own or else
+ * uncompressed from the archive it has been packed into.  Returns NULL if it
+ * is in neither.
+ */
+GBytes *log_file_load(const char *path);
+
+/** The size and modification time of the log at path, loose or packed. */
+gboolean log_file_stat(const char *path, gint64 *size, gint64 *mtime);
+
+/**
+ * The text of a log of the html or txt logger as purple_log_read() gives it,
+ * short of turning the links of a txt log into markup: the header line is
+ * dropped, txt is escaped with invalid UTF-8 replaced by '?', and carriage
+ * returns are stripped.  Safe to call from any thread.
+ */
+char *log_file_decode(const char *buf, gsize len, LogFormat format);
+
+/** Decodes as log_file_decode() does lines written to a log after its header. */
+char *log_file_decode_more(const char *buf, gsize len, LogFormat format);
+
+/**
+ * What the log viewer would show for the html entity called name, which is
+ * the len bytes between '&' and ';', into out.  Returns its length, or 0 if
+ * it is not an entity the viewer knows.
+ */
+gsize log_file_decode_entity(const char *name, gsize len, char out[8]);
+
+/** Copies buf with each byte that is not valid UTF-8 replaced by '?'. */
+char *log_file_salvage_utf8(const char *buf, gsize len);
+
+/**
+ * Walks logdir/protocol/account/buddy/ and reports every IM log in it,
+ * packed ones included.
+ */
+gboolean log_file_walk(const char *logdir, LogFileWalkFunc func, gpointer data);
+
+/** Like log_file_walk(), for the one buddy whose log directory is dir. */
+gboolean log_file_walk_buddy(const char *dir, LogFileWalkFunc func, gpointer data);
+
+/** Walks logdir/protocol/account/ and reports every buddy's log directory. */
+gboolean log_file_walk_dirs(const char *logdir, LogFileDirFunc func, gpointer data);
+
+#endif /* _LOGVIEWER_LOGFILE_H_ */
@@ -0,0 +1,233 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+/*
+ * Writes a synthetic log tree laid out the way libpurple's html and txt
+ * loggers lay one out, for benchmarking:
+ *
+ *   loggen [--logs N] [--seed S] [--txt PERCENT] OUTDIR
+ *
+ * A few buddies get most of the logs, most conversations are a few dozen
+ * lines and a few run to thousands, and the messages mix ordinary words with
+ * ticket numbers and host names of the kind people search for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <glib/gstdio.h>
+
+#define SPAN_DAYS  (5 * 365)        /* logs are spread over this many days */
+#define START_TIME 1262304000       /* 2010-01-01 00:00:00 UTC */
+
+static const char *words[] = {
+	"the", "a", "to", "and", "of", "is", "it", "that", "you", "for", "on",
+	"was", "with", "this", "have", "but", "not", "are", "just", "what",
+	"so", "can", "be", "at", "know", "think", "meeting", "tomorrow",
+	"deploy", "build", "server", "release", "lunch", "later", "ok", "yeah",
+	"thanks", "sure", "bug", "patch", "review", "branch", "merge", "test",
+	"weekend", "coffee", "call", "email", "ticket", "crash", "fixed",
+	"config", "network", "database", "backup", "password", "reboot",
+	"&", "<3", ":)", "http://example.com/page"
+};
+
+static const char *protocols[] = { "aim", "jabber", "msn", "yahoo" };
+
+typedef struct {
+	GRand   *rand;
+	gboolean txt;
+	char    *buddy;
+	char    *account;
+	char    *protocol;
+} Conversation;
+
+/* Roughly Zipf: buddy i is picked about 1/(i+1) as often as the first */
+static guint
+pick_zipf(GRand *rand, guint n)
+{
+	double u = g_rand_double(rand);
+
+	return MIN((guint)(exp(u * log(n + 1.0)) - 1.0), n - 1);
+}
+
+/* Mostly tens of lines, a few much longer */
+static guint
+pick_lines(GRand *rand)
+{
+	if (g_rand_int_range(rand, 0, 100) == 0)
+		return g_rand_int_range(rand, 1000, 5000);
+	return (guint)(4 + exp(g_rand_double_range(rand, 0.0, 5.0)));
+}
+
+static void
+append_message(GString *out, Conversation *conv, const struct tm *tm)
+{
+	guint n = g_rand_int_range(conv->rand, 1, 25), i;
+	gboolean mine = g_rand_boolean(conv->rand);
+	const char *who = mine ? conv->account : conv->buddy;
+	GString *text = g_string_new(NULL);
+
+	for (i = 0; i < n; i++) {
+		guint r = g_rand_int_range(conv->rand, 0, 200);
+
+		if (i > 0)
+			g_string_append_c(text, ' ');
+		if (r == 0)
+			g_string_append_printf(text, "TICKET-%u", g_rand_int_range(conv->rand, 1000, 9999));
+		else if (r == 1)
+			g_string_append_printf(text, "host%02u.example.net", g_rand_int_range(conv->rand, 0, 50));
+		else
+			g_string_append(text, words[g_rand_int_range(conv->rand, 0, G_N_ELEMENTS(words))]);
+	}
+
+	if (conv->txt) {
+		g_string_append_printf(out, "(%02d:%02d:%02d) %s: %s\n",
+		                       tm->tm_hour, tm->tm_min, tm->tm_sec, who, text->str);
+	} else {
+		char *escaped = g_markup_escape_text(text->str, -1);
+
+		g_string_append_printf(out,
+			"<font color=\"#%s\"><font size=\"2\">(%02d:%02d:%02d)</font> "
+			"<b>%s:</b></font> %s<br/>\n",
+			mine ? "16569E" : "A82F2F", tm->tm_hour, tm->tm_min, tm->tm_sec,
+			who, escaped);
+		g_free(escaped);
+	}
+	g_string_free(text, TRUE);
+}
+
+static gboolean
+write_log(const char *dir, Conversation *conv, time_t start)
+{
+	GString *out = g_string_new(NULL);
+	struct tm tm;
+	char date[64], name[64], *path;
+	guint lines = pick_lines(conv->rand), i;
+	time_t t;
+	gboolean ok;
+
+	/* Two conversations with one buddy cannot start in the same second */
+	for (;;) {
+		gmtime_r(&start, &tm);
+		strftime(name, sizeof(name), "%Y-%m-%d.%H%M%S+0000UTC", &tm);
+		strcat(name, conv->txt ? ".txt" : ".html");
+		path = g_build_filename(dir, name, NULL);
+		if (!g_file_test(path, G_FILE_TEST_EXISTS))
+			break;
+		g_free(path);
+		start++;
+	}
+	t = start;
+	strftime(date, sizeof(date), "%m/%d/%Y %I:%M:%S %p", &tm);
+
+	if (conv->txt)
+		g_string_append_printf(out, "Conversation with %s at %s on %s (%s)\n",
+		                       conv->buddy, date, conv->account, conv->protocol);
+	else
+		g_string_append_printf(out,
+			"<html><head><meta http-equiv=\"content-type\" content=\"text/html; "
+			"charset=UTF-8\"><title>Conversation with %s at %s on %s (%s)</title>"
+			"</head><body><h3>Conversation with %s at %s on %s (%s)</h3>\n",
+			conv->buddy, date, conv->account, conv->protocol,
+			conv->buddy, date, conv->account, conv->protocol);
+
+	for (i = 0; i < lines; i++) {
+		t += g_rand_int_range(conv->rand, 1, 120);
+		gmtime_r(&t, &tm);
+		append_message(out, conv, &tm);
+	}
+	if (!conv->txt)
+		g_string_append(out, "</body></html>\n");
+
+	ok = g_file_set_contents(path, out->str, out->len, NULL);
+	g_free(path);
+	g_string_free(out, TRUE);
+	return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+	guint n_logs = 1000, seed = 1, txt_percent = 20, n_buddies, i;
+	const char *outdir = NULL;
+	GRand *rand;
+	char **buddy_dirs;
+	Conversation conv;
+
+	for (i = 1; i < (guint)argc; i++) {
+		if (strcmp(argv[i], "--logs") == 0 && i + 1 < (guint)argc)
+			n_logs = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < (guint)argc)
+			seed = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--txt") == 0 && i + 1 < (guint)argc)
+			txt_percent = strtoul(argv[++i], NULL, 10);
+		else if (argv[i][0] != '-' && outdir == NULL)
+			outdir = argv[i];
+		else
+			break;
+	}
+	if (i < (guint)argc || outdir == NULL || n_logs == 0) {
+		fprintf(stderr, "usage: %s [--logs N] [--seed S] [--txt PERCENT] OUTDIR\n",
+		        argv[0]);
+		return 2;
+	}
+
+	rand = g_rand_new_with_seed(seed);
+	n_buddies = MAX(n_logs / 40, 5);
+	buddy_dirs = g_new0(char *, n_buddies);
+	for (i = 0; i < n_buddies; i++) {
+		const char *protocol = protocols[i % G_N_ELEMENTS(protocols)];
+		char *account = g_strdup_printf("me%u", i % 3);
+		char *buddy = g_strdup_printf("buddy%u", i);
+
+		buddy_dirs[i] = g_build_filename(outdir, protocol, account, buddy, NULL);
+		if (g_mkdir_with_parents(buddy_dirs[i], 0700) != 0) {
+			perror(buddy_dirs[i]);
+			return 1;
+		}
+		g_free(account);
+		g_free(buddy);
+	}
+
+	/* Chats and the system log, which the viewer is to skip */
+	for (i = 0; i < G_N_ELEMENTS(protocols); i++) {
+		char *dir = g_build_filename(outdir, protocols[i], "me0", ".system", NULL);
+
+		g_mkdir_with_parents(dir, 0700);
+		g_free(dir);
+		dir = g_build_filename(outdir, protocols[i], "me0", "room.chat", NULL);
+		g_mkdir_with_parents(dir, 0700);
+		g_free(dir);
+	}
+
+	conv.rand = rand;
+	for (i = 0; i < n_logs; i++) {
+		guint b = pick_zipf(rand, n_buddies);
+		time_t start = START_TIME +
+			(time_t)g_rand_int_range(rand, 0, SPAN_DAYS) * 86400 +
+			g_rand_int_range(rand, 0, 86400);
+
+		conv.txt = g_rand_int_range(rand, 0, 100) < (gint32)txt_percent;
+		conv.protocol = (char *)protocols[b % G_N_ELEMENTS(protocols)];
+		conv.account = g_strdup_printf("me%u", b % 3);
+		conv.buddy = g_strdup_printf("buddy%u", b);
+		if (!write_log(buddy_dirs[b], &conv, start)) {
+			fprintf(stderr, "%s: could not write a log\n", buddy_dirs[b]);
+			return 1;
+		}
+		g_free(conv.account);
+		g_free(conv.buddy);
+	}
+
+	printf("%u logs for %u buddies written to %s\n", n_logs, n_buddies, outdir);
+
+	for (i = 0; i < n_buddies; i++)
+		g_free(buddy_dirs[i]);
+	g_free(buddy_dirs);
+	g_rand_free(rand);
+	return 0;
+}
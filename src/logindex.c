@@ -0,0 +1,1553 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+/*
+ * The index is a set of immutable segment files plus a catalog.  The catalog
+ * lists the live segments and every indexed log ("doc"), with how many bytes
+ * of it have been indexed so that growing logs only need their tail read.
+ * A segment holds a sorted term table and, for every term, a posting list of
+ * doc ids each followed by the byte offsets the term occurs at.  New postings
+ * collect in memory and are written out as a new segment; once there are too
+ * many segments they are merged into one.
+ *
+ * Segments are written and searched without the lock held, which is only
+ * taken to swap tables in and out, so a query never waits on the disk.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "logfile.h"
+#include "logindex.h"
+
+#define LOG_INDEX_VERSION        2
+#define LOG_INDEX_MAX_TERM       48        /* longer words are cut to this  */
+#define LOG_INDEX_MAX_WORD       (4 * LOG_INDEX_MAX_TERM) /* bytes kept of a word */
+#define LOG_INDEX_FLUSH_POSTINGS (2 << 20) /* postings kept in memory       */
+#define LOG_INDEX_MAX_SEGMENTS   8
+
+typedef struct {
+	char    *path;
+	gint64   mtime;
+	guint64  indexed;   /**< Bytes at the start of the file already indexed */
+	guint64  saved;     /**< Of those, the bytes whose postings are on disk */
+	gint64   time;
+	gboolean dead;      /**< The file is gone or was rewritten              */
+} LogIndexDoc;
+
+typedef struct {
+	guint32 doc;
+	guint32 offset;
+} LogIndexPosting;
+
+typedef struct {
+	char    magic[4];
+	guint32 version;
+	guint32 n_terms;
+	guint32 reserved;
+	guint64 terms_off;
+	guint64 strings_off;
+} SegmentHeader;
+
+typedef struct {
+	guint32 str_off;
+	guint32 str_len;
+	guint32 n_docs;
+	guint32 post_len;
+	guint64 post_off;
+} SegmentTerm;
+
+typedef struct {
+	volatile gint      ref;
+	guint              id;
+	GMappedFile       *file;
+	guint32            n_terms;
+	const SegmentTerm *terms;
+	const char        *strings;
+	const guint8      *data;
+} LogIndexSegment;
+
+typedef enum {
+	JOB_SYNC,
+	JOB_UPDATE,
+	JOB_QUIT
+} LogIndexJobType;
+
+typedef struct {
+	LogIndexJobType type;
+	char           *path;
+	LogWarmup      *warmup;  /**< Of a sync, or NULL */
+} LogIndexJob;
+
+struct _LogIndex {
+	volatile gint ref;
+	char        *dir;
+	GMutex       lock;          /**< Guards everything below but jobs      */
+	GPtrArray   *docs;          /**< LogIndexDoc, indexed by doc id        */
+	GHashTable  *doc_ids;       /**< path -> doc id + 1                    */
+	GPtrArray   *segments;      /**< LogIndexSegment, oldest first         */
+	guint        next_segment;
+	GHashTable  *pending;       /**< term -> GArray of LogIndexPosting     */
+	guint        n_pending;
+	GHashTable  *flushing;      /**< The pending being written out, or NULL */
+	GHashTable  *stale;         /**< Logs written to but not indexed since */
+	gboolean     complete;      /**< A full sync has finished once         */
+	GAsyncQueue *jobs;
+	GThread     *thread;
+	volatile gint quit;
+};
+
+/* Tokenizer */
+
+typedef void (*TokenFunc)(const char *term, gsize len, guint32 offset, gpointer data);
+
+#define IS_WORD_BYTE(c) (g_ascii_isalnum(c) || (guchar)(c) >= 0x80)
+
+/*
+ * Lowers a word a character at a time, so that any part of a word comes out
+ * as the same part of the lowered word: ASCII and valid UTF-8 are lowered,
+ * other bytes are kept as they are.  The result is cut to LOG_INDEX_MAX_TERM
+ * bytes.
+ */
+static gsize
+normalize_word(const char *word, gsize len, char *out)
+{
+	const char *p = word, *end = word + len;
+	gsize n = 0;
+
+	while (p < end && n < LOG_INDEX_MAX_TERM) {
+		char lower[6];
+		gunichar c;
+		gsize lower_len;
+
+		if ((guchar)*p < 0x80) {
+			out[n++] = g_ascii_tolower(*p++);
+			continue;
+		}
+		c = g_utf8_get_char_validated(p, end - p);
+		if (c == (gunichar)-1 || c == (gunichar)-2) {
+			out[n++] = *p++;
+			continue;
+		}
+		lower_len = g_unichar_to_utf8(g_unichar_tolower(c), lower);
+		lower_len = MIN(lower_len, LOG_INDEX_MAX_TERM - n);
+		memcpy(out + n, lower, lower_len);
+		n += lower_len;
+		p = g_utf8_next_char(p);
+	}
+	out[n] = '\0';
+
+	return n;
+}
+
+/* A word being put together from the bytes of a log */
+typedef struct {
+	char     text[LOG_INDEX_MAX_WORD];
+	gsize    len;
+	gboolean cut;      /**< There was more of it than text holds */
+	guint32  start;
+} Word;
+
+static void
+word_add(Word *word, char c, guint32 offset)
+{
+	if (word->len == 0)
+		word->start = offset;
+	if (word->len < sizeof(word->text))
+		word->text[word->len++] = c;
+	else
+		word->cut = TRUE;
+}
+
+static void
+word_end(Word *word, TokenFunc func, gpointer data)
+{
+	char term[LOG_INDEX_MAX_TERM + 1];
+	const char *last;
+	gsize len = word->len, n;
+
+	if (len == 0)
+		return;
+	/* Far past what a term keeps, but not to end on part of a character */
+	if (word->cut && (last = g_utf8_find_prev_char(word->text, word->text + len)) != NULL)
+		len = last - word->text;
+
+	n = normalize_word(word->text, len, term);
+	func(term, n, word->start, data);
+	word->len = 0;
+	word->cut = FALSE;
+}
+
+/*
+ * Calls func for every word of text as the search sees it.  In markup, <br>
+ * ends a line, other tags are dropped and entities decoded, so a word may run
+ * on across them just as it does in the text the log viewer shows.
+ */
+static void
+tokenize(const char *text, gsize len, gboolean markup, guint32 base,
+         TokenFunc func, gpointer data)
+{
+	Word word;
+	gsize i = 0;
+
+	word.len = 0;
+	word.cut = FALSE;
+	while (i < len) {
+		guchar c = text[i];
+		const char *end;
+
+		if (markup && c == '<') {
+			if ((end = memchr(text + i, '>', len - i)) == NULL)
+				break;
+			if (len - i >= 3 && g_ascii_strncasecmp(text + i, "<br", 3) == 0)
+				word_end(&word, func, data);
+			i = end - text + 1;
+		} else if (markup && c == '&' &&
+		           (end = memchr(text + i, ';', MIN(len - i, 10))) != NULL) {
+			char decoded[8];
+			gsize j, n = log_file_decode_entity(text + i + 1, end - text - i - 1,
+			                                    decoded);
+
+			for (j = 0; j < n; j++) {
+				if (IS_WORD_BYTE(decoded[j]))
+					word_add(&word, decoded[j], base + i);
+				else
+					word_end(&word, func, data);
+			}
+			i = end - text + 1;
+		} else {
+			if (IS_WORD_BYTE(c))
+				word_add(&word, c, base + i);
+			else
+				word_end(&word, func, data);
+			i++;
+		}
+	}
+	word_end(&word, func, data);
+}
+
+/* Posting list encoding */
+
+static void
+put_varint(GByteArray *out, guint32 v)
+{
+	guint8 b;
+
+	while (v >= 0x80) {
+		b = (v & 0x7f) | 0x80;
+		g_byte_array_append(out, &b, 1);
+		v >>= 7;
+	}
+	b = v;
+	g_byte_array_append(out, &b, 1);
+}
+
+static gboolean
+get_varint(const guint8 **p, const guint8 *end, guint32 *v)
+{
+	guint32 result = 0;
+	int shift = 0;
+
+	while (*p < end && shift < 35) {
+		guint8 b = *(*p)++;
+
+		result |= (guint32)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*v = result;
+			return TRUE;
+		}
+		shift += 7;
+	}
+	return FALSE;
+}
+
+typedef struct {
+	const guint8 *p, *end;
+	guint32       doc;
+	guint32       n_offsets;
+	guint32       offset;
+	gboolean      started;
+} PostingReader;
+
+static void
+posting_reader_init(PostingReader *r, const LogIndexSegment *seg, const SegmentTerm *t)
+{
+	r->p = seg->data + sizeof(SegmentHeader) + t->post_off;
+	r->end = r->p + t->post_len;
+	r->doc = 0;
+	r->n_offsets = 0;
+	r->started = FALSE;
+}
+
+/* Moves to the next doc, skipping any offsets left unread in the current one */
+static gboolean
+posting_reader_next_doc(PostingReader *r)
+{
+	guint32 delta, v;
+
+	while (r->n_offsets > 0) {
+		if (!get_varint(&r->p, r->end, &v))
+			return FALSE;
+		r->n_offsets--;
+	}
+	if (!get_varint(&r->p, r->end, &delta) ||
+	    !get_varint(&r->p, r->end, &r->n_offsets))
+		return FALSE;
+
+	r->doc = r->started ? r->doc + delta : delta;
+	r->started = TRUE;
+	r->offset = 0;
+	return TRUE;
+}
+
+static gboolean
+posting_reader_next_offset(PostingReader *r, guint32 *offset)
+{
+	guint32 delta;
+
+	if (r->n_offsets == 0 || !get_varint(&r->p, r->end, &delta))
+		return FALSE;
+	r->n_offsets--;
+	r->offset += delta;
+	*offset = r->offset;
+	return TRUE;
+}
+
+/* Segment files */
+
+typedef struct {
+	FILE       *fp;
+	char       *tmp_path;
+	guint64     post_len;
+	GByteArray *terms;
+	GString    *strings;
+	SegmentTerm cur;
+	GByteArray *buf;        /**< Postings of the current term            */
+	guint32     last_doc;
+	guint32     last_offset;
+	gboolean    ok;
+} SegmentWriter;
+
+static char *
+segment_path(LogIndex *index, guint id)
+{
+	char *name = g_strdup_printf("seg-%08x.dat", id);
+	char *path = g_build_filename(index->dir, name, NULL);
+
+	g_free(name);
+	return path;
+}
+
+static SegmentWriter *
+segment_writer_new(const char *path)
+{
+	SegmentWriter *w = g_new0(SegmentWriter, 1);
+	SegmentHeader header;
+
+	w->tmp_path = g_strconcat(path, ".tmp", NULL);
+	w->fp = g_fopen(w->tmp_path, "wb");
+	w->terms = g_byte_array_new();
+	w->strings = g_string_new(NULL);
+	w->buf = g_byte_array_new();
+	w->ok = w->fp != NULL;
+
+	memset(&header, 0, sizeof(header));
+	if (w->ok)
+		w->ok = fwrite(&header, sizeof(header), 1, w->fp) == 1;
+	return w;
+}
+
+static void
+segment_writer_begin_term(SegmentWriter *w, const char *term)
+{
+	memset(&w->cur, 0, sizeof(w->cur));
+	w->cur.str_off = w->strings->len;
+	w->cur.str_len = strlen(term);
+	w->cur.post_off = w->post_len;
+	g_string_append_len(w->strings, term, w->cur.str_len + 1);
+	g_byte_array_set_size(w->buf, 0);
+	w->last_doc = 0;
+}
+
+static void
+segment_writer_add_doc(SegmentWriter *w, guint32 doc, guint32 n_offsets)
+{
+	put_varint(w->buf, w->cur.n_docs ? doc - w->last_doc : doc);
+	put_varint(w->buf, n_offsets);
+	w->cur.n_docs++;
+	w->last_doc = doc;
+	w->last_offset = 0;
+}
+
+static void
+segment_writer_add_offset(SegmentWriter *w, guint32 offset)
+{
+	if (offset < w->last_offset)
+		offset = w->last_offset;
+	put_varint(w->buf, offset - w->last_offset);
+	w->last_offset = offset;
+}
+
+static void
+segment_writer_end_term(SegmentWriter *w)
+{
+	if (w->cur.n_docs == 0) {
+		/* Nothing survived (all docs dead); drop the term again */
+		g_string_truncate(w->strings, w->cur.str_off);
+		return;
+	}
+	w->cur.post_len = w->buf->len;
+	if (w->ok)
+		w->ok = fwrite(w->buf->data, 1, w->buf->len, w->fp) == w->buf->len;
+	w->post_len += w->buf->len;
+	g_byte_array_append(w->terms, (guint8 *)&w->cur, sizeof(w->cur));
+}
+
+static gboolean
+segment_writer_finish(SegmentWriter *w, const char *path)
+{
+	SegmentHeader header;
+	static const guint8 zeros[8];
+	gsize pad = (8 - (sizeof(header) + w->post_len) % 8) % 8;
+	gboolean ok = w->ok;
+
+	memcpy(header.magic, "LVSG", 4);
+	header.version = LOG_INDEX_VERSION;
+	header.n_terms = w->terms->len / sizeof(SegmentTerm);
+	header.reserved = 0;
+	header.terms_off = sizeof(header) + w->post_len + pad;
+	header.strings_off = header.terms_off + w->terms->len;
+
+	if (ok)
+		ok = fwrite(zeros, 1, pad, w->fp) == pad &&
+		     fwrite(w->terms->data, 1, w->terms->len, w->fp) == w->terms->len &&
+		     fwrite(w->strings->str, 1, w->strings->len, w->fp) == w->strings->len &&
+		     fseek(w->fp, 0, SEEK_SET) == 0 &&
+		     fwrite(&header, sizeof(header), 1, w->fp) == 1;
+	if (w->fp != NULL && fclose(w->fp) != 0)
+		ok = FALSE;
+	if (ok)
+		ok = g_rename(w->tmp_path, path) == 0;
+	if (!ok)
+		g_unlink(w->tmp_path);
+
+	g_free(w->tmp_path);
+	g_byte_array_free(w->terms, TRUE);
+	g_string_free(w->strings, TRUE);
+	g_byte_array_free(w->buf, TRUE);
+	g_free(w);
+
+	return ok;
+}
+
+static LogIndexSegment *
+segment_ref(LogIndexSegment *seg)
+{
+	g_atomic_int_inc(&seg->ref);
+	return seg;
+}
+
+static void
+segment_unref(LogIndexSegment *seg)
+{
+	if (!g_atomic_int_dec_and_test(&seg->ref))
+		return;
+	g_mapped_file_unref(seg->file);
+	g_free(seg);
+}
+
+static LogIndexSegment *
+segment_load(LogIndex *index, guint id)
+{
+	LogIndexSegment *seg;
+	const SegmentHeader *header;
+	GMappedFile *file;
+	char *path = segment_path(index, id);
+	gsize len;
+	guint32 i;
+
+	file = g_mapped_file_new(path, FALSE, NULL);
+	g_free(path);
+	if (file == NULL)
+		return NULL;
+
+	len = g_mapped_file_get_length(file);
+	header = (const SegmentHeader *)g_mapped_file_get_contents(file);
+	if (len < sizeof(*header) || memcmp(header->magic, "LVSG", 4) != 0 ||
+	    header->version != LOG_INDEX_VERSION ||
+	    header->terms_off + (guint64)header->n_terms * sizeof(SegmentTerm) > header->strings_off ||
+	    header->strings_off > len) {
+		g_mapped_file_unref(file);
+		return NULL;
+	}
+
+	seg = g_new0(LogIndexSegment, 1);
+	seg->ref = 1;
+	seg->id = id;
+	seg->file = file;
+	seg->data = (const guint8 *)header;
+	seg->n_terms = header->n_terms;
+	seg->terms = (const SegmentTerm *)(seg->data + header->terms_off);
+	seg->strings = (const char *)(seg->data + header->strings_off);
+
+	/* Check every term once so lookups can trust the tables */
+	for (i = 0; i < seg->n_terms; i++) {
+		const SegmentTerm *t = &seg->terms[i];
+
+		if (header->strings_off + t->str_off + t->str_len >= len ||
+		    sizeof(*header) + t->post_off + t->post_len > header->terms_off) {
+			segment_unref(seg);
+			return NULL;
+		}
+	}
+
+	return seg;
+}
+
+static const char *
+segment_term(const LogIndexSegment *seg, guint32 i)
+{
+	return seg->strings + seg->terms[i].str_off;
+}
+
+/* Catalog */
+
+static void
+put_u32(GByteArray *out, guint32 v)
+{
+	g_byte_array_append(out, (guint8 *)&v, sizeof(v));
+}
+
+static void
+put_u64(GByteArray *out, guint64 v)
+{
+	g_byte_array_append(out, (guint8 *)&v, sizeof(v));
+}
+
+static gboolean
+get_bytes(const guint8 **p, const guint8 *end, void *v, gsize len)
+{
+	if ((gsize)(end - *p) < len)
+		return FALSE;
+	memcpy(v, *p, len);
+	*p += len;
+	return TRUE;
+}
+
+static void
+doc_free(LogIndexDoc *doc)
+{
+	g_free(doc->path);
+	g_free(doc);
+}
+
+/* Called with the lock held; what is on disk is saved by catalog_save */
+static GByteArray *
+catalog_build(LogIndex *index)
+{
+	GByteArray *out = g_byte_array_new();
+	guint i;
+
+	g_byte_array_append(out, (const guint8 *)"LVCT", 4);
+	put_u32(out, LOG_INDEX_VERSION);
+	put_u32(out, index->complete);
+	put_u32(out, index->next_segment);
+	put_u32(out, index->segments->len);
+	for (i = 0; i < index->segments->len; i++)
+		put_u32(out, ((LogIndexSegment *)g_ptr_array_index(index->segments, i))->id);
+
+	put_u32(out, index->docs->len);
+	for (i = 0; i < index->docs->len; i++) {
+		LogIndexDoc *doc = g_ptr_array_index(index->docs, i);
+		guint32 len = strlen(doc->path);
+
+		put_u64(out, doc->saved);
+		put_u64(out, doc->mtime);
+		put_u64(out, doc->time);
+		put_u32(out, doc->dead);
+		put_u32(out, len);
+		g_byte_array_append(out, (guint8 *)doc->path, len);
+	}
+
+	return out;
+}
+
+static void
+catalog_save(LogIndex *index, GByteArray *catalog)
+{
+	char *path = g_build_filename(index->dir, "catalog", NULL);
+
+	g_file_set_contents(path, (const char *)catalog->data, catalog->len, NULL);
+	g_byte_array_free(catalog, TRUE);
+	g_free(path);
+}
+
+static gboolean
+catalog_read(LogIndex *index)
+{
+	char *path = g_build_filename(index->dir, "catalog", NULL);
+	char *contents = NULL;
+	gsize len;
+	const guint8 *p, *end;
+	guint32 version, complete, n, i;
+	gboolean ok = FALSE;
+
+	if (!g_file_get_contents(path, &contents, &len, NULL))
+		goto out;
+
+	p = (const guint8 *)contents;
+	end = p + len;
+	if (len < 4 || memcmp(p, "LVCT", 4) != 0)
+		goto out;
+	p += 4;
+	if (!get_bytes(&p, end, &version, 4) || version != LOG_INDEX_VERSION ||
+	    !get_bytes(&p, end, &complete, 4) ||
+	    !get_bytes(&p, end, &index->next_segment, 4) ||
+	    !get_bytes(&p, end, &n, 4))
+		goto out;
+
+	for (i = 0; i < n; i++) {
+		LogIndexSegment *seg;
+		guint32 id;
+
+		if (!get_bytes(&p, end, &id, 4) || (seg = segment_load(index, id)) == NULL)
+			goto out;
+		g_ptr_array_add(index->segments, seg);
+	}
+
+	if (!get_bytes(&p, end, &n, 4))
+		goto out;
+	for (i = 0; i < n; i++) {
+		LogIndexDoc *doc = g_new0(LogIndexDoc, 1);
+		guint32 dead, plen;
+
+		g_ptr_array_add(index->docs, doc);
+		if (!get_bytes(&p, end, &doc->indexed, 8) ||
+		    !get_bytes(&p, end, &doc->mtime, 8) ||
+		    !get_bytes(&p, end, &doc->time, 8) ||
+		    !get_bytes(&p, end, &dead, 4) ||
+		    !get_bytes(&p, end, &plen, 4) ||
+		    (gsize)(end - p) < plen)
+			goto out;
+
+		doc->path = g_strndup((const char *)p, plen);
+		doc->saved = doc->indexed;
+		doc->dead = dead;
+		p += plen;
+		if (!doc->dead)
+			g_hash_table_insert(index->doc_ids, doc->path, GUINT_TO_POINTER(i + 1));
+	}
+
+	index->complete = complete;
+	ok = TRUE;
+
+out:
+	if (!ok) {
+		/* Whatever is there is unusable; start over from scratch */
+		g_hash_table_remove_all(index->doc_ids);
+		g_ptr_array_set_size(index->docs, 0);
+		g_ptr_array_set_size(index->segments, 0);
+		index->next_segment = 0;
+		index->complete = FALSE;
+	}
+	g_free(contents);
+	g_free(path);
+	return ok;
+}
+
+/* Removes segment files left behind by an interrupted flush or merge */
+static void
+remove_stale_files(LogIndex *index)
+{
+	GDir *dir = g_dir_open(index->dir, 0, NULL);
+	const char *name;
+	guint i, id;
+
+	if (dir == NULL)
+		return;
+
+	while ((name = g_dir_read_name(dir)) != NULL) {
+		gboolean live = FALSE;
+
+		if (!g_str_has_prefix(name, "seg-"))
+			continue;
+		if (sscanf(name, "seg-%08x.dat", &id) == 1 && g_str_has_suffix(name, ".dat")) {
+			for (i = 0; i < index->segments->len; i++)
+				if (((LogIndexSegment *)g_ptr_array_index(index->segments, i))->id == id)
+					live = TRUE;
+		}
+		if (!live) {
+			char *path = g_build_filename(index->dir, name, NULL);
+			g_unlink(path);
+			g_free(path);
+		}
+	}
+	g_dir_close(dir);
+}
+
+/* Writing, all done on the index thread */
+
+static int
+posting_compare(gconstpointer a, gconstpointer b)
+{
+	const LogIndexPosting *p1 = a, *p2 = b;
+
+	if (p1->doc != p2->doc)
+		return p1->doc < p2->doc ? -1 : 1;
+	if (p1->offset != p2->offset)
+		return p1->offset < p2->offset ? -1 : 1;
+	return 0;
+}
+
+static int
+string_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void merge_segments(LogIndex *index);
+
+/*
+ * Writes the pending postings out as a new segment.  The table is swapped
+ * for an empty one and written without the lock, while queries go on
+ * looking it up as flushing.  Only once the segment is in do the docs' saved
+ * sizes move up to what it holds; if it could not be written, they are
+ * indexed again from there.
+ */
+static void
+flush_pending(LogIndex *index)
+{
+	GHashTable *flushing;
+	GPtrArray *terms;
+	GHashTableIter iter;
+	gpointer key;
+	SegmentWriter *w;
+	LogIndexSegment *seg = NULL;
+	GByteArray *catalog;
+	guint64 *sizes;
+	char *path;
+	guint i, id, n_docs;
+
+	g_mutex_lock(&index->lock);
+
+	if (index->n_pending == 0) {
+		catalog = catalog_build(index);
+		g_mutex_unlock(&index->lock);
+		catalog_save(index, catalog);
+		return;
+	}
+
+	flushing = index->flushing = index->pending;
+	index->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                       (GDestroyNotify)g_array_unref);
+	index->n_pending = 0;
+	id = index->next_segment++;
+	n_docs = index->docs->len;
+	sizes = g_new(guint64, n_docs);
+	for (i = 0; i < n_docs; i++)
+		sizes[i] = ((LogIndexDoc *)g_ptr_array_index(index->docs, i))->indexed;
+
+	g_mutex_unlock(&index->lock);
+
+	terms = g_ptr_array_new();
+	g_hash_table_iter_init(&iter, flushing);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		g_ptr_array_add(terms, key);
+	g_ptr_array_sort(terms, string_compare);
+
+	path = segment_path(index, id);
+	w = segment_writer_new(path);
+
+	for (i = 0; i < terms->len; i++) {
+		const char *term = g_ptr_array_index(terms, i);
+		GArray *shared = g_hash_table_lookup(flushing, term);
+		GArray *postings;
+		LogIndexPosting *p;
+		guint j, k;
+
+		/* Queries may be reading the table's own arrays meanwhile */
+		postings = g_array_sized_new(FALSE, FALSE, sizeof(LogIndexPosting), shared->len);
+		g_array_append_vals(postings, shared->data, shared->len);
+		g_array_sort(postings, posting_compare);
+
+		segment_writer_begin_term(w, term);
+		for (j = 0; j < postings->len; j = k) {
+			p = &g_array_index(postings, LogIndexPosting, j);
+			for (k = j; k < postings->len &&
+			            g_array_index(postings, LogIndexPosting, k).doc == p->doc; k++)
+				;
+			segment_writer_add_doc(w, p->doc, k - j);
+			for (; j < k; j++)
+				segment_writer_add_offset(w,
+					g_array_index(postings, LogIndexPosting, j).offset);
+		}
+		segment_writer_end_term(w);
+		g_array_free(postings, TRUE);
+	}
+	g_ptr_array_free(terms, TRUE);
+
+	if (segment_writer_finish(w, path))
+		seg = segment_load(index, id);
+	g_free(path);
+
+	g_mutex_lock(&index->lock);
+	for (i = 0; i < n_docs; i++) {
+		LogIndexDoc *doc = g_ptr_array_index(index->docs, i);
+
+		if (seg != NULL)
+			doc->saved = sizes[i];
+		else
+			doc->indexed = doc->saved;
+	}
+	if (seg != NULL)
+		g_ptr_array_add(index->segments, seg);
+	index->flushing = NULL;
+	catalog = catalog_build(index);
+	g_mutex_unlock(&index->lock);
+
+	g_hash_table_destroy(flushing);
+	g_free(sizes);
+	catalog_save(index, catalog);
+
+	if (index->segments->len > LOG_INDEX_MAX_SEGMENTS)
+		merge_segments(index);
+}
+
+/*
+ * Merges every segment into one.  Only this thread replaces segments, so
+ * they can be read without the lock; the lock is taken to swap the result in.
+ * Queries still reading the old ones hold references to them.
+ */
+static void
+merge_segments(LogIndex *index)
+{
+	GPtrArray *inputs;
+	LogIndexSegment *merged;
+	guint8 *dead;
+	guint *cursor;
+	PostingReader *readers;
+	gboolean *has_term, *has_doc;
+	SegmentWriter *w;
+	guint n_docs, i, id;
+	char *path;
+
+	g_mutex_lock(&index->lock);
+	inputs = g_ptr_array_new();
+	for (i = 0; i < index->segments->len; i++)
+		g_ptr_array_add(inputs, g_ptr_array_index(index->segments, i));
+	n_docs = index->docs->len;
+	dead = g_new0(guint8, n_docs + 1);
+	for (i = 0; i < n_docs; i++)
+		dead[i] = ((LogIndexDoc *)g_ptr_array_index(index->docs, i))->dead;
+	id = index->next_segment++;
+	g_mutex_unlock(&index->lock);
+
+	path = segment_path(index, id);
+	w = segment_writer_new(path);
+	cursor = g_new0(guint, inputs->len);
+	readers = g_new0(PostingReader, inputs->len);
+	has_term = g_new0(gboolean, inputs->len);
+	has_doc = g_new0(gboolean, inputs->len);
+
+	while (!g_atomic_int_get(&index->quit)) {
+		const char *term = NULL;
+
+		for (i = 0; i < inputs->len; i++) {
+			LogIndexSegment *seg = g_ptr_array_index(inputs, i);
+
+			if (cursor[i] < seg->n_terms &&
+			    (term == NULL || strcmp(segment_term(seg, cursor[i]), term) < 0))
+				term = segment_term(seg, cursor[i]);
+		}
+		if (term == NULL)
+			break;
+
+		for (i = 0; i < inputs->len; i++) {
+			LogIndexSegment *seg = g_ptr_array_index(inputs, i);
+
+			has_term[i] = cursor[i] < seg->n_terms &&
+			              strcmp(segment_term(seg, cursor[i]), term) == 0;
+			has_doc[i] = FALSE;
+			if (has_term[i]) {
+				posting_reader_init(&readers[i], seg, &seg->terms[cursor[i]]);
+				has_doc[i] = posting_reader_next_doc(&readers[i]);
+			}
+		}
+
+		segment_writer_begin_term(w, term);
+		for (;;) {
+			guint32 doc = G_MAXUINT32, total = 0, offset;
+			gboolean live;
+
+			for (i = 0; i < inputs->len; i++)
+				if (has_doc[i] && readers[i].doc < doc)
+					doc = readers[i].doc;
+			if (doc == G_MAXUINT32)
+				break;
+
+			for (i = 0; i < inputs->len; i++)
+				if (has_doc[i] && readers[i].doc == doc)
+					total += readers[i].n_offsets;
+
+			live = doc < n_docs && !dead[doc];
+			if (live)
+				segment_writer_add_doc(w, doc, total);
+
+			/* Older segments hold the start of a log, newer ones its tail */
+			for (i = 0; i < inputs->len; i++) {
+				if (!has_doc[i] || readers[i].doc != doc)
+					continue;
+				while (posting_reader_next_offset(&readers[i], &offset))
+					if (live)
+						segment_writer_add_offset(w, offset);
+				has_doc[i] = posting_reader_next_doc(&readers[i]);
+			}
+		}
+		segment_writer_end_term(w);
+
+		for (i = 0; i < inputs->len; i++)
+			if (has_term[i])
+				cursor[i]++;
+	}
+
+	if (g_atomic_int_get(&index->quit)) {
+		w->ok = FALSE;
+		segment_writer_finish(w, path);
+	} else if (segment_writer_finish(w, path) &&
+	           (merged = segment_load(index, id)) != NULL) {
+		GArray *old_ids = g_array_new(FALSE, FALSE, sizeof(guint));
+		GByteArray *catalog;
+
+		for (i = 0; i < inputs->len; i++)
+			g_array_append_val(old_ids,
+				((LogIndexSegment *)g_ptr_array_index(inputs, i))->id);
+
+		/* Nothing else adds segments, so the inputs are all there is */
+		g_mutex_lock(&index->lock);
+		g_ptr_array_set_size(index->segments, 0);
+		g_ptr_array_add(index->segments, merged);
+		catalog = catalog_build(index);
+		g_mutex_unlock(&index->lock);
+		catalog_save(index, catalog);
+
+		for (i = 0; i < old_ids->len; i++) {
+			char *old = segment_path(index, g_array_index(old_ids, guint, i));
+
+			g_unlink(old);
+			g_free(old);
+		}
+		g_array_free(old_ids, TRUE);
+	}
+
+	g_free(path);
+	g_free(cursor);
+	g_free(readers);
+	g_free(has_term);
+	g_free(has_doc);
+	g_free(dead);
+	g_ptr_array_free(inputs, TRUE);
+}
+
+/* Collects a log's offsets per term, to be added to pending at once */
+static void
+collect_offset(const char *term, gsize len, guint32 offset, gpointer data)
+{
+	GHashTable *terms = data;
+	GArray *offsets = g_hash_table_lookup(terms, term);
+
+	if (offsets == NULL) {
+		offsets = g_array_new(FALSE, FALSE, sizeof(guint32));
+		g_hash_table_insert(terms, g_strndup(term, len), offsets);
+	}
+	g_array_append_val(offsets, offset);
+}
+
+/* Called with the lock held */
+static void
+add_postings(LogIndex *index, guint32 doc, GHashTable *terms)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	LogIndexPosting posting;
+
+	posting.doc = doc;
+	g_hash_table_iter_init(&iter, terms);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		GArray *offsets = value;
+		GArray *postings = g_hash_table_lookup(index->pending, key);
+		guint i;
+
+		if (postings == NULL) {
+			postings = g_array_new(FALSE, FALSE, sizeof(LogIndexPosting));
+			g_hash_table_insert(index->pending, g_strdup(key), postings);
+		}
+		for (i = 0; i < offsets->len; i++) {
+			posting.offset = g_array_index(offsets, guint32, i);
+			g_array_append_val(postings, posting);
+		}
+		index->n_pending += offsets->len;
+	}
+}
+
+static char *
+read_range(const char *path, guint64 from, guint64 size, gsize *len)
+{
+	FILE *fp = g_fopen(path, "rb");
+	GBytes *bytes;
+	const char *data;
+	char *buf;
+
+	if (fp == NULL) {
+		/* Packed into an archive, which can only be read whole */
+		if ((bytes = log_file_load(path)) == NULL)
+			return NULL;
+		data = g_bytes_get_data(bytes, NULL);
+		size = MIN(size, g_bytes_get_size(bytes));
+		from = MIN(from, size);
+		buf = g_malloc(size - from + 1);
+		*len = size - from;
+		memcpy(buf, data + from, *len);
+		buf[*len] = '\0';
+		g_bytes_unref(bytes);
+		return buf;
+	}
+	if (fseeko(fp, from, SEEK_SET) != 0) {
+		fclose(fp);
+		return NULL;
+	}
+	buf = g_malloc(size - from + 1);
+	*len = fread(buf, 1, size - from, fp);
+	buf[*len] = '\0';
+	fclose(fp);
+
+	return buf;
+}
+
+/* Indexes whatever part of path has not been indexed yet */
+static void
+index_file(LogIndex *index, const char *path, time_t time, LogFormat format)
+{
+	gint64 size, mtime;
+	LogIndexDoc *doc = NULL;
+	guint id;
+	guint64 from;
+	char *buf, *last_nl;
+	gsize len;
+	GHashTable *terms;
+
+	if (!log_file_stat(path, &size, &mtime))
+		return;
+
+	g_mutex_lock(&index->lock);
+	id = GPOINTER_TO_UINT(g_hash_table_lookup(index->doc_ids, path));
+	if (id != 0) {
+		doc = g_ptr_array_index(index->docs, id - 1);
+		if ((guint64)size == doc->indexed) {
+			doc->mtime = mtime;
+			g_mutex_unlock(&index->lock);
+			return;
+		}
+		if ((guint64)size < doc->indexed) {
+			/* Rewritten rather than appended to; start this log over */
+			doc->dead = TRUE;
+			g_hash_table_remove(index->doc_ids, doc->path);
+			doc = NULL;
+		}
+	}
+	if (doc == NULL) {
+		doc = g_new0(LogIndexDoc, 1);
+		doc->path = g_strdup(path);
+		doc->time = time;
+		g_ptr_array_add(index->docs, doc);
+		g_hash_table_insert(index->doc_ids, doc->path,
+		                    GUINT_TO_POINTER(index->docs->len));
+	}
+	id = GPOINTER_TO_UINT(g_hash_table_lookup(index->doc_ids, path)) - 1;
+	from = doc->indexed;
+	g_mutex_unlock(&index->lock);
+
+	buf = read_range(path, from, size, &len);
+	if (buf == NULL)
+		return;
+
+	/* Leave a partly written last line for the next update */
+	last_nl = g_strrstr_len(buf, len, "\n");
+	len = last_nl ? (gsize)(last_nl - buf + 1) : 0;
+
+	terms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                              (GDestroyNotify)g_array_unref);
+	tokenize(buf, len, format != LOG_FORMAT_TXT, from, collect_offset, terms);
+	g_free(buf);
+
+	g_mutex_lock(&index->lock);
+	add_postings(index, id, terms);
+	doc->indexed = from + len;
+	doc->mtime = mtime;
+	g_mutex_unlock(&index->lock);
+
+	g_hash_table_destroy(terms);
+
+	if (index->n_pending >= LOG_INDEX_FLUSH_POSTINGS)
+		flush_pending(index);
+}
+
+static gboolean
+sync_file_cb(const char *protocol, const char *account, const char *buddy,
+             const char *path, time_t time, LogFormat format, gpointer data)
+{
+	gpointer *args = data;
+	LogIndex *index = args[0];
+	GHashTable *seen = args[1];
+	LogWarmup *warmup = args[2];
+
+	index_file(index, path, time, format);
+	g_hash_table_add(seen, g_strdup(path));
+
+	if (warmup != NULL && !log_warmup_yield(warmup, args[3]))
+		return FALSE;
+	return !g_atomic_int_get(&index->quit);
+}
+
+static void
+sync_tree(LogIndex *index, const char *logdir, LogWarmup *warmup)
+{
+	GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	gint64 busy_since = 0;
+	gpointer args[4];
+	guint i;
+
+	args[0] = index;
+	args[1] = seen;
+	args[2] = warmup;
+	args[3] = &busy_since;
+	if (!log_file_walk(logdir, sync_file_cb, args)) {
+		g_hash_table_destroy(seen);
+		return;
+	}
+
+	g_mutex_lock(&index->lock);
+	for (i = 0; i < index->docs->len; i++) {
+		LogIndexDoc *doc = g_ptr_array_index(index->docs, i);
+
+		if (!doc->dead && !g_hash_table_contains(seen, doc->path)) {
+			doc->dead = TRUE;
+			g_hash_table_remove(index->doc_ids, doc->path);
+		}
+	}
+	index->complete = TRUE;
+	g_mutex_unlock(&index->lock);
+
+	g_hash_table_destroy(seen);
+	flush_pending(index);
+}
+
+static gpointer
+index_thread(gpointer data)
+{
+	LogIndex *index = data;
+	LogIndexJob *job;
+	gboolean running = TRUE;
+
+	while (running && (job = g_async_queue_pop(index->jobs)) != NULL) {
+		switch (job->type) {
+		case JOB_SYNC:
+			sync_tree(index, job->path, job->warmup);
+			break;
+		case JOB_UPDATE:
+		{
+			time_t time;
+			LogFormat format;
+			char *name = g_path_get_basename(job->path);
+
+			if (log_file_parse_name(name, &time, &format))
+				index_file(index, job->path, time, format);
+			g_free(name);
+
+			g_mutex_lock(&index->lock);
+			g_hash_table_remove(index->stale, job->path);
+			g_mutex_unlock(&index->lock);
+			break;
+		}
+		case JOB_QUIT:
+			flush_pending(index);
+			running = FALSE;
+			break;
+		}
+		g_free(job->path);
+		g_free(job);
+	}
+
+	return NULL;
+}
+
+static void
+push_job(LogIndex *index, LogIndexJobType type, const char *path)
+{
+	LogIndexJob *job = g_new0(LogIndexJob, 1);
+
+	job->type = type;
+	job->path = g_strdup(path);
+	g_async_queue_push(index->jobs, job);
+}
+
+LogIndex *
+log_index_open(const char *dir)
+{
+	LogIndex *index = g_new0(LogIndex, 1);
+
+	index->ref = 1;
+	index->dir = g_strdup(dir);
+	g_mutex_init(&index->lock);
+	index->docs = g_ptr_array_new_with_free_func((GDestroyNotify)doc_free);
+	index->doc_ids = g_hash_table_new(g_str_hash, g_str_equal);
+	index->segments = g_ptr_array_new_with_free_func((GDestroyNotify)segment_unref);
+	index->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                       (GDestroyNotify)g_array_unref);
+	index->stale = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	index->jobs = g_async_queue_new();
+
+	g_mkdir_with_parents(dir, 0700);
+	catalog_read(index);
+	remove_stale_files(index);
+
+	index->thread = g_thread_new("logindex", index_thread, index);
+
+	return index;
+}
+
+void
+log_index_close(LogIndex *index)
+{
+	if (index == NULL)
+		return;
+
+	g_atomic_int_set(&index->quit, 1);
+	push_job(index, JOB_QUIT, NULL);
+	g_thread_join(index->thread);
+
+	while (g_async_queue_length(index->jobs) > 0) {
+		LogIndexJob *job = g_async_queue_pop(index->jobs);
+		g_free(job->path);
+		g_free(job);
+	}
+	g_async_queue_unref(index->jobs);
+	index->jobs = NULL;
+
+	log_index_unref(index);
+}
+
+LogIndex *
+log_index_ref(LogIndex *index)
+{
+	g_atomic_int_inc(&index->ref);
+	return index;
+}
+
+void
+log_index_unref(LogIndex *index)
+{
+	if (index == NULL || !g_atomic_int_dec_and_test(&index->ref))
+		return;
+
+	g_hash_table_destroy(index->stale);
+	g_hash_table_destroy(index->pending);
+	g_ptr_array_free(index->segments, TRUE);
+	g_hash_table_destroy(index->doc_ids);
+	g_ptr_array_free(index->docs, TRUE);
+	g_mutex_clear(&index->lock);
+	g_free(index->dir);
+	g_free(index);
+}
+
+void
+log_index_sync(LogIndex *index, const char *logdir, LogWarmup *warmup)
+{
+	LogIndexJob *job = g_new0(LogIndexJob, 1);
+
+	job->type = JOB_SYNC;
+	job->path = g_strdup(logdir);
+	job->warmup = warmup;
+	g_async_queue_push(index->jobs, job);
+}
+
+void
+log_index_update_file(LogIndex *index, const char *path)
+{
+	g_mutex_lock(&index->lock);
+	g_hash_table_add(index->stale, g_strdup(path));
+	g_mutex_unlock(&index->lock);
+
+	push_job(index, JOB_UPDATE, path);
+}
+
+void
+log_index_remove_file(LogIndex *index, const char *path)
+{
+	guint id;
+
+	g_mutex_lock(&index->lock);
+	id = GPOINTER_TO_UINT(g_hash_table_lookup(index->doc_ids, path));
+	if (id != 0) {
+		LogIndexDoc *doc = g_ptr_array_index(index->docs, id - 1);
+
+		doc->dead = TRUE;
+		g_hash_table_remove(index->doc_ids, doc->path);
+	}
+	g_hash_table_remove(index->stale, path);
+	g_mutex_unlock(&index->lock);
+}
+
+gboolean
+log_index_is_ready(LogIndex *index)
+{
+	gboolean ready;
+
+	g_mutex_lock(&index->lock);
+	ready = index->complete;
+	g_mutex_unlock(&index->lock);
+
+	return ready;
+}
+
+/* Querying */
+
+typedef enum {
+	MATCH_EXACT,
+	MATCH_PREFIX,     /**< the query word starts the term   */
+	MATCH_SUFFIX,     /**< the query word ends the term     */
+	MATCH_ANYWHERE
+} MatchMode;
+
+typedef struct {
+	char       *word;
+	gsize       len;
+	MatchMode   mode;
+	GHashTable *docs;   /**< Ids of the docs it may be in */
+} QueryWord;
+
+static void
+collect_word(const char *term, gsize len, guint32 offset, gpointer data)
+{
+	GPtrArray *words = data;
+	QueryWord *w = g_new0(QueryWord, 1);
+
+	w->word = g_strndup(term, len);
+	w->len = len;
+	w->docs = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_ptr_array_add(words, w);
+}
+
+static void
+query_word_free(QueryWord *w)
+{
+	g_hash_table_destroy(w->docs);
+	g_free(w->word);
+	g_free(w);
+}
+
+/* Whether the word may be the part of term its mode asks for */
+static gboolean
+word_matches(const QueryWord *w, const char *term, gsize term_len)
+{
+	/* A term that was cut may have held the word further on */
+	gboolean cut = term_len >= LOG_INDEX_MAX_TERM;
+
+	switch (w->mode) {
+	case MATCH_EXACT:
+		return term_len == w->len && memcmp(term, w->word, w->len) == 0;
+	case MATCH_PREFIX:
+		return term_len >= w->len && memcmp(term, w->word, w->len) == 0;
+	case MATCH_SUFFIX:
+		return cut || (term_len >= w->len &&
+		               memcmp(term + term_len - w->len, w->word, w->len) == 0);
+	case MATCH_ANYWHERE:
+		return cut || strstr(term, w->word) != NULL;
+	}
+	return FALSE;
+}
+
+static void
+lookup_segment_term(QueryWord *w, const LogIndexSegment *seg, guint32 i)
+{
+	PostingReader r;
+
+	posting_reader_init(&r, seg, &seg->terms[i]);
+	while (posting_reader_next_doc(&r))
+		g_hash_table_add(w->docs, GUINT_TO_POINTER(r.doc));
+}
+
+static void
+lookup_segment(QueryWord *w, const LogIndexSegment *seg)
+{
+	guint32 lo = 0, hi = seg->n_terms, i;
+
+	if (w->mode == MATCH_SUFFIX || w->mode == MATCH_ANYWHERE) {
+		for (i = 0; i < seg->n_terms; i++)
+			if (word_matches(w, segment_term(seg, i), seg->terms[i].str_len))
+				lookup_segment_term(w, seg, i);
+		return;
+	}
+
+	/* Exact and prefix matches form a range of the sorted term table */
+	while (lo < hi) {
+		guint32 mid = lo + (hi - lo) / 2;
+
+		if (strcmp(segment_term(seg, mid), w->word) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (i = lo; i < seg->n_terms; i++) {
+		if (strncmp(segment_term(seg, i), w->word, w->len) != 0)
+			break;
+		if (word_matches(w, segment_term(seg, i), seg->terms[i].str_len))
+			lookup_segment_term(w, seg, i);
+	}
+}
+
+static void
+lookup_pending(QueryWord *w, GHashTable *pending)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&iter, pending);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		GArray *postings = value;
+		guint i;
+
+		if (!word_matches(w, key, strlen(key)))
+			continue;
+		for (i = 0; i < postings->len; i++)
+			g_hash_table_add(w->docs, GUINT_TO_POINTER(
+				g_array_index(postings, LogIndexPosting, i).doc));
+	}
+}
+
+static void
+add_hit(GPtrArray *hits, const char *path, time_t time)
+{
+	LogIndexHit *hit = g_new0(LogIndexHit, 1);
+
+	hit->path = g_strdup(path);
+	hit->time = time;
+	g_ptr_array_add(hits, hit);
+}
+
+GPtrArray *
+log_index_query(LogIndex *index, const char *text)
+{
+	GPtrArray *words, *segments, *hits = NULL;
+	GHashTable *found;
+	GHashTableIter iter;
+	gpointer key;
+	QueryWord *first;
+	guint i;
+
+	words = g_ptr_array_new_with_free_func((GDestroyNotify)query_word_free);
+	tokenize(text, strlen(text), FALSE, 0, collect_word, words);
+	if (words->len == 0)
+		goto out;
+
+	for (i = 0; i < words->len; i++) {
+		QueryWord *w = g_ptr_array_index(words, i);
+
+		/* A word that got cut in the index can not be looked up */
+		if (w->len >= LOG_INDEX_MAX_TERM)
+			goto out;
+
+		/* The ends of the text may be parts of longer words */
+		if (words->len == 1)
+			w->mode = MATCH_ANYWHERE;
+		else if (i == 0)
+			w->mode = MATCH_SUFFIX;
+		else if (i == words->len - 1)
+			w->mode = MATCH_PREFIX;
+		else
+			w->mode = MATCH_EXACT;
+	}
+
+	g_mutex_lock(&index->lock);
+	if (!index->complete) {
+		g_mutex_unlock(&index->lock);
+		goto out;
+	}
+
+	segments = g_ptr_array_new_with_free_func((GDestroyNotify)segment_unref);
+	for (i = 0; i < index->segments->len; i++)
+		g_ptr_array_add(segments, segment_ref(g_ptr_array_index(index->segments, i)));
+	for (i = 0; i < words->len; i++) {
+		QueryWord *w = g_ptr_array_index(words, i);
+
+		lookup_pending(w, index->pending);
+		if (index->flushing != NULL)
+			lookup_pending(w, index->flushing);
+	}
+	g_mutex_unlock(&index->lock);
+
+	/* Their term tables are searched without holding up the index thread */
+	for (i = 0; i < words->len; i++) {
+		QueryWord *w = g_ptr_array_index(words, i);
+		guint j;
+
+		for (j = 0; j < segments->len; j++)
+			lookup_segment(w, g_ptr_array_index(segments, j));
+	}
+	g_ptr_array_free(segments, TRUE);
+
+	/* A log may hold the text only if it has every one of its words */
+	g_mutex_lock(&index->lock);
+	hits = g_ptr_array_new_with_free_func((GDestroyNotify)log_index_hit_free);
+	found = g_hash_table_new(g_str_hash, g_str_equal);
+	first = g_ptr_array_index(words, 0);
+	g_hash_table_iter_init(&iter, first->docs);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		guint32 doc = GPOINTER_TO_UINT(key);
+		LogIndexDoc *d;
+
+		if (doc >= index->docs->len)
+			continue;
+		d = g_ptr_array_index(index->docs, doc);
+		if (d->dead)
+			continue;
+
+		for (i = 1; i < words->len; i++)
+			if (!g_hash_table_contains(
+			        ((QueryWord *)g_ptr_array_index(words, i))->docs, key))
+				break;
+		if (i < words->len)
+			continue;
+
+		add_hit(hits, d->path, d->time);
+		g_hash_table_add(found, d->path);
+	}
+
+	/* What was written since it was indexed has not been looked at */
+	g_hash_table_iter_init(&iter, index->stale);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		char *name = g_path_get_basename(key);
+		time_t time;
+
+		if (!g_hash_table_contains(found, key) &&
+		    log_file_parse_name(name, &time, NULL))
+			add_hit(hits, key, time);
+		g_free(name);
+	}
+	g_hash_table_destroy(found);
+	g_mutex_unlock(&index->lock);
+
+out:
+	g_ptr_array_free(words, TRUE);
+	return hits;
+}
+
+void
+log_index_hit_free(LogIndexHit *hit)
+{
+	g_free(hit->path);
+	g_free(hit);
+}
@@ -0,0 +1,71 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGINDEX_H_
+#define _LOGVIEWER_LOGINDEX_H_
+
+#include <time.h>
+#include <glib.h>
+
+#include "logwarmup.h"
+
+typedef struct _LogIndex LogIndex;
+typedef struct _LogIndexHit LogIndexHit;
+
+struct _LogIndexHit {
+	char    *path;     /**< A log file the text may be in              */
+	time_t   time;     /**< When the conversation in that file started */
+};
+
+/**
+ * Opens (or creates) the on-disk word index kept in dir.  All writing is done
+ * by a worker thread owned by the index; the other calls may be made from the
+ * main thread at any time.
+ */
+LogIndex *log_index_open(const char *dir);
+
+/**
+ * Stops the worker, writes out anything not yet on disk and drops the
+ * reference.  Those still holding one may go on querying what is there.
+ */
+void log_index_close(LogIndex *index);
+
+LogIndex *log_index_ref(LogIndex *index);
+
+void log_index_unref(LogIndex *index);
+
+/**
+ * Brings the index up to date with the log tree under logdir in the
+ * background: new logs are indexed, grown logs have their new tail indexed
+ * and vanished logs are dropped.  The work yields to warmup between logs,
+ * if it is given.
+ */
+void log_index_sync(LogIndex *index, const char *logdir, LogWarmup *warmup);
+
+/**
+ * Indexes whatever has been appended to path since it was last indexed.
+ * Until then, path is among the logs any query may be in.
+ */
+void log_index_update_file(LogIndex *index, const char *path);
+
+/** Forgets a log that has been deleted. */
+void log_index_remove_file(LogIndex *index, const char *path);
+
+/** Whether the index has covered the whole log tree at least once. */
+gboolean log_index_is_ready(LogIndex *index);
+
+/**
+ * The logs text may be in, as LogSearch matches it: those with every word of
+ * text, the first and last of which may be parts of longer words.  Every log
+ * text is in is among them, but not every one of them holds text, so each
+ * has to be read to be sure.  Returns a GPtrArray of LogIndexHit (owning
+ * them), or NULL when the index is not ready or text has no word it can look
+ * up, and every log has to be read.
+ */
+GPtrArray *log_index_query(LogIndex *index, const char *text);
+
+void log_index_hit_free(LogIndexHit *hit);
+
+#endif /* _LOGVIEWER_LOGINDEX_H_ */
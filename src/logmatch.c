@@ -0,0 +1,918 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+/*
+ * Every word and phrase of the query goes into one Aho-Corasick automaton,
+ * built out into a full table over case-folded bytes, and the log is fed
+ * through it one text byte at a time, with tags dropped and entities decoded
+ * as they come.  Almost all of a log leaves the automaton in its start
+ * state, and from there only a byte that starts some term, a '<' or a '&'
+ * can change anything.  So while in the start state the bytes are skipped
+ * sixteen or thirty-two at a time with SSE2 or AVX2, picked at run time, or
+ * one at a time where neither is available or there are too many such bytes.
+ *
+ * A fuzzy term, one allowed k edits, is split into k+1 pieces, at least one
+ * of which is in any text near enough to it.  The pieces go into the
+ * automaton like terms of their own, so the skipping carries on as before,
+ * and only around a piece is the text run through a bit-parallel matcher
+ * for the whole term (Wu and Manber's, one word of state per edit allowed).
+ */
+
+#include <string.h>
+
+#include "logmatch.h"
+#include "logquery.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LOGMATCH_X86 1
+#include <immintrin.h>
+#endif
+
+#define MAX_STATES      G_MAXUINT16
+#define MAX_VECTOR_STOPS 8
+#define RECENT          256     /* text bytes whose place in the log is kept */
+
+/* The text a fuzzy term may start in before the end of one of its pieces */
+#define FUZZY_REACH     (LOG_QUERY_MAX_FUZZY_LEN + LOG_QUERY_MAX_FUZZ)
+#define SPANS           128     /* skipped runs of text kept, more than reach */
+
+typedef struct _StopSet StopSet;
+
+/* Finds the first byte of the set in [p, end), or returns end */
+typedef const char *(*SkipFunc)(const char *p, const char *end, const StopSet *set);
+
+struct _StopSet {
+	guint8   table[256];              /**< Non-zero for bytes in the set   */
+	guint8   bytes[MAX_VECTOR_STOPS];
+	guint    n_bytes;                 /**< Only counted up to the above    */
+	SkipFunc skip;
+};
+
+typedef struct {
+	guint64   bit;        /**< The term's bit                             */
+	guint     len;        /**< Bytes in its text                          */
+	guint     k;          /**< Edits allowed                              */
+	guint64   masks[256]; /**< For each byte, the places in the text it is */
+	guint64   rmasks[256]; /**< The same for the text backwards           */
+} FuzzyTerm;
+
+struct _LogMatcher {
+	LogQuery *query;
+	guint16  *delta;      /**< n_states rows of 256 next states         */
+	guint64  *out;        /**< The terms found on reaching each state   */
+	guint64  *pieces;     /**< The fuzzy terms a piece of ends in each,
+	                           by their place in fuzzy                   */
+	guint     n_states;
+	FuzzyTerm *fuzzy;
+	guint     n_fuzzy;
+	guint64   text_terms; /**< Bits of the terms looked for in the text */
+	guint     term_len[LOG_QUERY_MAX_TERMS]; /**< Text bytes of each term */
+	guint64   with_terms;
+	gboolean  monotone;
+	StopSet   html_stops;
+	StopSet   text_stops;
+};
+
+/* Text the automaton skipped, which is not in Run's text and recent */
+typedef struct {
+	const char *p;
+	guint       fed;    /**< The count of text bytes it starts at */
+	guint       len;
+} Span;
+
+typedef struct {
+	const LogMatcher *m;
+	guint             state;
+	guint64           found;  /**< Terms seen so far, with: ones included */
+
+	/* Only for log_matcher_match_positions() */
+	GArray           *positions;
+	const char       *buf;
+	const char       *unit_end;       /**< End of an entity or tag being fed */
+	guint32           recent[RECENT]; /**< Where the last text bytes came from */
+
+	guint             fed;            /**< Text bytes fed or skipped so far */
+
+	/* Only for fuzzy terms */
+	guint8            text[RECENT];   /**< The last text bytes fed */
+	Span              spans[SPANS];
+	guint             n_spans;        /**< Ever skipped */
+	guint64           following;      /**< The fuzzy terms being matched */
+	guint64           hit;            /**< Those found at the last byte */
+	guint             hit_last[LOG_QUERY_MAX_TERMS]; /**< The text byte it was */
+	guint32           hit_end[LOG_QUERY_MAX_TERMS];  /**< Where that ended */
+	guint             until[LOG_QUERY_MAX_TERMS]; /**< Till fed reaches this */
+	guint64           bitap[LOG_QUERY_MAX_TERMS][LOG_QUERY_MAX_FUZZ + 1];
+} Run;
+
+static const char *
+skip_scalar(const char *p, const char *end, const StopSet *set)
+{
+	while (p < end && !set->table[(guint8)*p])
+		p++;
+	return p;
+}
+
+#ifdef LOGMATCH_X86
+__attribute__((target("sse2")))
+static const char *
+skip_sse2(const char *p, const char *end, const StopSet *set)
+{
+	__m128i stops[MAX_VECTOR_STOPS];
+	guint i;
+
+	for (i = 0; i < set->n_bytes; i++)
+		stops[i] = _mm_set1_epi8(set->bytes[i]);
+
+	while (end - p >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)p);
+		__m128i hit = _mm_cmpeq_epi8(x, stops[0]);
+		int mask;
+
+		for (i = 1; i < set->n_bytes; i++)
+			hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, stops[i]));
+		if ((mask = _mm_movemask_epi8(hit)) != 0)
+			return p + __builtin_ctz(mask);
+		p += 16;
+	}
+	return skip_scalar(p, end, set);
+}
+
+__attribute__((target("avx2")))
+static const char *
+skip_avx2(const char *p, const char *end, const StopSet *set)
+{
+	__m256i stops[MAX_VECTOR_STOPS];
+	guint i;
+
+	for (i = 0; i < set->n_bytes; i++)
+		stops[i] = _mm256_set1_epi8(set->bytes[i]);
+
+	while (end - p >= 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)p);
+		__m256i hit = _mm256_cmpeq_epi8(x, stops[0]);
+		unsigned int mask;
+
+		for (i = 1; i < set->n_bytes; i++)
+			hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, stops[i]));
+		if ((mask = _mm256_movemask_epi8(hit)) != 0)
+			return p + __builtin_ctz(mask);
+		p += 32;
+	}
+	return skip_sse2(p, end, set);
+}
+#endif
+
+static SkipFunc
+pick_skip(void)
+{
+#ifdef LOGMATCH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return skip_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return skip_sse2;
+#endif
+	return skip_scalar;
+}
+
+static void
+stop_set_add(StopSet *set, guint8 c)
+{
+	if (set->table[c])
+		return;
+	set->table[c] = 1;
+	if (set->n_bytes < MAX_VECTOR_STOPS)
+		set->bytes[set->n_bytes] = c;
+	set->n_bytes++;
+}
+
+/* The bytes that move the automaton out of its start state, and extra */
+static void
+stop_set_init(StopSet *set, const LogMatcher *m, const char *extra, SkipFunc vector)
+{
+	guint c;
+
+	memset(set, 0, sizeof(*set));
+	for (c = 0; c < 256; c++)
+		if (m->delta[c] != 0)
+			stop_set_add(set, c);
+	for (; *extra != '\0'; extra++)
+		stop_set_add(set, *extra);
+
+	set->skip = set->n_bytes > 0 && set->n_bytes <= MAX_VECTOR_STOPS ?
+	            vector : skip_scalar;
+}
+
+/* Adds len bytes at p to the trie, returning the state they lead to */
+static guint
+add_string(LogMatcher *m, const guint8 *p, gsize len)
+{
+	guint s = 0;
+
+	for (; len > 0; p++, len--) {
+		if (m->delta[s * 256 + *p] == 0)
+			m->delta[s * 256 + *p] = m->n_states++;
+		s = m->delta[s * 256 + *p];
+	}
+	return s;
+}
+
+/* Adds the pieces of term i, which is fuzzy, and its matcher's masks */
+static void
+add_fuzzy(LogMatcher *m, const LogQueryTerm *term, guint i)
+{
+	FuzzyTerm *f = &m->fuzzy[m->n_fuzzy];
+	const guint8 *text = (const guint8 *)term->text;
+	guint j, start = 0;
+
+	f->bit = G_GUINT64_CONSTANT(1) << i;
+	f->len = m->term_len[i];
+	f->k = term->fuzz;
+	for (j = 0; j < f->len; j++) {
+		guint8 upper = g_ascii_toupper(text[j]);
+
+		f->masks[text[j]] |= G_GUINT64_CONSTANT(1) << j;
+		f->masks[upper] |= G_GUINT64_CONSTANT(1) << j;
+		f->rmasks[text[j]] |= G_GUINT64_CONSTANT(1) << (f->len - 1 - j);
+		f->rmasks[upper] |= G_GUINT64_CONSTANT(1) << (f->len - 1 - j);
+	}
+
+	/* k edits leave at least one of k+1 pieces whole */
+	for (j = 1; j <= f->k + 1; j++) {
+		guint end = f->len * j / (f->k + 1);
+		guint s = add_string(m, text + start, end - start);
+
+		m->pieces[s] |= G_GUINT64_CONSTANT(1) << m->n_fuzzy;
+		start = end;
+	}
+	m->n_fuzzy++;
+}
+
+/* Builds the automaton from the words and phrases of the query */
+static gboolean
+build_automaton(LogMatcher *m)
+{
+	guint n_terms = log_query_get_n_terms(m->query);
+	guint *fail, *queue, head = 0, tail = 0;
+	guint i, s, c;
+	gsize states = 1;
+
+	for (i = 0; i < n_terms; i++) {
+		const LogQueryTerm *term = log_query_get_term(m->query, i);
+
+		if (term->kind == LOG_QUERY_WITH)
+			m->with_terms |= G_GUINT64_CONSTANT(1) << i;
+		else
+			states += m->term_len[i] = strlen(term->text);
+		if (term->fuzz > 0)
+			m->n_fuzzy++;
+	}
+	if (states > MAX_STATES)
+		return FALSE;
+
+	m->delta = g_new0(guint16, states * 256);
+	m->out = g_new0(guint64, states);
+	m->pieces = g_new0(guint64, states);
+	m->fuzzy = g_new0(FuzzyTerm, m->n_fuzzy);
+	m->n_states = 1;
+	m->n_fuzzy = 0;
+
+	/* The trie; 0 means no edge, as nothing leads back to the root */
+	for (i = 0; i < n_terms; i++) {
+		const LogQueryTerm *term = log_query_get_term(m->query, i);
+
+		if (term->kind == LOG_QUERY_WITH)
+			continue;
+		m->text_terms |= G_GUINT64_CONSTANT(1) << i;
+		if (term->fuzz > 0) {
+			add_fuzzy(m, term, i);
+			continue;
+		}
+
+		s = add_string(m, (const guint8 *)term->text, m->term_len[i]);
+		m->out[s] |= G_GUINT64_CONSTANT(1) << i;
+	}
+
+	/* Failure links, breadth first, filling in the missing edges as we go */
+	fail = g_new0(guint, m->n_states);
+	queue = g_new(guint, m->n_states);
+	queue[tail++] = 0;
+	while (head < tail) {
+		guint r = queue[head++];
+
+		for (c = 0; c < 256; c++) {
+			guint u = m->delta[r * 256 + c];
+
+			if (u != 0) {
+				fail[u] = r == 0 ? 0 : m->delta[fail[r] * 256 + c];
+				m->out[u] |= m->out[fail[u]];
+				m->pieces[u] |= m->pieces[fail[u]];
+				queue[tail++] = u;
+			} else if (r != 0) {
+				m->delta[r * 256 + c] = m->delta[fail[r] * 256 + c];
+			}
+		}
+	}
+	g_free(queue);
+	g_free(fail);
+
+	/* The terms are in lower case; take capitals the same way */
+	for (s = 0; s < m->n_states; s++)
+		for (c = 'A'; c <= 'Z'; c++)
+			m->delta[s * 256 + c] = m->delta[s * 256 + c - 'A' + 'a'];
+
+	return TRUE;
+}
+
+LogMatcher *
+log_matcher_new(const char *query)
+{
+	static gsize vector = 0;
+	LogMatcher *m;
+	LogQuery *q;
+
+	if (g_once_init_enter(&vector))
+		g_once_init_leave(&vector, (gsize)pick_skip());
+
+	if ((q = log_query_parse(query)) == NULL)
+		return NULL;
+
+	m = g_new0(LogMatcher, 1);
+	m->query = q;
+	m->monotone = log_query_is_monotone(q);
+	if (!build_automaton(m)) {
+		log_matcher_free(m);
+		return NULL;
+	}
+	stop_set_init(&m->html_stops, m, "<&", (SkipFunc)vector);
+	stop_set_init(&m->text_stops, m, "", (SkipFunc)vector);
+
+	return m;
+}
+
+void
+log_matcher_free(LogMatcher *matcher)
+{
+	if (matcher == NULL)
+		return;
+	log_query_free(matcher->query);
+	g_free(matcher->delta);
+	g_free(matcher->out);
+	g_free(matcher->pieces);
+	g_free(matcher->fuzzy);
+	g_free(matcher);
+}
+
+gboolean
+log_matcher_wants_buddy(const LogMatcher *matcher)
+{
+	return matcher->with_terms != 0;
+}
+
+/* Whether reading on can still change the outcome, or add a position */
+static gboolean
+settled(const Run *run)
+{
+	const LogMatcher *m = run->m;
+
+	if (run->positions != NULL && run->positions->len < LOG_MATCH_MAX_POSITIONS)
+		return FALSE;
+	if ((run->found & m->text_terms) == m->text_terms)
+		return TRUE;
+	return m->monotone && log_query_eval(m->query, run->found);
+}
+
+/* Keeps where the text in [p, end) was, which the automaton skipped */
+static inline void
+note_skipped(Run *run, const char *p, const char *end)
+{
+	Span *span;
+
+	if (p == end)
+		return;
+	span = &run->spans[run->n_spans++ % SPANS];
+	span->p = p;
+	span->fed = run->fed;
+	span->len = end - p;
+	run->fed += span->len;
+}
+
+/* Where text byte i, one of the last FUZZY_REACH, is in the log if it was skipped */
+static const char *
+skipped_at(const Run *run, guint i)
+{
+	guint n;
+
+	for (n = run->n_spans; n > 0 && run->n_spans - n < SPANS; n--) {
+		const Span *span = &run->spans[(n - 1) % SPANS];
+
+		if (i >= span->fed + span->len)
+			break;
+		if (i >= span->fed)
+			return span->p + (i - span->fed);
+	}
+	return NULL;
+}
+
+/* Where text byte i, one of the last RECENT, came from in the log */
+static guint32
+text_offset(const Run *run, guint i)
+{
+	const char *skipped = run->m->n_fuzzy > 0 ? skipped_at(run, i) : NULL;
+
+	return skipped != NULL ? skipped - run->buf : run->recent[i % RECENT];
+}
+
+/* Notes where the terms in out, which end with the byte at unit, start */
+static void
+add_positions(Run *run, guint64 out, const char *unit)
+{
+	const char *end = run->unit_end != NULL ? run->unit_end : unit + 1;
+	guint i;
+
+	for (i = 0; out != 0 && run->positions->len < LOG_MATCH_MAX_POSITIONS;
+	     i++, out >>= 1) {
+		guint back = MIN(MIN(run->m->term_len[i], run->fed), RECENT);
+		LogMatchPos pos;
+
+		if (!(out & 1))
+			continue;
+		pos.offset = text_offset(run, run->fed - back);
+		pos.len = end - run->buf - pos.offset;
+		pos.line = 0;
+		g_array_append_val(run->positions, pos);
+	}
+}
+
+/* Starts the matcher of fuzzy term f afresh */
+static void
+bitap_reset(const FuzzyTerm *f, guint64 *r)
+{
+	guint d;
+
+	/* Up to d bytes of the term can be left out before any text */
+	for (d = 0; d <= f->k; d++)
+		r[d] = (G_GUINT64_CONSTANT(1) << d) - 1;
+}
+
+/*
+ * Moves the matcher of f on by the text byte c.  Bit j of r[d] is set when
+ * the first j+1 bytes of the term end here with at most d edits; with
+ * rmasks and the text backwards, the last j+1 bytes start here.
+ */
+static inline gboolean
+bitap_step(const FuzzyTerm *f, const guint64 *masks, guint64 *r, guint8 c)
+{
+	guint64 mask = masks[c], prev = r[0], next;
+	guint d;
+
+	r[0] = ((r[0] << 1) | 1) & mask;
+	for (d = 1; d <= f->k; d++) {
+		/* Matched, changed, put in or left out */
+		next = (((r[d] << 1) | 1) & mask) | ((prev | r[d - 1]) << 1) | prev | 1;
+		prev = r[d];
+		r[d] = next;
+	}
+	return (r[f->k] >> (f->len - 1)) & 1;
+}
+
+/* Text byte i, one of the last FUZZY_REACH */
+static guint8
+text_at(const Run *run, guint i)
+{
+	const char *skipped = skipped_at(run, i);
+
+	return skipped != NULL ? *skipped : run->text[i % RECENT];
+}
+
+/*
+ * Notes where fuzzy term i is, last found ending at text byte hit_last:
+ * matched backwards from there, it starts as far back as the fewest edits
+ * allow
+ */
+static void
+add_fuzzy_position(Run *run, guint i)
+{
+	const FuzzyTerm *f = &run->m->fuzzy[i];
+	guint last = run->hit_last[i], start = last, best = f->k + 1, j, d;
+	guint64 r[LOG_QUERY_MAX_FUZZ + 1];
+	LogMatchPos pos;
+
+	if (run->positions->len >= LOG_MATCH_MAX_POSITIONS)
+		return;
+
+	bitap_reset(f, r);
+	for (j = 0; j <= last && j < f->len + f->k && best > 0; j++) {
+		bitap_step(f, f->rmasks, r, text_at(run, last - j));
+		for (d = 0; d <= MIN(best, f->k); d++) {
+			if ((r[d] >> (f->len - 1)) & 1) {
+				best = d;
+				start = last - j;
+				break;
+			}
+		}
+	}
+
+	pos.offset = text_offset(run, start);
+	pos.len = run->hit_end[i] - pos.offset;
+	pos.line = 0;
+	g_array_append_val(run->positions, pos);
+}
+
+/*
+ * Runs the matchers of the fuzzy terms near a piece of them over the text
+ * byte just fed, which came from the log at unit, starting one from the
+ * text before the piece that could be part of its term; returns the terms
+ * found
+ */
+static guint64
+follow_fuzzy(Run *run, const char *unit)
+{
+	const LogMatcher *m = run->m;
+	guint64 pieces = m->pieces[run->state], found = 0;
+	guint i, j;
+
+	for (i = 0; i < m->n_fuzzy; i++) {
+		const FuzzyTerm *f = &m->fuzzy[i];
+		guint64 bit = G_GUINT64_CONSTANT(1) << i;
+		guint64 *r = run->bitap[i];
+
+		if (pieces & bit) {
+			if (!(run->following & bit)) {
+				guint back = MIN(run->fed - 1, f->len + f->k);
+
+				bitap_reset(f, r);
+				for (j = run->fed - 1 - back; j < run->fed - 1; j++)
+					bitap_step(f, f->masks, r, text_at(run, j));
+				run->following |= bit;
+				run->hit &= ~bit;
+			}
+			/* The rest of the term, with as much put in as allowed */
+			run->until[i] = run->fed + f->len + f->k;
+		}
+		if (!(run->following & bit))
+			continue;
+		/*
+		 * A match is also one at the next few bytes; its place is noted
+		 * from the last of them, which took in the most of it
+		 */
+		if (bitap_step(f, f->masks, r, run->text[(run->fed - 1) % RECENT])) {
+			found |= f->bit;
+			run->hit |= bit;
+			run->hit_last[i] = run->fed - 1;
+			run->hit_end[i] = (run->unit_end != NULL ? run->unit_end : unit + 1) -
+			                  run->buf;
+		} else if (run->hit & bit) {
+			run->hit &= ~bit;
+			if (run->positions != NULL)
+				add_fuzzy_position(run, i);
+		}
+		if (run->fed >= run->until[i]) {
+			run->following &= ~bit;
+			if ((run->hit & bit) && run->positions != NULL)
+				add_fuzzy_position(run, i);
+			run->hit &= ~bit;
+		}
+	}
+	return found;
+}
+
+/*
+ * Feeds one text byte, which came from the log at unit, through the
+ * automaton; TRUE once the outcome is known
+ */
+static inline gboolean
+feed(Run *run, guint8 c, const char *unit)
+{
+	const LogMatcher *m = run->m;
+	guint64 out;
+
+	run->state = m->delta[run->state * 256 + c];
+	out = m->out[run->state];
+	if (m->n_fuzzy > 0)
+		run->text[run->fed % RECENT] = c;
+	if (m->n_fuzzy > 0 || run->positions != NULL)
+		run->recent[run->fed++ % RECENT] = unit - run->buf;
+	if (out != 0 && run->positions != NULL)
+		add_positions(run, out, unit);
+	if (m->n_fuzzy > 0 && (run->following != 0 || m->pieces[run->state] != 0))
+		out |= follow_fuzzy(run, unit);
+	if ((out &= ~run->found) == 0)
+		return FALSE;
+	run->found |= out;
+	return settled(run);
+}
+
+static gboolean
+feed_str(Run *run, const char *s, gsize len, const char *unit)
+{
+	gsize i;
+
+	for (i = 0; i < len; i++)
+		if (feed(run, s[i], unit))
+			return TRUE;
+	return FALSE;
+}
+
+static gboolean
+feed_entity(Run *run, const char *name, gsize len)
+{
+	char text[8];
+
+	return feed_str(run, text, log_file_decode_entity(name, len, text), name - 1);
+}
+
+static void
+match_html(Run *run, const char *p, const char *end)
+{
+	const StopSet *stops = &run->m->html_stops;
+
+	while (p < end) {
+		const char *stop;
+
+		if (run->state == 0 && run->following == 0) {
+			const char *from = p;
+
+			p = stops->skip(p, end, stops);
+			if (run->m->n_fuzzy > 0)
+				note_skipped(run, from, p);
+			if (p == end)
+				break;
+		}
+
+		if (*p == '<') {
+			if ((stop = memchr(p, '>', end - p)) == NULL)
+				return;
+			run->unit_end = stop + 1;
+			if (end - p >= 3 && g_ascii_strncasecmp(p, "<br", 3) == 0 &&
+			    feed(run, '\n', p))
+				return;
+			run->unit_end = NULL;
+			p = stop + 1;
+		} else if (*p == '&' &&
+		           (stop = memchr(p, ';', MIN(end - p, 10))) != NULL) {
+			run->unit_end = stop + 1;
+			if (feed_entity(run, p + 1, stop - p - 1))
+				return;
+			run->unit_end = NULL;
+			p = stop + 1;
+		} else {
+			if (feed(run, *p, p))
+				return;
+			p++;
+		}
+	}
+}
+
+static void
+match_text(Run *run, const char *p, const char *end)
+{
+	const StopSet *stops = &run->m->text_stops;
+
+	while (p < end) {
+		if (run->state == 0 && run->following == 0) {
+			const char *from = p;
+
+			p = stops->skip(p, end, stops);
+			if (run->m->n_fuzzy > 0)
+				note_skipped(run, from, p);
+			if (p == end)
+				break;
+		}
+		if (feed(run, *p, p))
+			return;
+		p++;
+	}
+}
+
+/* Whether haystack contains needle, which is in lower case, ignoring ASCII case */
+static gboolean
+contains_folded(const char *haystack, const char *needle)
+{
+	gsize n = strlen(needle);
+
+	for (; *haystack != '\0'; haystack++)
+		if (g_ascii_strncasecmp(haystack, needle, n) == 0)
+			return TRUE;
+	return n == 0;
+}
+
+/* The with: terms that buddy satisfies */
+static guint64
+with_found(const LogMatcher *matcher, const char *buddy)
+{
+	guint64 found = 0;
+	guint i;
+
+	if (matcher->with_terms == 0 || buddy == NULL)
+		return 0;
+
+	for (i = 0; i < log_query_get_n_terms(matcher->query); i++) {
+		const LogQueryTerm *term = log_query_get_term(matcher->query, i);
+
+		if (term->kind == LOG_QUERY_WITH && contains_folded(buddy, term->text))
+			found |= G_GUINT64_CONSTANT(1) << i;
+	}
+	return found;
+}
+
+gboolean
+log_matcher_may_match(const LogMatcher *matcher, const char *buddy)
+{
+	/* Could it match if every word turned up? */
+	return !matcher->monotone ||
+	       log_query_eval(matcher->query, with_found(matcher, buddy) | matcher->text_terms);
+}
+
+/* Matches, noting positions as well if they are given */
+static gboolean
+match(const LogMatcher *matcher, const char *buddy, const char *buf, gsize len,
+      LogFormat format, GArray *positions)
+{
+	Run run;
+	guint i;
+
+	run.m = matcher;
+	run.state = 0;
+	run.found = with_found(matcher, buddy);
+	run.positions = positions;
+	run.buf = buf;
+	run.unit_end = NULL;
+	run.fed = 0;
+	run.following = 0;
+	run.n_spans = 0;
+	run.hit = 0;
+
+	/* Not even every word turning up would do, so do not read the log */
+	if (matcher->monotone &&
+	    !log_query_eval(matcher->query, run.found | matcher->text_terms))
+		return FALSE;
+
+	if (matcher->text_terms != 0 && !settled(&run)) {
+		if (format == LOG_FORMAT_HTML)
+			match_html(&run, buf, buf + len);
+		else
+			match_text(&run, buf, buf + len);
+	}
+
+	/* Fuzzy terms found at the very end */
+	for (i = 0; positions != NULL && i < matcher->n_fuzzy; i++)
+		if (run.hit & (G_GUINT64_CONSTANT(1) << i))
+			add_fuzzy_position(&run, i);
+
+	return log_query_eval(matcher->query, run.found);
+}
+
+gboolean
+log_matcher_match(const LogMatcher *matcher, const char *buddy,
+                  const char *buf, gsize len, LogFormat format)
+{
+	return match(matcher, buddy, buf, len, format, NULL);
+}
+
+static gint
+position_compare(gconstpointer a, gconstpointer b)
+{
+	const LogMatchPos *p1 = a, *p2 = b;
+
+	return p1->offset < p2->offset ? -1 : p1->offset > p2->offset;
+}
+
+gboolean
+log_matcher_match_positions(const LogMatcher *matcher, const char *buddy,
+                            const char *buf, gsize len, LogFormat format,
+                            GArray *positions)
+{
+	const char *p = buf, *nl;
+	guint32 line = 0;
+	guint i;
+
+	g_array_set_size(positions, 0);
+	if (!match(matcher, buddy, buf, len, format, positions)) {
+		g_array_set_size(positions, 0);
+		return FALSE;
+	}
+
+	/* Terms are noted where they end; a longer one may start earlier */
+	g_array_sort(positions, position_compare);
+	for (i = 0; i < positions->len; i++) {
+		LogMatchPos *pos = &g_array_index(positions, LogMatchPos, i);
+
+		while ((nl = memchr(p, '\n', buf + pos->offset - p)) != NULL) {
+			p = nl + 1;
+			line++;
+		}
+		p = buf + pos->offset;
+		pos->line = line;
+	}
+	return TRUE;
+}
+
+/* Snippets */
+
+#define SNIPPET_BEFORE  30      /* characters shown before the match */
+#define SNIPPET_AFTER   60      /* and after it */
+#define SNIPPET_REACH   512     /* bytes looked at on either side */
+
+static void
+append_space(GString *out)
+{
+	if (out->len == 0 || out->str[out->len - 1] != ' ')
+		g_string_append_c(out, ' ');
+}
+
+/* The text the viewer shows for [p, end), with space run together */
+static char *
+visible_text(const char *p, const char *end, LogFormat format)
+{
+	GString *out = g_string_sized_new(end - p);
+	const char *stop;
+	char text[8];
+	gsize len;
+
+	while (p < end) {
+		if (format == LOG_FORMAT_HTML && *p == '<') {
+			if ((stop = memchr(p, '>', end - p)) == NULL)
+				break;
+			if (g_ascii_strncasecmp(p, "<br", MIN(3, end - p)) == 0)
+				append_space(out);
+			p = stop + 1;
+		} else if (format == LOG_FORMAT_HTML && *p == '&' &&
+		           (stop = memchr(p, ';', MIN(end - p, 10))) != NULL &&
+		           (len = log_file_decode_entity(p + 1, stop - p - 1, text)) > 0) {
+			if (g_ascii_isspace(*text))
+				append_space(out);
+			else
+				g_string_append_len(out, text, len);
+			p = stop + 1;
+		} else if (g_ascii_isspace(*p)) {
+			append_space(out);
+			p++;
+		} else {
+			g_string_append_c(out, *p++);
+		}
+	}
+
+	if (!g_utf8_validate(out->str, out->len, NULL)) {
+		char *valid = log_file_salvage_utf8(out->str, out->len);
+
+		g_string_free(out, TRUE);
+		return valid;
+	}
+	return g_string_free(out, FALSE);
+}
+
+char *
+log_matcher_snippet(const char *buf, gsize len, LogFormat format,
+                    const LogMatchPos *pos)
+{
+	const char *match = buf + MIN(pos->offset, len);
+	const char *match_end = buf + MIN((gsize)pos->offset + pos->len, len);
+	const char *from = match, *to = match_end, *gt;
+	char *before, *text, *after, *cut, *snippet;
+	gchar *e1, *e2, *e3;
+	glong n;
+
+	/* The line the match is on, or as much of it as is near */
+	while (from > buf && match - from < SNIPPET_REACH && from[-1] != '\n')
+		from--;
+	while (to < buf + len && to - match_end < SNIPPET_REACH && *to != '\n')
+		to++;
+	if (format == LOG_FORMAT_HTML && from > buf && from[-1] != '\n' &&
+	    (gt = memchr(from, '>', match - from)) != NULL &&
+	    memchr(from, '<', gt - from) == NULL)
+		from = gt + 1;  /* Started inside a tag */
+
+	before = g_strchug(visible_text(from, match, format));
+	text = visible_text(match, match_end, format);
+	after = g_strchomp(visible_text(match_end, to, format));
+
+	if ((n = g_utf8_strlen(before, -1)) > SNIPPET_BEFORE) {
+		cut = g_strconcat("...", g_utf8_offset_to_pointer(before, n - SNIPPET_BEFORE),
+		                  NULL);
+		g_free(before);
+		before = cut;
+	}
+	if (g_utf8_strlen(after, -1) > SNIPPET_AFTER) {
+		*g_utf8_offset_to_pointer(after, SNIPPET_AFTER) = '\0';
+		cut = g_strconcat(after, "...", NULL);
+		g_free(after);
+		after = cut;
+	}
+
+	e1 = g_markup_escape_text(before, -1);
+	e2 = g_markup_escape_text(text, -1);
+	e3 = g_markup_escape_text(after, -1);
+	snippet = g_strdup_printf("%s<b>%s</b>%s", e1, e2, e3);
+	g_free(e1);
+	g_free(e2);
+	g_free(e3);
+	g_free(before);
+	g_free(text);
+	g_free(after);
+
+	return snippet;
+}
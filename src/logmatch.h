@@ -0,0 +1,69 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGMATCH_H_
+#define _LOGVIEWER_LOGMATCH_H_
+
+#include <glib.h>
+
+#include "logfile.h"
+
+/**
+ * A search query (see logquery.h) compiled for matching logs against.  All
+ * its words and phrases are found in one pass over the bytes of a log, with
+ * ASCII case ignored: markup and entities of html logs are skipped or
+ * decoded on the fly, so no stripped copy is ever made.  Compile once;
+ * matching allocates nothing and may be done from any thread.
+ */
+typedef struct _LogMatcher LogMatcher;
+
+/** Most places noted in a log by log_matcher_match_positions(). */
+#define LOG_MATCH_MAX_POSITIONS 64
+
+/** Where a word or phrase of the query was found in a log. */
+typedef struct {
+	guint32 offset;  /**< Byte offset of where it starts          */
+	guint32 len;     /**< Bytes it spans, markup between included */
+	guint32 line;    /**< Line of the log it starts on, from 0    */
+} LogMatchPos;
+
+/** Returns NULL if the query has nothing to search for or is too big. */
+LogMatcher *log_matcher_new(const char *query);
+
+void log_matcher_free(LogMatcher *matcher);
+
+/** Whether the query has with: terms, which need the buddy's name. */
+gboolean log_matcher_wants_buddy(const LogMatcher *matcher);
+
+/**
+ * FALSE if no log of a conversation with buddy can match, whatever it says,
+ * so that it need not be read.
+ */
+gboolean log_matcher_may_match(const LogMatcher *matcher, const char *buddy);
+
+/**
+ * Whether a log of a conversation with buddy, which may be NULL if it is
+ * not known, matches the query.
+ */
+gboolean log_matcher_match(const LogMatcher *matcher, const char *buddy,
+                           const char *buf, gsize len, LogFormat format);
+
+/**
+ * Like log_matcher_match(), but a log that matches is read on to note where
+ * its words and phrases are, in order, up to LOG_MATCH_MAX_POSITIONS of them.
+ * positions is an array of LogMatchPos, and is left empty on no match.
+ */
+gboolean log_matcher_match_positions(const LogMatcher *matcher, const char *buddy,
+                                     const char *buf, gsize len, LogFormat format,
+                                     GArray *positions);
+
+/**
+ * A line of text around pos in the log, as Pango markup with the match in
+ * bold: markup is dropped, entities decoded and space run together.
+ */
+char *log_matcher_snippet(const char *buf, gsize len, LogFormat format,
+                          const LogMatchPos *pos);
+
+#endif /* _LOGVIEWER_LOGMATCH_H_ */
@@ -22,12 +22,16 @@
 #include <assert.h>
 #include <math.h>
 #include <stdint.h>
+#include <glib/gstdio.h>
 
 #include "plugin.h"
 #include "pidgin.h"
 
 #include "account.h"
+#include "conversation.h"
 #include "debug.h"
+#include "eventloop.h"
+#include "idle.h"
 #include "log.h"
 #include "notify.h"
 #include "request.h"
@@ -41,6 +45,23 @@
 #include "gtkutils.h"
 #include "gtkplugin.h"
 
+#include "logactivity.h"
+#include "logarchive.h"
+#include "logbuddies.h"
+#include "logcache.h"
+#include "logexport.h"
+#include "logfile.h"
+#include "logindex.h"
+#include "logmatch.h"
+#include "logprefetch.h"
+#include "logprefix.h"
+#include "logresultmodel.h"
+#include "logresults.h"
+#include "logquery.h"
+#include "logsearch.h"
+#include "logstats.h"
+#include "logtimeline.h"
+#include "logwarmup.h"
 
 typedef struct _PidginLogViewerNew PidginLogViewerNew;
 
@@ -65,13 +86,60 @@ struct _PidginLogViewerNew {
 	PurpleLogReadFlags search_flags;   /**< The most recently used log flags         */
 	char             *search;	/**< The string currently being searched for  */
 	char             *find;		/**< The string to be searched within the log */
-	gboolean         search_cancelled;
+	LogSearch        *scan;           /**< The search running on the worker threads */
+	LogResults       *results;        /**< What the rows of search_treeview stand for */
+	LogResultModel   *result_model;   /**< The rows of search_treeview */
+	PurpleLog        *search_log;     /**< The result shown, made when it was picked */
+	GtkWidget        *search_note;    /**< Says when not every result could be listed */
+	GPtrArray        *hit_marks;      /**< Start and end of each match in imhtml_search */
+	guint             hit_current;    /**< The match selected */
+	GtkWidget        *hit_label;
+	GtkWidget        *hit_prev;
+	GtkWidget        *hit_next;
+	LogMatcher       *other_matcher;  /**< The search, for logs of other loggers */
+	GSList           *other_buddies;  /**< Buddies whose logs are still to look at */
+	guint             other_id;       /**< Idle source working through them */
+	GHashTable       *refine_hits;    /**< Files still holding a narrowed search */
+	gboolean          search_complete; /**< The results are all there is for search */
+	guint             search_timer;   /**< Starts the search once typing pauses */
 	PurpleAccount    *account;	/**< The account currently selected  */
+	LogBuddyScan     *buddy_scan;     /**< The search for buddies with logs */
+	GHashTable       *buddy_accounts; /**< Account log directory -> account, for it */
+	GHashTable       *buddy_contacts; /**< Contacts already in buddy_liststore */
+	LogPrefixIndex   *buddy_index;    /**< Aliases and screen names of its rows */
+	GArray           *buddy_iters;    /**< Iter of each row, by row number */
+	GByteArray       *buddy_shown;    /**< Whether each row passes the filter */
+	char             *buddy_filter;   /**< The filter text folded, or NULL */
+	GtkWidget        *buddy_filter_entry;
+	GtkWidget        *buddy_names_check; /**< Filter on screen names too */
+	LogStatsTimer     buddy_timer;    /**< Started with the buddy scan */
+	gint64            buddy_cpu;      /**< Spent adding rows for its buddies */
+	guint             buddy_rows;
 	PurpleContact    *contact;
+	LogTimeline      *timeline;       /**< The selected contact's logs by day */
+	struct _LogRender *conv_render;   /**< Still filling imhtml_conv, if anything */
+	struct _LogRender *search_render; /**< Still filling imhtml_search, if anything */
+	GtkWidget        *stats_view;     /**< Shows the running totals of logstats.h */
+	LogExport        *export;         /**< Writing logs out to a file, if it is */
+	GtkWidget        *export_window;  /**< Shows how far along it is */
+	GtkWidget        *export_bar;
+	GtkWidget        *activity_map;   /**< The year's days and the hours of the day */
+	GtkWidget        *activity_view;  /**< Totals, busiest days and top contacts */
+	GtkWidget        *activity_selected; /**< Count only the selected contact */
+	GtkWidget        *activity_year;
+	LogActivityReport *activity;      /**< What the Activity page shows */
+	char             *tail_path;      /**< The log file shown, followed as it is written */
+	gint64            tail_size;      /**< How much of it has been shown */
+	LogFormat         tail_format;
+	guint             tail_timer;     /**< Shows what was just written to it */
         PurpleLog        *log;
 };
 
 void populate_log_tree_buddies(PidginLogViewerNew *dialog);
+static GHashTable *log_account_dirs_new(void);
+static const char *log_get_common_path(PurpleLog *log);
+static char *log_read(PurpleLog *log, PurpleLogReadFlags *flags);
+static PurpleLog *log_find_result_log(PidginLogViewerNew *lvn, guint i);
 static void pidgin_log_win_show(PurplePluginAction *action);
 void log_find_log_cb(GtkWidget *w, PidginLogViewerNew *lvn);
 void month_changed_cb(GtkWidget *calendar, PidginLogViewerNew *dialog);
@@ -79,62 +147,324 @@ gboolean delete_log_win_cb(GtkWidget *w, GdkEventAny *e, PidginLogViewerNew *dat
 void log_mark_calendar_by_month(PidginLogViewerNew *dialog ,uint month, uint year);
 void log_day_selected_cb(GtkWidget *calendar, PidginLogViewerNew *dialog);
 void buddy_filter_change_cb(GtkWidget *entry, PidginLogViewerNew *lvn);
-static gint purple_log_reverse_compare(gconstpointer l1, gconstpointer l2);
-static gboolean buddy_visible_func (GtkTreeModel *model, GtkTreeIter  *iter, gchar *ftext);
 void logsonday_combo_changed_cb(GtkWidget *combo, PidginLogViewerNew *dialog);
 void search_filter_changed_cb(GtkWidget *entry, PidginLogViewerNew *lvn);
 void find_filter_changed_cb(GtkWidget *entry, PidginLogViewerNew *lvn);
 void delete_log_cb(GtkWidget *button, PidginLogViewerNew *lvn);
+static void log_export_cb(GtkWidget *button, PidginLogViewerNew *lvn);
+static void log_activity_refresh(PidginLogViewerNew *lvn);
+static void log_tail_start(PidginLogViewerNew *lvn, PurpleLog *log);
+static void log_tail_stop(PidginLogViewerNew *lvn);
+static gboolean index_update_cb(gpointer data);
+
+#define SEARCH_DELAY_MS  300
+#define SEARCH_CACHED    16   /* queries whose last results are remembered */
+#define SEARCH_CACHE_BYTES (16 << 20) /* what those results may take up */
+#define PREFETCH_BYTES   (8 << 20)  /* decoded logs kept in memory */
+#define PREFETCH_LOGS    16   /* logs read ahead around the selected day */
+#define WARMUP_IDLE_SECS 30   /* the user is away once idle this long */
+#define TAIL_DELAY_MS    100  /* a burst of messages is shown at once */
+
+#define PREF_ROOT         "/plugins/gtk/log_view"
+#define PREF_MAX_RESULTS  PREF_ROOT "/max_results"
+#define MAX_RESULTS       50000  /* search results listed, unless set otherwise */
+
+/* Columns of buddy_liststore */
+enum {
+	BUDDY_COL_ALIAS,
+	BUDDY_COL_CONTACT,
+	BUDDY_COL_ACCOUNT,  /**< With BUDDY_COL_NAME, for someone not on the list */
+	BUDDY_COL_NAME,
+	BUDDY_COL_SHOWN,    /**< Passes the filter */
+	BUDDY_N_COLS
+};
+
+static GList      *log_viewers = NULL;    /**< Every viewer window open           */
+static LogIndex   *log_index = NULL;      /**< Word index over all IM logs        */
+static LogCache   *log_cache = NULL;      /**< Results of recent scans            */
+static LogPrefetch *log_prefetch = NULL;  /**< Logs shown lately or soon to be   */
+static LogActivity *log_activity = NULL;  /**< Messages per day and hour, by buddy */
+static PurpleLogLogger *archive_logger = NULL; /**< Lists and reads packed logs */
+static GThread    *pack_thread = NULL;    /**< Packing old logs, if it is         */
+static volatile gint pack_cancel = 0;
+static guint       pack_done_id = 0;      /**< Reports on packing once it is over */
+G_LOCK_DEFINE_STATIC(pack_done_id);
+static GHashTable *index_updates = NULL;  /**< Logs written to since last update  */
+static guint       index_update_timer = 0;
+static LogWarmup  *log_warmup = NULL;     /**< Work done while the user is away   */
+static guint       warmup_timer = 0;
+static GPtrArray  *warmup_recent = NULL;  /**< Logs to read ahead, under its lock */
+G_LOCK_DEFINE_STATIC(warmup_recent);
 
 
 void
 log_mark_calendar_by_month(PidginLogViewerNew *dialog ,uint month, uint year)
 {
-	PurpleLog *log;
-	GList *logs = NULL, *l;
-	PurpleContact *contact = dialog->contact;
-	PurpleBlistNode *child;
-	int day=0;
+	guint32 days = 0;
+	int day;
+	LogStatsTimer timer;
+
 	gtk_calendar_select_day(GTK_CALENDAR(dialog->calendar),1);
 	gtk_calendar_clear_marks(GTK_CALENDAR(dialog->calendar));
 	
 	gtk_calendar_select_month(GTK_CALENDAR(dialog->calendar), month, year);
-	year -= 1900;
-	
-	for (child = purple_blist_node_get_first_child((PurpleBlistNode*)contact) ;
-	     child != NULL ;
-	     child = purple_blist_node_get_sibling_next(child)) {
-		const char *buddy_name;
-		PurpleAccount *account;
 
-		if (!PURPLE_BLIST_NODE_IS_BUDDY(child))
-			continue;
+	log_stats_timer_start(&timer);
+	if (dialog->timeline != NULL)
+		days = log_timeline_month_mask(dialog->timeline, year, month);
 
-		buddy_name = purple_buddy_get_name((PurpleBuddy *)child);
-		account = purple_buddy_get_account((PurpleBuddy *)child);
-		logs = g_list_concat(purple_log_get_logs(PURPLE_LOG_IM, buddy_name, account), logs);
-		
+	for (day = 1; day <= 31; day++)
+		if (days & (1u << day))
+			gtk_calendar_mark_day(GTK_CALENDAR(dialog->calendar), day);
+	log_stats_timer_stop(&timer, LOG_STATS_CALENDAR, 0, 0, 0);
+
+	/* The last day with logs, or none at all */
+	gtk_calendar_select_day(GTK_CALENDAR(dialog->calendar),
+	                        days ? g_bit_storage(days) - 1 : 0);
+}
+/*
+ * Big logs are shown a piece at a time so the window keeps painting: the
+ * first screenful goes in at once and the rest from an idle source, which
+ * runs below GTK's redraws.  Pieces end on a line break, as every message
+ * of an html log sits on a line of its own.
+ */
+#define RENDER_FIRST_CHUNK  (32 * 1024)
+#define RENDER_CHUNK        (16 * 1024)
+
+/*
+ * Given a mark at the start of each line asked for: first as soon as the
+ * first of them has been shown, so it can be gone to, and again with all
+ * set once the whole log is.  The last of the first call's marks may be of
+ * a line not shown yet.  What is returned with all set is whether lines were
+ * found; FALSE has the text of the find entry looked for in all of the log
+ * instead.  The marks are deleted afterwards.
+ */
+typedef gboolean (*LogRenderMarksFunc)(GtkWidget *imhtml, GPtrArray *marks,
+                                       gboolean all, gpointer data);
+
+typedef struct _LogRender {
+	GtkWidget        *imhtml;
+	GtkWidget        *find_entry;  /**< Its text is highlighted once all is shown */
+	char             *text;
+	gsize             len;
+	gsize             offset;      /**< How much has been shown */
+	GtkIMHtmlOptions  options;
+	gboolean          query;       /**< find_entry holds a search query */
+	gint64            started;
+	guint             id;
+	struct _LogRender **slot;      /**< Cleared when the render goes */
+
+	guint32          *lines;       /**< Lines of text to mark, ascending */
+	guint             n_lines;
+	guint             next_line;   /**< The first of them not yet marked */
+	guint32           line;        /**< The line of text starting at line_start */
+	gsize             line_start;
+	GPtrArray        *marks;       /**< Where the marked lines went */
+	gsize             marked_at;   /**< The offset the last mark was made at */
+	gboolean          first_shown; /**< marks_cb has had the first line */
+	LogRenderMarksFunc marks_cb;
+	gpointer          marks_data;
+} LogRender;
+
+static void
+log_render_free(LogRender *render)
+{
+	GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(render->imhtml));
+	guint i;
+
+	if (render->id != 0)
+		g_source_remove(render->id);
+	*render->slot = NULL;
+	for (i = 0; i < render->marks->len; i++)
+		gtk_text_buffer_delete_mark(buffer, g_ptr_array_index(render->marks, i));
+	g_ptr_array_free(render->marks, TRUE);
+	g_free(render->lines);
+	g_free(render->text);
+	g_free(render);
+}
+
+/* Stops a render still in progress, leaving what has been shown */
+static void
+log_render_cancel(LogRender **slot)
+{
+	if (*slot != NULL)
+		log_render_free(*slot);
+}
+
+/* Where the next line to mark starts in the text, or len if none is left */
+static gsize
+log_render_next_mark(LogRender *render)
+{
+	const char *nl;
+
+	if (render->next_line >= render->n_lines)
+		return render->len;
+
+	while (render->line < render->lines[render->next_line] &&
+	       (nl = memchr(render->text + render->line_start, '\n',
+	                    render->len - render->line_start)) != NULL) {
+		render->line_start = nl - render->text + 1;
+		render->line++;
 	}
-	
-	l = logs;
-	while(logs != NULL)
-	{
-		log = logs->data;
-                if( log == NULL ) continue;
-		if(((log->tm ? log->tm : localtime(&log->time))->tm_year == year) && ((log->tm ? log->tm : localtime(&log->time))->tm_mon == month))
-		{
-			gtk_calendar_mark_day(GTK_CALENDAR(dialog->calendar),(log->tm ? log->tm : localtime(&log->time))->tm_mday);
-			if((log->tm ? log->tm : localtime(&log->time))->tm_mday > day) day = (log->tm ? log->tm : localtime(&log->time))->tm_mday;
+	if (render->line < render->lines[render->next_line]) {
+		/* Past the end of the text */
+		render->next_line = render->n_lines;
+		return render->len;
+	}
+	return render->line_start;
+}
+
+/* Marks the lines starting where the text shown so far ends */
+static gsize
+log_render_mark(LogRender *render)
+{
+	GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(render->imhtml));
+	GtkTextIter iter;
+	gsize next;
+
+	while ((next = log_render_next_mark(render)) == render->offset &&
+	       render->next_line < render->n_lines) {
+		gtk_text_buffer_get_end_iter(buffer, &iter);
+		g_ptr_array_add(render->marks,
+		                gtk_text_buffer_create_mark(buffer, NULL, &iter, TRUE));
+		render->marked_at = render->offset;
+		render->next_line++;
+	}
+	return next;
+}
+
+/*
+ * Shows up to about max more bytes; TRUE once the whole log is in.  A piece
+ * also ends where a line to be marked starts.
+ */
+static gboolean
+log_render_chunk(LogRender *render, gsize max)
+{
+	char *end, *nl, saved;
+	LogStatsTimer timer;
+	gsize mark = log_render_mark(render);
+
+	log_stats_timer_start(&timer);
+	if (render->len - render->offset <= max) {
+		end = render->text + render->len;
+	} else {
+		end = render->text + render->offset + max;
+		nl = memchr(end, '\n', render->text + render->len - end);
+		end = nl == NULL ? render->text + render->len : nl + 1;
+	}
+	if (render->text + mark < end)
+		end = render->text + mark;
+
+	/* Terminate the piece in place rather than copy it */
+	saved = *end;
+	*end = '\0';
+	gtk_imhtml_append_text(GTK_IMHTML(render->imhtml),
+	                       render->text + render->offset, render->options);
+	*end = saved;
+	log_stats_timer_stop(&timer, LOG_STATS_RENDER,
+	                     end - (render->text + render->offset), 0, 0);
+	render->offset = end - render->text;
+	log_render_mark(render);
+
+	/* The first marked line is gone to without waiting for the rest */
+	if (render->marks_cb != NULL && !render->first_shown &&
+	    render->offset < render->len &&
+	    (render->marks->len > 1 ||
+	     (render->marks->len == 1 && render->marked_at < render->offset))) {
+		render->first_shown = TRUE;
+		render->marks_cb(render->imhtml, render->marks, FALSE, render->marks_data);
+	}
+
+	return render->offset == render->len;
+}
+
+static void
+log_render_done(LogRender *render)
+{
+	const gchar *filter = gtk_entry_get_text(GTK_ENTRY(render->find_entry));
+	LogQuery *query = NULL;
+	guint i;
+
+	gtk_imhtml_search_clear(GTK_IMHTML(render->imhtml));
+	if (render->marks_cb != NULL &&
+	    render->marks_cb(render->imhtml, render->marks, TRUE, render->marks_data))
+		filter = "";
+
+	/* Of a search, the first word or phrase is what gets highlighted */
+	if (render->query && *filter != '\0' &&
+	    (query = log_query_parse(filter)) != NULL) {
+		for (i = 0; i < log_query_get_n_terms(query); i++) {
+			const LogQueryTerm *term = log_query_get_term(query, i);
+
+			if (term->kind == LOG_QUERY_TEXT) {
+				filter = term->literal;
+				break;
+			}
 		}
-		
-		logs = logs->next;
 	}
-        if ( l != NULL ) {
-                g_list_foreach(logs, (GFunc)purple_log_free, NULL);
-                g_list_free(logs);
-        }
-	gtk_calendar_select_day(GTK_CALENDAR(dialog->calendar), day);
+
+	if (*filter != '\0')
+		gtk_imhtml_search_find(GTK_IMHTML(render->imhtml), filter);
+	log_query_free(query);
+
+	purple_debug_info("logviewer", "showed %" G_GSIZE_FORMAT " bytes in %.1f ms\n",
+	                  render->len, (log_stats_now() - render->started) / 1e6);
 }
+
+static gboolean
+log_render_cb(LogRender *render)
+{
+	if (!log_render_chunk(render, RENDER_CHUNK))
+		return TRUE;
+
+	render->id = 0;
+	log_render_done(render);
+	log_render_free(render);
+	return FALSE;
+}
+
+/*
+ * Shows text, which the render takes, in imhtml.  Any earlier render into
+ * slot is stopped first.  query says whether find_entry holds a search query
+ * rather than plain text.  If marks_cb is given, the n_lines lines of text
+ * in lines, ascending and counted from 0, are marked for it where they start.
+ */
+static void
+log_render_start(LogRender **slot, GtkWidget *imhtml, GtkWidget *find_entry,
+                 gboolean query, char *text, GtkIMHtmlOptions options,
+                 const guint32 *lines, guint n_lines,
+                 LogRenderMarksFunc marks_cb, gpointer marks_data)
+{
+	LogRender *render = g_new0(LogRender, 1);
+
+	log_render_cancel(slot);
+	if (marks_cb != NULL) {
+		render->lines = g_memdup(lines, n_lines * sizeof(guint32));
+		render->n_lines = n_lines;
+		render->marks_cb = marks_cb;
+		render->marks_data = marks_data;
+	}
+	render->marks = g_ptr_array_new();
+
+	render->imhtml = imhtml;
+	render->find_entry = find_entry;
+	render->text = text;
+	render->len = strlen(text);
+	render->options = options;
+	render->query = query;
+	render->started = log_stats_now();
+	render->slot = slot;
+	*slot = render;
+
+	if (log_render_chunk(render, RENDER_FIRST_CHUNK)) {
+		log_render_done(render);
+		log_render_free(render);
+		return;
+	}
+	render->id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+	                             (GSourceFunc)log_render_cb, render, NULL);
+}
+
 void
 logsonday_combo_changed_cb(GtkWidget *combo, PidginLogViewerNew *dialog)
 {
@@ -143,10 +473,11 @@ logsonday_combo_changed_cb(GtkWidget *combo, PidginLogViewerNew *dialog)
         PurpleLog *log = NULL;
         PurpleLogReadFlags flags;
         char *read = NULL;
-        const gchar *filter = gtk_entry_get_text(GTK_ENTRY(dialog->find_filter_entry));
         
         dialog->log = NULL;
         gtk_widget_set_sensitive(dialog->delete_button,FALSE);
+        log_tail_stop(dialog);
+        log_render_cancel(&dialog->conv_render);
         gtk_imhtml_clear(GTK_IMHTML(dialog->imhtml_conv));
         if(gtk_combo_box_get_active_iter(GTK_COMBO_BOX(dialog->logsonday_combo), &iter))
         {
@@ -158,7 +489,7 @@ logsonday_combo_changed_cb(GtkWidget *combo, PidginLogViewerNew *dialog)
                 return;
         }
         
-        read = purple_log_read(log, &flags);
+        read = log_read(log, &flags);
         
         if(read == NULL) {
                 return;
@@ -171,20 +502,63 @@ logsonday_combo_changed_cb(GtkWidget *combo, PidginLogViewerNew *dialog)
 
 	purple_signal_emit(pidgin_log_get_handle(), "log-displaying", dialog, log);
 
-	gtk_imhtml_append_text(GTK_IMHTML(dialog->imhtml_conv), read,
-                GTK_IMHTML_NO_COMMENTS | GTK_IMHTML_NO_TITLE | GTK_IMHTML_NO_SCROLL |
-		((flags & PURPLE_LOG_READ_NO_NEWLINE) ? GTK_IMHTML_NO_NEWLINE : 0));
-        g_free(read);
-        
         dialog->log = log;
-        gtk_widget_set_sensitive(dialog->delete_button,TRUE);
-        
-        gtk_imhtml_search_clear(GTK_IMHTML(dialog->imhtml_conv));
-        if(*filter == '\0')
-	{
+        gtk_widget_set_sensitive(dialog->delete_button, purple_log_is_deletable(log));
+
+	log_render_start(&dialog->conv_render, dialog->imhtml_conv,
+                dialog->find_filter_entry, FALSE, read,
+                GTK_IMHTML_NO_COMMENTS | GTK_IMHTML_NO_TITLE | GTK_IMHTML_NO_SCROLL |
+		((flags & PURPLE_LOG_READ_NO_NEWLINE) ? GTK_IMHTML_NO_NEWLINE : 0),
+		NULL, 0, NULL, NULL);
+	/* read is of the file as it is now; anything written later is appended */
+	log_tail_start(dialog, log);
+}
+
+/* Adds the logs of the day entry i of the timeline is on, newest first */
+static void
+log_prefetch_add_day(LogTimeline *timeline, guint i, GPtrArray *paths)
+{
+	PurpleLog *log = log_timeline_get(timeline, i);
+	struct tm tm = *(log->tm ? log->tm : localtime(&log->time));
+	guint first, n;
+
+	n = log_timeline_day(timeline, tm.tm_year + 1900, tm.tm_mon, tm.tm_mday, &first);
+	while (n > 0 && paths->len < PREFETCH_LOGS) {
+		const char *path = log_get_common_path(log_timeline_get(timeline, first + --n));
+
+		if (path != NULL)
+			g_ptr_array_add(paths, (gpointer)path);
+	}
+}
+
+/*
+ * Reads ahead what is likely to be looked at after the day at first: its
+ * other logs, then those of the days with logs before and after it.
+ */
+static void
+log_prefetch_around(LogTimeline *timeline, guint first, guint logsonday)
+{
+	GPtrArray *paths;
+	guint i;
+
+	if (log_prefetch == NULL)
 		return;
+
+	paths = g_ptr_array_new();
+	/* The newest is being shown already */
+	for (i = logsonday; i > 1; i--) {
+		const char *path = log_get_common_path(log_timeline_get(timeline, first + i - 2));
+
+		if (path != NULL)
+			g_ptr_array_add(paths, (gpointer)path);
 	}
-        gtk_imhtml_search_find(GTK_IMHTML(dialog->imhtml_conv), filter);
+	if (first > 0)
+		log_prefetch_add_day(timeline, first - 1, paths);
+	if (first + logsonday < log_timeline_length(timeline))
+		log_prefetch_add_day(timeline, first + logsonday, paths);
+
+	log_prefetch_request(log_prefetch, paths);
+	g_ptr_array_free(paths, TRUE);
 }
 
 void
@@ -192,60 +566,38 @@ log_day_selected_cb(GtkWidget *calendar, PidginLogViewerNew *dialog)
 {
 	uint year,month,day;
 	PurpleLog *log;
-	GList *logs = NULL, *l;
-	PurpleContact *contact = dialog->contact;
-	PurpleBlistNode *child;
 	GtkTreeIter iter;
         GtkTreeModel *model;
-        int logsonday = 0;
+        guint first, logsonday, i;
 
         model = gtk_combo_box_get_model( GTK_COMBO_BOX( dialog->logsonday_combo ) );
 	
         gtk_list_store_clear(GTK_LIST_STORE(model));
-	if(contact == NULL) {
+	if(dialog->timeline == NULL) {
                 return;
         }
 	
 	gtk_calendar_get_date(GTK_CALENDAR(calendar), &year, &month, &day);
-	year -= 1900;
-	
-	for (child = purple_blist_node_get_first_child((PurpleBlistNode*)contact) ;
-	     child != NULL ;
-	     child = purple_blist_node_get_sibling_next(child)) {
-		const char *buddy_name;
-		PurpleAccount *account;
-
-		if (!PURPLE_BLIST_NODE_IS_BUDDY(child))
-			continue;
-
-		buddy_name = purple_buddy_get_name((PurpleBuddy *)child);
-		account = purple_buddy_get_account((PurpleBuddy *)child);
-		logs = g_list_concat(purple_log_get_logs(PURPLE_LOG_IM, buddy_name, account), logs);
-		
-	}
-	logs = g_list_sort(logs, purple_log_reverse_compare);
-        l = logs;
 
+	log_tail_stop(dialog);
+	log_render_cancel(&dialog->conv_render);
 	gtk_imhtml_clear(GTK_IMHTML(dialog->imhtml_conv));
-	while(logs != NULL)
+	if (day == 0)
+		logsonday = 0;
+	else
+		logsonday = log_timeline_day(dialog->timeline, year, month, day, &first);
+	if (day != 0)
+		log_prefetch_around(dialog->timeline, first, logsonday);
+
+	/* Newest first; the timeline keeps them oldest first */
+	for (i = logsonday; i > 0; i--)
 	{
-		log = logs->data;
-                
-                if(log == NULL) continue;
-                
-                if(((log->tm ? log->tm : localtime(&log->time))->tm_year == year) && 
-                ((log->tm ? log->tm : localtime(&log->time))->tm_mon == month) && 
-                ((log->tm ? log->tm : localtime(&log->time))->tm_mday == day))
-		{
-			gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-                        gtk_list_store_set(GTK_LIST_STORE(model), &iter, 0,
-                                purple_utf8_strftime("%I:%M %p",
-                                        log->tm ? log->tm : localtime(&log->time)),
-                                1, log, -1);
-                        ++logsonday;
-		}
-		
-		logs = logs->next;
+		log = log_timeline_get(dialog->timeline, first + i - 1);
+		gtk_list_store_append(GTK_LIST_STORE(model), &iter);
+                gtk_list_store_set(GTK_LIST_STORE(model), &iter, 0,
+                        purple_utf8_strftime("%I:%M %p",
+                                log->tm ? log->tm : localtime(&log->time)),
+                        1, log, -1);
 	}
         
         if(logsonday) gtk_combo_box_set_active(GTK_COMBO_BOX(dialog->logsonday_combo), 0);
@@ -263,116 +615,363 @@ month_changed_cb(GtkWidget *calendar, PidginLogViewerNew *dialog)
 	gtk_calendar_select_day(GTK_CALENDAR(calendar),1);
 	log_mark_calendar_by_month(dialog,month,year);
 }
+/* Hands the buddy's logs over to the timeline */
+static void
+log_timeline_add_buddy(LogTimeline *timeline, const char *buddy_name,
+                       PurpleAccount *account)
+{
+	GList *logs, *l;
+
+	logs = purple_log_get_logs(PURPLE_LOG_IM, buddy_name, account);
+	for (l = logs; l != NULL; l = l->next) {
+		PurpleLog *log = l->data;
+
+		log_timeline_add(timeline, log->time, log->tm, log);
+	}
+	g_list_free(logs);
+}
+
 static void
 log_select_buddy_cb(GtkTreeSelection *sel, PidginLogViewerNew *dialog) {
 	GtkTreeIter iter;
-	GValue val;
 	GtkTreeModel *model = GTK_TREE_MODEL(dialog->buddy_liststore);
-	GList *logs = NULL, *l;
-	PurpleLog *log;
 	PurpleContact *contact = NULL;
-	int last_day=0, last_month=0, last_year=0;
+	PurpleAccount *account = NULL;
+	char *name = NULL;
+	int last_day, last_month, last_year;
 	PurpleBlistNode *child;
+	LogStatsTimer timer;
 	
 	if (!gtk_tree_selection_get_selected(sel, &model, &iter))
 		return;
 
-	val.g_type = 0;
-	gtk_tree_model_get_value (model, &iter, 1, &val);
-	contact = g_value_get_pointer(&val);
-	g_value_unset(&val);
+	gtk_tree_model_get(model, &iter, BUDDY_COL_CONTACT, &contact,
+	                   BUDDY_COL_ACCOUNT, &account, BUDDY_COL_NAME, &name, -1);
 
-	if (contact == NULL)
-	{
-		dialog->contact = NULL;
+	/* The day's combo points into the old timeline */
+	gtk_list_store_clear(GTK_LIST_STORE(gtk_combo_box_get_model(
+		GTK_COMBO_BOX(dialog->logsonday_combo))));
+	dialog->log = NULL;
+	gtk_widget_set_sensitive(dialog->delete_button,FALSE);
+	log_timeline_free(dialog->timeline);
+	dialog->timeline = NULL;
+	/* A buddy without logs would otherwise show the last one's days */
+	gtk_calendar_clear_marks(GTK_CALENDAR(dialog->calendar));
+	dialog->contact = contact;
+	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(dialog->activity_selected)))
+		log_activity_refresh(dialog);
+
+	if (contact == NULL && name == NULL)
 		return;
-	}
 	
-	dialog->contact = contact;
+	log_stats_timer_start(&timer);
+	dialog->timeline = log_timeline_new((GDestroyNotify)purple_log_free);
+
+	/* Someone with logs who is no longer on the buddy list */
+	if (contact == NULL) {
+		log_timeline_add_buddy(dialog->timeline, name, account);
+		g_free(name);
+	}
 		
-	for (child = purple_blist_node_get_first_child((PurpleBlistNode*)contact) ;
+	for (child = contact ? purple_blist_node_get_first_child((PurpleBlistNode*)contact) : NULL ;
 	     child != NULL ;
 	     child = purple_blist_node_get_sibling_next(child)) {
-		const char *buddy_name;
-		PurpleAccount *account;
-
 		if (!PURPLE_BLIST_NODE_IS_BUDDY(child))
 			continue;
 
-		buddy_name = purple_buddy_get_name((PurpleBuddy *)child);
-		account = purple_buddy_get_account((PurpleBuddy *)child);
-		logs = g_list_concat(purple_log_get_logs(PURPLE_LOG_IM, buddy_name, account), logs);
-		
+		log_timeline_add_buddy(dialog->timeline,
+		                       purple_buddy_get_name((PurpleBuddy *)child),
+		                       purple_buddy_get_account((PurpleBuddy *)child));
 	}
-	
-	l = logs;
-	while(logs != NULL)
-	{
-		log = logs->data;
-                if(log == NULL) continue;
-		if((log->tm ? log->tm : localtime(&log->time))->tm_year > last_year)
-		{
-			last_year = (log->tm ? log->tm : localtime(&log->time))->tm_year;
-			last_month = (log->tm ? log->tm : localtime(&log->time))->tm_mon;
-			last_day = (log->tm ? log->tm : localtime(&log->time))->tm_mday;
-		}
-		else if(((log->tm ? log->tm : localtime(&log->time))->tm_year == last_year) &&
-                ((log->tm ? log->tm : localtime(&log->time))->tm_mon > last_month))
-		{
-			last_year = (log->tm ? log->tm : localtime(&log->time))->tm_year;
-			last_month = (log->tm ? log->tm : localtime(&log->time))->tm_mon;
-			last_day = (log->tm ? log->tm : localtime(&log->time))->tm_mday;
+
+	log_stats_timer_stop(&timer, LOG_STATS_CALENDAR, 0,
+	                     log_timeline_length(dialog->timeline), 0);
+
+	if (!log_timeline_latest(dialog->timeline, &last_year, &last_month, &last_day))
+		return;
+
+	log_mark_calendar_by_month(dialog, last_month, last_year);
+}
+
+static gboolean
+log_buddy_key_shown(PidginLogViewerNew *lvn, const char *key, gboolean screen_name)
+{
+	if (lvn->buddy_filter == NULL)
+		return TRUE;
+	if (screen_name && !gtk_toggle_button_get_active(
+	                   GTK_TOGGLE_BUTTON(lvn->buddy_names_check)))
+		return FALSE;
+	return g_str_has_prefix(key, lvn->buddy_filter);
+}
+
+/*
+ * Adds a row to buddy_liststore, for contact or for name on account, and
+ * indexes its alias and screen names for the filter.
+ */
+static void
+log_buddy_row_add(PidginLogViewerNew *lvn, const char *alias,
+                  PurpleContact *contact, PurpleAccount *account,
+                  const char *name)
+{
+	guint row = lvn->buddy_iters->len;
+	guint8 shown;
+	GtkTreeIter iter;
+	PurpleBlistNode *child;
+	const char *key;
+
+	key = log_prefix_index_add(lvn->buddy_index, alias, row, FALSE);
+	shown = log_buddy_key_shown(lvn, key, FALSE);
+
+	for (child = contact ? purple_blist_node_get_first_child((PurpleBlistNode *)contact) : NULL;
+	     child != NULL;
+	     child = purple_blist_node_get_sibling_next(child)) {
+		if (!PURPLE_BLIST_NODE_IS_BUDDY(child))
+			continue;
+		key = log_prefix_index_add(lvn->buddy_index,
+		                           purple_buddy_get_name((PurpleBuddy *)child),
+		                           row, TRUE);
+		shown |= log_buddy_key_shown(lvn, key, TRUE);
+	}
+
+	gtk_list_store_insert_with_values(lvn->buddy_liststore, &iter, -1,
+	                   BUDDY_COL_ALIAS, alias, BUDDY_COL_CONTACT, contact,
+	                   BUDDY_COL_ACCOUNT, account, BUDDY_COL_NAME, name,
+	                   BUDDY_COL_SHOWN, (gboolean)shown, -1);
+	g_array_append_val(lvn->buddy_iters, iter);
+	g_byte_array_append(lvn->buddy_shown, &shown, 1);
+	lvn->buddy_rows++;
+}
+
+/*
+ * Adds a row for each buddy directory the scan turns up.  Buddies on the list
+ * are shown once per contact; logs of anyone else get a row of their own.
+ */
+static void
+log_buddy_scan_found_cb(LogBuddyScan *scan, GPtrArray *dirs, gpointer data)
+{
+	PidginLogViewerNew *lvn = data;
+	gint64 cpu = log_stats_cpu_now();
+	guint i;
+
+	for (i = 0; i < dirs->len; i++) {
+		LogBuddyDir *dir = g_ptr_array_index(dirs, i);
+		PurpleAccount *account;
+		PurpleBuddy *bdy;
+		PurpleContact *contact;
+		const char *name;
+
+		account = g_hash_table_lookup(lvn->buddy_accounts, dir->account_dir);
+		if (account == NULL)
+			continue;
+
+		name = purple_unescape_filename(dir->buddy);
+		bdy = purple_find_buddy(account, name);
+		if (bdy == NULL) {
+			log_buddy_row_add(lvn, name, NULL, account, name);
+			continue;
 		}
-		else if(((log->tm ? log->tm : localtime(&log->time))->tm_year == last_year) &&
-                ((log->tm ? log->tm : localtime(&log->time))->tm_mon == last_month) &&
-                ((log->tm ? log->tm : localtime(&log->time))->tm_mday > last_day))
-		{
-			last_year = (log->tm ? log->tm : localtime(&log->time))->tm_year;
-			last_month = (log->tm ? log->tm : localtime(&log->time))->tm_mon;
-			last_day = (log->tm ? log->tm : localtime(&log->time))->tm_mday;
-		}	
-		logs = logs->next;
-	}
-    if(l != NULL)
-    {
-        g_list_foreach(l, (GFunc)purple_log_free, NULL);
-        g_list_free(l);
-    }
-    
-    log_mark_calendar_by_month(dialog, last_month, last_year+1900);
+
+		contact = purple_buddy_get_contact(bdy);
+		if (g_hash_table_contains(lvn->buddy_contacts, contact))
+			continue;
+		g_hash_table_add(lvn->buddy_contacts, contact);
+
+		log_buddy_row_add(lvn, purple_contact_get_alias(contact), contact,
+		                  NULL, NULL);
+	}
+	lvn->buddy_cpu += log_stats_cpu_now() - cpu;
 }
 
+static void
+log_buddy_scan_done_cb(LogBuddyScan *scan, gpointer data)
+{
+	PidginLogViewerNew *lvn = data;
+	LogStatsCounters stats = { 0 };
+
+	stats.calls = 1;
+	stats.wall = log_stats_now() - lvn->buddy_timer.wall;
+	stats.cpu = lvn->buddy_cpu;
+	stats.logs = lvn->buddy_rows;
+	log_stats_add(LOG_STATS_BUDDIES, &stats);
+	purple_debug_info("logviewer", "listed %u buddies in %.1f ms\n",
+	                  lvn->buddy_rows, stats.wall / 1e6);
+
+	log_buddy_scan_free(lvn->buddy_scan);
+	lvn->buddy_scan = NULL;
+}
 
 void
 populate_log_tree_buddies(PidginLogViewerNew *lvn)
 {
-	GList *logs;
-	GSList *buddies;
-	PurpleBuddy *bdy;
-	GtkTreeIter bdy_level;
-	
-	buddies = purple_blist_get_buddies();
-	
-	while(buddies != NULL)
-	{
-		bdy = buddies->data;
-         
-		logs = purple_log_get_logs(PURPLE_LOG_IM, purple_buddy_get_name(bdy), purple_buddy_get_account(bdy));
-            
-		if(logs != NULL)
-		{
-			gtk_list_store_append(lvn->buddy_liststore, &bdy_level);//, NULL);
-			gtk_list_store_set(lvn->buddy_liststore, &bdy_level, 0, purple_buddy_get_alias(bdy),
-                        1, purple_buddy_get_contact(bdy), -1);
-                        g_list_foreach(logs, (GFunc)purple_log_free, NULL);
-                        g_list_free(logs);
+	char *logdir = g_build_filename(purple_user_dir(), "logs", NULL);
+
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(lvn->buddy_liststore),
+	                                     BUDDY_COL_ALIAS, GTK_SORT_ASCENDING);
+
+	lvn->buddy_accounts = log_account_dirs_new();
+	lvn->buddy_contacts = g_hash_table_new(g_direct_hash, g_direct_equal);
+	lvn->buddy_index = log_prefix_index_new();
+	lvn->buddy_iters = g_array_new(FALSE, FALSE, sizeof(GtkTreeIter));
+	lvn->buddy_shown = g_byte_array_new();
+	log_stats_timer_start(&lvn->buddy_timer);
+	lvn->buddy_cpu = 0;
+	lvn->buddy_rows = 0;
+	lvn->buddy_scan = log_buddy_scan_start(logdir, log_buddy_scan_found_cb,
+	                                       log_buddy_scan_done_cb, lvn);
+	g_free(logdir);
+}
+/* The matches in the search result shown */
+
+/* Forgets the matches shown, and greys out moving between them */
+static void
+log_hits_clear(PidginLogViewerNew *lvn)
+{
+	GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(lvn->imhtml_search));
+	guint i;
+
+	for (i = 0; i < lvn->hit_marks->len; i++)
+		gtk_text_buffer_delete_mark(buffer, g_ptr_array_index(lvn->hit_marks, i));
+	g_ptr_array_set_size(lvn->hit_marks, 0);
+	lvn->hit_current = 0;
+	gtk_label_set_text(GTK_LABEL(lvn->hit_label), "");
+	gtk_widget_set_sensitive(lvn->hit_prev, FALSE);
+	gtk_widget_set_sensitive(lvn->hit_next, FALSE);
+}
+
+/* Selects match i and scrolls to it */
+static void
+log_hits_show(PidginLogViewerNew *lvn, guint i)
+{
+	GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(lvn->imhtml_search));
+	GtkTextMark *start = g_ptr_array_index(lvn->hit_marks, 2 * i);
+	guint n = lvn->hit_marks->len / 2;
+	GtkTextIter from, to;
+	char *text;
+
+	lvn->hit_current = i;
+	gtk_text_buffer_get_iter_at_mark(buffer, &from, start);
+	gtk_text_buffer_get_iter_at_mark(buffer, &to, g_ptr_array_index(lvn->hit_marks, 2 * i + 1));
+	gtk_text_buffer_select_range(buffer, &from, &to);
+	gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(lvn->imhtml_search), start,
+	                             0.1, FALSE, 0, 0);
+
+	text = g_strdup_printf("Match %u of %u", i + 1, n);
+	gtk_label_set_text(GTK_LABEL(lvn->hit_label), text);
+	g_free(text);
+	gtk_widget_set_sensitive(lvn->hit_prev, i > 0);
+	gtk_widget_set_sensitive(lvn->hit_next, i + 1 < n);
+}
+
+static void
+log_hits_prev_cb(GtkWidget *button, PidginLogViewerNew *lvn)
+{
+	if (lvn->hit_current > 0)
+		log_hits_show(lvn, lvn->hit_current - 1);
+}
+
+static void
+log_hits_next_cb(GtkWidget *button, PidginLogViewerNew *lvn)
+{
+	if (lvn->hit_current + 1 < lvn->hit_marks->len / 2)
+		log_hits_show(lvn, lvn->hit_current + 1);
+}
+
+/*
+ * Whether text, in ASCII lower case, is in the buffer at iter and before
+ * limit, ignoring ASCII case as the scan does; end is set to where it stops
+ */
+static gboolean
+log_hits_text_at(const GtkTextIter *iter, const GtkTextIter *limit, const char *text,
+                 GtkTextIter *end)
+{
+	*end = *iter;
+	for (; *text != '\0'; text = g_utf8_next_char(text)) {
+		gunichar c;
+
+		if (gtk_text_iter_equal(end, limit))
+			return FALSE;
+		c = gtk_text_iter_get_char(end);
+		if (c < 0x80)
+			c = g_ascii_tolower(c);
+		if (c != g_utf8_get_char(text))
+			return FALSE;
+		gtk_text_iter_forward_char(end);
+	}
+	return TRUE;
+}
+
+/*
+ * Finds the words and phrases of the search on the lines the scan saw them
+ * on, each marked where it was shown, highlights them and selects the first.
+ * Only those lines are looked through.  A line with no exact word or phrase
+ * on it was found by a fuzzy one, and is a hit as a whole.  Once all of the
+ * log is shown they are found again, and the one selected stays so.
+ */
+static gboolean
+log_hits_found_cb(GtkWidget *imhtml, GPtrArray *marks, gboolean all,
+                  PidginLogViewerNew *lvn)
+{
+	GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(imhtml));
+	LogQuery *query = lvn->search != NULL ? log_query_parse(lvn->search) : NULL;
+	GtkTextIter iter, limit, end, done, start;
+	gboolean fuzzy = FALSE;
+	guint current = lvn->hit_current;
+	guint i, t, n_hits;
+
+	log_hits_clear(lvn);
+	if (query == NULL)
+		return FALSE;
+	for (t = 0; t < log_query_get_n_terms(query); t++)
+		fuzzy |= log_query_get_term(query, t)->fuzz > 0;
+
+	gtk_text_buffer_get_start_iter(buffer, &done);
+	for (i = 0; i < marks->len; i++) {
+		gtk_text_buffer_get_iter_at_mark(buffer, &iter, g_ptr_array_index(marks, i));
+		/* Lines of the log may share a line of the view */
+		if (gtk_text_iter_compare(&iter, &done) < 0)
+			iter = done;
+		limit = iter;
+		if (!gtk_text_iter_ends_line(&limit))
+			gtk_text_iter_forward_to_line_end(&limit);
+		start = iter;
+		n_hits = lvn->hit_marks->len;
+
+		while (gtk_text_iter_compare(&iter, &limit) < 0) {
+			for (t = 0; t < log_query_get_n_terms(query); t++) {
+				const LogQueryTerm *term = log_query_get_term(query, t);
+
+				if (term->kind == LOG_QUERY_TEXT && *term->text != '\0' &&
+				    log_hits_text_at(&iter, &limit, term->text, &end))
+					break;
+			}
+			if (t == log_query_get_n_terms(query)) {
+				gtk_text_iter_forward_char(&iter);
+				continue;
+			}
+			gtk_text_buffer_apply_tag_by_name(buffer, "search", &iter, &end);
+			g_ptr_array_add(lvn->hit_marks,
+			                gtk_text_buffer_create_mark(buffer, NULL, &iter, TRUE));
+			g_ptr_array_add(lvn->hit_marks,
+			                gtk_text_buffer_create_mark(buffer, NULL, &end, FALSE));
+			iter = end;
 		}
-		
-		buddies = buddies->next;
+		if (fuzzy && lvn->hit_marks->len == n_hits &&
+		    gtk_text_iter_compare(&start, &limit) < 0) {
+			g_ptr_array_add(lvn->hit_marks,
+			                gtk_text_buffer_create_mark(buffer, NULL, &start, TRUE));
+			g_ptr_array_add(lvn->hit_marks,
+			                gtk_text_buffer_create_mark(buffer, NULL, &limit, FALSE));
+		}
+		done = limit;
 	}
-	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(lvn->buddy_liststore),0,GTK_SORT_ASCENDING);
-    
+	log_query_free(query);
+
+	if (lvn->hit_marks->len == 0)
+		return FALSE;
+	log_hits_show(lvn, MIN(current, lvn->hit_marks->len / 2 - 1));
+	return TRUE;
 }
+
 static void
 log_select_search_result_cb(GtkTreeSelection *sel, PidginLogViewerNew *dialog)
 {
@@ -380,274 +979,1653 @@ log_select_search_result_cb(GtkTreeSelection *sel, PidginLogViewerNew *dialog)
 	GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(dialog->search_treeview));
 	PurpleLog *log = NULL;
 	gchar *read = NULL;
-        const gchar *filter;
         PurpleLogReadFlags flags;
+        const LogMatchPos *positions;
+        guint32 *lines;
+        guint i, j, n, n_lines = 0;
 		
 	if (!gtk_tree_selection_get_selected(sel, &model, &iter))
 		return;
 
-	gtk_tree_model_get( model, &iter, 2, &log, -1);
-	
+	i = log_result_model_get_result(dialog->result_model, &iter);
+
+	/* Only the log being shown is ever made */
+	log = log_find_result_log(dialog, i);
         if(log == NULL) return;    
-        read = purple_log_read(log, &flags);
-        if(read == NULL) return;
+        read = log_read(log, &flags);
+        if(read == NULL) {
+                purple_log_free(log);
+                return;
+        }
     
         dialog->search_flags = flags;
 
+        log_render_cancel(&dialog->search_render);
+        log_hits_clear(dialog);
         gtk_imhtml_clear(GTK_IMHTML(dialog->imhtml_search));
+        if (dialog->search_log != NULL)
+                purple_log_free(dialog->search_log);
+        dialog->search_log = log;
         gtk_imhtml_set_protocol_name(GTK_IMHTML(dialog->imhtml_search),
         purple_account_get_protocol_name(log->account));
 
         purple_signal_emit(pidgin_log_get_handle(), "log-displaying", dialog, log);
     
-        gtk_imhtml_append_text(GTK_IMHTML(dialog->imhtml_search), read,
+        /*
+         * The lines the scan found the query on, less the header line the
+         * text shown goes without; only they are looked through once shown
+         */
+        positions = log_results_get_positions(dialog->results, i, &n);
+        lines = g_new(guint32, MAX(n, 1));
+        for (j = 0; j < n; j++) {
+                guint32 line = MAX(positions[j].line, 1) - 1;
+
+                if (n_lines == 0 || lines[n_lines - 1] != line)
+                        lines[n_lines++] = line;
+        }
+
+        log_render_start(&dialog->search_render, dialog->imhtml_search,
+                dialog->search_entry, TRUE, read,
                 GTK_IMHTML_NO_COMMENTS | GTK_IMHTML_NO_TITLE | GTK_IMHTML_NO_SCROLL |
-                ((flags & PURPLE_LOG_READ_NO_NEWLINE) ? GTK_IMHTML_NO_NEWLINE : 0));
-    
-        g_free(read);
-        
-        filter = gtk_entry_get_text(GTK_ENTRY(dialog->search_entry));
-        gtk_imhtml_search_clear(GTK_IMHTML(dialog->imhtml_search));
-        
-        if( *filter == '\0' ) return;
-        gtk_imhtml_search_find(GTK_IMHTML(dialog->imhtml_search),filter);
-        
+                ((flags & PURPLE_LOG_READ_NO_NEWLINE) ? GTK_IMHTML_NO_NEWLINE : 0),
+                lines, n_lines,
+                n_lines > 0 ? (LogRenderMarksFunc)log_hits_found_cb : NULL, dialog);
+        g_free(lines);
 }
-void log_find_log_cb(GtkWidget *w, PidginLogViewerNew *lvn)
+/*
+ * The file behind a log written by the built-in html or txt logger, or the
+ * path a packed log had as a file
+ */
+static const char *
+log_get_common_path(PurpleLog *log)
 {
-	GList *buddies, *logs, *l;
-        GtkTreeIter iter;
-	PurpleBuddy *bdy;
-	PurpleLog *log;
-	gchar *searchfilter;
-	const gchar *entrytext = gtk_entry_get_text(GTK_ENTRY(lvn->search_entry));
-	gchar *read, *read2;
-        PurpleLogReadFlags flags;
-        GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(lvn->search_treeview));
-                 
-        gtk_list_store_clear(GTK_LIST_STORE(model));
-        gtk_imhtml_clear(GTK_IMHTML(lvn->imhtml_search));
-        
-        if ( *entrytext == '\0' ) {
+	if (log == NULL || log->logger == NULL || log->logger_data == NULL)
+		return NULL;
+	if (strcmp(log->logger->id, "html") != 0 && strcmp(log->logger->id, "txt") != 0 &&
+	    log->logger != archive_logger)
+		return NULL;
+	return ((PurpleLogCommonLoggerData *)log->logger_data)->path;
+}
+
+/* Finishes what log_file_decode() leaves to be done on the main thread */
+static char *
+log_prefetch_finish(char *text, LogFormat format)
+{
+	char *linked;
+
+	if (format != LOG_FORMAT_TXT)
+		return text;
+	linked = purple_markup_linkify(text);
+	g_free(text);
+	return linked;
+}
+
+/*
+ * What purple_log_read() gives for the html or txt log at path, read through
+ * a mapping so the file is not copied twice, or from its archive, or taken
+ * from the logs held in memory.  Returns NULL if it is nowhere to be found.
+ */
+static char *
+log_read_path(const char *path, PurpleLogReadFlags *flags)
+{
+	char *name = g_path_get_basename(path);
+	LogFormat format;
+	GBytes *bytes;
+	char *read;
+	gsize size;
+	LogStatsTimer timer;
+	gboolean ok = log_file_parse_name(name, NULL, &format);
+
+	g_free(name);
+	if (!ok)
+		return NULL;
+	*flags = format == LOG_FORMAT_HTML ? PURPLE_LOG_READ_NO_NEWLINE : 0;
+
+	if (log_prefetch != NULL &&
+	    (read = log_prefetch_lookup(log_prefetch, path)) != NULL)
+		return read;
+
+	log_stats_timer_start(&timer);
+	if ((bytes = log_file_load(path)) == NULL)
+		return NULL;
+	size = g_bytes_get_size(bytes);
+	log_stats_timer_stop(&timer, LOG_STATS_READ, size, 1, 0);
+
+	log_stats_timer_start(&timer);
+	read = log_file_decode(g_bytes_get_data(bytes, NULL), size, format);
+	g_bytes_unref(bytes);
+	read = log_prefetch_finish(read, format);
+	log_stats_timer_stop(&timer, LOG_STATS_DECODE, size, 1, 0);
+
+	if (log_prefetch != NULL)
+		log_prefetch_insert(log_prefetch, path, read);
+	return read;
+}
+
+/* Logs of loggers other than html and txt go through purple_log_read() */
+static char *
+log_read(PurpleLog *log, PurpleLogReadFlags *flags)
+{
+	const char *path = log_get_common_path(log);
+	char *read;
+	LogStatsTimer timer;
+
+	if (path != NULL && (read = log_read_path(path, flags)) != NULL)
+		return read;
+
+	/* Reading and decoding are one step for other loggers */
+	log_stats_timer_start(&timer);
+	read = purple_log_read(log, flags);
+	log_stats_timer_stop(&timer, LOG_STATS_READ, read ? strlen(read) : 0, 1, 0);
+	return read;
+}
+
+/* Following the log shown as it is written to */
+
+/*
+ * Appends the whole lines written to the log followed since it was last
+ * looked at, reading only those.  Waits for the log to be shown in full.
+ */
+static gboolean
+log_tail_cb(PidginLogViewerNew *lvn)
+{
+	gint64 size, mtime;
+	gsize len = 0;
+	char *buf, *text;
+	FILE *fp;
+
+	/* Appending now would put it in the middle of the log */
+	if (lvn->conv_render != NULL)
+		return TRUE;
+	lvn->tail_timer = 0;
+
+	/* Shrunk, it is not the file that was shown */
+	if (!log_file_stat(lvn->tail_path, &size, &mtime) || size <= lvn->tail_size ||
+	    (fp = g_fopen(lvn->tail_path, "rb")) == NULL)
+		return FALSE;
+	buf = g_malloc(size - lvn->tail_size);
+	if (fseeko(fp, lvn->tail_size, SEEK_SET) == 0)
+		len = fread(buf, 1, size - lvn->tail_size, fp);
+	fclose(fp);
+
+	/* A line still being written is left for next time */
+	while (len > 0 && buf[len - 1] != '\n')
+		len--;
+	if (len == 0) {
+		g_free(buf);
+		return FALSE;
+	}
+
+	/* An empty log had no header yet */
+	if (lvn->tail_size == 0)
+		text = log_file_decode(buf, len, lvn->tail_format);
+	else
+		text = log_file_decode_more(buf, len, lvn->tail_format);
+	g_free(buf);
+	text = log_prefetch_finish(text, lvn->tail_format);
+
+	/* Scrolled along only if the end was in view */
+	gtk_imhtml_append_text(GTK_IMHTML(lvn->imhtml_conv), text,
+		GTK_IMHTML_NO_COMMENTS | GTK_IMHTML_NO_TITLE |
+		((lvn->conv_flags & PURPLE_LOG_READ_NO_NEWLINE) ? GTK_IMHTML_NO_NEWLINE : 0));
+	g_free(text);
+	lvn->tail_size += len;
+
+	return FALSE;
+}
+
+static void
+log_tail_wrote_cb(PurpleAccount *account, const char *who, char *message,
+                  PurpleConversation *conv, PurpleMessageFlags flags,
+                  PidginLogViewerNew *lvn)
+{
+	GList *l;
+
+	if (conv == NULL || lvn->tail_timer != 0)
+		return;
+
+	/* By now the message is in the log, if it went to the one shown */
+	for (l = conv->logs; l != NULL; l = l->next) {
+		const char *path = log_get_common_path(l->data);
+
+		if (path != NULL && strcmp(path, lvn->tail_path) == 0) {
+			lvn->tail_timer = purple_timeout_add(TAIL_DELAY_MS,
+			                                     (GSourceFunc)log_tail_cb, lvn);
+			break;
+		}
+	}
+}
+
+/*
+ * Follows the html or txt log file of log, just shown in imhtml_conv, so
+ * that messages written to it are appended as they come.
+ */
+static void
+log_tail_start(PidginLogViewerNew *lvn, PurpleLog *log)
+{
+	const char *path = log_get_common_path(log);
+	gint64 size, mtime;
+	char *name;
+	gboolean ok;
+
+	log_tail_stop(lvn);
+	/* Packed logs are never written to again */
+	if (path == NULL || !g_file_test(path, G_FILE_TEST_IS_REGULAR) ||
+	    !log_file_stat(path, &size, &mtime))
+		return;
+	name = g_path_get_basename(path);
+	ok = log_file_parse_name(name, NULL, &lvn->tail_format);
+	g_free(name);
+	if (!ok)
+		return;
+
+	lvn->tail_path = g_strdup(path);
+	lvn->tail_size = size;
+	purple_signal_connect(purple_conversations_get_handle(), "wrote-im-msg",
+	                      lvn, PURPLE_CALLBACK(log_tail_wrote_cb), lvn);
+}
+
+static void
+log_tail_stop(PidginLogViewerNew *lvn)
+{
+	if (lvn->tail_path == NULL)
+		return;
+
+	purple_signal_disconnect(purple_conversations_get_handle(), "wrote-im-msg",
+	                         lvn, PURPLE_CALLBACK(log_tail_wrote_cb));
+	if (lvn->tail_timer != 0)
+		purple_timeout_remove(lvn->tail_timer);
+	lvn->tail_timer = 0;
+	g_free(lvn->tail_path);
+	lvn->tail_path = NULL;
+}
+
+/*
+ * The logger of packed logs.  It only lists and reads them, so it is never
+ * offered for writing new logs, and packed logs cannot be deleted.
+ */
+
+static void
+archive_logger_finalize(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+
+	g_free(data->path);
+	g_free(data);
+}
+
+static GList *
+archive_logger_list(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	GHashTable *loose;
+	GSList *archives = NULL, *l;
+	GList *logs = NULL;
+	const char *file;
+	char *dir;
+	GDir *d;
+
+	if (type != PURPLE_LOG_IM ||
+	    (dir = purple_log_get_log_dir(type, name, account)) == NULL)
+		return NULL;
+	if ((d = g_dir_open(dir, 0, NULL)) == NULL) {
+		g_free(dir);
+		return NULL;
+	}
+
+	loose = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	while ((file = g_dir_read_name(d)) != NULL) {
+		if (log_archive_parse_name(file, NULL, NULL))
+			archives = g_slist_prepend(archives, g_build_filename(dir, file, NULL));
+		else
+			g_hash_table_add(loose, g_strdup(file));
+	}
+	g_dir_close(d);
+
+	for (l = archives; l != NULL; l = l->next) {
+		LogArchive *archive = log_archive_open(l->data);
+		guint i;
+
+		for (i = 0; archive != NULL && i < log_archive_get_n_logs(archive); i++) {
+			const char *lname = log_archive_get_name(archive, i);
+			time_t time = log_archive_get_time(archive, i);
+			PurpleLogCommonLoggerData *data;
+			PurpleLog *log;
+
+			/* Left over from packing cut short; the html or txt logger lists it */
+			if (g_hash_table_contains(loose, lname))
+				continue;
+
+			log = purple_log_new(PURPLE_LOG_IM, name, account, NULL, time,
+			                     localtime(&time));
+			data = g_new0(PurpleLogCommonLoggerData, 1);
+			data->path = g_build_filename(dir, lname, NULL);
+			log->logger = archive_logger;
+			log->logger_data = data;
+			logs = g_list_prepend(logs, log);
+		}
+		log_archive_close(archive);
+	}
+
+	g_slist_free_full(archives, g_free);
+	g_hash_table_destroy(loose);
+	g_free(dir);
+	return logs;
+}
+
+static char *
+archive_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
+{
+	char *read = log_read_path(log_get_common_path(log), flags);
+
+	if (read == NULL)
+		read = g_strdup("<font color=\"red\"><b>This log could not be read "
+		                "from its archive.</b></font>");
+	return read;
+}
+
+static int
+archive_logger_size(PurpleLog *log)
+{
+	gint64 size, mtime;
+
+	if (!log_file_stat(log_get_common_path(log), &size, &mtime))
+		return 0;
+	return size;
+}
+
+/* What to call a buddy: their contact's alias if they are on the list */
+static const char *
+log_get_display_name(PurpleAccount *account, const char *name)
+{
+	PurpleBuddy *bdy = purple_find_buddy(account, name);
+	const char *bname;
+
+	if (bdy == NULL)
+		return name;
+	bname = purple_contact_get_alias(purple_buddy_get_contact(bdy));
+	if (*bname == '\0')
+		bname = purple_buddy_get_alias(bdy);
+	return bname;
+}
+
+static void
+log_list_free(GList *logs)
+{
+	GList *l;
+
+	for (l = logs; l != NULL; l = l->next)
+		if (l->data != NULL)
+			purple_log_free(l->data);
+	g_list_free(logs);
+}
+
+/* Maps each account's log directory to the account */
+static GHashTable *
+log_account_dirs_new(void)
+{
+	GHashTable *dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GList *l;
+
+	for (l = purple_accounts_get_all(); l != NULL; l = l->next) {
+		char *dir = purple_log_get_log_dir(PURPLE_LOG_IM, "x", l->data);
+
+		if (dir == NULL)
+			continue;
+		g_hash_table_insert(dirs, g_path_get_dirname(dir), l->data);
+		g_free(dir);
+	}
+	return dirs;
+}
+
+/* The account and screen name a buddy's log directory belongs to */
+static PurpleAccount *
+log_buddy_dir_account(PidginLogViewerNew *lvn, const char *dir, char **name)
+{
+	char *adir = g_path_get_dirname(dir);
+	PurpleAccount *account = g_hash_table_lookup(lvn->buddy_accounts, adir);
+
+	if (name != NULL) {
+		char *target = g_path_get_basename(dir);
+
+		*name = g_strdup(purple_unescape_filename(target));
+		g_free(target);
+	}
+	g_free(adir);
+	return account;
+}
+
+/* Lists the results numbered in rows, naming any buddies new to the list */
+static void
+log_find_add_rows(PidginLogViewerNew *lvn, GArray *rows)
+{
+	LogResultModel *model = lvn->result_model;
+
+	while (log_result_model_get_n_buddies(model) < log_results_get_n_buddies(lvn->results)) {
+		const char *dir = log_results_get_buddy_dir(lvn->results,
+		                                            log_result_model_get_n_buddies(model));
+		char *name;
+		PurpleAccount *account = log_buddy_dir_account(lvn, dir, &name);
+
+		log_result_model_add_buddy(model, log_get_display_name(account, name));
+		g_free(name);
+	}
+	log_result_model_append(model, (const guint *)rows->data, rows->len);
+}
+
+/*
+ * Turns a log file with a hit into a result, to go in rows; no log is read.
+ * positions, if not NULL, holds the LogMatchPos the scan found.
+ */
+static void
+log_find_add_hit(PidginLogViewerNew *lvn, GArray *rows, const char *hit_path,
+                 time_t time, guint matches, const char *snippet, GArray *positions)
+{
+	char *bdir = g_path_get_dirname(hit_path);
+	guint i;
+
+	/* Logs of accounts that are gone could not be opened */
+	if (log_buddy_dir_account(lvn, bdir, NULL) != NULL &&
+	    (i = log_results_add_path(lvn->results, hit_path, time, matches)) != (guint)-1) {
+		if (positions != NULL)
+			log_results_set_positions(lvn->results, i, snippet,
+			                          (const LogMatchPos *)positions->data,
+			                          positions->len);
+		g_array_append_val(rows, i);
+	}
+	g_free(bdir);
+}
+
+/*
+ * Makes the PurpleLog for result i, out of the list of its buddy's logs.
+ * Returns NULL if it is not there any more.
+ */
+static PurpleLog *
+log_find_result_log(PidginLogViewerNew *lvn, guint i)
+{
+	const char *dir = log_results_get_buddy_dir(lvn->results,
+	                                            log_results_get_buddy(lvn->results, i));
+	char *path = log_results_get_path(lvn->results, i);
+	time_t time = log_results_get_time(lvn->results, i);
+	PurpleLog *found = NULL;
+	PurpleAccount *account;
+	GList *logs = NULL, *l;
+	char *name;
+
+	if ((account = log_buddy_dir_account(lvn, dir, &name)) != NULL)
+		logs = purple_log_get_logs(PURPLE_LOG_IM, name, account);
+
+	for (l = logs; l != NULL && found == NULL; l = l->next) {
+		PurpleLog *log = l->data;
+		const char *log_path = log_get_common_path(log);
+
+		/* A log that is not a file is known by its time */
+		if (path != NULL ? log_path != NULL && strcmp(log_path, path) == 0
+		                 : log_path == NULL && log->time == time) {
+			found = log;
+			l->data = NULL;
+		}
+	}
+	log_list_free(logs);
+	g_free(name);
+	g_free(path);
+
+	return found;
+}
+
+static void
+log_find_stop(PidginLogViewerNew *lvn)
+{
+	log_search_free(lvn->scan);
+	lvn->scan = NULL;
+
+	if (lvn->refine_hits != NULL)
+		g_hash_table_destroy(lvn->refine_hits);
+	lvn->refine_hits = NULL;
+
+	if (lvn->other_id != 0)
+		g_source_remove(lvn->other_id);
+	lvn->other_id = 0;
+	g_slist_free(lvn->other_buddies);
+	lvn->other_buddies = NULL;
+	log_matcher_free(lvn->other_matcher);
+	lvn->other_matcher = NULL;
+
+#if GTK_CHECK_VERSION(2, 20, 0)
+	{
+		gtk_spinner_stop(GTK_SPINNER(lvn->search_spinner));
+		gtk_widget_hide(lvn->search_spinner);
+	}
+#endif
+}
+
+/* Once there are as many results as are listed, says so and stops the search */
+static gboolean
+log_find_check_full(PidginLogViewerNew *lvn)
+{
+	char *text;
+
+	if (log_results_get_dropped(lvn->results) == 0)
+		return FALSE;
+
+	text = g_strdup_printf("Only the first %u results are listed; "
+	                       "narrow the search to see the rest.",
+	                       log_results_length(lvn->results));
+	gtk_label_set_text(GTK_LABEL(lvn->search_note), text);
+	gtk_widget_show(lvn->search_note);
+	g_free(text);
+
+	log_find_stop(lvn);
+	return TRUE;
+}
+
+static void
+log_find_scan_hits_cb(LogSearch *search, GPtrArray *hits, PidginLogViewerNew *lvn)
+{
+	GArray *rows = g_array_sized_new(FALSE, FALSE, sizeof(guint), hits->len);
+	LogStatsTimer timer;
+	guint i;
+
+	log_stats_timer_start(&timer);
+	for (i = 0; i < hits->len; i++) {
+		LogSearchHit *hit = g_ptr_array_index(hits, i);
+		log_find_add_hit(lvn, rows, hit->path, hit->time, 0, hit->snippet,
+		                 hit->positions);
+	}
+	log_find_add_rows(lvn, rows);
+	g_array_free(rows, TRUE);
+	log_stats_timer_stop(&timer, LOG_STATS_ROWS, 0, 0, hits->len);
+	log_find_check_full(lvn);
+}
+
+/*
+ * Looks through one buddy's logs from a logger other than html and txt,
+ * whose files the scan cannot read.  Runs once per buddy from an idle source.
+ */
+static gboolean
+log_find_other_logger_cb(PidginLogViewerNew *lvn)
+{
+	PurpleLogLogger *logger = purple_log_logger_get();
+	PurpleBuddy *bdy;
+	GList *logs, *l;
+	GArray *rows;
+
+	if (lvn->other_buddies == NULL || logger == NULL || logger->list == NULL) {
+		lvn->other_id = 0;
+		log_find_stop(lvn);
+		lvn->search_complete = TRUE;
+		return FALSE;
+	}
+
+	bdy = lvn->other_buddies->data;
+	lvn->other_buddies = g_slist_delete_link(lvn->other_buddies, lvn->other_buddies);
+
+	logs = logger->list(PURPLE_LOG_IM, purple_buddy_get_name(bdy),
+	                    purple_buddy_get_account(bdy));
+	rows = g_array_new(FALSE, FALSE, sizeof(guint));
+	for (l = logs; l != NULL; l = l->next) {
+		PurpleLog *log = l->data;
+		char *read = purple_log_read(log, NULL);
+
+		if (read != NULL &&
+		    log_matcher_match(lvn->other_matcher, log->name, read, strlen(read),
+		                      LOG_FORMAT_HTML)) {
+			char *dir = purple_log_get_log_dir(PURPLE_LOG_IM, log->name, log->account);
+			gint i;
+
+			if (dir != NULL &&
+			    (i = log_results_add(lvn->results, dir, NULL, log->time, 0)) >= 0)
+				g_array_append_val(rows, i);
+			g_free(dir);
+		}
+		g_free(read);
+	}
+	log_list_free(logs);
+	log_find_add_rows(lvn, rows);
+	g_array_free(rows, TRUE);
+
+	if (log_results_get_dropped(lvn->results) > 0) {
+		lvn->other_id = 0;
+		log_find_check_full(lvn);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Once the files have been searched, goes on to logs of any other logger */
+static void
+log_find_finish(PidginLogViewerNew *lvn)
+{
+	PurpleLogLogger *logger = purple_log_logger_get();
+
+	log_search_free(lvn->scan);
+	lvn->scan = NULL;
+
+	if (logger == NULL || logger->list == NULL ||
+	    strcmp(logger->id, "html") == 0 || strcmp(logger->id, "txt") == 0) {
+		log_find_stop(lvn);
+		lvn->search_complete = TRUE;
+		return;
+	}
+
+	if ((lvn->other_matcher = log_matcher_new(lvn->search)) == NULL) {
+		log_find_stop(lvn);
+		return;
+	}
+	lvn->other_buddies = purple_blist_get_buddies();
+	lvn->other_id = g_idle_add((GSourceFunc)log_find_other_logger_cb, lvn);
+
+#if GTK_CHECK_VERSION(2, 20, 0)
+	{
+		gtk_spinner_start(GTK_SPINNER(lvn->search_spinner));
+		gtk_widget_show(lvn->search_spinner);
+	}
+#endif
+}
+
+/* What a finished scan cost, for the debug window */
+static void
+log_find_debug_stats(LogSearch *search, const char *query)
+{
+	LogStatsCounters stats;
+
+	log_search_get_stats(search, &stats);
+	purple_debug_info("logviewer",
+		"searched %" G_GINT64_FORMAT " logs, %.1f MB, for \"%s\" in %.1f ms "
+		"(%.1f ms cpu): %" G_GINT64_FORMAT " hits\n",
+		stats.logs, stats.bytes / (double)(1 << 20), query,
+		stats.wall / 1e6, stats.cpu / 1e6, stats.hits);
+}
+
+static void
+log_find_scan_done_cb(LogSearch *search, PidginLogViewerNew *lvn)
+{
+	log_find_debug_stats(search, lvn->search);
+	log_find_finish(lvn);
+}
+
+/* Drops the results, and starts a new store for them at the size set now */
+static void
+log_find_clear_results(PidginLogViewerNew *lvn)
+{
+	LogResults *old = lvn->results;
+
+	lvn->results = log_results_new(purple_prefs_get_int(PREF_MAX_RESULTS));
+	log_result_model_set_results(lvn->result_model, lvn->results);
+	log_results_free(old);
+	gtk_widget_hide(lvn->search_note);
+}
+
+/*
+ * The files behind the rows of a finished search that query narrows down,
+ * or NULL if its hits have to be looked for from scratch.
+ */
+static GPtrArray *
+log_find_refinable(PidginLogViewerNew *lvn, const char *query)
+{
+	GPtrArray *paths;
+	guint i;
+	LogQuery *old, *new;
+	gboolean narrower;
+
+	if (!lvn->search_complete || lvn->search == NULL)
+		return NULL;
+
+	old = log_query_parse(lvn->search);
+	new = log_query_parse(query);
+	narrower = old != NULL && new != NULL && log_query_narrows(new, old);
+	log_query_free(old);
+	log_query_free(new);
+	if (!narrower)
+		return NULL;
+
+	paths = g_ptr_array_new_with_free_func(g_free);
+	for (i = 0; i < log_results_length(lvn->results); i++) {
+		char *path = log_results_get_path(lvn->results, i);
+
+		if (path == NULL) {
+			/* Only files can be looked through again */
+			g_ptr_array_free(paths, TRUE);
+			return NULL;
+		}
+		g_ptr_array_add(paths, path);
+	}
+	return paths;
+}
+
+static void
+log_find_refine_hits_cb(LogSearch *search, GPtrArray *hits, PidginLogViewerNew *lvn)
+{
+	guint i;
+
+	/* The hits are kept, for where the narrower query is in each */
+	for (i = 0; i < hits->len; i++) {
+		LogSearchHit *hit = g_ptr_array_index(hits, i);
+
+		g_hash_table_replace(lvn->refine_hits, hit->path, hit);
+		g_ptr_array_index(hits, i) = NULL;
+	}
+}
+
+static gboolean
+log_find_refine_keep_cb(LogResults *results, guint i, PidginLogViewerNew *lvn)
+{
+	char *path = log_results_get_path(results, i);
+	LogSearchHit *hit = g_hash_table_lookup(lvn->refine_hits, path);
+
+	g_free(path);
+	if (hit == NULL)
+		return FALSE;
+	if (hit->positions != NULL)
+		log_results_set_positions(results, i, hit->snippet,
+		                          (const LogMatchPos *)hit->positions->data,
+		                          hit->positions->len);
+	return TRUE;
+}
+
+/* Keeps the results the narrower query is in, and lists them again */
+static void
+log_find_refine_done_cb(LogSearch *search, PidginLogViewerNew *lvn)
+{
+	GArray *rows;
+	guint i, n;
+
+	log_find_debug_stats(search, lvn->search);
+	log_result_model_clear(lvn->result_model);
+	n = log_results_filter(lvn->results,
+	                       (LogResultsFilterFunc)log_find_refine_keep_cb, lvn);
+	rows = g_array_sized_new(FALSE, FALSE, sizeof(guint), n);
+	for (i = 0; i < n; i++)
+		g_array_append_val(rows, i);
+	log_find_add_rows(lvn, rows);
+	g_array_free(rows, TRUE);
+
+	log_find_stop(lvn);
+	lvn->search_complete = TRUE;
+}
+
+void log_find_log_cb(GtkWidget *w, PidginLogViewerNew *lvn)
+{
+	const gchar *entrytext = gtk_entry_get_text(GTK_ENTRY(lvn->search_entry));
+        GPtrArray *paths;
+        LogQuery *query;
+        char *logdir;
+
+        if (lvn->search_timer != 0) {
+                purple_timeout_remove(lvn->search_timer);
+                lvn->search_timer = 0;
+        }
+
+        paths = *entrytext == '\0' ? NULL : log_find_refinable(lvn, entrytext);
+
+        /* Starting over, or clearing the entry, stops the previous search */
+        log_find_stop(lvn);
+        lvn->search_complete = FALSE;
+        log_render_cancel(&lvn->search_render);
+        log_hits_clear(lvn);
+        gtk_imhtml_clear(GTK_IMHTML(lvn->imhtml_search));
+        if (lvn->search_log != NULL)
+                purple_log_free(lvn->search_log);
+        lvn->search_log = NULL;
+
+        /* A longer query only needs the hits of the shorter one looked at */
+        if (paths != NULL) {
+                purple_debug_info("logviewer", "narrowing %u hits of \"%s\" to \"%s\"\n",
+                                  paths->len, lvn->search, entrytext);
+                g_free(lvn->search);
+                lvn->search = g_strdup(entrytext);
+                lvn->refine_hits = g_hash_table_new_full(g_str_hash, g_str_equal,
+                        NULL, (GDestroyNotify)log_search_hit_free);
+                lvn->scan = log_search_start_files(paths, entrytext,
+                        (LogSearchHitsFunc)log_find_refine_hits_cb,
+                        (LogSearchDoneFunc)log_find_refine_done_cb, lvn);
+                g_ptr_array_free(paths, TRUE);
+                return;
+        }
+
+        log_find_clear_results(lvn);
+        
+        if ( *entrytext == '\0' ) {
+                return;
+        }
+
+        g_free(lvn->search);
+        lvn->search = g_strdup(entrytext);
+
+        if ((query = log_query_parse(entrytext)) == NULL) {
+                purple_debug_info("logviewer", "nothing to search for in \"%s\"\n",
+                                  entrytext);
+                return;
+        }
+        log_query_free(query);
+
+#if GTK_CHECK_VERSION(2, 20, 0)
+	{
+		gtk_spinner_start(GTK_SPINNER(lvn->search_spinner));
+		gtk_widget_show(lvn->search_spinner);
+	}
+#endif
+        /*
+         * A single word or phrase is looked for only in the logs the index
+         * names; those written to lately have to be named too.
+         */
+        if (index_update_timer != 0) {
+                purple_timeout_remove(index_update_timer);
+                index_update_cb(NULL);
+        }
+        logdir = g_build_filename(purple_user_dir(), "logs", NULL);
+        lvn->scan = log_search_start(logdir, entrytext, log_cache, log_index,
+                (LogSearchHitsFunc)log_find_scan_hits_cb,
+                (LogSearchDoneFunc)log_find_scan_done_cb, lvn);
+        g_free(logdir);
+}
+
+static gboolean
+log_find_timeout_cb(PidginLogViewerNew *lvn)
+{
+	lvn->search_timer = 0;
+	log_find_log_cb(NULL, lvn);
+	return FALSE;
+}
+
+/*
+ * Shows the buddies with an alias, or a screen name if those are wanted,
+ * starting with the filter text.  Only rows whose state changes are touched.
+ */
+void
+buddy_filter_change_cb(GtkWidget *widget, PidginLogViewerNew *lvn)
+{
+	const gchar *text = gtk_entry_get_text(GTK_ENTRY(lvn->buddy_filter_entry));
+	gboolean names = gtk_toggle_button_get_active(
+		GTK_TOGGLE_BUTTON(lvn->buddy_names_check));
+	guint n_rows = lvn->buddy_iters->len;
+	guint8 *shown;
+	guint i, n, first, row;
+	gboolean screen_name;
+
+	g_free(lvn->buddy_filter);
+	lvn->buddy_filter = *text != '\0' ? log_prefix_fold(text) : NULL;
+
+	if (lvn->buddy_filter == NULL) {
+		shown = g_malloc(n_rows);
+		memset(shown, TRUE, n_rows);
+	} else {
+		shown = g_malloc0(n_rows);
+		n = log_prefix_index_find(lvn->buddy_index, lvn->buddy_filter, &first);
+		for (i = first; i < first + n; i++) {
+			row = log_prefix_index_get_row(lvn->buddy_index, i, &screen_name);
+			if (!screen_name || names)
+				shown[row] = TRUE;
+		}
+	}
+
+	for (row = 0; row < n_rows; row++) {
+		if (shown[row] == lvn->buddy_shown->data[row])
+			continue;
+		lvn->buddy_shown->data[row] = shown[row];
+		gtk_list_store_set(lvn->buddy_liststore,
+		                   &g_array_index(lvn->buddy_iters, GtkTreeIter, row),
+		                   BUDDY_COL_SHOWN, (gboolean)shown[row], -1);
+	}
+	g_free(shown);
+}
+
+void
+search_filter_changed_cb(GtkWidget *entry, PidginLogViewerNew *lvn)
+{
+	const gchar *filter = gtk_entry_get_text(GTK_ENTRY(entry));
+
+	/* Search as the user types, once they pause */
+	if (lvn->search_timer != 0)
+		purple_timeout_remove(lvn->search_timer);
+	lvn->search_timer = 0;
+        
+	if(*filter == '\0')
+	{
+		gtk_widget_set_sensitive(lvn->search_button, FALSE);
+		log_find_log_cb(entry, lvn);
+		return;
+	}
+	
+	gtk_widget_set_sensitive(lvn->search_button, TRUE);
+	lvn->search_timer = purple_timeout_add(SEARCH_DELAY_MS,
+	                                       (GSourceFunc)log_find_timeout_cb, lvn);
+}
+
+void
+find_filter_changed_cb(GtkWidget *entry, PidginLogViewerNew *lvn)
+{
+        const gchar *filter = gtk_entry_get_text(GTK_ENTRY(entry));
+        
+        gtk_imhtml_search_clear(GTK_IMHTML(lvn->imhtml_conv));
+        if(*filter == '\0')
+	{
+		return;
+	}
+        gtk_imhtml_search_find(GTK_IMHTML(lvn->imhtml_conv), filter);
+}
+
+void
+delete_log_cb(GtkWidget *button, PidginLogViewerNew *lvn)
+{
+        uint day, month, year;
+        char *path;
+        
+        if(lvn->log == NULL) return;
+        
+        path = g_strdup(log_get_common_path(lvn->log));
+        if (!purple_log_delete(lvn->log))
+	{
+		purple_notify_error(NULL, NULL, "Log Deletion Failed",
+		                  "Check permissions and try again.");
+                g_free(path);
+                return;
+	}
+        if (log_index != NULL && path != NULL)
+                log_index_remove_file(log_index, path);
+        if (log_activity != NULL && path != NULL)
+                log_activity_remove_file(log_activity, path);
+        g_free(path);
+        gtk_list_store_clear(GTK_LIST_STORE(gtk_combo_box_get_model(
+                GTK_COMBO_BOX(lvn->logsonday_combo))));
+        log_timeline_remove(lvn->timeline, lvn->log);
+        lvn->log = NULL;
+        gtk_widget_set_sensitive(lvn->delete_button,FALSE);
+        gtk_calendar_get_date(GTK_CALENDAR(lvn->calendar),&year,&month,&day);
+        log_mark_calendar_by_month(lvn,month,year);
+}
+
+/* Exporting */
+
+static const char *export_names[] = { "logs.jsonl", "logs.txt", "logs.html" };
+
+static void
+log_export_stop(PidginLogViewerNew *lvn)
+{
+	log_export_free(lvn->export);
+	lvn->export = NULL;
+	if (lvn->export_window != NULL)
+		gtk_widget_destroy(lvn->export_window);
+	lvn->export_window = NULL;
+	lvn->export_bar = NULL;
+}
+
+static void
+log_export_cancel_cb(GtkWidget *button, PidginLogViewerNew *lvn)
+{
+	log_export_stop(lvn);
+}
+
+static gboolean
+log_export_delete_cb(GtkWidget *w, GdkEventAny *e, PidginLogViewerNew *lvn)
+{
+	log_export_stop(lvn);
+	return TRUE;
+}
+
+static void
+log_export_progress_cb(LogExport *export, guint done, guint total, gpointer data)
+{
+	PidginLogViewerNew *lvn = data;
+	char *text;
+
+	if (total == 0)
+		return;
+	text = g_strdup_printf("%u of %u logs", done, total);
+	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(lvn->export_bar),
+	                              (double)done / total);
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(lvn->export_bar), text);
+	g_free(text);
+}
+
+static void
+log_export_done_cb(LogExport *export, const char *error, gpointer data)
+{
+	PidginLogViewerNew *lvn = data;
+
+	log_export_stop(lvn);
+	if (error != NULL)
+		purple_notify_error(NULL, NULL, "Could not export logs", error);
+}
+
+static void
+log_export_window_new(PidginLogViewerNew *lvn)
+{
+	GtkWidget *vbox, *bbox, *cancel;
+
+	lvn->export_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_title(GTK_WINDOW(lvn->export_window), "Exporting Logs");
+	gtk_window_set_transient_for(GTK_WINDOW(lvn->export_window),
+	                             GTK_WINDOW(lvn->window));
+	gtk_container_set_border_width(GTK_CONTAINER(lvn->export_window),
+	                               PIDGIN_HIG_BORDER);
+	g_signal_connect(G_OBJECT(lvn->export_window), "delete_event",
+	                 G_CALLBACK(log_export_delete_cb), lvn);
+
+	lvn->export_bar = gtk_progress_bar_new();
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(lvn->export_bar), "Counting logs...");
+	gtk_widget_set_size_request(lvn->export_bar, 300, -1);
+
+	cancel = gtk_button_new_from_stock(GTK_STOCK_CANCEL);
+	g_signal_connect(G_OBJECT(cancel), "clicked",
+	                 G_CALLBACK(log_export_cancel_cb), lvn);
+	bbox = gtk_hbutton_box_new();
+	gtk_button_box_set_layout(GTK_BUTTON_BOX(bbox), GTK_BUTTONBOX_END);
+	gtk_box_pack_start(GTK_BOX(bbox), cancel, FALSE, FALSE, 0);
+
+	vbox = gtk_vbox_new(FALSE, PIDGIN_HIG_BOX_SPACE);
+	gtk_box_pack_start(GTK_BOX(vbox), lvn->export_bar, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), bbox, FALSE, FALSE, 0);
+	gtk_container_add(GTK_CONTAINER(lvn->export_window), vbox);
+	gtk_widget_show_all(lvn->export_window);
+}
+
+/* The log directories of the selected row's buddies, or NULL if there is none */
+static GPtrArray *
+log_selected_dirs(PidginLogViewerNew *lvn)
+{
+	GtkTreeSelection *sel;
+	GtkTreeModel *model;
+	GtkTreeIter iter;
+	PurpleContact *contact = NULL;
+	PurpleAccount *account = NULL;
+	PurpleBlistNode *child;
+	GPtrArray *dirs;
+	char *name = NULL, *dir;
+
+	sel = gtk_tree_view_get_selection(GTK_TREE_VIEW(lvn->buddy_treeview));
+	if (!gtk_tree_selection_get_selected(sel, &model, &iter))
+		return NULL;
+	gtk_tree_model_get(model, &iter, BUDDY_COL_CONTACT, &contact,
+	                   BUDDY_COL_ACCOUNT, &account, BUDDY_COL_NAME, &name, -1);
+
+	dirs = g_ptr_array_new_with_free_func(g_free);
+	if (contact == NULL && name != NULL &&
+	    (dir = purple_log_get_log_dir(PURPLE_LOG_IM, name, account)) != NULL)
+		g_ptr_array_add(dirs, dir);
+	for (child = contact ? purple_blist_node_get_first_child((PurpleBlistNode *)contact) : NULL;
+	     child != NULL;
+	     child = purple_blist_node_get_sibling_next(child)) {
+		if (!PURPLE_BLIST_NODE_IS_BUDDY(child))
+			continue;
+		dir = purple_log_get_log_dir(PURPLE_LOG_IM,
+		                             purple_buddy_get_name((PurpleBuddy *)child),
+		                             purple_buddy_get_account((PurpleBuddy *)child));
+		if (dir != NULL)
+			g_ptr_array_add(dirs, dir);
+	}
+	g_free(name);
+
+	return dirs;
+}
+
+/*
+ * Parses YYYY-MM-DD as the local midnight that starts the day, or ends it
+ * if end is set.  An empty text leaves that end of the range open.
+ */
+static gboolean
+log_export_parse_date(const char *text, gboolean end, time_t *time)
+{
+	int year, month, day;
+	struct tm tm;
+
+	*time = 0;
+	while (g_ascii_isspace(*text))
+		text++;
+	if (*text == '\0')
+		return TRUE;
+	if (sscanf(text, "%d-%d-%d", &year, &month, &day) != 3)
+		return FALSE;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = year - 1900;
+	tm.tm_mon = month - 1;
+	tm.tm_mday = day + (end ? 1 : 0);
+	tm.tm_isdst = -1;
+	*time = mktime(&tm);
+	return *time != (time_t)-1;
+}
+
+static void
+log_export_format_cb(GtkWidget *combo, GtkWidget *chooser)
+{
+	gint format = gtk_combo_box_get_active(GTK_COMBO_BOX(combo));
+
+	if (format >= 0)
+		gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(chooser),
+		                                  export_names[format]);
+}
+
+static GtkWidget *
+log_export_labelled(GtkWidget *vbox, const char *text, GtkWidget *widget)
+{
+	GtkWidget *hbox = gtk_hbox_new(FALSE, PIDGIN_HIG_BOX_SPACE);
+
+	gtk_box_pack_start(GTK_BOX(hbox), gtk_label_new(text), FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(hbox), widget, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+	return widget;
+}
+
+/*
+ * Asks where to and what to export: the selected buddy's logs or everyone's,
+ * from and to which day, and in which format.
+ */
+static void
+log_export_cb(GtkWidget *button, PidginLogViewerNew *lvn)
+{
+	GtkWidget *chooser, *vbox, *everyone, *selected, *from_entry, *to_entry, *combo;
+	GPtrArray *dirs;
+	char *logdir, *path;
+	time_t from, to;
+	gint format;
+
+	if (lvn->export_window != NULL) {
+		gtk_window_present(GTK_WINDOW(lvn->export_window));
+		return;
+	}
+
+	chooser = gtk_file_chooser_dialog_new("Export Logs", GTK_WINDOW(lvn->window),
+	                                      GTK_FILE_CHOOSER_ACTION_SAVE,
+	                                      GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+	                                      GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT, NULL);
+	gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(chooser), TRUE);
+	gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(chooser), export_names[0]);
+
+	vbox = gtk_vbox_new(FALSE, PIDGIN_HIG_BOX_SPACE);
+	selected = gtk_radio_button_new_with_mnemonic(NULL, "Logs of the _selected buddy");
+	everyone = gtk_radio_button_new_with_mnemonic_from_widget(
+		GTK_RADIO_BUTTON(selected), "Logs of _everyone");
+	dirs = log_selected_dirs(lvn);
+	if (dirs == NULL) {
+		gtk_widget_set_sensitive(selected, FALSE);
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(everyone), TRUE);
+	}
+	gtk_box_pack_start(GTK_BOX(vbox), selected, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), everyone, FALSE, FALSE, 0);
+
+	from_entry = log_export_labelled(vbox, "From (YYYY-MM-DD):", gtk_entry_new());
+	to_entry = log_export_labelled(vbox, "To (YYYY-MM-DD):", gtk_entry_new());
+
+	combo = gtk_combo_box_new_text();
+	gtk_combo_box_append_text(GTK_COMBO_BOX(combo), "JSON Lines");
+	gtk_combo_box_append_text(GTK_COMBO_BOX(combo), "Plain text");
+	gtk_combo_box_append_text(GTK_COMBO_BOX(combo), "HTML");
+	gtk_combo_box_set_active(GTK_COMBO_BOX(combo), LOG_EXPORT_JSON);
+	g_signal_connect(G_OBJECT(combo), "changed",
+	                 G_CALLBACK(log_export_format_cb), chooser);
+	log_export_labelled(vbox, "Format:", combo);
+
+	gtk_widget_show_all(vbox);
+	gtk_file_chooser_set_extra_widget(GTK_FILE_CHOOSER(chooser), vbox);
+
+	while (gtk_dialog_run(GTK_DIALOG(chooser)) == GTK_RESPONSE_ACCEPT) {
+		if (!log_export_parse_date(gtk_entry_get_text(GTK_ENTRY(from_entry)), FALSE, &from) ||
+		    !log_export_parse_date(gtk_entry_get_text(GTK_ENTRY(to_entry)), TRUE, &to)) {
+			purple_notify_error(NULL, NULL, "Could not export logs",
+			                    "Dates are written as YYYY-MM-DD.");
+			continue;
+		}
+
+		path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(chooser));
+		format = gtk_combo_box_get_active(GTK_COMBO_BOX(combo));
+		logdir = g_build_filename(purple_user_dir(), "logs", NULL);
+		log_export_window_new(lvn);
+		lvn->export = log_export_start(logdir,
+			gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(everyone)) ? NULL : dirs,
+			from, to, format, path, log_export_progress_cb,
+			log_export_done_cb, lvn);
+		g_free(logdir);
+		g_free(path);
+		break;
+	}
+
+	if (dirs != NULL)
+		g_ptr_array_free(dirs, TRUE);
+	gtk_widget_destroy(chooser);
+}
+
+gboolean
+delete_log_win_cb(GtkWidget *w, GdkEventAny *e, PidginLogViewerNew *lvn)
+{
+	log_viewers = g_list_remove(log_viewers, lvn);
+	log_export_stop(lvn);
+	log_find_stop(lvn);
+	if (lvn->search_timer != 0)
+		purple_timeout_remove(lvn->search_timer);
+	log_results_free(lvn->results);
+	if (lvn->search_log != NULL)
+		purple_log_free(lvn->search_log);
+	log_tail_stop(lvn);
+	log_render_cancel(&lvn->conv_render);
+	log_render_cancel(&lvn->search_render);
+	log_buddy_scan_free(lvn->buddy_scan);
+	g_hash_table_destroy(lvn->buddy_accounts);
+	g_hash_table_destroy(lvn->buddy_contacts);
+	log_prefix_index_free(lvn->buddy_index);
+	g_array_free(lvn->buddy_iters, TRUE);
+	g_byte_array_free(lvn->buddy_shown, TRUE);
+	g_free(lvn->buddy_filter);
+	gtk_widget_destroy(lvn->window);
+	/* The marks went with the window */
+	g_ptr_array_free(lvn->hit_marks, TRUE);
+	log_activity_report_free(lvn->activity);
+	log_timeline_free(lvn->timeline);
+	g_free(lvn->search);
+	g_free(lvn);
+	return TRUE;
+}
+
+/* The Statistics page */
+
+static void
+log_stats_refresh(PidginLogViewerNew *lvn)
+{
+	char *table = log_stats_to_table();
+
+	gtk_text_buffer_set_text(gtk_text_view_get_buffer(GTK_TEXT_VIEW(lvn->stats_view)),
+	                         table, -1);
+	g_free(table);
+}
+
+static void
+log_stats_refresh_cb(GtkWidget *button, PidginLogViewerNew *lvn)
+{
+	log_stats_refresh(lvn);
+}
+
+static void
+log_stats_reset_cb(GtkWidget *button, PidginLogViewerNew *lvn)
+{
+	log_stats_reset();
+	log_stats_refresh(lvn);
+}
+
+/* Saves the totals as tab-separated values, to set beside another build's */
+static void
+log_stats_export_cb(GtkWidget *button, PidginLogViewerNew *lvn)
+{
+	GtkWidget *chooser;
+
+	chooser = gtk_file_chooser_dialog_new("Export Statistics", GTK_WINDOW(lvn->window),
+	                                      GTK_FILE_CHOOSER_ACTION_SAVE,
+	                                      GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+	                                      GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT, NULL);
+	gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(chooser), TRUE);
+	gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(chooser), "logviewer-stats.tsv");
+
+	if (gtk_dialog_run(GTK_DIALOG(chooser)) == GTK_RESPONSE_ACCEPT) {
+		char *path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(chooser));
+		char *tsv = log_stats_to_tsv(VERSION);
+		GError *error = NULL;
+
+		if (!g_file_set_contents(path, tsv, -1, &error)) {
+			purple_notify_error(NULL, NULL, "Could not export statistics",
+			                    error->message);
+			g_error_free(error);
+		}
+		g_free(tsv);
+		g_free(path);
+	}
+	gtk_widget_destroy(chooser);
+}
+
+static void
+log_stats_page_cb(GtkNotebook *notebook, gpointer page, guint page_num,
+                  PidginLogViewerNew *lvn)
+{
+	if (gtk_notebook_get_nth_page(notebook, page_num) ==
+	    gtk_widget_get_parent(gtk_widget_get_parent(lvn->stats_view)))
+		log_stats_refresh(lvn);
+}
+
+static GtkWidget *
+log_stats_page_new(PidginLogViewerNew *lvn)
+{
+	GtkWidget *vbox, *sw, *bbox, *button;
+	PangoFontDescription *font;
+
+	lvn->stats_view = gtk_text_view_new();
+	gtk_text_view_set_editable(GTK_TEXT_VIEW(lvn->stats_view), FALSE);
+	font = pango_font_description_from_string("monospace");
+	gtk_widget_modify_font(lvn->stats_view, font);
+	pango_font_description_free(font);
+
+	sw = gtk_scrolled_window_new(NULL, NULL);
+	gtk_scrolled_window_set_shadow_type(GTK_SCROLLED_WINDOW(sw), GTK_SHADOW_IN);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(sw),
+	                               GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+	gtk_container_add(GTK_CONTAINER(sw), lvn->stats_view);
+
+	bbox = gtk_hbutton_box_new();
+	gtk_button_box_set_layout(GTK_BUTTON_BOX(bbox), GTK_BUTTONBOX_END);
+	gtk_box_set_spacing(GTK_BOX(bbox), PIDGIN_HIG_BOX_SPACE);
+
+	button = gtk_button_new_from_stock(GTK_STOCK_REFRESH);
+	g_signal_connect(G_OBJECT(button), "clicked", G_CALLBACK(log_stats_refresh_cb), lvn);
+	gtk_box_pack_start(GTK_BOX(bbox), button, FALSE, FALSE, 0);
+	button = gtk_button_new_from_stock(GTK_STOCK_CLEAR);
+	g_signal_connect(G_OBJECT(button), "clicked", G_CALLBACK(log_stats_reset_cb), lvn);
+	gtk_box_pack_start(GTK_BOX(bbox), button, FALSE, FALSE, 0);
+	button = gtk_button_new_from_stock(GTK_STOCK_SAVE_AS);
+	g_signal_connect(G_OBJECT(button), "clicked", G_CALLBACK(log_stats_export_cb), lvn);
+	gtk_box_pack_start(GTK_BOX(bbox), button, FALSE, FALSE, 0);
+
+	vbox = gtk_vbox_new(FALSE, PIDGIN_HIG_BOX_SPACE);
+	gtk_container_set_border_width(GTK_CONTAINER(vbox), PIDGIN_HIG_BORDER);
+	gtk_box_pack_start(GTK_BOX(vbox), sw, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), bbox, FALSE, FALSE, 0);
+	log_stats_refresh(lvn);
+
+	return vbox;
+}
+
+/* The Activity page */
+
+#define ACTIVITY_CELL  11   /* size of a day in the year map, less the gap */
+#define ACTIVITY_BARS  60   /* height of the tallest hour of the day */
+#define ACTIVITY_TOP   10   /* days and contacts listed as the busiest */
+
+/* Where a day of year falls in the map: a column per week, a row per weekday */
+static gboolean
+log_activity_day_cell(gint32 date, int year, int *week, int *weekday)
+{
+	struct tm tm;
+	int jan1;
+
+	if (date / 10000 != year)
+		return FALSE;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = year - 1900;
+	tm.tm_mon = date / 100 % 100 - 1;
+	tm.tm_mday = date % 100;
+	tm.tm_hour = 12;
+	tm.tm_isdst = -1;
+	mktime(&tm);
+
+	jan1 = ((tm.tm_wday - tm.tm_yday) % 7 + 7) % 7;
+	*week = (tm.tm_yday + jan1) / 7;
+	*weekday = tm.tm_wday;
+	return TRUE;
+}
+
+static gboolean
+log_activity_expose_cb(GtkWidget *area, GdkEventExpose *event, PidginLogViewerNew *lvn)
+{
+	LogActivityReport *report = lvn->activity;
+	int year = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(lvn->activity_year));
+	int top = 7 * (ACTIVITY_CELL + 2) + 14;
+	int week, weekday, month;
+	guint32 most = 0;
+	guint64 busiest = 0;
+	cairo_t *cr;
+	guint i;
+
+	if (report == NULL)
+		return FALSE;
 
-#if GTK_CHECK_VERSION(2, 20, 0)
-	{
-		gtk_spinner_stop(GTK_SPINNER(lvn->search_spinner));
-		gtk_widget_hide(lvn->search_spinner);
+	cr = gdk_cairo_create(gtk_widget_get_window(area));
+	cairo_set_source_rgb(cr, 1, 1, 1);
+	cairo_paint(cr);
+
+	/* Every day of the year, then the days anything was said over them */
+	cairo_set_source_rgb(cr, 0.92, 0.92, 0.92);
+	for (month = 1; month <= 12; month++) {
+		for (i = 1; i <= 31; i++) {
+			if (!g_date_valid_dmy(i, month, year) ||
+			    !log_activity_day_cell(year * 10000 + month * 100 + i, year,
+			                           &week, &weekday))
+				continue;
+			cairo_rectangle(cr, week * (ACTIVITY_CELL + 2), weekday * (ACTIVITY_CELL + 2),
+			                ACTIVITY_CELL, ACTIVITY_CELL);
+		}
 	}
-#endif
-                lvn->search_cancelled = TRUE;
-                return;
-        }
-	
-	lvn->search_cancelled = FALSE;
-#if GTK_CHECK_VERSION(2, 20, 0)
-	{
-		gtk_spinner_start(GTK_SPINNER(lvn->search_spinner));
-		gtk_widget_show(lvn->search_spinner);
+	cairo_fill(cr);
+
+	for (i = 0; i < report->days->len; i++) {
+		const LogActivityDay *day = &g_array_index(report->days, LogActivityDay, i);
+
+		if (day->date / 10000 == year)
+			most = MAX(most, day->messages);
 	}
-#endif
-	searchfilter = g_strdup(entrytext);
-    		
-	buddies = (GList *)purple_blist_get_buddies();
-	while(buddies != NULL)
-	{
-		bdy = buddies->data;
-		logs = purple_log_get_logs(PURPLE_LOG_IM, 
-                purple_buddy_get_name(bdy), purple_buddy_get_account(bdy));
-		l = logs;
-        
-		while(logs != NULL)
-		{
-			log = logs->data;
-                        
-                        if(log == NULL) continue;
-
-			read = purple_log_read(log, &flags);
-			
-			lvn->search_cancelled = FALSE;
-			while (gtk_events_pending()) {
-				gtk_main_iteration(); 
-                        }
-                        
-                        if( lvn->search_cancelled == TRUE ) {
-				
-                                purple_log_free(log);
-				if ( l != NULL ) {
-					g_list_free((GList*) l);
-				}
-				
-				g_free(read);
-				return;
-			}
- 		    
-			read2 = purple_markup_strip_html(read);
-                        if(*read2 && purple_strcasestr(read2,searchfilter) !=NULL)
-                        {
-                                const char *date, *bname;
-                                date = purple_utf8_strftime("%a %d %b %Y %I:%M %p",
-                                        log->tm ? log->tm : localtime(&log->time));
-                                bname = purple_contact_get_alias(purple_buddy_get_contact(bdy));
-                                if (*bname == '\0') {
-					bname = purple_buddy_get_alias(bdy);
-				}
-                                gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-                                gtk_list_store_set(GTK_LIST_STORE(model), 
-                                &iter,0,bname,1,date,2,log,-1);
-                        } else {
-                                purple_log_free(log);
-                        }
-            
-                        
-                        g_free(read);
-                        g_free(read2);
-            
-			logs = logs->next;
-		}
-                if ( l != NULL ) {
-                    g_list_free((GList*) l);
-                }
-		buddies = buddies->next;
+	for (i = 0; i < report->days->len; i++) {
+		const LogActivityDay *day = &g_array_index(report->days, LogActivityDay, i);
+		double level;
+
+		if (!log_activity_day_cell(day->date, year, &week, &weekday))
+			continue;
+
+		/* The square root keeps quiet days from fading out next to busy ones */
+		level = sqrt((double)day->messages / most);
+		cairo_set_source_rgb(cr, 0.78 - 0.68 * level, 0.90 - 0.50 * level,
+		                     0.65 - 0.50 * level);
+		cairo_rectangle(cr, week * (ACTIVITY_CELL + 2), weekday * (ACTIVITY_CELL + 2),
+		                ACTIVITY_CELL, ACTIVITY_CELL);
+		cairo_fill(cr);
 	}
-	
-	g_free(searchfilter);
-#if GTK_CHECK_VERSION(2, 20, 0)
-	{
-		gtk_spinner_stop(GTK_SPINNER(lvn->search_spinner));
-		gtk_widget_hide(lvn->search_spinner);
+
+	/* Messages by hour of the day, under the map */
+	for (i = 0; i < 24; i++)
+		busiest = MAX(busiest, report->hours[i]);
+	cairo_set_source_rgb(cr, 0.30, 0.45, 0.70);
+	for (i = 0; i < 24 && busiest > 0; i++) {
+		double height = (double)ACTIVITY_BARS * report->hours[i] / busiest;
+
+		cairo_rectangle(cr, i * 28, top + ACTIVITY_BARS - height, 24, height);
 	}
-#endif
-	lvn->search_cancelled = TRUE;
-    
-}
-static gboolean
-buddy_visible_func (GtkTreeModel *model, GtkTreeIter  *iter, gchar *ftext)
-{
-  /* Visible if row is non-empty and the string filter is found at the beginning of buddy name */
-  gchar *str;
-  gchar *ftextU;
-  gboolean visible = FALSE;
-  
-  ftextU = g_strdup(ftext);
-  g_strup(ftextU);
-    
-  gtk_tree_model_get (model, iter, 0, &str, -1);
-  g_strup(str);
-  if (str && purple_str_has_prefix(str,ftextU))
-    visible = TRUE;
-  
-  g_free (str);
-  g_free (ftextU);
-  
-  return visible;
+	cairo_fill(cr);
+
+	cairo_set_source_rgb(cr, 0.3, 0.3, 0.3);
+	cairo_set_font_size(cr, 10);
+	for (i = 0; i < 24; i += 3) {
+		char label[8];
+
+		g_snprintf(label, sizeof(label), "%02u:00", i);
+		cairo_move_to(cr, i * 28, top + ACTIVITY_BARS + 12);
+		cairo_show_text(cr, label);
+	}
+
+	cairo_destroy(cr);
+	return TRUE;
 }
 
-static gint
-purple_log_reverse_compare(gconstpointer l1, gconstpointer l2)
+/* What to call whoever has logs in dir: their contact's alias if on the list */
+static char *
+log_activity_buddy_name(PidginLogViewerNew *lvn, const char *dir)
 {
-	return -purple_log_compare(l1,l2);
-}
+	char *account_dir = g_path_get_dirname(dir);
+	char *buddy = g_path_get_basename(dir);
+	PurpleAccount *account = g_hash_table_lookup(lvn->buddy_accounts, account_dir);
+	const char *name = purple_unescape_filename(buddy);
+	PurpleBuddy *bdy = account != NULL ? purple_find_buddy(account, name) : NULL;
+	char *text;
 
-static gint
-log_compare_func (GtkTreeModel *model, GtkTreeIter  *a,
-GtkTreeIter  *b, gpointer *pointer)
-{
-  
-  PurpleLog *l1,*l2;
-  guint ret;
-  
-  gtk_tree_model_get (model, a, 2, &l1, -1);
-  gtk_tree_model_get (model, b, 2, &l2, -1);
-  
-  ret = purple_log_reverse_compare(l1,l2);   
-    
-  return ret;
+	if (bdy != NULL)
+		text = g_strdup(purple_contact_get_alias(purple_buddy_get_contact(bdy)));
+	else
+		text = g_strdup(name);
+
+	g_free(account_dir);
+	g_free(buddy);
+	return text;
 }
 
-void
-buddy_filter_change_cb(GtkWidget *entry, PidginLogViewerNew *lvn)
+static int
+log_activity_busiest_compare(gconstpointer a, gconstpointer b)
 {
-	const gchar *filter = gtk_entry_get_text(GTK_ENTRY(entry));
-	GtkTreeModel *filtermodel;
-		
-	if(*filter == '\0')
-	{
-		gtk_tree_view_set_model(GTK_TREE_VIEW(lvn->buddy_treeview),
-                GTK_TREE_MODEL(lvn->buddy_liststore));
-		return;
-	}
-	
-	filtermodel = gtk_tree_model_filter_new(
-                GTK_TREE_MODEL(lvn->buddy_liststore), NULL);
-	gtk_tree_model_filter_set_visible_func(
-                GTK_TREE_MODEL_FILTER(filtermodel),
-                (GtkTreeModelFilterVisibleFunc) buddy_visible_func,
-                (gpointer) filter, NULL);
-	
-	gtk_tree_view_set_model(GTK_TREE_VIEW(lvn->buddy_treeview),
-        GTK_TREE_MODEL(filtermodel));
-	g_object_unref(G_OBJECT(filtermodel));
+	const LogActivityDay *d1 = a, *d2 = b;
+
+	if (d1->messages != d2->messages)
+		return d1->messages > d2->messages ? -1 : 1;
+	return d1->date - d2->date;
 }
 
-void
-search_filter_changed_cb(GtkWidget *entry, PidginLogViewerNew *lvn)
+static void
+log_activity_summary(PidginLogViewerNew *lvn, GString *text)
 {
-	const gchar *filter = gtk_entry_get_text(GTK_ENTRY(entry));
-        
-	if(*filter == '\0')
-	{
-		gtk_widget_set_sensitive(lvn->search_button, FALSE);
-		return;
+	LogActivityReport *report = lvn->activity;
+	int year = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(lvn->activity_year));
+	GArray *days = g_array_new(FALSE, FALSE, sizeof(LogActivityDay));
+	guint64 year_messages = 0;
+	char *size;
+	guint i, hours[24];
+
+	if (!log_activity_is_ready(log_activity))
+		g_string_append(text, "Still counting logs; the totals are not complete yet.\n\n");
+
+	for (i = 0; i < report->days->len; i++) {
+		const LogActivityDay *day = &g_array_index(report->days, LogActivityDay, i);
+
+		if (day->date / 10000 != year)
+			continue;
+		g_array_append_val(days, *day);
+		year_messages += day->messages;
+	}
+
+	size = purple_str_size_to_units(report->bytes);
+	g_string_append_printf(text, "All years: %" G_GUINT64_FORMAT " messages (%s) on %u days\n",
+	                       report->messages, size, report->days->len);
+	g_free(size);
+	g_string_append_printf(text, "%d:      %" G_GUINT64_FORMAT " messages on %u days",
+	                       year, year_messages, days->len);
+	if (days->len > 0)
+		g_string_append_printf(text, ", %.1f a day on those days",
+		                       (double)year_messages / days->len);
+	g_string_append(text, "\n");
+
+	if (days->len > 0) {
+		g_array_sort(days, log_activity_busiest_compare);
+		g_string_append_printf(text, "\nBusiest days of %d\n", year);
+		for (i = 0; i < days->len && i < ACTIVITY_TOP; i++) {
+			const LogActivityDay *day = &g_array_index(days, LogActivityDay, i);
+
+			g_string_append_printf(text, "  %04d-%02d-%02d  %6u messages\n",
+			                       day->date / 10000, day->date / 100 % 100,
+			                       day->date % 100, day->messages);
+		}
+	}
+	g_array_free(days, TRUE);
+
+	if (report->messages > 0) {
+		guint j, k;
+
+		/* The hours ranked, by insertion since there are only 24 */
+		for (i = 0; i < 24; i++) {
+			for (j = i; j > 0 && report->hours[hours[j - 1]] < report->hours[i]; j--)
+				hours[j] = hours[j - 1];
+			hours[j] = i;
+		}
+		g_string_append(text, "\nBusiest hours\n");
+		for (k = 0; k < 5; k++)
+			g_string_append_printf(text, "  %02u:00-%02u:00  %6" G_GUINT64_FORMAT " messages\n",
+			                       hours[k], (hours[k] + 1) % 24,
+			                       report->hours[hours[k]]);
+	}
+
+	if (report->buddies->len > 1) {
+		g_string_append(text, "\nMost active contacts\n");
+		for (i = 0; i < report->buddies->len && i < ACTIVITY_TOP; i++) {
+			const LogActivityBuddy *buddy = g_ptr_array_index(report->buddies, i);
+			char *name = log_activity_buddy_name(lvn, buddy->dir);
+
+			size = purple_str_size_to_units(buddy->bytes);
+			g_string_append_printf(text, "  %-24s %8" G_GUINT64_FORMAT " messages  %s\n",
+			                       name, buddy->messages, size);
+			g_free(size);
+			g_free(name);
+		}
 	}
-	
-	gtk_widget_set_sensitive(lvn->search_button, TRUE);
 }
 
-void
-find_filter_changed_cb(GtkWidget *entry, PidginLogViewerNew *lvn)
+static void
+log_activity_refresh(PidginLogViewerNew *lvn)
 {
-        const gchar *filter = gtk_entry_get_text(GTK_ENTRY(entry));
-        
-        gtk_imhtml_search_clear(GTK_IMHTML(lvn->imhtml_conv));
-        if(*filter == '\0')
-	{
+	GPtrArray *dirs = NULL;
+	GString *text;
+
+	if (log_activity == NULL)
 		return;
-	}
-        gtk_imhtml_search_find(GTK_IMHTML(lvn->imhtml_conv), filter);
+
+	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(lvn->activity_selected)) &&
+	    (dirs = log_selected_dirs(lvn)) == NULL)
+		dirs = g_ptr_array_new_with_free_func(g_free);
+	log_activity_report_free(lvn->activity);
+	lvn->activity = log_activity_report(log_activity, dirs);
+	if (dirs != NULL)
+		g_ptr_array_free(dirs, TRUE);
+
+	text = g_string_new(NULL);
+	log_activity_summary(lvn, text);
+	gtk_text_buffer_set_text(gtk_text_view_get_buffer(GTK_TEXT_VIEW(lvn->activity_view)),
+	                         text->str, text->len);
+	g_string_free(text, TRUE);
+	gtk_widget_queue_draw(lvn->activity_map);
 }
 
-void
-delete_log_cb(GtkWidget *button, PidginLogViewerNew *lvn)
+static void
+log_activity_refresh_cb(GtkWidget *widget, PidginLogViewerNew *lvn)
 {
-        uint day, month, year;
-        
-        if(lvn->log == NULL) return;
-        
-        if (!purple_log_delete(lvn->log))
-	{
-		purple_notify_error(NULL, NULL, "Log Deletion Failed",
-		                  "Check permissions and try again.");
-                return;
-	}
-        lvn->log = NULL;
-        gtk_widget_set_sensitive(lvn->delete_button,FALSE);
-        gtk_calendar_get_date(GTK_CALENDAR(lvn->calendar),&year,&month,&day);
-        log_mark_calendar_by_month(lvn,month,year);
+	log_activity_refresh(lvn);
 }
 
-gboolean
-delete_log_win_cb(GtkWidget *w, GdkEventAny *e, PidginLogViewerNew *lvn)
+static void
+log_activity_page_cb(GtkNotebook *notebook, gpointer page, guint page_num,
+                     PidginLogViewerNew *lvn)
 {
-	lvn->search_cancelled = TRUE;
-	while(gtk_events_pending())
-	{
-		gtk_main_iteration();
-	}
-	gtk_widget_destroy(lvn->window);
-	g_free(lvn);
-	return TRUE;
+	if (gtk_notebook_get_nth_page(notebook, page_num) ==
+	    gtk_widget_get_parent(gtk_widget_get_parent(lvn->activity_view)))
+		log_activity_refresh(lvn);
 }
 
+static GtkWidget *
+log_activity_page_new(PidginLogViewerNew *lvn)
+{
+	GtkWidget *vbox, *hbox, *sw, *button;
+	PangoFontDescription *font;
+	time_t now = time(NULL);
+	struct tm *tm = localtime(&now);
+
+	hbox = gtk_hbox_new(FALSE, PIDGIN_HIG_BOX_SPACE);
+	lvn->activity_selected = gtk_check_button_new_with_mnemonic("_Selected contact only");
+	g_signal_connect(G_OBJECT(lvn->activity_selected), "toggled",
+	                 G_CALLBACK(log_activity_refresh_cb), lvn);
+	gtk_box_pack_start(GTK_BOX(hbox), lvn->activity_selected, FALSE, FALSE, 0);
+	lvn->activity_year = gtk_spin_button_new_with_range(1990, 2100, 1);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(lvn->activity_year), tm->tm_year + 1900);
+	g_signal_connect(G_OBJECT(lvn->activity_year), "value-changed",
+	                 G_CALLBACK(log_activity_refresh_cb), lvn);
+	gtk_box_pack_start(GTK_BOX(hbox), gtk_label_new("Year:"), FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(hbox), lvn->activity_year, FALSE, FALSE, 0);
+	button = gtk_button_new_from_stock(GTK_STOCK_REFRESH);
+	g_signal_connect(G_OBJECT(button), "clicked", G_CALLBACK(log_activity_refresh_cb), lvn);
+	gtk_box_pack_end(GTK_BOX(hbox), button, FALSE, FALSE, 0);
+
+	lvn->activity_map = gtk_drawing_area_new();
+	gtk_widget_set_size_request(lvn->activity_map, 53 * (ACTIVITY_CELL + 2),
+	                            7 * (ACTIVITY_CELL + 2) + 14 + ACTIVITY_BARS + 16);
+	g_signal_connect(G_OBJECT(lvn->activity_map), "expose-event",
+	                 G_CALLBACK(log_activity_expose_cb), lvn);
+
+	lvn->activity_view = gtk_text_view_new();
+	gtk_text_view_set_editable(GTK_TEXT_VIEW(lvn->activity_view), FALSE);
+	font = pango_font_description_from_string("monospace");
+	gtk_widget_modify_font(lvn->activity_view, font);
+	pango_font_description_free(font);
+
+	sw = gtk_scrolled_window_new(NULL, NULL);
+	gtk_scrolled_window_set_shadow_type(GTK_SCROLLED_WINDOW(sw), GTK_SHADOW_IN);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(sw),
+	                               GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+	gtk_container_add(GTK_CONTAINER(sw), lvn->activity_view);
+
+	vbox = gtk_vbox_new(FALSE, PIDGIN_HIG_BOX_SPACE);
+	gtk_container_set_border_width(GTK_CONTAINER(vbox), PIDGIN_HIG_BORDER);
+	gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), lvn->activity_map, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), sw, TRUE, TRUE, 0);
+
+	return vbox;
+}
 
 static void
 pidgin_log_win_show(PurplePluginAction *action)
@@ -659,10 +2637,12 @@ pidgin_log_win_show(PurplePluginAction *action)
 	GtkCellRenderer *rend;
 	GtkTreeSelection *sel1, *sel2;
 	GtkTreeViewColumn *col;
-        GtkWidget *buddy_filter_entry, *find_img;
-        GtkListStore *logsonday_liststore, *search_liststore;
+        GtkWidget *find_img, *export_button;
+        GtkTreeModel *buddy_filter;
+        GtkListStore *logsonday_liststore;
         	
 	lvn = g_new0(PidginLogViewerNew, 1);
+	log_viewers = g_list_prepend(log_viewers, lvn);
 	
         lvn->log = NULL;
 	lvn->window = window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -683,20 +2663,32 @@ pidgin_log_win_show(PurplePluginAction *action)
 	g_signal_connect(G_OBJECT(lvn->calendar), "day-selected",
 					 G_CALLBACK(log_day_selected_cb),lvn);
 	
-	buddy_filter_entry = gtk_entry_new();
+	lvn->buddy_filter_entry = gtk_entry_new();
 	
-	g_signal_connect(G_OBJECT(buddy_filter_entry), "changed",
+	g_signal_connect(G_OBJECT(lvn->buddy_filter_entry), "changed",
+                     G_CALLBACK(buddy_filter_change_cb), lvn);
+
+	lvn->buddy_names_check = gtk_check_button_new_with_mnemonic("Match _screen names");
+	g_signal_connect(G_OBJECT(lvn->buddy_names_check), "toggled",
                      G_CALLBACK(buddy_filter_change_cb), lvn);
 	
 	vbox1 = gtk_vbox_new(FALSE,PIDGIN_HIG_BOX_SPACE);
-	gtk_box_pack_start(GTK_BOX(vbox1),buddy_filter_entry,FALSE,FALSE,0);
+	gtk_box_pack_start(GTK_BOX(vbox1),lvn->buddy_filter_entry,FALSE,FALSE,0);
+	gtk_box_pack_start(GTK_BOX(vbox1),lvn->buddy_names_check,FALSE,FALSE,0);
 	
 	lvn->contact = NULL;
 	
-	lvn->buddy_liststore = gtk_list_store_new (2, G_TYPE_STRING, G_TYPE_POINTER);
+	lvn->buddy_liststore = gtk_list_store_new (BUDDY_N_COLS, G_TYPE_STRING,
+                G_TYPE_POINTER, G_TYPE_POINTER, G_TYPE_STRING, G_TYPE_BOOLEAN);
 	populate_log_tree_buddies(lvn);
-	lvn->buddy_treeview = gtk_tree_view_new_with_model (
-                GTK_TREE_MODEL (lvn->buddy_liststore));
+
+	/* Filtering only flips BUDDY_COL_SHOWN on the rows that change */
+	buddy_filter = gtk_tree_model_filter_new(
+                GTK_TREE_MODEL(lvn->buddy_liststore), NULL);
+	gtk_tree_model_filter_set_visible_column(
+                GTK_TREE_MODEL_FILTER(buddy_filter), BUDDY_COL_SHOWN);
+	lvn->buddy_treeview = gtk_tree_view_new_with_model(buddy_filter);
+	g_object_unref(buddy_filter);
 		
 	sel1 = gtk_tree_view_get_selection (GTK_TREE_VIEW (lvn->buddy_treeview));
 	g_signal_connect (G_OBJECT (sel1), "changed",
@@ -706,7 +2698,7 @@ pidgin_log_win_show(PurplePluginAction *action)
 	rend = gtk_cell_renderer_text_new();
 	gtk_tree_view_insert_column_with_attributes(
                 GTK_TREE_VIEW(lvn->buddy_treeview),-1,
-                "bname", rend, "markup", 0, NULL);
+                "bname", rend, "markup", BUDDY_COL_ALIAS, NULL);
 	gtk_tree_view_set_headers_visible (GTK_TREE_VIEW (lvn->buddy_treeview), FALSE);
 	sw = gtk_scrolled_window_new (NULL, NULL);
 	gtk_scrolled_window_set_shadow_type (GTK_SCROLLED_WINDOW (sw), GTK_SHADOW_IN);
@@ -717,6 +2709,11 @@ pidgin_log_win_show(PurplePluginAction *action)
 	gtk_container_add(GTK_CONTAINER(sw),lvn->buddy_treeview);
 	
 	gtk_box_pack_start(GTK_BOX(vbox1),lvn->calendar,FALSE,FALSE,0);
+
+	export_button = gtk_button_new_with_mnemonic("E_xport...");
+	g_signal_connect(G_OBJECT(export_button), "clicked",
+                     G_CALLBACK(log_export_cb), lvn);
+	gtk_box_pack_start(GTK_BOX(vbox1),export_button,FALSE,FALSE,0);
 	
 	frame = pidgin_create_imhtml(FALSE, &lvn->imhtml_conv, NULL, NULL);
 	gtk_widget_set_name(lvn->imhtml_conv, "pidgin_log_imhtml_conv");
@@ -793,31 +2790,51 @@ pidgin_log_win_show(PurplePluginAction *action)
 	gtk_box_pack_start(GTK_BOX(hbox2),lvn->search_button,FALSE,FALSE, 10);
 	
 	
-	search_liststore = gtk_list_store_new (
-                3, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_POINTER);
-	gtk_tree_sortable_set_sort_column_id(
-                GTK_TREE_SORTABLE(search_liststore),2,GTK_SORT_ASCENDING);
+	/* Each row is only the number of a result in lvn->results */
+	lvn->results = log_results_new(purple_prefs_get_int(PREF_MAX_RESULTS));
+	lvn->result_model = log_result_model_new();
+	log_result_model_set_results(lvn->result_model, lvn->results);
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(lvn->result_model),
+	        LOG_RESULT_MODEL_COL_DATE, GTK_SORT_ASCENDING);
 	
         lvn->search_treeview = gtk_tree_view_new_with_model(
-                GTK_TREE_MODEL (search_liststore));
+                GTK_TREE_MODEL (lvn->result_model));
+        g_object_unref(lvn->result_model);
+	/* Every row is one line; the view need not measure each of them */
+	gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(lvn->search_treeview), TRUE);
 	
-	col = gtk_tree_view_column_new_with_attributes("Contact", rend, "markup", 0, NULL);
+	col = gtk_tree_view_column_new_with_attributes("Contact", rend, "text",
+	        LOG_RESULT_MODEL_COL_CONTACT, NULL);
+	gtk_tree_view_column_set_sizing(col, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_column_set_fixed_width(col, 200);
 	gtk_tree_view_column_set_resizable(GTK_TREE_VIEW_COLUMN(col),TRUE);
-	gtk_tree_view_column_set_sort_column_id(GTK_TREE_VIEW_COLUMN(col),0);
+	gtk_tree_view_column_set_sort_column_id(GTK_TREE_VIEW_COLUMN(col),
+	        LOG_RESULT_MODEL_COL_CONTACT);
 	gtk_tree_view_append_column(GTK_TREE_VIEW(
                 lvn->search_treeview),GTK_TREE_VIEW_COLUMN(col));
     
-        col = gtk_tree_view_column_new_with_attributes("Date", rend, "markup", 1, NULL);
+        col = gtk_tree_view_column_new_with_attributes("Date", rend, "text",
+                LOG_RESULT_MODEL_COL_DATE, NULL);
+	gtk_tree_view_column_set_sizing(col, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_column_set_fixed_width(col, 200);
         gtk_tree_view_column_set_resizable(GTK_TREE_VIEW_COLUMN(col),TRUE);
 	gtk_tree_view_column_set_sort_indicator(GTK_TREE_VIEW_COLUMN(col), TRUE);
 	gtk_tree_view_column_set_sort_order(GTK_TREE_VIEW_COLUMN(col),GTK_SORT_ASCENDING);
-	gtk_tree_sortable_set_sort_func(
-                GTK_TREE_SORTABLE(search_liststore),2,
-                (GtkTreeIterCompareFunc) log_compare_func, NULL, NULL);
-        g_object_unref(search_liststore);
-	gtk_tree_view_column_set_sort_column_id(GTK_TREE_VIEW_COLUMN(col),2);
+	gtk_tree_view_column_set_sort_column_id(GTK_TREE_VIEW_COLUMN(col),
+	        LOG_RESULT_MODEL_COL_DATE);
 	gtk_tree_view_append_column(GTK_TREE_VIEW(lvn->search_treeview),
                 GTK_TREE_VIEW_COLUMN(col));
+
+	/* A line of each log the query is on, where the scan saw it */
+	rend = gtk_cell_renderer_text_new();
+	g_object_set(G_OBJECT(rend), "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+	col = gtk_tree_view_column_new_with_attributes("Context", rend, "markup",
+	        LOG_RESULT_MODEL_COL_SNIPPET, NULL);
+	gtk_tree_view_column_set_sizing(col, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_column_set_fixed_width(col, 400);
+	gtk_tree_view_column_set_expand(col, TRUE);
+	gtk_tree_view_column_set_resizable(col, TRUE);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(lvn->search_treeview), col);
 	
 	sel2 = gtk_tree_view_get_selection (GTK_TREE_VIEW (lvn->search_treeview));
 	g_signal_connect (G_OBJECT (sel2), "changed",
@@ -837,6 +2854,23 @@ pidgin_log_win_show(PurplePluginAction *action)
         gtk_widget_set_size_request(sw1, -1, 120);
 	
 	hbox3 = gtk_hbox_new(FALSE, PIDGIN_HIG_BOX_SPACE);
+	lvn->search_note = gtk_label_new(NULL);
+	gtk_box_pack_start(GTK_BOX(hbox3), lvn->search_note, FALSE, FALSE, 0);
+
+	/* Moving between the matches in the result shown */
+	lvn->hit_marks = g_ptr_array_new();
+	lvn->hit_label = gtk_label_new(NULL);
+	lvn->hit_prev = gtk_button_new_from_stock(GTK_STOCK_GO_UP);
+	lvn->hit_next = gtk_button_new_from_stock(GTK_STOCK_GO_DOWN);
+	gtk_widget_set_sensitive(lvn->hit_prev, FALSE);
+	gtk_widget_set_sensitive(lvn->hit_next, FALSE);
+	g_signal_connect(G_OBJECT(lvn->hit_prev), "clicked",
+	                 G_CALLBACK(log_hits_prev_cb), lvn);
+	g_signal_connect(G_OBJECT(lvn->hit_next), "clicked",
+	                 G_CALLBACK(log_hits_next_cb), lvn);
+	gtk_box_pack_end(GTK_BOX(hbox3), lvn->hit_next, FALSE, FALSE, 0);
+	gtk_box_pack_end(GTK_BOX(hbox3), lvn->hit_prev, FALSE, FALSE, 0);
+	gtk_box_pack_end(GTK_BOX(hbox3), lvn->hit_label, FALSE, FALSE, 0);
            
         vbox2 = gtk_vbox_new(FALSE,PIDGIN_HIG_BOX_SPACE);
 	gtk_box_pack_start(GTK_BOX(vbox2),hbox2,FALSE,FALSE,5);
@@ -853,6 +2887,14 @@ pidgin_log_win_show(PurplePluginAction *action)
 	label2 = gtk_label_new_with_mnemonic("Conversations");
 	gtk_notebook_append_page(GTK_NOTEBOOK(notebook), vbox2, label1);
 	gtk_notebook_append_page(GTK_NOTEBOOK(notebook), hbox1, label2);
+	gtk_notebook_append_page(GTK_NOTEBOOK(notebook), log_stats_page_new(lvn),
+	                         gtk_label_new_with_mnemonic("Statistics"));
+	gtk_notebook_append_page(GTK_NOTEBOOK(notebook), log_activity_page_new(lvn),
+	                         gtk_label_new_with_mnemonic("Activity"));
+	g_signal_connect(G_OBJECT(notebook), "switch-page",
+	                 G_CALLBACK(log_stats_page_cb), lvn);
+	g_signal_connect(G_OBJECT(notebook), "switch-page",
+	                 G_CALLBACK(log_activity_page_cb), lvn);
 	gtk_container_add(GTK_CONTAINER(GTK_WINDOW(window)),notebook);
 	
 	gtk_widget_show_all(lvn->window);
@@ -861,6 +2903,7 @@ pidgin_log_win_show(PurplePluginAction *action)
 		gtk_widget_hide(lvn->search_spinner);
 	}
 #endif
+	gtk_widget_hide(lvn->search_note);
 	
 	
 	
@@ -869,6 +2912,62 @@ pidgin_log_win_show(PurplePluginAction *action)
 
 
 
+static gboolean
+log_pack_done_cb(gpointer data)
+{
+	guint packed = GPOINTER_TO_UINT(g_thread_join(pack_thread));
+	char *msg;
+
+	pack_thread = NULL;
+	G_LOCK(pack_done_id);
+	pack_done_id = 0;
+	G_UNLOCK(pack_done_id);
+	msg = g_strdup_printf("%u logs were packed into monthly archives.", packed);
+	purple_notify_info(NULL, "Pack Old Logs", "Old logs have been packed", msg);
+	g_free(msg);
+	return FALSE;
+}
+
+static gpointer
+log_pack_thread(gpointer data)
+{
+	char *logdir = data;
+	time_t now = time(NULL);
+	struct tm tm = *localtime(&now);
+	guint packed;
+
+	/* The last month may still have a conversation going on into this one */
+	tm.tm_mon--;
+	if (tm.tm_mon < 0) {
+		tm.tm_mon = 11;
+		tm.tm_year--;
+	}
+	packed = log_archive_compact(logdir, tm.tm_year + 1900, tm.tm_mon, &pack_cancel);
+	g_free(logdir);
+
+	/* Held across the add, so the report cannot clear the id before it is set */
+	G_LOCK(pack_done_id);
+	if (!g_atomic_int_get(&pack_cancel))
+		pack_done_id = g_idle_add(log_pack_done_cb, NULL);
+	G_UNLOCK(pack_done_id);
+	return GUINT_TO_POINTER(packed);
+}
+
+/*
+ * Packs each buddy's logs of every month before last into one archive per
+ * month, in the background.
+ */
+static void
+log_pack_action(PurplePluginAction *action)
+{
+	if (pack_thread != NULL)
+		return;
+
+	g_atomic_int_set(&pack_cancel, 0);
+	pack_thread = g_thread_new("logpack", log_pack_thread,
+	                           g_build_filename(purple_user_dir(), "logs", NULL));
+}
+
 static GList *
 actions(PurplePlugin *plugin, gpointer context)
 {
@@ -877,11 +2976,294 @@ actions(PurplePlugin *plugin, gpointer context)
 
 	act = purple_plugin_action_new("View Logs", pidgin_log_win_show);
 	l = g_list_append(l, act);
+	act = purple_plugin_action_new("Pack Old Logs", log_pack_action);
+	l = g_list_append(l, act);
 
 	return l;
 }
 
 
+static gboolean
+index_update_cb(gpointer data)
+{
+	GHashTableIter iter;
+	gpointer path;
+
+	g_hash_table_iter_init(&iter, index_updates);
+	while (g_hash_table_iter_next(&iter, &path, NULL)) {
+		log_index_update_file(log_index, path);
+		log_activity_update_file(log_activity, path);
+	}
+	g_hash_table_remove_all(index_updates);
+
+	index_update_timer = 0;
+	return FALSE;
+}
+
+static void
+wrote_im_msg_cb(PurpleAccount *account, const char *who, char *message,
+                PurpleConversation *conv, PurpleMessageFlags flags)
+{
+	GList *l;
+
+	if (conv == NULL)
+		return;
+
+	/* By now the message is in the log; index it with the next batch */
+	for (l = conv->logs; l != NULL; l = l->next) {
+		const char *path = log_get_common_path(l->data);
+
+		if (path != NULL)
+			g_hash_table_add(index_updates, g_strdup(path));
+	}
+	if (index_update_timer == 0 && g_hash_table_size(index_updates) > 0)
+		index_update_timer = purple_timeout_add_seconds(5, index_update_cb, NULL);
+}
+
+/* Warming up */
+
+/* Brings the index and the message counts up to date, at the warmup's pace */
+static void
+warmup_sync_step(LogWarmup *warmup, gpointer data)
+{
+	log_index_sync(log_index, data, warmup);
+	log_activity_sync(log_activity, data, warmup);
+}
+
+typedef struct {
+	char  *path;
+	time_t time;
+} RecentLog;
+
+typedef struct {
+	LogWarmup  *warmup;
+	gint64      busy_since;
+	GHashTable *newest;     /**< Buddy log directory -> RecentLog */
+} RecentWalk;
+
+static void
+recent_log_free(RecentLog *recent)
+{
+	g_free(recent->path);
+	g_free(recent);
+}
+
+static gint
+recent_log_compare(gconstpointer a, gconstpointer b)
+{
+	const RecentLog *r1 = *(RecentLog * const *)a, *r2 = *(RecentLog * const *)b;
+
+	return r1->time > r2->time ? -1 : r1->time < r2->time;
+}
+
+static gboolean
+warmup_recent_cb(const char *protocol, const char *account, const char *buddy,
+                 const char *path, time_t time, LogFormat format, gpointer data)
+{
+	RecentWalk *walk = data;
+	char *dir = g_path_get_dirname(path);
+	RecentLog *recent = g_hash_table_lookup(walk->newest, dir);
+
+	if (recent == NULL) {
+		recent = g_new0(RecentLog, 1);
+		g_hash_table_insert(walk->newest, dir, recent);
+	} else {
+		g_free(dir);
+	}
+	if (recent->path == NULL || time > recent->time) {
+		g_free(recent->path);
+		recent->path = g_strdup(path);
+		recent->time = time;
+	}
+
+	return log_warmup_yield(walk->warmup, &walk->busy_since);
+}
+
+/*
+ * Lists every log, which also brings the log tree's directories into the
+ * system's cache for the buddy list, and picks out the latest log of the
+ * buddies talked to last, for the main loop to have read ahead.
+ */
+static void
+warmup_recent_step(LogWarmup *warmup, gpointer data)
+{
+	RecentWalk walk;
+	GHashTableIter iter;
+	GPtrArray *newest, *paths;
+	gpointer recent;
+	guint i;
+
+	walk.warmup = warmup;
+	walk.busy_since = 0;
+	walk.newest = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                    (GDestroyNotify)recent_log_free);
+	if (!log_file_walk(data, warmup_recent_cb, &walk)) {
+		g_hash_table_destroy(walk.newest);
+		return;
+	}
+
+	newest = g_ptr_array_new();
+	g_hash_table_iter_init(&iter, walk.newest);
+	while (g_hash_table_iter_next(&iter, NULL, &recent))
+		g_ptr_array_add(newest, recent);
+	g_ptr_array_sort(newest, recent_log_compare);
+	paths = g_ptr_array_new_with_free_func(g_free);
+	for (i = 0; i < newest->len && i < PREFETCH_LOGS; i++)
+		g_ptr_array_add(paths, g_strdup(((RecentLog *)g_ptr_array_index(newest, i))->path));
+	g_ptr_array_free(newest, TRUE);
+	g_hash_table_destroy(walk.newest);
+
+	G_LOCK(warmup_recent);
+	if (warmup_recent != NULL)
+		g_ptr_array_unref(warmup_recent);
+	warmup_recent = paths;
+	G_UNLOCK(warmup_recent);
+}
+
+/*
+ * Lets the warmup go on only while the user is away, and hands what it has
+ * found to read ahead to the prefetcher.  Without a way to tell how long
+ * the user has been idle, they are taken to be away.
+ */
+static gboolean
+warmup_check_cb(gpointer data)
+{
+	PurpleIdleUiOps *ops = purple_idle_get_ui_ops();
+	gboolean away = ops == NULL || ops->get_time_idle == NULL ||
+	                ops->get_time_idle() >= WARMUP_IDLE_SECS;
+	GPtrArray *paths = NULL;
+
+	log_warmup_set_paused(log_warmup, !away);
+
+	if (away) {
+		G_LOCK(warmup_recent);
+		paths = warmup_recent;
+		warmup_recent = NULL;
+		G_UNLOCK(warmup_recent);
+	}
+	if (paths != NULL) {
+		log_prefetch_request(log_prefetch, paths);
+		g_ptr_array_unref(paths);
+	}
+
+	return TRUE;
+}
+
+static gboolean
+plugin_load(PurplePlugin *plugin)
+{
+	char *dir, *logdir;
+
+	dir = g_build_filename(purple_user_dir(), "logviewer", "index", NULL);
+	logdir = g_build_filename(purple_user_dir(), "logs", NULL);
+	log_index = log_index_open(dir);
+	log_activity = log_activity_open();
+	g_free(dir);
+
+	log_cache = log_cache_new(SEARCH_CACHED, SEARCH_CACHE_BYTES);
+	log_prefetch = log_prefetch_new(PREFETCH_BYTES, log_prefetch_finish);
+
+	/* Nothing is read until the user is first away */
+	log_warmup = log_warmup_new();
+	log_warmup_add(log_warmup, warmup_sync_step, g_strdup(logdir), g_free);
+	log_warmup_add(log_warmup, warmup_recent_step, logdir, g_free);
+	warmup_timer = purple_timeout_add_seconds(1, warmup_check_cb, NULL);
+
+	archive_logger = purple_log_logger_new("logpack", "Packed archive", 6,
+	                                       NULL, NULL, archive_logger_finalize,
+	                                       archive_logger_list, archive_logger_read,
+	                                       archive_logger_size);
+	purple_log_logger_add(archive_logger);
+
+	index_updates = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	purple_signal_connect(purple_conversations_get_handle(), "wrote-im-msg",
+	                      plugin, PURPLE_CALLBACK(wrote_im_msg_cb), NULL);
+
+	return TRUE;
+}
+
+static gboolean
+plugin_unload(PurplePlugin *plugin)
+{
+	purple_signals_disconnect_by_handle(plugin);
+
+	/*
+	 * A window still open would keep its tail connected and its search
+	 * running into code about to be unloaded
+	 */
+	while (log_viewers != NULL)
+		delete_log_win_cb(NULL, NULL, log_viewers->data);
+
+	/* Before what the warmup and the syncs yielding to it use goes away */
+	purple_timeout_remove(warmup_timer);
+	warmup_timer = 0;
+	log_warmup_stop(log_warmup);
+
+	if (pack_thread != NULL) {
+		g_atomic_int_set(&pack_cancel, 1);
+		g_thread_join(pack_thread);
+		pack_thread = NULL;
+		G_LOCK(pack_done_id);
+		if (pack_done_id != 0)
+			g_source_remove(pack_done_id);
+		pack_done_id = 0;
+		G_UNLOCK(pack_done_id);
+	}
+	purple_log_logger_remove(archive_logger);
+	purple_log_logger_free(archive_logger);
+	archive_logger = NULL;
+
+	if (index_update_timer != 0) {
+		purple_timeout_remove(index_update_timer);
+		index_update_cb(NULL);
+	}
+	g_hash_table_destroy(index_updates);
+	index_updates = NULL;
+
+	log_index_close(log_index);
+	log_index = NULL;
+	log_activity_close(log_activity);
+	log_activity = NULL;
+	log_warmup_free(log_warmup);
+	log_warmup = NULL;
+	if (warmup_recent != NULL)
+		g_ptr_array_unref(warmup_recent);
+	warmup_recent = NULL;
+	log_cache_unref(log_cache);
+	log_cache = NULL;
+	log_prefetch_free(log_prefetch);
+	log_prefetch = NULL;
+
+	return TRUE;
+}
+
+static PurplePluginPrefFrame *
+get_plugin_pref_frame(PurplePlugin *plugin)
+{
+	PurplePluginPrefFrame *frame = purple_plugin_pref_frame_new();
+	PurplePluginPref *pref;
+
+	pref = purple_plugin_pref_new_with_name_and_label(PREF_MAX_RESULTS,
+	                                                  "Most search results to list");
+	purple_plugin_pref_set_bounds(pref, 100, 10000000);
+	purple_plugin_pref_frame_add(frame, pref);
+
+	return frame;
+}
+
+static PurplePluginUiInfo prefs_info =
+{
+	get_plugin_pref_frame,
+	0,                                            /**< page_num       */
+	NULL,                                         /**< frame          */
+
+	/* padding */
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
 static PurplePluginInfo info =
 {
 	PURPLE_PLUGIN_MAGIC,
@@ -903,13 +3285,13 @@ static PurplePluginInfo info =
 	"Tirtha Chatterjee <tirtha.p.chatterjee@gmail.com>",             /**< author         */
 	"http://thebengaliheart.wordpress.com/",                               /**< homepage       */
 
-	NULL,                                  /**< load           */
-	NULL,                                /**< unload         */
+	plugin_load,                                  /**< load           */
+	plugin_unload,                                /**< unload         */
 	NULL,                                         /**< destroy        */
 
 	NULL,                                         /**< ui_info        */
 	NULL,                                         /**< extra_info     */
-	NULL,
+	&prefs_info,                                  /**< prefs_info     */
 	actions,
 
 	/* padding */
@@ -922,6 +3304,8 @@ static PurplePluginInfo info =
 static void
 init_plugin(PurplePlugin *plugin)
 {
+	purple_prefs_add_none(PREF_ROOT);
+	purple_prefs_add_int(PREF_MAX_RESULTS, MAX_RESULTS);
 }
 
 PURPLE_INIT_PLUGIN(log_viewer, init_plugin, info)
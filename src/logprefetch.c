@@ -0,0 +1,305 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#include <string.h>
+
+#include "logprefetch.h"
+#include "logstats.h"
+
+/* No one log may take more than this share of the budget */
+#define HELD_MAX_SHARE  4
+
+typedef struct {
+	char   *path;
+	char   *text;
+	gsize   len;
+	gint64  size;      /**< Of the file when it was read */
+	gint64  mtime;
+	GList   link;      /**< In lru; data points back here */
+} HeldText;
+
+typedef struct {
+	char     *path;
+	char     *text;
+	LogFormat format;
+	gint64    size;
+	gint64    mtime;
+} ReadText;
+
+struct _LogPrefetch {
+	GHashTable *held;      /**< Path to HeldText                       */
+	GQueue      lru;       /**< HeldText, most recently used first     */
+	gsize       bytes;
+	gsize       max_bytes;
+	LogPrefetchFinishFunc finish;
+
+	GThread    *thread;
+	GMutex      lock;      /**< Guards wanted, read, stop and idle_id  */
+	GCond       wakeup;
+	GQueue      wanted;    /**< Paths still to be read                 */
+	GPtrArray  *read;      /**< ReadText waiting for the main loop     */
+	gboolean    stop;
+	guint       idle_id;
+};
+
+static void
+read_text_free(ReadText *read)
+{
+	g_free(read->path);
+	g_free(read->text);
+	g_free(read);
+}
+
+/* Keeping texts */
+
+static void
+held_free(HeldText *held)
+{
+	g_free(held->path);
+	g_free(held->text);
+	g_free(held);
+}
+
+static void
+held_drop(LogPrefetch *prefetch, HeldText *held)
+{
+	g_queue_unlink(&prefetch->lru, &held->link);
+	prefetch->bytes -= held->len;
+	/* Frees it */
+	g_hash_table_remove(prefetch->held, held->path);
+}
+
+/* Takes text */
+static void
+held_add(LogPrefetch *prefetch, const char *path, char *text,
+         gint64 size, gint64 mtime)
+{
+	HeldText *held = g_hash_table_lookup(prefetch->held, path);
+	gsize len = strlen(text);
+
+	if (held != NULL)
+		held_drop(prefetch, held);
+	if (len > prefetch->max_bytes / HELD_MAX_SHARE) {
+		g_free(text);
+		return;
+	}
+
+	while (prefetch->bytes + len > prefetch->max_bytes)
+		held_drop(prefetch, g_queue_peek_tail(&prefetch->lru));
+
+	held = g_new0(HeldText, 1);
+	held->path = g_strdup(path);
+	held->text = text;
+	held->len = len;
+	held->size = size;
+	held->mtime = mtime;
+	held->link.data = held;
+	g_queue_push_head_link(&prefetch->lru, &held->link);
+	g_hash_table_insert(prefetch->held, held->path, held);
+	prefetch->bytes += len;
+}
+
+char *
+log_prefetch_lookup(LogPrefetch *prefetch, const char *path)
+{
+	HeldText *held = g_hash_table_lookup(prefetch->held, path);
+	gint64 size, mtime;
+
+	if (held == NULL)
+		return NULL;
+
+	if (!log_file_stat(path, &size, &mtime) ||
+	    size != held->size || mtime != held->mtime) {
+		held_drop(prefetch, held);
+		return NULL;
+	}
+
+	g_queue_unlink(&prefetch->lru, &held->link);
+	g_queue_push_head_link(&prefetch->lru, &held->link);
+	return g_strndup(held->text, held->len);
+}
+
+void
+log_prefetch_insert(LogPrefetch *prefetch, const char *path, const char *text)
+{
+	gint64 size, mtime;
+
+	if (log_file_stat(path, &size, &mtime))
+		held_add(prefetch, path, g_strdup(text), size, mtime);
+}
+
+/* Reading ahead */
+
+static gboolean
+deliver_cb(gpointer data)
+{
+	LogPrefetch *prefetch = data;
+	GPtrArray *read;
+	guint i;
+
+	g_mutex_lock(&prefetch->lock);
+	read = prefetch->read;
+	prefetch->read = g_ptr_array_new_with_free_func((GDestroyNotify)read_text_free);
+	prefetch->idle_id = 0;
+	g_mutex_unlock(&prefetch->lock);
+
+	for (i = 0; i < read->len; i++) {
+		ReadText *r = g_ptr_array_index(read, i);
+		char *text = r->text;
+
+		/* Shown, and so read, in the meantime */
+		if (g_hash_table_lookup(prefetch->held, r->path) != NULL)
+			continue;
+
+		r->text = NULL;
+		if (prefetch->finish != NULL)
+			text = prefetch->finish(text, r->format);
+		held_add(prefetch, r->path, text, r->size, r->mtime);
+	}
+	g_ptr_array_free(read, TRUE);
+
+	return FALSE;
+}
+
+/* Reads and decodes one log, or returns NULL if it is gone or too big */
+static ReadText *
+read_log(LogPrefetch *prefetch, const char *path)
+{
+	char *name = g_path_get_basename(path);
+	GBytes *bytes;
+	ReadText *read;
+	LogFormat format;
+	LogStatsCounters stats = { 0 };
+	gint64 size, mtime, start, loaded;
+	gboolean ok;
+
+	ok = log_file_parse_name(name, NULL, &format);
+	g_free(name);
+
+	/* Looked at first, so a write made while reading is noticed later */
+	if (!ok || !log_file_stat(path, &size, &mtime) ||
+	    size < 0 || (guint64)size > prefetch->max_bytes / HELD_MAX_SHARE)
+		return NULL;
+
+	start = log_stats_now();
+	if ((bytes = log_file_load(path)) == NULL)
+		return NULL;
+	loaded = log_stats_now();
+
+	read = g_new0(ReadText, 1);
+	read->path = g_strdup(path);
+	read->format = format;
+	read->size = size;
+	read->mtime = mtime;
+	read->text = log_file_decode(g_bytes_get_data(bytes, NULL),
+	                             g_bytes_get_size(bytes), format);
+
+	stats.calls = 1;
+	stats.logs = 1;
+	stats.bytes = g_bytes_get_size(bytes);
+	stats.wall = loaded - start;
+	log_stats_add(LOG_STATS_READ, &stats);
+	stats.wall = log_stats_now() - loaded;
+	log_stats_add(LOG_STATS_DECODE, &stats);
+	g_bytes_unref(bytes);
+
+	return read;
+}
+
+static gpointer
+prefetch_thread(gpointer data)
+{
+	LogPrefetch *prefetch = data;
+
+	g_mutex_lock(&prefetch->lock);
+	while (!prefetch->stop) {
+		char *path = g_queue_pop_head(&prefetch->wanted);
+		ReadText *read;
+
+		if (path == NULL) {
+			g_cond_wait(&prefetch->wakeup, &prefetch->lock);
+			continue;
+		}
+
+		g_mutex_unlock(&prefetch->lock);
+		read = read_log(prefetch, path);
+		g_free(path);
+		g_mutex_lock(&prefetch->lock);
+
+		if (read == NULL)
+			continue;
+		g_ptr_array_add(prefetch->read, read);
+		if (prefetch->idle_id == 0)
+			prefetch->idle_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+			                                    deliver_cb, prefetch, NULL);
+	}
+	g_mutex_unlock(&prefetch->lock);
+
+	return NULL;
+}
+
+void
+log_prefetch_request(LogPrefetch *prefetch, GPtrArray *paths)
+{
+	guint i;
+
+	g_mutex_lock(&prefetch->lock);
+	g_queue_foreach(&prefetch->wanted, (GFunc)g_free, NULL);
+	g_queue_clear(&prefetch->wanted);
+
+	for (i = 0; i < paths->len; i++) {
+		const char *path = g_ptr_array_index(paths, i);
+
+		if (g_hash_table_lookup(prefetch->held, path) == NULL)
+			g_queue_push_tail(&prefetch->wanted, g_strdup(path));
+	}
+	g_cond_signal(&prefetch->wakeup);
+	g_mutex_unlock(&prefetch->lock);
+}
+
+LogPrefetch *
+log_prefetch_new(gsize max_bytes, LogPrefetchFinishFunc finish)
+{
+	LogPrefetch *prefetch = g_new0(LogPrefetch, 1);
+
+	prefetch->held = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	                                       (GDestroyNotify)held_free);
+	g_queue_init(&prefetch->lru);
+	prefetch->max_bytes = max_bytes;
+	prefetch->finish = finish;
+
+	g_mutex_init(&prefetch->lock);
+	g_cond_init(&prefetch->wakeup);
+	g_queue_init(&prefetch->wanted);
+	prefetch->read = g_ptr_array_new_with_free_func((GDestroyNotify)read_text_free);
+	prefetch->thread = g_thread_new("logprefetch", prefetch_thread, prefetch);
+
+	return prefetch;
+}
+
+void
+log_prefetch_free(LogPrefetch *prefetch)
+{
+	if (prefetch == NULL)
+		return;
+
+	g_mutex_lock(&prefetch->lock);
+	prefetch->stop = TRUE;
+	g_cond_signal(&prefetch->wakeup);
+	g_mutex_unlock(&prefetch->lock);
+	g_thread_join(prefetch->thread);
+
+	if (prefetch->idle_id != 0)
+		g_source_remove(prefetch->idle_id);
+	g_ptr_array_free(prefetch->read, TRUE);
+	g_queue_foreach(&prefetch->wanted, (GFunc)g_free, NULL);
+	g_queue_clear(&prefetch->wanted);
+
+	/* The queue links live inside the texts */
+	g_hash_table_destroy(prefetch->held);
+	g_mutex_clear(&prefetch->lock);
+	g_cond_clear(&prefetch->wakeup);
+	g_free(prefetch);
+}
@@ -0,0 +1,46 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGPREFETCH_H_
+#define _LOGVIEWER_LOGPREFETCH_H_
+
+#include <glib.h>
+
+#include "logfile.h"
+
+/**
+ * The decoded text of recently shown html and txt logs, kept up to a budget
+ * of bytes with the least recently used dropped first, and of logs likely to
+ * be shown next, which a worker thread reads ahead of time.  A log that has
+ * changed on disk since it was read is read again.  All calls are made from
+ * the main thread.
+ */
+typedef struct _LogPrefetch LogPrefetch;
+
+/**
+ * Called on the main loop for text read ahead, before it is kept, to do what
+ * log_file_decode() leaves undone.  Returns the text to keep, which may be
+ * text itself; it takes text.
+ */
+typedef char *(*LogPrefetchFinishFunc)(char *text, LogFormat format);
+
+LogPrefetch *log_prefetch_new(gsize max_bytes, LogPrefetchFinishFunc finish);
+
+/** Waits for the worker to finish the log it is reading. */
+void log_prefetch_free(LogPrefetch *prefetch);
+
+/** A copy of the text of path if it is held and still current, else NULL. */
+char *log_prefetch_lookup(LogPrefetch *prefetch, const char *path);
+
+/** Keeps text, just read from path, for later lookups. */
+void log_prefetch_insert(LogPrefetch *prefetch, const char *path, const char *text);
+
+/**
+ * Has the logs at paths read in the background, most wanted first, in place
+ * of any earlier ones not read yet.  Those already held are skipped.
+ */
+void log_prefetch_request(LogPrefetch *prefetch, GPtrArray *paths);
+
+#endif /* _LOGVIEWER_LOGPREFETCH_H_ */
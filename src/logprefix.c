@@ -0,0 +1,144 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#include <string.h>
+
+#include "logprefix.h"
+
+typedef struct {
+	char    *key;          /**< Folded name                          */
+	guint    row;
+	gboolean screen_name;
+} PrefixEntry;
+
+struct _LogPrefixIndex {
+	GArray  *entries;      /**< PrefixEntry, by key once sorted      */
+	gboolean dirty;        /**< Entries added since the last sort    */
+};
+
+static int
+entry_compare(gconstpointer a, gconstpointer b)
+{
+	const PrefixEntry *e1 = a, *e2 = b;
+	int cmp = strcmp(e1->key, e2->key);
+
+	if (cmp != 0)
+		return cmp;
+	return e1->row < e2->row ? -1 : e1->row > e2->row;
+}
+
+static void
+sort_entries(LogPrefixIndex *index)
+{
+	if (!index->dirty)
+		return;
+
+	g_array_sort(index->entries, entry_compare);
+	index->dirty = FALSE;
+}
+
+LogPrefixIndex *
+log_prefix_index_new(void)
+{
+	LogPrefixIndex *index = g_new0(LogPrefixIndex, 1);
+
+	index->entries = g_array_new(FALSE, FALSE, sizeof(PrefixEntry));
+
+	return index;
+}
+
+void
+log_prefix_index_free(LogPrefixIndex *index)
+{
+	guint i;
+
+	if (index == NULL)
+		return;
+
+	for (i = 0; i < index->entries->len; i++)
+		g_free(g_array_index(index->entries, PrefixEntry, i).key);
+	g_array_free(index->entries, TRUE);
+	g_free(index);
+}
+
+char *
+log_prefix_fold(const char *text)
+{
+	char *folded, *normal;
+
+	if (!g_utf8_validate(text, -1, NULL))
+		return g_ascii_strdown(text, -1);
+
+	/* Compatibility forms fold too, so "ﬁ" finds "fi" */
+	folded = g_utf8_casefold(text, -1);
+	normal = g_utf8_normalize(folded, -1, G_NORMALIZE_ALL);
+	g_free(folded);
+
+	return normal;
+}
+
+const char *
+log_prefix_index_add(LogPrefixIndex *index, const char *name, guint row,
+                     gboolean screen_name)
+{
+	PrefixEntry entry;
+
+	entry.key = log_prefix_fold(name);
+	entry.row = row;
+	entry.screen_name = screen_name;
+	g_array_append_val(index->entries, entry);
+	index->dirty = TRUE;
+
+	return entry.key;
+}
+
+/* The first position whose key is not below prefix, or past it if after */
+static guint
+bound(LogPrefixIndex *index, const char *prefix, gsize len, gboolean past)
+{
+	guint lo = 0, hi = index->entries->len;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		const char *key = g_array_index(index->entries, PrefixEntry, mid).key;
+		int cmp = strncmp(key, prefix, len);
+
+		if (cmp < 0 || (past && cmp == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+guint
+log_prefix_index_find(LogPrefixIndex *index, const char *prefix, guint *first)
+{
+	gsize len = strlen(prefix);
+	guint start, end;
+
+	sort_entries(index);
+
+	start = bound(index, prefix, len, FALSE);
+	end = bound(index, prefix, len, TRUE);
+	if (first != NULL)
+		*first = start;
+
+	return end - start;
+}
+
+guint
+log_prefix_index_get_row(LogPrefixIndex *index, guint i, gboolean *screen_name)
+{
+	const PrefixEntry *entry;
+
+	sort_entries(index);
+	entry = &g_array_index(index->entries, PrefixEntry, i);
+	if (screen_name != NULL)
+		*screen_name = entry->screen_name;
+
+	return entry->row;
+}
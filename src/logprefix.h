@@ -0,0 +1,41 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGPREFIX_H_
+#define _LOGVIEWER_LOGPREFIX_H_
+
+#include <glib.h>
+
+/**
+ * Names of rows, casefolded once and kept sorted, so that finding every row
+ * with a name starting with some text is a binary search.  A row can have
+ * several names: an alias and any number of screen names.
+ */
+typedef struct _LogPrefixIndex LogPrefixIndex;
+
+LogPrefixIndex *log_prefix_index_new(void);
+
+void log_prefix_index_free(LogPrefixIndex *index);
+
+/** Casefolds and normalizes text the way names are compared.  Free with g_free(). */
+char *log_prefix_fold(const char *text);
+
+/** Adds a name for row.  Returns it folded; the index owns it. */
+const char *log_prefix_index_add(LogPrefixIndex *index, const char *name,
+                                 guint row, gboolean screen_name);
+
+/**
+ * Finds the names starting with prefix, which must be folded already.
+ * Returns how many there are and points first at the position of the first,
+ * for use with log_prefix_index_get_row().
+ */
+guint log_prefix_index_find(LogPrefixIndex *index, const char *prefix,
+                            guint *first);
+
+/** The row of the name at position i, and whether it is a screen name. */
+guint log_prefix_index_get_row(LogPrefixIndex *index, guint i,
+                               gboolean *screen_name);
+
+#endif /* _LOGVIEWER_LOGPREFIX_H_ */
@@ -0,0 +1,539 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+/*
+ * The grammar, loosest binding first:
+ *
+ *   or    := and ( "OR" and )*
+ *   and   := unary ( [ "AND" ] unary )*
+ *   unary := "NOT" unary | "(" or ")" | term
+ *   term  := word [ "~" [ digit ] ] | "phrase" [ "~" [ digit ] ]
+ *          | from:name | with:name
+ *
+ * where name may be quoted too.  The parser never fails: operators with
+ * nothing to work on are dropped.
+ */
+
+#include <string.h>
+
+#include "logquery.h"
+
+typedef enum {
+	NODE_AND,
+	NODE_OR,
+	NODE_NOT,
+	NODE_TERM
+} NodeType;
+
+typedef struct _QueryNode QueryNode;
+
+struct _QueryNode {
+	NodeType   type;
+	GPtrArray *children;   /**< Of AND and OR; the one operand of NOT  */
+	guint      term;       /**< Of TERM, an index into terms           */
+};
+
+typedef enum {
+	TOKEN_WORD,
+	TOKEN_PHRASE,
+	TOKEN_AND,
+	TOKEN_OR,
+	TOKEN_NOT,
+	TOKEN_OPEN,
+	TOKEN_CLOSE
+} TokenType;
+
+typedef struct {
+	TokenType type;
+	char     *text;        /**< Of words and phrases                    */
+	guint     fuzz;        /**< Of words and phrases with a ~ after them */
+} Token;
+
+struct _LogQuery {
+	QueryNode *root;
+	GPtrArray *terms;      /**< LogQueryTerm                            */
+	gboolean   monotone;
+};
+
+typedef struct {
+	Token    *tokens;
+	guint     n_tokens;
+	guint     pos;
+	LogQuery *query;
+	gboolean  overflow;    /**< Ran out of term bits                    */
+} Parser;
+
+/* Tokenizing */
+
+static char *
+read_quoted(const char **p)
+{
+	const char *start = *p, *end = strchr(start, '"');
+
+	if (end == NULL) {
+		*p = start + strlen(start);
+		return g_strdup(start);
+	}
+	*p = end + 1;
+	return g_strndup(start, end - start);
+}
+
+/* Reads the digit of a ~ at *p, if there is one, after a word or phrase */
+static guint
+read_fuzz(const char **p)
+{
+	guint fuzz = 1;
+
+	(*p)++;
+	if (g_ascii_isdigit(**p))
+		fuzz = *(*p)++ - '0';
+	return fuzz;
+}
+
+/* Takes a ~ or ~N off the end of a word, for its fuzz */
+static guint
+take_fuzz(char *word)
+{
+	char *tilde = strrchr(word, '~');
+	const char *p = tilde;
+	guint fuzz;
+
+	if (tilde == NULL || tilde == word ||
+	    (tilde[1] != '\0' && (!g_ascii_isdigit(tilde[1]) || tilde[2] != '\0')))
+		return 0;
+	fuzz = read_fuzz(&p);
+	*tilde = '\0';
+	return fuzz;
+}
+
+static GArray *
+tokenize(const char *text)
+{
+	GArray *tokens = g_array_new(FALSE, FALSE, sizeof(Token));
+	const char *p = text;
+
+	while (*p != '\0') {
+		Token token = { TOKEN_WORD, NULL, 0 };
+		const char *start;
+
+		if (g_ascii_isspace(*p)) {
+			p++;
+			continue;
+		}
+
+		if (*p == '(' || *p == ')') {
+			token.type = *p == '(' ? TOKEN_OPEN : TOKEN_CLOSE;
+			p++;
+		} else if (*p == '"') {
+			p++;
+			token.type = TOKEN_PHRASE;
+			token.text = read_quoted(&p);
+			if (*p == '~')
+				token.fuzz = read_fuzz(&p);
+		} else {
+			start = p;
+			while (*p != '\0' && !g_ascii_isspace(*p) && *p != '(' && *p != ')') {
+				/* from:"Jane Doe" */
+				if (*p == '"' && p > start && p[-1] == ':') {
+					char *prefix = g_strndup(start, p - start);
+					char *name;
+
+					p++;
+					name = read_quoted(&p);
+					token.text = g_strconcat(prefix, name, NULL);
+					g_free(prefix);
+					g_free(name);
+					break;
+				}
+				p++;
+			}
+			if (token.text == NULL)
+				token.text = g_strndup(start, p - start);
+
+			if (strcmp(token.text, "AND") == 0)
+				token.type = TOKEN_AND;
+			else if (strcmp(token.text, "OR") == 0)
+				token.type = TOKEN_OR;
+			else if (strcmp(token.text, "NOT") == 0)
+				token.type = TOKEN_NOT;
+			if (token.type != TOKEN_WORD) {
+				g_free(token.text);
+				token.text = NULL;
+			} else {
+				token.fuzz = take_fuzz(token.text);
+			}
+		}
+		g_array_append_val(tokens, token);
+	}
+	return tokens;
+}
+
+/* Parsing */
+
+static void
+node_free(QueryNode *node)
+{
+	if (node == NULL)
+		return;
+	if (node->children != NULL)
+		g_ptr_array_free(node->children, TRUE);
+	g_free(node);
+}
+
+static QueryNode *
+node_new(NodeType type)
+{
+	QueryNode *node = g_new0(QueryNode, 1);
+
+	node->type = type;
+	if (type != NODE_TERM)
+		node->children = g_ptr_array_new_with_free_func((GDestroyNotify)node_free);
+	return node;
+}
+
+static void
+term_free(LogQueryTerm *term)
+{
+	g_free(term->text);
+	g_free(term->literal);
+	g_free(term);
+}
+
+/* Finds or adds the term; the same term twice shares one bit */
+static QueryNode *
+term_node(Parser *parser, LogQueryTermKind kind, const char *literal, guint fuzz)
+{
+	GPtrArray *terms = parser->query->terms;
+	LogQueryTerm *term;
+	QueryNode *node;
+	char *text;
+	guint i;
+
+	if (*literal == '\0')
+		return NULL;
+
+	text = g_ascii_strdown(literal, -1);
+	if (kind == LOG_QUERY_FROM) {
+		/* Every message line reads "(12:34:56) name: text" once stripped */
+		char *line = g_strdup_printf(") %s:", text);
+
+		g_free(text);
+		text = line;
+	}
+
+	/* Enough of the term has to be left for a match to mean anything */
+	if (kind != LOG_QUERY_TEXT || strlen(text) > LOG_QUERY_MAX_FUZZY_LEN)
+		fuzz = 0;
+	fuzz = MIN(MIN(fuzz, LOG_QUERY_MAX_FUZZ), (strlen(text) - 1) / 2);
+
+	for (i = 0; i < terms->len; i++) {
+		term = g_ptr_array_index(terms, i);
+		if (term->kind == kind && term->fuzz == fuzz && strcmp(term->text, text) == 0)
+			break;
+	}
+	if (i == terms->len) {
+		if (terms->len == LOG_QUERY_MAX_TERMS) {
+			parser->overflow = TRUE;
+			g_free(text);
+			return NULL;
+		}
+		term = g_new0(LogQueryTerm, 1);
+		term->kind = kind;
+		term->text = text;
+		term->literal = g_strdup(literal);
+		term->fuzz = fuzz;
+		g_ptr_array_add(terms, term);
+	} else {
+		g_free(text);
+	}
+
+	node = node_new(NODE_TERM);
+	node->term = i;
+	return node;
+}
+
+static Token *
+peek(Parser *parser)
+{
+	return parser->pos < parser->n_tokens ? &parser->tokens[parser->pos] : NULL;
+}
+
+static QueryNode *parse_or(Parser *parser);
+
+static QueryNode *
+parse_unary(Parser *parser)
+{
+	Token *token = peek(parser);
+	QueryNode *node, *child;
+
+	if (token == NULL)
+		return NULL;
+
+	switch (token->type) {
+	case TOKEN_NOT:
+		parser->pos++;
+		if ((child = parse_unary(parser)) == NULL)
+			return NULL;
+		node = node_new(NODE_NOT);
+		g_ptr_array_add(node->children, child);
+		parser->query->monotone = FALSE;
+		return node;
+
+	case TOKEN_OPEN:
+		parser->pos++;
+		node = parse_or(parser);
+		if ((token = peek(parser)) != NULL && token->type == TOKEN_CLOSE)
+			parser->pos++;
+		return node;
+
+	case TOKEN_PHRASE:
+		parser->pos++;
+		return term_node(parser, LOG_QUERY_TEXT, token->text, token->fuzz);
+
+	case TOKEN_WORD:
+		parser->pos++;
+		if (g_str_has_prefix(token->text, "from:"))
+			return term_node(parser, LOG_QUERY_FROM, token->text + 5, 0);
+		if (g_str_has_prefix(token->text, "with:"))
+			return term_node(parser, LOG_QUERY_WITH, token->text + 5, 0);
+		return term_node(parser, LOG_QUERY_TEXT, token->text, token->fuzz);
+
+	default:
+		/* A stray operator or ')' */
+		parser->pos++;
+		return NULL;
+	}
+}
+
+/* Wraps the operands, dropping empty ones; a lone operand stands for itself */
+static QueryNode *
+combine(NodeType type, GPtrArray *operands)
+{
+	QueryNode *node;
+
+	if (operands->len == 0) {
+		g_ptr_array_free(operands, TRUE);
+		return NULL;
+	}
+	if (operands->len == 1) {
+		node = g_ptr_array_index(operands, 0);
+		g_ptr_array_set_free_func(operands, NULL);
+		g_ptr_array_free(operands, TRUE);
+		return node;
+	}
+	node = node_new(type);
+	g_ptr_array_free(node->children, TRUE);
+	node->children = operands;
+	return node;
+}
+
+static QueryNode *
+parse_and(Parser *parser)
+{
+	GPtrArray *operands = g_ptr_array_new_with_free_func((GDestroyNotify)node_free);
+	Token *token;
+
+	while ((token = peek(parser)) != NULL &&
+	       token->type != TOKEN_OR && token->type != TOKEN_CLOSE) {
+		QueryNode *node;
+
+		if (token->type == TOKEN_AND) {
+			parser->pos++;
+			continue;
+		}
+		if ((node = parse_unary(parser)) != NULL)
+			g_ptr_array_add(operands, node);
+	}
+	return combine(NODE_AND, operands);
+}
+
+static QueryNode *
+parse_or(Parser *parser)
+{
+	GPtrArray *operands = g_ptr_array_new_with_free_func((GDestroyNotify)node_free);
+	Token *token;
+
+	for (;;) {
+		QueryNode *node = parse_and(parser);
+
+		if (node != NULL)
+			g_ptr_array_add(operands, node);
+		if ((token = peek(parser)) == NULL || token->type != TOKEN_OR)
+			break;
+		parser->pos++;
+	}
+	return combine(NODE_OR, operands);
+}
+
+LogQuery *
+log_query_parse(const char *text)
+{
+	GArray *tokens = tokenize(text);
+	Parser parser;
+	LogQuery *query = g_new0(LogQuery, 1);
+	guint i;
+
+	query->terms = g_ptr_array_new_with_free_func((GDestroyNotify)term_free);
+	query->monotone = TRUE;
+
+	parser.tokens = (Token *)tokens->data;
+	parser.n_tokens = tokens->len;
+	parser.pos = 0;
+	parser.query = query;
+	parser.overflow = FALSE;
+
+	/* A ')' with no '(' ends the expression early; parse what follows too */
+	{
+		GPtrArray *parts = g_ptr_array_new_with_free_func((GDestroyNotify)node_free);
+
+		while (parser.pos < parser.n_tokens) {
+			QueryNode *node = parse_or(&parser);
+
+			if (node != NULL)
+				g_ptr_array_add(parts, node);
+			if (parser.pos < parser.n_tokens)
+				parser.pos++;
+		}
+		query->root = combine(NODE_AND, parts);
+	}
+
+	for (i = 0; i < tokens->len; i++)
+		g_free(g_array_index(tokens, Token, i).text);
+	g_array_free(tokens, TRUE);
+
+	if (query->root == NULL || parser.overflow) {
+		log_query_free(query);
+		return NULL;
+	}
+	return query;
+}
+
+void
+log_query_free(LogQuery *query)
+{
+	if (query == NULL)
+		return;
+	node_free(query->root);
+	g_ptr_array_free(query->terms, TRUE);
+	g_free(query);
+}
+
+guint
+log_query_get_n_terms(const LogQuery *query)
+{
+	return query->terms->len;
+}
+
+const LogQueryTerm *
+log_query_get_term(const LogQuery *query, guint i)
+{
+	return g_ptr_array_index(query->terms, i);
+}
+
+static gboolean
+node_eval(const QueryNode *node, guint64 present)
+{
+	guint i;
+
+	switch (node->type) {
+	case NODE_TERM:
+		return (present >> node->term) & 1;
+	case NODE_NOT:
+		return !node_eval(g_ptr_array_index(node->children, 0), present);
+	case NODE_AND:
+		for (i = 0; i < node->children->len; i++)
+			if (!node_eval(g_ptr_array_index(node->children, i), present))
+				return FALSE;
+		return TRUE;
+	case NODE_OR:
+		for (i = 0; i < node->children->len; i++)
+			if (node_eval(g_ptr_array_index(node->children, i), present))
+				return TRUE;
+		return FALSE;
+	}
+	return FALSE;
+}
+
+gboolean
+log_query_eval(const LogQuery *query, guint64 present)
+{
+	return node_eval(query->root, present);
+}
+
+gboolean
+log_query_is_monotone(const LogQuery *query)
+{
+	return query->monotone;
+}
+
+const char *
+log_query_get_literal(const LogQuery *query)
+{
+	const LogQueryTerm *term;
+
+	if (query->root->type != NODE_TERM)
+		return NULL;
+	term = log_query_get_term(query, query->root->term);
+	return term->kind == LOG_QUERY_TEXT && term->fuzz == 0 ? term->literal : NULL;
+}
+
+/* The terms of a query that is nothing but terms ANDed together */
+static gboolean
+conjunction_terms(const LogQuery *query, GPtrArray *out)
+{
+	const QueryNode *root = query->root;
+	guint i;
+
+	if (root->type == NODE_TERM) {
+		g_ptr_array_add(out, g_ptr_array_index(query->terms, root->term));
+		return TRUE;
+	}
+	if (root->type != NODE_AND)
+		return FALSE;
+
+	for (i = 0; i < root->children->len; i++) {
+		const QueryNode *child = g_ptr_array_index(root->children, i);
+
+		if (child->type != NODE_TERM)
+			return FALSE;
+		g_ptr_array_add(out, g_ptr_array_index(query->terms, child->term));
+	}
+	return TRUE;
+}
+
+gboolean
+log_query_narrows(const LogQuery *narrow, const LogQuery *wide)
+{
+	GPtrArray *n = g_ptr_array_new(), *w = g_ptr_array_new();
+	gboolean narrows = FALSE;
+	guint i, j;
+
+	if (!conjunction_terms(narrow, n) || !conjunction_terms(wide, w))
+		goto out;
+
+	/*
+	 * Each wide term has to be implied by some narrow one.  Text near
+	 * enough to the narrow term holds text as near to any part of it.
+	 */
+	for (i = 0; i < w->len; i++) {
+		const LogQueryTerm *wt = g_ptr_array_index(w, i);
+
+		for (j = 0; j < n->len; j++) {
+			const LogQueryTerm *nt = g_ptr_array_index(n, j);
+
+			if (nt->kind == wt->kind && nt->fuzz <= wt->fuzz &&
+			    strstr(nt->text, wt->text) != NULL)
+				break;
+		}
+		if (j == n->len)
+			goto out;
+	}
+	narrows = TRUE;
+
+out:
+	g_ptr_array_free(n, TRUE);
+	g_ptr_array_free(w, TRUE);
+	return narrows;
+}
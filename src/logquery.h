@@ -0,0 +1,71 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGQUERY_H_
+#define _LOGVIEWER_LOGQUERY_H_
+
+#include <glib.h>
+
+/** Queries with more distinct terms than this are refused. */
+#define LOG_QUERY_MAX_TERMS 64
+
+/** The most edits a fuzzy term may be found with, and its longest text. */
+#define LOG_QUERY_MAX_FUZZ     3
+#define LOG_QUERY_MAX_FUZZY_LEN 63
+
+typedef enum {
+	LOG_QUERY_TEXT,     /**< A word or "quoted phrase" anywhere in the log  */
+	LOG_QUERY_FROM,     /**< from:name, a message sent by name              */
+	LOG_QUERY_WITH      /**< with:name, a conversation with name            */
+} LogQueryTermKind;
+
+typedef struct {
+	LogQueryTermKind kind;
+	char *text;         /**< What to look for, folded to ASCII lower case    */
+	char *literal;      /**< The term as it was typed, without quotes        */
+	guint fuzz;         /**< Edits it may be found with, for a word or phrase
+	                         typed with ~N after it (a bare ~ is ~1)        */
+} LogQueryTerm;
+
+/**
+ * A parsed search: terms combined with AND, OR and NOT, and parentheses.
+ * Terms next to each other are ANDed; the operators are only recognised in
+ * capitals, so "or" can still be searched for.
+ *
+ * A fuzzy term matches text that is within its number of edits of it, an
+ * edit being a byte put in, left out or changed.  Short terms get fewer
+ * edits, so that at least half of each is left to go on, and terms longer
+ * than LOG_QUERY_MAX_FUZZY_LEN none.
+ */
+typedef struct _LogQuery LogQuery;
+
+/**
+ * Parses the text of the search box.  Unbalanced quotes and parentheses are
+ * closed at the end.  Returns NULL if nothing is left to search for or if
+ * there are too many terms.
+ */
+LogQuery *log_query_parse(const char *text);
+
+void log_query_free(LogQuery *query);
+
+guint log_query_get_n_terms(const LogQuery *query);
+const LogQueryTerm *log_query_get_term(const LogQuery *query, guint i);
+
+/** Whether the query holds when exactly the terms whose bits are set occur. */
+gboolean log_query_eval(const LogQuery *query, guint64 present);
+
+/** TRUE when there is no NOT, so finding more terms never makes it false. */
+gboolean log_query_is_monotone(const LogQuery *query);
+
+/** The typed text when the query is a single exact word or phrase, else NULL. */
+const char *log_query_get_literal(const LogQuery *query);
+
+/**
+ * Whether every log matching narrow also matches wide, as when a word has
+ * been typed further or a term added.  Only plain ANDs of terms are compared.
+ */
+gboolean log_query_narrows(const LogQuery *narrow, const LogQuery *wide);
+
+#endif /* _LOGVIEWER_LOGQUERY_H_ */
@@ -0,0 +1,706 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+/*
+ * A file is opened and its size looked up before its read is started, so
+ * that the buffers of the reads in flight and of the files read but not yet
+ * given back stay within a budget.  With io_uring, its contents are read
+ * with a readv queued on the ring; up to depth of them are in flight while
+ * the caller works on those already read.  The ring is driven with the raw
+ * system calls, so nothing beyond the kernel's headers is needed.  Without
+ * it, the same reads are done by a pool of threads shared by every reader.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "logfile.h"
+#include "logreader.h"
+
+/*
+ * Bigger logs are mapped and paged in as they are matched instead, which
+ * stops as soon as the outcome is known
+ */
+#define READER_MAX_FILE  (512 << 10)
+#define READER_BUDGET    (4 << 20)  /* bytes read and not given back yet */
+#define POOL_THREADS     32
+
+typedef struct {
+	char    *path;
+	gpointer data;
+	gboolean opened;
+	int      fd;       /**< Once opened; -1 for a log not to be read here */
+	gsize    size;
+} Request;
+
+typedef struct {
+	gpointer data;
+	GBytes  *bytes;
+	gsize    held;     /**< Of the budget, until it is given back */
+} Done;
+
+typedef struct {
+	int          fd;
+	gsize        size;
+	gpointer     data;
+	GAsyncQueue *done;
+} PoolJob;
+
+#ifdef HAVE_LINUX_IO_URING_H
+typedef struct {
+	char        *path;     /**< To read it again should the ring fail */
+	gpointer     data;
+	int          fd;
+	char        *buf;
+	gsize        size;
+	gsize        got;
+	struct iovec iov;
+} Slot;
+
+typedef struct {
+	int       fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void     *sq_ring;
+	void     *cq_ring;
+	gsize     sq_ring_len;
+	gsize     cq_ring_len;
+	gsize     sqes_len;
+	guint     to_submit;   /**< Queued on the ring but not yet entered */
+} Ring;
+#endif
+
+struct _LogReader {
+	guint        depth;
+	guint        in_flight;
+	gsize        held;       /**< Bytes being read or waiting in done    */
+	GQueue       wanted;     /**< Requests not started yet               */
+	GQueue       done;       /**< Read, waiting to be given back         */
+	GAsyncQueue *pool_done;  /**< Read by the pool, or NULL with a ring  */
+
+#ifdef HAVE_LINUX_IO_URING_H
+	Ring         ring;
+	Slot        *slots;
+	guint       *free_slots;
+	guint        n_free;
+#endif
+};
+
+static GMutex       pool_lock;
+static GThreadPool *pool = NULL;
+static guint        pool_users = 0;
+
+static void
+request_free(Request *request)
+{
+	if (request->opened && request->fd >= 0)
+		close(request->fd);
+	g_free(request->path);
+	g_free(request);
+}
+
+static void
+push_done(LogReader *reader, gpointer data, GBytes *bytes, gsize held)
+{
+	Done *done = g_new(Done, 1);
+
+	done->data = data;
+	done->bytes = bytes;
+	done->held = held;
+	g_queue_push_tail(&reader->done, done);
+}
+
+/*
+ * Opens a log worth reading into memory, or returns -1 for one too big and
+ * one that is gone, which may have been packed since it was listed.
+ */
+static int
+open_log(const char *path, gsize *size)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > READER_MAX_FILE) {
+		close(fd);
+		return -1;
+	}
+	*size = st.st_size;
+	return fd;
+}
+
+/* Reads an opened log the plain way, blocking, and closes it */
+static GBytes *
+read_log(int fd, gsize size)
+{
+	gsize got = 0;
+	gssize r = 0;
+	char *buf;
+
+	buf = g_malloc(size);
+	while (got < size) {
+		r = pread(fd, buf + got, size - got, got);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		got += r;
+	}
+	close(fd);
+
+	if (r < 0) {
+		g_free(buf);
+		return NULL;
+	}
+	return g_bytes_new_take(buf, got);
+}
+
+/* The thread pool */
+
+static void
+pool_read(gpointer data, gpointer user_data)
+{
+	PoolJob *job = data;
+	Done *done = g_new(Done, 1);
+
+	done->data = job->data;
+	done->bytes = read_log(job->fd, job->size);
+	done->held = job->size;
+	g_async_queue_push(job->done, done);
+
+	g_async_queue_unref(job->done);
+	g_free(job);
+}
+
+static void
+pool_use(void)
+{
+	g_mutex_lock(&pool_lock);
+	if (pool_users++ == 0)
+		pool = g_thread_pool_new(pool_read, NULL, POOL_THREADS, FALSE, NULL);
+	g_mutex_unlock(&pool_lock);
+}
+
+static void
+pool_release(void)
+{
+	g_mutex_lock(&pool_lock);
+	if (--pool_users == 0) {
+		g_thread_pool_free(pool, FALSE, TRUE);
+		pool = NULL;
+	}
+	g_mutex_unlock(&pool_lock);
+}
+
+static void
+pool_start(LogReader *reader, Request *request)
+{
+	PoolJob *job = g_new(PoolJob, 1);
+
+	job->fd = request->fd;
+	job->size = request->size;
+	job->data = request->data;
+	job->done = g_async_queue_ref(reader->pool_done);
+	g_free(request->path);
+	g_free(request);
+
+	g_thread_pool_push(pool, job, NULL);
+	reader->in_flight++;
+}
+
+static void
+pool_wait(LogReader *reader)
+{
+	Done *done = g_async_queue_pop(reader->pool_done);
+
+	reader->in_flight--;
+	g_queue_push_tail(&reader->done, done);
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+/* io_uring */
+
+static gboolean
+ring_init(Ring *ring, guint entries)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return FALSE;
+
+	ring->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_ring_len = ring->cq_ring_len =
+			MAX(ring->sq_ring_len, ring->cq_ring_len);
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+	                     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ring = ring->sq_ring;
+	else
+		ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+		                     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if (ring->cq_ring == MAP_FAILED) {
+		munmap(ring->sq_ring, ring->sq_ring_len);
+		goto fail;
+	}
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+	                  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (ring->cq_ring != ring->sq_ring)
+			munmap(ring->cq_ring, ring->cq_ring_len);
+		munmap(ring->sq_ring, ring->sq_ring_len);
+		goto fail;
+	}
+
+	ring->sq_head = (unsigned *)((char *)ring->sq_ring + p.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq_ring + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_ring + p.sq_off.array);
+	ring->cq_head = (unsigned *)((char *)ring->cq_ring + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_ring + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + p.cq_off.cqes);
+	ring->to_submit = 0;
+	return TRUE;
+
+fail:
+	close(ring->fd);
+	return FALSE;
+}
+
+static void
+ring_free(Ring *ring)
+{
+	munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_len);
+	munmap(ring->sq_ring, ring->sq_ring_len);
+	close(ring->fd);
+}
+
+/* Queues a read of what is left of the file in slot i */
+static void
+ring_queue_read(LogReader *reader, guint i)
+{
+	Ring *ring = &reader->ring;
+	Slot *slot = &reader->slots[i];
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	slot->iov.iov_base = slot->buf + slot->got;
+	slot->iov.iov_len = slot->size - slot->got;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = slot->fd;
+	sqe->addr = (unsigned long)&slot->iov;
+	sqe->len = 1;
+	sqe->off = slot->got;
+	sqe->user_data = i;
+	ring->sq_array[index] = index;
+
+	/* The kernel must see the entry before the new tail */
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+}
+
+/* Submits what is queued and, if wait is set, waits for a completion */
+static gboolean
+ring_enter(Ring *ring, gboolean wait)
+{
+	int r;
+
+	do {
+		r = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait ? 1 : 0,
+		            wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (r < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+
+	if (r < 0)
+		return FALSE;
+	ring->to_submit -= MIN((guint)r, ring->to_submit);
+	return TRUE;
+}
+
+static void
+ring_start(LogReader *reader, Request *request)
+{
+	guint i = reader->free_slots[--reader->n_free];
+	Slot *slot = &reader->slots[i];
+
+	slot->path = request->path;
+	slot->data = request->data;
+	slot->fd = request->fd;
+	slot->size = request->size;
+	slot->got = 0;
+	slot->buf = g_malloc(slot->size);
+	g_free(request);
+
+	ring_queue_read(reader, i);
+	reader->in_flight++;
+}
+
+static void
+ring_complete(LogReader *reader, guint i, int res)
+{
+	Slot *slot = &reader->slots[i];
+
+	if (res == -EINTR || res == -EAGAIN) {
+		ring_queue_read(reader, i);
+		return;
+	}
+	if (res > 0) {
+		slot->got += res;
+		if (slot->got < slot->size) {
+			ring_queue_read(reader, i);
+			return;
+		}
+	}
+
+	/* Read in full, cut short by the file shrinking, or failed */
+	close(slot->fd);
+	if (res < 0) {
+		g_free(slot->buf);
+		push_done(reader, slot->data, NULL, slot->size);
+	} else {
+		push_done(reader, slot->data, g_bytes_new_take(slot->buf, slot->got),
+		          slot->size);
+	}
+	g_free(slot->path);
+	slot->path = NULL;
+	slot->buf = NULL;
+	reader->free_slots[reader->n_free++] = i;
+	reader->in_flight--;
+}
+
+/* Marks the user_data of a cancel, which is that of the read it is for */
+#define RING_CANCEL  ((guint64)1 << 32)
+
+/*
+ * Asks the kernel to cancel every read still in flight and waits until each
+ * has completed one way or another, so that nothing writes into their
+ * buffers any more.  FALSE if the ring would not take even that.
+ */
+static gboolean
+ring_cancel_all(LogReader *reader)
+{
+	Ring *ring = &reader->ring;
+	gboolean *open = g_new0(gboolean, reader->depth);
+	guint left = 0, next = 0, i;
+	gboolean ok = TRUE;
+
+	for (i = 0; i < reader->depth; i++)
+		if (reader->slots[i].buf != NULL) {
+			open[i] = TRUE;
+			left++;
+		}
+
+	while (left > 0) {
+		unsigned head;
+
+		/* As many cancels as the submission queue has room for */
+		for (; next < reader->depth; next++) {
+			unsigned tail = *ring->sq_tail;
+			unsigned index = tail & *ring->sq_mask;
+			struct io_uring_sqe *sqe;
+
+			if (!open[next])
+				continue;
+			if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >
+			    *ring->sq_mask)
+				break;
+			sqe = &ring->sqes[index];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = next;
+			sqe->user_data = RING_CANCEL | next;
+			ring->sq_array[index] = index;
+			__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+			ring->to_submit++;
+		}
+
+		if (!ring_enter(ring, TRUE)) {
+			ok = FALSE;
+			break;
+		}
+		while ((head = *ring->cq_head) !=
+		       __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			guint64 data = ring->cqes[head & *ring->cq_mask].user_data;
+
+			if (!(data & RING_CANCEL) && data < reader->depth && open[data]) {
+				open[data] = FALSE;
+				left--;
+			}
+			__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	g_free(open);
+	return ok;
+}
+
+/*
+ * Goes over to the thread pool when the ring stops working.  The reads in
+ * flight are cancelled and waited for before the ring is torn down, as
+ * closing it does not stop those the kernel has already started; the logs
+ * are then read again by the pool.  Should even that fail, their buffers
+ * are leaked rather than freed while they may still be written to.
+ */
+static void
+ring_abandon(LogReader *reader)
+{
+	gboolean quiet = ring_cancel_all(reader);
+	guint i;
+
+	ring_free(&reader->ring);
+	for (i = 0; i < reader->depth; i++) {
+		Slot *slot = &reader->slots[i];
+		Request *request;
+
+		if (slot->buf == NULL)
+			continue;
+		if (quiet)
+			g_free(slot->buf);
+		reader->held -= slot->size;
+
+		request = g_new(Request, 1);
+		request->path = slot->path;
+		request->data = slot->data;
+		request->opened = TRUE;
+		request->fd = slot->fd;
+		request->size = slot->size;
+		g_queue_push_head(&reader->wanted, request);
+	}
+	/* The slots hold the iovecs the kernel reads through */
+	if (quiet)
+		g_free(reader->slots);
+	g_free(reader->free_slots);
+	reader->slots = NULL;
+	reader->free_slots = NULL;
+	reader->in_flight = 0;
+
+	reader->pool_done = g_async_queue_new();
+	pool_use();
+}
+
+static void
+ring_wait(LogReader *reader)
+{
+	Ring *ring = &reader->ring;
+	gboolean waited = FALSE;
+	guint reaped = 0;
+
+	for (;;) {
+		unsigned head = *ring->cq_head;
+		struct io_uring_cqe *cqe;
+
+		if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			if (waited || reaped > 0)
+				return;
+			if (!ring_enter(ring, TRUE)) {
+				g_warning("io_uring_enter: %s", g_strerror(errno));
+				ring_abandon(reader);
+				return;
+			}
+			waited = TRUE;
+			continue;
+		}
+
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		ring_complete(reader, cqe->user_data, cqe->res);
+		__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+		reaped++;
+	}
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+/* Starts reads until depth of them are in flight or the budget is used up */
+static void
+fill(LogReader *reader)
+{
+	Request *request;
+
+	while (reader->in_flight < reader->depth &&
+	       (request = g_queue_peek_head(&reader->wanted)) != NULL) {
+		if (!request->opened) {
+			request->fd = open_log(request->path, &request->size);
+			request->opened = TRUE;
+		}
+		/* A log that does not fit waits, unless nothing else is held */
+		if (request->fd >= 0 && reader->held > 0 &&
+		    reader->held + request->size > READER_BUDGET)
+			break;
+		g_queue_pop_head(&reader->wanted);
+
+		/* Nothing to read for these */
+		if (request->fd < 0 || request->size == 0) {
+			push_done(reader, request->data,
+			          request->fd >= 0 ? g_bytes_new(NULL, 0) :
+			                             log_file_load(request->path), 0);
+			request_free(request);
+			continue;
+		}
+		reader->held += request->size;
+
+#ifdef HAVE_LINUX_IO_URING_H
+		if (reader->pool_done == NULL) {
+			ring_start(reader, request);
+			continue;
+		}
+#endif
+		pool_start(reader, request);
+	}
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (reader->pool_done == NULL && reader->ring.to_submit > 0 &&
+	    !ring_enter(&reader->ring, FALSE)) {
+		g_warning("io_uring_enter: %s", g_strerror(errno));
+		ring_abandon(reader);
+		fill(reader);
+	}
+#endif
+}
+
+static void
+wait_one(LogReader *reader)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	if (reader->pool_done == NULL) {
+		ring_wait(reader);
+		return;
+	}
+#endif
+	pool_wait(reader);
+}
+
+LogReader *
+log_reader_new(guint depth)
+{
+	LogReader *reader = g_new0(LogReader, 1);
+
+	reader->depth = MAX(depth, 1);
+	g_queue_init(&reader->wanted);
+	g_queue_init(&reader->done);
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (ring_init(&reader->ring, reader->depth)) {
+		guint i;
+
+		reader->slots = g_new0(Slot, reader->depth);
+		reader->free_slots = g_new(guint, reader->depth);
+		for (i = 0; i < reader->depth; i++)
+			reader->free_slots[i] = i;
+		reader->n_free = reader->depth;
+		return reader;
+	}
+#endif
+
+	reader->pool_done = g_async_queue_new();
+	pool_use();
+	return reader;
+}
+
+void
+log_reader_free(LogReader *reader)
+{
+	Done *done;
+
+	if (reader == NULL)
+		return;
+
+	/* Reads in flight are writing into buffers of ours */
+	while (reader->in_flight > 0)
+		wait_one(reader);
+
+	while ((done = g_queue_pop_head(&reader->done)) != NULL) {
+		if (done->bytes != NULL)
+			g_bytes_unref(done->bytes);
+		g_free(done);
+	}
+	g_queue_foreach(&reader->wanted, (GFunc)request_free, NULL);
+	g_queue_clear(&reader->wanted);
+
+	if (reader->pool_done != NULL) {
+		g_async_queue_unref(reader->pool_done);
+		pool_release();
+	}
+#ifdef HAVE_LINUX_IO_URING_H
+	else {
+		ring_free(&reader->ring);
+	}
+	g_free(reader->slots);
+	g_free(reader->free_slots);
+#endif
+	g_free(reader);
+}
+
+void
+log_reader_add(LogReader *reader, const char *path, gpointer data)
+{
+	Request *request = g_new0(Request, 1);
+
+	request->path = g_strdup(path);
+	request->data = data;
+	g_queue_push_tail(&reader->wanted, request);
+}
+
+gboolean
+log_reader_next(LogReader *reader, gpointer *data, GBytes **bytes)
+{
+	Done *done;
+
+	for (;;) {
+		fill(reader);
+		if ((done = g_queue_pop_head(&reader->done)) != NULL)
+			break;
+		if (reader->in_flight == 0)
+			return FALSE;
+		wait_one(reader);
+	}
+
+	*data = done->data;
+	*bytes = done->bytes;
+	reader->held -= done->held;
+	g_free(done);
+	return TRUE;
+}
+
+gboolean
+log_reader_is_batched(const LogReader *reader)
+{
+	return reader->pool_done == NULL;
+}
@@ -0,0 +1,42 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGREADER_H_
+#define _LOGVIEWER_LOGREADER_H_
+
+#include <glib.h>
+
+/**
+ * Reads whole log files with many reads in flight at once, so a scan over a
+ * cold page cache keeps the disk's queue full instead of waiting on one file
+ * at a time.  On Linux the reads go through io_uring; where that cannot be
+ * set up they are handed to a shared pool of threads.  Files come back in
+ * the order their reads complete.  No more than a few megabytes are read
+ * ahead of the caller; bigger logs are mapped rather than read.
+ *
+ * A reader belongs to the thread that made it.
+ */
+typedef struct _LogReader LogReader;
+
+/** depth is how many reads may be in flight at once. */
+LogReader *log_reader_new(guint depth);
+
+/** Waits for any reads still in flight and drops what they read. */
+void log_reader_free(LogReader *reader);
+
+/** Queues the file at path to be read; data comes back with its contents. */
+void log_reader_add(LogReader *reader, const char *path, gpointer data);
+
+/**
+ * Waits for the next file to have been read and gives back its data and
+ * contents; bytes is set to NULL if it could not be read.  Returns FALSE
+ * once every file added has been given back.
+ */
+gboolean log_reader_next(LogReader *reader, gpointer *data, GBytes **bytes);
+
+/** Whether reads go through io_uring rather than the thread pool. */
+gboolean log_reader_is_batched(const LogReader *reader);
+
+#endif /* _LOGVIEWER_LOGREADER_H_ */
@@ -0,0 +1,484 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#include <string.h>
+
+#include "logresultmodel.h"
+
+typedef struct {
+	gint64  time;
+	guint32 result;
+	guint32 buddy;
+} Row;
+
+struct _LogResultModel {
+	GObject      parent;
+	gint         stamp;        /**< Changes whenever iters stop being valid  */
+	LogResults  *results;
+	GArray      *rows;         /**< Row, in the order they are shown         */
+	guint        shown;        /**< Rows the views have been told about      */
+	GPtrArray   *names;        /**< Name of each buddy, by number            */
+	GPtrArray   *keys;         /**< Collation key of each name               */
+	GArray      *ranks;        /**< guint32: each buddy's place by name      */
+	gboolean     ranks_stale;  /**< Buddies were named since ranks were made */
+	gint         sort_column;  /**< A column, or GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID */
+	GtkSortType  order;
+};
+
+struct _LogResultModelClass {
+	GObjectClass parent_class;
+};
+
+static void log_result_model_tree_model_init(GtkTreeModelIface *iface);
+static void log_result_model_sortable_init(GtkTreeSortableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(LogResultModel, log_result_model, G_TYPE_OBJECT,
+	G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, log_result_model_tree_model_init)
+	G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_SORTABLE, log_result_model_sortable_init))
+
+/* Ordering */
+
+static int
+key_compare(gconstpointer a, gconstpointer b, gpointer data)
+{
+	GPtrArray *keys = data;
+
+	return strcmp(g_ptr_array_index(keys, *(const guint32 *)a),
+	              g_ptr_array_index(keys, *(const guint32 *)b));
+}
+
+/* Ranks the buddies by name, once for every batch that names new ones */
+static void
+update_ranks(LogResultModel *model)
+{
+	guint32 *by_name;
+	guint i, n = model->keys->len;
+
+	if (!model->ranks_stale)
+		return;
+
+	by_name = g_new(guint32, n);
+	for (i = 0; i < n; i++)
+		by_name[i] = i;
+	g_qsort_with_data(by_name, n, sizeof(guint32), key_compare, model->keys);
+
+	g_array_set_size(model->ranks, n);
+	for (i = 0; i < n; i++)
+		g_array_index(model->ranks, guint32, by_name[i]) = i;
+	g_free(by_name);
+
+	model->ranks_stale = FALSE;
+}
+
+/*
+ * Orders two rows by the sort column.  Ties, and rows that are not sorted,
+ * go by result number, which keeps the order the results were found in.
+ */
+static int
+row_compare(const Row *a, const Row *b, LogResultModel *model)
+{
+	int ret = 0;
+
+	if (model->sort_column == LOG_RESULT_MODEL_COL_CONTACT) {
+		guint32 r1 = g_array_index(model->ranks, guint32, a->buddy);
+		guint32 r2 = g_array_index(model->ranks, guint32, b->buddy);
+
+		ret = r1 < r2 ? -1 : r1 > r2;
+	}
+	if (ret == 0 && (model->sort_column == LOG_RESULT_MODEL_COL_CONTACT ||
+	                 model->sort_column == LOG_RESULT_MODEL_COL_DATE))
+		ret = a->time < b->time ? -1 : a->time > b->time;
+	if (ret == 0)
+		ret = a->result < b->result ? -1 : a->result > b->result;
+
+	return model->order == GTK_SORT_DESCENDING ? -ret : ret;
+}
+
+static int
+row_compare_cb(gconstpointer a, gconstpointer b, gpointer data)
+{
+	return row_compare(a, b, data);
+}
+
+static int
+position_compare_cb(gconstpointer a, gconstpointer b, gpointer data)
+{
+	LogResultModel *model = data;
+
+	return row_compare(&g_array_index(model->rows, Row, *(const gint *)a),
+	                   &g_array_index(model->rows, Row, *(const gint *)b), model);
+}
+
+/* Puts the rows in the sort order and tells the views where each went */
+static void
+sort_rows(LogResultModel *model)
+{
+	guint i, n = model->rows->len;
+	gint *order;
+	Row *old;
+	GtkTreePath *path;
+
+	if (n < 2)
+		return;
+
+	update_ranks(model);
+	order = g_new(gint, n);
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	g_qsort_with_data(order, n, sizeof(gint), position_compare_cb, model);
+
+	old = g_memdup(model->rows->data, n * sizeof(Row));
+	for (i = 0; i < n; i++)
+		g_array_index(model->rows, Row, i) = old[order[i]];
+	g_free(old);
+
+	path = gtk_tree_path_new();
+	gtk_tree_model_rows_reordered(GTK_TREE_MODEL(model), path, NULL, order);
+	gtk_tree_path_free(path);
+	g_free(order);
+}
+
+/* GtkTreeModel */
+
+static GtkTreeModelFlags
+get_flags(GtkTreeModel *tree_model)
+{
+	return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint
+get_n_columns(GtkTreeModel *tree_model)
+{
+	return LOG_RESULT_MODEL_N_COLS;
+}
+
+static GType
+get_column_type(GtkTreeModel *tree_model, gint column)
+{
+	return column == LOG_RESULT_MODEL_COL_RESULT ? G_TYPE_UINT : G_TYPE_STRING;
+}
+
+static gboolean
+set_iter(LogResultModel *model, GtkTreeIter *iter, gint i)
+{
+	if (i < 0 || (guint)i >= model->shown)
+		return FALSE;
+
+	iter->stamp = model->stamp;
+	iter->user_data = GINT_TO_POINTER(i);
+	return TRUE;
+}
+
+static gboolean
+get_iter(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path)
+{
+	if (gtk_tree_path_get_depth(path) != 1)
+		return FALSE;
+	return set_iter(LOG_RESULT_MODEL(tree_model), iter,
+	                gtk_tree_path_get_indices(path)[0]);
+}
+
+static GtkTreePath *
+get_path(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return gtk_tree_path_new_from_indices(GPOINTER_TO_INT(iter->user_data), -1);
+}
+
+static void
+get_value(GtkTreeModel *tree_model, GtkTreeIter *iter, gint column, GValue *value)
+{
+	LogResultModel *model = LOG_RESULT_MODEL(tree_model);
+	const Row *row = &g_array_index(model->rows, Row, GPOINTER_TO_INT(iter->user_data));
+	GDateTime *time;
+	const char *snippet;
+	guint matches;
+
+	g_value_init(value, get_column_type(tree_model, column));
+	switch (column) {
+	case LOG_RESULT_MODEL_COL_RESULT:
+		g_value_set_uint(value, row->result);
+		break;
+	case LOG_RESULT_MODEL_COL_CONTACT:
+		g_value_set_string(value, g_ptr_array_index(model->names, row->buddy));
+		break;
+	case LOG_RESULT_MODEL_COL_DATE:
+		/* Made only for the rows on screen */
+		time = g_date_time_new_from_unix_local(row->time);
+		g_value_take_string(value, g_date_time_format(time, "%a %d %b %Y %I:%M %p"));
+		g_date_time_unref(time);
+		break;
+	case LOG_RESULT_MODEL_COL_SNIPPET:
+		snippet = log_results_get_snippet(model->results, row->result);
+		matches = log_results_get_matches(model->results, row->result);
+		if (snippet != NULL)
+			g_value_set_string(value, snippet);
+		else if (matches > 0)
+			g_value_take_string(value, g_strdup_printf(
+				matches == 1 ? "%u match" : "%u matches", matches));
+		break;
+	}
+}
+
+static gboolean
+iter_next(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return set_iter(LOG_RESULT_MODEL(tree_model), iter,
+	                GPOINTER_TO_INT(iter->user_data) + 1);
+}
+
+static gboolean
+iter_nth_child(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent, gint n)
+{
+	if (parent != NULL)
+		return FALSE;
+	return set_iter(LOG_RESULT_MODEL(tree_model), iter, n);
+}
+
+static gboolean
+iter_children(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent)
+{
+	return iter_nth_child(tree_model, iter, parent, 0);
+}
+
+static gboolean
+iter_has_child(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return FALSE;
+}
+
+static gint
+iter_n_children(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return iter == NULL ? (gint)LOG_RESULT_MODEL(tree_model)->shown : 0;
+}
+
+static gboolean
+iter_parent(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *child)
+{
+	return FALSE;
+}
+
+static void
+log_result_model_tree_model_init(GtkTreeModelIface *iface)
+{
+	iface->get_flags = get_flags;
+	iface->get_n_columns = get_n_columns;
+	iface->get_column_type = get_column_type;
+	iface->get_iter = get_iter;
+	iface->get_path = get_path;
+	iface->get_value = get_value;
+	iface->iter_next = iter_next;
+	iface->iter_children = iter_children;
+	iface->iter_has_child = iter_has_child;
+	iface->iter_n_children = iter_n_children;
+	iface->iter_nth_child = iter_nth_child;
+	iface->iter_parent = iter_parent;
+}
+
+/* GtkTreeSortable */
+
+static gboolean
+get_sort_column_id(GtkTreeSortable *sortable, gint *sort_column_id, GtkSortType *order)
+{
+	LogResultModel *model = LOG_RESULT_MODEL(sortable);
+
+	if (sort_column_id != NULL)
+		*sort_column_id = model->sort_column;
+	if (order != NULL)
+		*order = model->order;
+	return model->sort_column != GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID &&
+	       model->sort_column != GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID;
+}
+
+static void
+set_sort_column_id(GtkTreeSortable *sortable, gint sort_column_id, GtkSortType order)
+{
+	LogResultModel *model = LOG_RESULT_MODEL(sortable);
+
+	if (model->sort_column == sort_column_id && model->order == order)
+		return;
+
+	model->sort_column = sort_column_id;
+	model->order = order;
+	gtk_tree_sortable_sort_column_changed(sortable);
+	sort_rows(model);
+}
+
+/* The columns sort themselves; there is nothing to set */
+static void
+set_sort_func(GtkTreeSortable *sortable, gint sort_column_id,
+              GtkTreeIterCompareFunc func, gpointer data, GDestroyNotify destroy)
+{
+}
+
+static void
+set_default_sort_func(GtkTreeSortable *sortable, GtkTreeIterCompareFunc func,
+                      gpointer data, GDestroyNotify destroy)
+{
+}
+
+static gboolean
+has_default_sort_func(GtkTreeSortable *sortable)
+{
+	return FALSE;
+}
+
+static void
+log_result_model_sortable_init(GtkTreeSortableIface *iface)
+{
+	iface->get_sort_column_id = get_sort_column_id;
+	iface->set_sort_column_id = set_sort_column_id;
+	iface->set_sort_func = set_sort_func;
+	iface->set_default_sort_func = set_default_sort_func;
+	iface->has_default_sort_func = has_default_sort_func;
+}
+
+/* GObject */
+
+static void
+log_result_model_finalize(GObject *object)
+{
+	LogResultModel *model = LOG_RESULT_MODEL(object);
+
+	g_array_free(model->rows, TRUE);
+	g_ptr_array_free(model->names, TRUE);
+	g_ptr_array_free(model->keys, TRUE);
+	g_array_free(model->ranks, TRUE);
+
+	G_OBJECT_CLASS(log_result_model_parent_class)->finalize(object);
+}
+
+static void
+log_result_model_class_init(LogResultModelClass *klass)
+{
+	G_OBJECT_CLASS(klass)->finalize = log_result_model_finalize;
+}
+
+static void
+log_result_model_init(LogResultModel *model)
+{
+	model->stamp = g_random_int();
+	model->rows = g_array_new(FALSE, FALSE, sizeof(Row));
+	model->names = g_ptr_array_new_with_free_func(g_free);
+	model->keys = g_ptr_array_new_with_free_func(g_free);
+	model->ranks = g_array_new(FALSE, FALSE, sizeof(guint32));
+	model->sort_column = GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;
+	model->order = GTK_SORT_ASCENDING;
+}
+
+/* Public */
+
+LogResultModel *
+log_result_model_new(void)
+{
+	return g_object_new(LOG_TYPE_RESULT_MODEL, NULL);
+}
+
+void
+log_result_model_clear(LogResultModel *model)
+{
+	GtkTreePath *path = gtk_tree_path_new_from_indices(0, -1);
+
+	/* From the end, so every row is where the views think it is */
+	while (model->shown > 0) {
+		model->shown--;
+		gtk_tree_path_get_indices(path)[0] = model->shown;
+		gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), path);
+	}
+	gtk_tree_path_free(path);
+
+	g_array_set_size(model->rows, 0);
+	model->stamp++;
+}
+
+void
+log_result_model_set_results(LogResultModel *model, LogResults *results)
+{
+	log_result_model_clear(model);
+	g_ptr_array_set_size(model->names, 0);
+	g_ptr_array_set_size(model->keys, 0);
+	g_array_set_size(model->ranks, 0);
+	model->ranks_stale = FALSE;
+	model->results = results;
+}
+
+guint
+log_result_model_get_n_buddies(LogResultModel *model)
+{
+	return model->names->len;
+}
+
+void
+log_result_model_add_buddy(LogResultModel *model, const char *name)
+{
+	g_ptr_array_add(model->names, g_strdup(name));
+	g_ptr_array_add(model->keys, g_utf8_collate_key(name, -1));
+	model->ranks_stale = TRUE;
+}
+
+void
+log_result_model_append(LogResultModel *model, const guint *results, guint n)
+{
+	GArray *merged;
+	Row *batch;
+	guint *at;
+	guint i, j, k, old = model->rows->len;
+	GtkTreePath *path;
+	GtkTreeIter iter;
+
+	if (n == 0)
+		return;
+
+	batch = g_new(Row, n);
+	for (i = 0; i < n; i++) {
+		batch[i].time = log_results_get_time(model->results, results[i]);
+		batch[i].result = results[i];
+		batch[i].buddy = log_results_get_buddy(model->results, results[i]);
+	}
+	update_ranks(model);
+	g_qsort_with_data(batch, n, sizeof(Row), row_compare_cb, model);
+
+	/* Merges the sorted batch in, noting where each new row lands */
+	merged = g_array_sized_new(FALSE, FALSE, sizeof(Row), old + n);
+	at = g_new(guint, n);
+	for (i = j = k = 0; i < old || j < n; k++) {
+		const Row *row = &g_array_index(model->rows, Row, i);
+
+		if (j < n && (i == old || row_compare(&batch[j], row, model) < 0)) {
+			at[j] = k;
+			g_array_append_val(merged, batch[j]);
+			j++;
+		} else {
+			g_array_append_val(merged, *row);
+			i++;
+		}
+	}
+	g_array_free(model->rows, TRUE);
+	model->rows = merged;
+
+	/*
+	 * The new rows are announced first to last; the rows before each one
+	 * are then just as the views have been told.
+	 */
+	path = gtk_tree_path_new_from_indices(0, -1);
+	for (j = 0; j < n; j++) {
+		model->shown++;
+		gtk_tree_path_get_indices(path)[0] = at[j];
+		set_iter(model, &iter, at[j]);
+		gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), path, &iter);
+	}
+	gtk_tree_path_free(path);
+
+	g_free(at);
+	g_free(batch);
+}
+
+guint
+log_result_model_get_result(LogResultModel *model, GtkTreeIter *iter)
+{
+	g_return_val_if_fail(iter->stamp == model->stamp, 0);
+
+	return g_array_index(model->rows, Row, GPOINTER_TO_INT(iter->user_data)).result;
+}
@@ -0,0 +1,65 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGRESULTMODEL_H_
+#define _LOGVIEWER_LOGRESULTMODEL_H_
+
+#include <gtk/gtk.h>
+
+#include "logresults.h"
+
+/**
+ * A flat GtkTreeModel over a LogResults, for the search result list.  Each
+ * row is a few words in one array: the result's number, its time and its
+ * buddy.  A buddy's name is ranked once among the buddies' names, so sorting
+ * by contact or date only ever compares integers.  Rows come in batches and
+ * are merged into place whatever the sort order, and any row is found by
+ * its position at once.
+ *
+ * Rows hold result numbers only; the LogResults must outlive them.
+ */
+#define LOG_TYPE_RESULT_MODEL    (log_result_model_get_type())
+#define LOG_RESULT_MODEL(obj)    (G_TYPE_CHECK_INSTANCE_CAST((obj), LOG_TYPE_RESULT_MODEL, \
+                                                             LogResultModel))
+#define LOG_IS_RESULT_MODEL(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), LOG_TYPE_RESULT_MODEL))
+
+typedef struct _LogResultModel LogResultModel;
+typedef struct _LogResultModelClass LogResultModelClass;
+
+/* Columns, which are also the sort column ids */
+enum {
+	LOG_RESULT_MODEL_COL_RESULT,   /**< guint, the number in the LogResults */
+	LOG_RESULT_MODEL_COL_CONTACT,  /**< string, the buddy's name            */
+	LOG_RESULT_MODEL_COL_DATE,     /**< string, when the log began          */
+	LOG_RESULT_MODEL_COL_SNIPPET,  /**< string, markup of the query in context */
+	LOG_RESULT_MODEL_N_COLS
+};
+
+GType log_result_model_get_type(void);
+
+LogResultModel *log_result_model_new(void);
+
+/** Drops every row and buddy name, and lists results of results from now on. */
+void log_result_model_set_results(LogResultModel *model, LogResults *results);
+
+/** Drops every row but keeps the buddy names, as when results is filtered. */
+void log_result_model_clear(LogResultModel *model);
+
+/** How many buddies have been given names. */
+guint log_result_model_get_n_buddies(LogResultModel *model);
+
+/** Names the next buddy of the LogResults, in the order they are numbered. */
+void log_result_model_add_buddy(LogResultModel *model, const char *name);
+
+/**
+ * Adds a row for each of the n result numbers, each where the sort order
+ * puts it.  Their buddies must have been named.
+ */
+void log_result_model_append(LogResultModel *model, const guint *results, guint n);
+
+/** The result number of the row at iter. */
+guint log_result_model_get_result(LogResultModel *model, GtkTreeIter *iter);
+
+#endif /* _LOGVIEWER_LOGRESULTMODEL_H_ */
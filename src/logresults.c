@@ -0,0 +1,209 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#include <string.h>
+
+#include "logresults.h"
+
+typedef struct {
+	const char *name;     /**< In names, or NULL for a log that is not a file */
+	const char *snippet;  /**< In names, or NULL                               */
+	gint64      time;
+	guint32     buddy;
+	guint32     matches;
+	guint32     first;    /**< Its first place in positions                    */
+	guint32     n_positions;
+} LogResult;
+
+struct _LogResults {
+	GArray       *results;   /**< LogResult, in the order they were added */
+	GPtrArray    *buddies;   /**< Buddy log directories, by number        */
+	GHashTable   *buddy_ids; /**< Buddy log directory -> its number + 1   */
+	GStringChunk *names;     /**< File names and snippets of the logs     */
+	GArray       *positions; /**< LogMatchPos, a run of them per result   */
+	guint         cap;
+	guint         dropped;
+};
+
+LogResults *
+log_results_new(guint cap)
+{
+	LogResults *results = g_new0(LogResults, 1);
+
+	results->results = g_array_new(FALSE, FALSE, sizeof(LogResult));
+	results->buddies = g_ptr_array_new_with_free_func(g_free);
+	results->buddy_ids = g_hash_table_new(g_str_hash, g_str_equal);
+	results->names = g_string_chunk_new(4096);
+	results->positions = g_array_new(FALSE, FALSE, sizeof(LogMatchPos));
+	results->cap = cap;
+
+	return results;
+}
+
+void
+log_results_free(LogResults *results)
+{
+	if (results == NULL)
+		return;
+
+	g_array_free(results->results, TRUE);
+	g_hash_table_destroy(results->buddy_ids);
+	g_ptr_array_free(results->buddies, TRUE);
+	g_string_chunk_free(results->names);
+	g_array_free(results->positions, TRUE);
+	g_free(results);
+}
+
+gint
+log_results_add(LogResults *results, const char *buddy_dir, const char *name,
+                time_t time, guint matches)
+{
+	LogResult result;
+	guint id;
+
+	if (results->cap > 0 && results->results->len >= results->cap) {
+		results->dropped++;
+		return -1;
+	}
+
+	id = GPOINTER_TO_UINT(g_hash_table_lookup(results->buddy_ids, buddy_dir));
+	if (id == 0) {
+		char *dir = g_strdup(buddy_dir);
+
+		g_ptr_array_add(results->buddies, dir);
+		id = results->buddies->len;
+		g_hash_table_insert(results->buddy_ids, dir, GUINT_TO_POINTER(id));
+	}
+
+	memset(&result, 0, sizeof(result));
+	result.name = name != NULL ? g_string_chunk_insert(results->names, name) : NULL;
+	result.time = time;
+	result.buddy = id - 1;
+	result.matches = matches;
+	g_array_append_val(results->results, result);
+
+	return results->results->len - 1;
+}
+
+gint
+log_results_add_path(LogResults *results, const char *path, time_t time,
+                     guint matches)
+{
+	char *dir = g_path_get_dirname(path);
+	char *name = g_path_get_basename(path);
+	gint i = log_results_add(results, dir, name, time, matches);
+
+	g_free(dir);
+	g_free(name);
+	return i;
+}
+
+guint
+log_results_length(const LogResults *results)
+{
+	return results->results->len;
+}
+
+guint
+log_results_get_dropped(const LogResults *results)
+{
+	return results->dropped;
+}
+
+guint
+log_results_get_buddy(const LogResults *results, guint i)
+{
+	return g_array_index(results->results, LogResult, i).buddy;
+}
+
+guint
+log_results_get_n_buddies(const LogResults *results)
+{
+	return results->buddies->len;
+}
+
+const char *
+log_results_get_buddy_dir(const LogResults *results, guint buddy)
+{
+	return g_ptr_array_index(results->buddies, buddy);
+}
+
+const char *
+log_results_get_name(const LogResults *results, guint i)
+{
+	return g_array_index(results->results, LogResult, i).name;
+}
+
+time_t
+log_results_get_time(const LogResults *results, guint i)
+{
+	return g_array_index(results->results, LogResult, i).time;
+}
+
+guint
+log_results_get_matches(const LogResults *results, guint i)
+{
+	return g_array_index(results->results, LogResult, i).matches;
+}
+
+void
+log_results_set_positions(LogResults *results, guint i, const char *snippet,
+                          const LogMatchPos *positions, guint n)
+{
+	LogResult *result = &g_array_index(results->results, LogResult, i);
+
+	/* What it had is left behind; results are not set again often */
+	result->snippet = snippet != NULL ?
+	                  g_string_chunk_insert(results->names, snippet) : NULL;
+	result->first = results->positions->len;
+	result->n_positions = n;
+	g_array_append_vals(results->positions, positions, n);
+}
+
+const char *
+log_results_get_snippet(const LogResults *results, guint i)
+{
+	return g_array_index(results->results, LogResult, i).snippet;
+}
+
+const LogMatchPos *
+log_results_get_positions(const LogResults *results, guint i, guint *n)
+{
+	const LogResult *result = &g_array_index(results->results, LogResult, i);
+
+	*n = result->n_positions;
+	if (result->n_positions == 0)
+		return NULL;
+	return &g_array_index(results->positions, LogMatchPos, result->first);
+}
+
+char *
+log_results_get_path(const LogResults *results, guint i)
+{
+	const LogResult *result = &g_array_index(results->results, LogResult, i);
+
+	if (result->name == NULL)
+		return NULL;
+	return g_build_filename(g_ptr_array_index(results->buddies, result->buddy),
+	                        result->name, NULL);
+}
+
+guint
+log_results_filter(LogResults *results, LogResultsFilterFunc func, gpointer data)
+{
+	guint i, kept = 0;
+
+	for (i = 0; i < results->results->len; i++) {
+		if (!func(results, i, data))
+			continue;
+		if (kept != i)
+			g_array_index(results->results, LogResult, kept) =
+				g_array_index(results->results, LogResult, i);
+		kept++;
+	}
+	g_array_set_size(results->results, kept);
+
+	return kept;
+}
@@ -0,0 +1,88 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGRESULTS_H_
+#define _LOGVIEWER_LOGRESULTS_H_
+
+#include <time.h>
+#include <glib.h>
+
+#include "logmatch.h"
+
+/**
+ * The logs a search found, packed into one array a few words per log: the
+ * buddy's log directory, kept once however many of its logs there are, the
+ * log's file name, when it began and how often the query was found in it,
+ * and where the scan saw it if the log was read.
+ * Nothing is kept that could be made again from those, so the viewer only
+ * lists a buddy's logs for the one result that is opened.
+ *
+ * Results are numbered in the order they were added, from 0.
+ */
+typedef struct _LogResults LogResults;
+
+/** Decides whether result i stays in log_results_filter(). */
+typedef gboolean (*LogResultsFilterFunc)(LogResults *results, guint i, gpointer data);
+
+/** Holds at most cap results, or any number if cap is 0. */
+LogResults *log_results_new(guint cap);
+
+void log_results_free(LogResults *results);
+
+/**
+ * Adds the log called name in buddy_dir.  name is NULL for a log that is not
+ * a file, which is then known only by its time.  matches is 0 if it was not
+ * counted.  Returns the new result's number, or -1 if the store is full.
+ */
+gint log_results_add(LogResults *results, const char *buddy_dir, const char *name,
+                     time_t time, guint matches);
+
+/** Adds the log file at path, as log_results_add() does. */
+gint log_results_add_path(LogResults *results, const char *path, time_t time,
+                          guint matches);
+
+guint log_results_length(const LogResults *results);
+
+/** How many logs were turned away since the store filled up. */
+guint log_results_get_dropped(const LogResults *results);
+
+/**
+ * The number of result i's buddy.  Buddies are numbered from 0 as their
+ * first result is added, up to log_results_get_n_buddies().
+ */
+guint log_results_get_buddy(const LogResults *results, guint i);
+guint log_results_get_n_buddies(const LogResults *results);
+const char *log_results_get_buddy_dir(const LogResults *results, guint buddy);
+
+/** The file name of result i, or NULL if it is not a file. */
+const char *log_results_get_name(const LogResults *results, guint i);
+time_t log_results_get_time(const LogResults *results, guint i);
+guint log_results_get_matches(const LogResults *results, guint i);
+
+/**
+ * Keeps the snippet and the n places the scan found the query at for result
+ * i, replacing any it had.
+ */
+void log_results_set_positions(LogResults *results, guint i, const char *snippet,
+                               const LogMatchPos *positions, guint n);
+
+/** The markup of a line around the query in result i, or NULL. */
+const char *log_results_get_snippet(const LogResults *results, guint i);
+
+/** Where the query is in result i, with n set to how many; NULL if not known. */
+const LogMatchPos *log_results_get_positions(const LogResults *results, guint i,
+                                             guint *n);
+
+/** The full path of result i, or NULL if it is not a file.  Free with g_free(). */
+char *log_results_get_path(const LogResults *results, guint i);
+
+/**
+ * Keeps only the results func accepts, renumbering them in the same order.
+ * Buddies keep their numbers.  Returns how many are left.
+ */
+guint log_results_filter(LogResults *results, LogResultsFilterFunc func,
+                         gpointer data);
+
+#endif /* _LOGVIEWER_LOGRESULTS_H_ */
@@ -0,0 +1,877 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+/*
+ * Each search gets one worker thread per core.  Every worker owns a deque of
+ * work items: the log root expands into account directories, those into
+ * buddy directories and those into log files and archives.  A worker pushes
+ * what it expands onto the front of its own deque and pops from there, so it
+ * keeps working through one buddy; a worker that runs dry steals from the
+ * back of another's deque, which is where the biggest unexpanded items sit.
+ * With an index, the search starts from the logs it names instead of the
+ * log root.
+ */
+
+#include <string.h>
+
+#include "logarchive.h"
+#include "logcache.h"
+#include "logmatch.h"
+#include "logquery.h"
+#include "logreader.h"
+#include "logsearch.h"
+
+#define HIT_BATCH_SIZE   64
+#define HIT_BATCH_USEC   (50 * 1000)
+#define MAX_WORKERS      16
+#define READ_DEPTH       32     /* reads each worker keeps in flight       */
+#define READ_BATCH       64     /* log files a worker takes on at once     */
+
+typedef enum {
+	ITEM_INDEX,
+	ITEM_ROOT,
+	ITEM_PROTOCOL,
+	ITEM_ACCOUNT,
+	ITEM_BUDDY,
+	ITEM_FILE,
+	ITEM_ARCHIVE
+} ItemType;
+
+typedef struct {
+	ItemType type;
+	char    *path;
+} WorkItem;
+
+/* A log file being scanned */
+typedef struct {
+	char     *path;
+	time_t    time;
+	LogFormat format;
+	gboolean  have_stat;   /**< size and mtime are known, for the cache */
+	gint64    size;
+	gint64    mtime;
+	char     *buddy;       /**< Who it is with, for with: terms         */
+} ScanLog;
+
+typedef struct {
+	LogSearch *search;
+	LogReader *reader;      /**< Only ever used by the worker's thread    */
+	GMutex     lock;
+	GQueue     items;
+	GPtrArray *hits;        /**< Found since the last hand-over           */
+	GArray    *positions;   /**< LogMatchPos in the log last matched      */
+	gint64     last_flush;
+	guint      rand;
+
+	LogStatsCounters list;  /**< Added to the totals when the worker ends */
+	LogStatsCounters read;
+	LogStatsCounters match;
+	gint64     n_scanned;   /**< Logs looked at, read or not              */
+	gint64     n_hits;
+} Worker;
+
+struct _LogSearch {
+	volatile gint ref;
+	volatile gint cancelled;
+	volatile gint pending;  /**< Items queued or being worked on        */
+	volatile gint running;  /**< Workers that have not exited yet       */
+
+	LogMatcher *matcher;
+	LogIndex   *index;      /**< Names the logs to read, if given         */
+	char       *literal;    /**< What to look up in it                    */
+
+	LogCache       *cache;   /**< Where to store the outcome, if anywhere  */
+	char           *query;
+	LogCacheResult *prior;   /**< What the last scan for query found       */
+	LogCacheResult *fresh;   /**< What this one has found, under lock      */
+	volatile gint   uncacheable; /**< A hit could not be recorded or a log
+	                                 could not be read                   */
+
+	Worker    *workers;
+	guint      n_workers;
+
+	GMutex     lock;        /**< Guards hits, finished, idle_id, done   */
+	GCond      wakeup;
+	GPtrArray *hits;        /**< Waiting to be handed to the main loop  */
+	gboolean   finished;
+	gboolean   done;        /**< done_cb has been made                  */
+	guint      idle_id;
+	gint64     started;
+	LogStatsCounters stats; /**< Of the whole search, under lock        */
+
+	LogSearchHitsFunc hits_cb;
+	LogSearchDoneFunc done_cb;
+	gpointer          data;
+};
+
+static void
+work_item_free(WorkItem *item)
+{
+	g_free(item->path);
+	g_free(item);
+}
+
+void
+log_search_hit_free(LogSearchHit *hit)
+{
+	if (hit == NULL)
+		return;
+	g_free(hit->path);
+	g_free(hit->snippet);
+	if (hit->positions != NULL)
+		g_array_free(hit->positions, TRUE);
+	g_free(hit);
+}
+
+static LogSearch *
+log_search_ref(LogSearch *search)
+{
+	g_atomic_int_inc(&search->ref);
+	return search;
+}
+
+static void
+log_search_unref(LogSearch *search)
+{
+	guint i;
+
+	if (!g_atomic_int_dec_and_test(&search->ref))
+		return;
+
+	for (i = 0; i < search->n_workers; i++) {
+		Worker *w = &search->workers[i];
+
+		g_queue_foreach(&w->items, (GFunc)work_item_free, NULL);
+		g_queue_clear(&w->items);
+		g_ptr_array_free(w->hits, TRUE);
+		g_array_free(w->positions, TRUE);
+		g_mutex_clear(&w->lock);
+	}
+	g_free(search->workers);
+	g_ptr_array_free(search->hits, TRUE);
+	g_mutex_clear(&search->lock);
+	g_cond_clear(&search->wakeup);
+	log_matcher_free(search->matcher);
+	log_index_unref(search->index);
+	g_free(search->literal);
+	log_cache_result_unref(search->prior);
+	log_cache_result_unref(search->fresh);
+	g_free(search->query);
+	log_cache_unref(search->cache);
+	g_free(search);
+}
+
+/* Matching */
+
+/* The name of the buddy a log is with, from its directory */
+static char *
+log_buddy_name(const char *path)
+{
+	char *dir = g_path_get_dirname(path);
+	char *escaped = g_path_get_basename(dir);
+	char *name = g_uri_unescape_string(escaped, NULL);
+
+	g_free(dir);
+	if (name == NULL)
+		return escaped;
+	g_free(escaped);
+	return name;
+}
+
+/*
+ * Whether the matcher may find anything in the log at path at all.  Only
+ * with: terms need to know who the log is with; buddy is set for them.
+ */
+static gboolean
+log_wanted(const LogMatcher *matcher, const char *path, char **buddy)
+{
+	*buddy = NULL;
+	if (matcher == NULL)
+		return FALSE;
+	if (!log_matcher_wants_buddy(matcher))
+		return TRUE;
+	*buddy = log_buddy_name(path);
+	return log_matcher_may_match(matcher, *buddy);
+}
+
+/*
+ * Matching stops as soon as the outcome is known, or for a log that matches
+ * once w->positions has as many places as it can hold
+ */
+static gboolean
+bytes_match(Worker *w, const char *buddy, GBytes *bytes, LogFormat format)
+{
+	gint64 start = log_stats_now();
+	gboolean found;
+
+	found = log_matcher_match_positions(w->search->matcher, buddy,
+	                                    g_bytes_get_data(bytes, NULL),
+	                                    g_bytes_get_size(bytes), format, w->positions);
+	w->match.calls++;
+	w->match.wall += log_stats_now() - start;
+	w->match.bytes += g_bytes_get_size(bytes);
+	w->match.logs++;
+	w->match.hits += found;
+	return found;
+}
+
+static void
+count_read(Worker *w, gint64 start, GBytes *bytes)
+{
+	w->read.calls++;
+	w->read.wall += log_stats_now() - start;
+	if (bytes != NULL) {
+		w->read.bytes += g_bytes_get_size(bytes);
+		w->read.logs++;
+	}
+}
+
+/* Handing hits over to the main loop */
+
+static gboolean
+deliver_cb(gpointer data)
+{
+	LogSearch *search = data;
+	GPtrArray *hits;
+	gboolean finished, report_done;
+
+	g_mutex_lock(&search->lock);
+	hits = search->hits;
+	search->hits = g_ptr_array_new_with_free_func((GDestroyNotify)log_search_hit_free);
+	finished = search->finished;
+	report_done = finished && !search->done;
+	search->done |= finished;
+	search->idle_id = 0;
+	if (report_done) {
+		search->stats.calls = 1;
+		search->stats.wall = log_stats_now() - search->started;
+	}
+	g_mutex_unlock(&search->lock);
+
+	/* Every worker has added its share by now */
+	if (report_done)
+		log_stats_add(LOG_STATS_SEARCH, &search->stats);
+
+	if (!g_atomic_int_get(&search->cancelled)) {
+		if (hits->len > 0 && search->hits_cb != NULL)
+			search->hits_cb(search, hits, search->data);
+		if (report_done && search->done_cb != NULL &&
+		    !g_atomic_int_get(&search->cancelled))
+			search->done_cb(search, search->data);
+	}
+	g_ptr_array_free(hits, TRUE);
+
+	return FALSE;
+}
+
+/* Called with search->lock held */
+static void
+schedule_delivery(LogSearch *search)
+{
+	if (search->idle_id == 0)
+		search->idle_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, deliver_cb,
+		                                  log_search_ref(search),
+		                                  (GDestroyNotify)log_search_unref);
+}
+
+static void
+flush_hits(Worker *w, gboolean force)
+{
+	LogSearch *search = w->search;
+	gint64 now = g_get_monotonic_time();
+	guint i;
+
+	if (w->hits->len == 0 ||
+	    (!force && w->hits->len < HIT_BATCH_SIZE && now - w->last_flush < HIT_BATCH_USEC))
+		return;
+
+	g_mutex_lock(&search->lock);
+	for (i = 0; i < w->hits->len; i++)
+		g_ptr_array_add(search->hits, g_ptr_array_index(w->hits, i));
+	schedule_delivery(search);
+	g_mutex_unlock(&search->lock);
+
+	/* The shared array owns them now */
+	g_ptr_array_set_free_func(w->hits, NULL);
+	g_ptr_array_set_size(w->hits, 0);
+	g_ptr_array_set_free_func(w->hits, (GDestroyNotify)log_search_hit_free);
+	w->last_flush = now;
+}
+
+/* Work items */
+
+static void
+push_item(Worker *w, ItemType type, char *path)
+{
+	WorkItem *item = g_new(WorkItem, 1);
+
+	item->type = type;
+	item->path = path;
+
+	g_atomic_int_inc(&w->search->pending);
+	g_mutex_lock(&w->lock);
+	g_queue_push_head(&w->items, item);
+	g_mutex_unlock(&w->lock);
+}
+
+static WorkItem *
+pop_item(Worker *w)
+{
+	WorkItem *item;
+
+	g_mutex_lock(&w->lock);
+	item = g_queue_pop_head(&w->items);
+	g_mutex_unlock(&w->lock);
+
+	return item;
+}
+
+static WorkItem *
+steal_item(Worker *w)
+{
+	LogSearch *search = w->search;
+	guint i, start;
+
+	w->rand = w->rand * 1103515245 + 12345;
+	start = (w->rand >> 16) % search->n_workers;
+
+	for (i = 0; i < search->n_workers; i++) {
+		Worker *victim = &search->workers[(start + i) % search->n_workers];
+		WorkItem *item;
+
+		if (victim == w)
+			continue;
+		g_mutex_lock(&victim->lock);
+		item = g_queue_pop_tail(&victim->items);
+		g_mutex_unlock(&victim->lock);
+		if (item != NULL)
+			return item;
+	}
+	return NULL;
+}
+
+static void
+expand_dir(Worker *w, WorkItem *item)
+{
+	gint64 start = log_stats_now();
+	GDir *dir = g_dir_open(item->path, 0, NULL);
+	const char *name;
+
+	if (dir == NULL)
+		return;
+
+	while ((name = g_dir_read_name(dir)) != NULL) {
+		switch (item->type) {
+		case ITEM_ROOT:
+			push_item(w, ITEM_PROTOCOL, g_build_filename(item->path, name, NULL));
+			break;
+		case ITEM_PROTOCOL:
+			push_item(w, ITEM_ACCOUNT, g_build_filename(item->path, name, NULL));
+			break;
+		case ITEM_ACCOUNT:
+			/* Chats and the system log are not IM conversations */
+			if (g_str_has_suffix(name, ".chat") || strcmp(name, ".system") == 0)
+				break;
+			push_item(w, ITEM_BUDDY, g_build_filename(item->path, name, NULL));
+			break;
+		case ITEM_BUDDY:
+			if (log_file_parse_name(name, NULL, NULL))
+				push_item(w, ITEM_FILE, g_build_filename(item->path, name, NULL));
+			else if (log_archive_parse_name(name, NULL, NULL))
+				push_item(w, ITEM_ARCHIVE, g_build_filename(item->path, name, NULL));
+			break;
+		case ITEM_INDEX:
+		case ITEM_FILE:
+		case ITEM_ARCHIVE:
+			break;
+		}
+	}
+	g_dir_close(dir);
+
+	w->list.calls++;
+	w->list.wall += log_stats_now() - start;
+}
+
+/*
+ * Deals out the logs the index says the query may be in, each to be read and
+ * matched, or goes through the whole log tree if it cannot tell.
+ */
+static void
+expand_index(Worker *w, WorkItem *item)
+{
+	LogSearch *search = w->search;
+	gint64 start = log_stats_now();
+	GPtrArray *hits = log_index_query(search->index, search->literal);
+	guint i;
+
+	if (hits == NULL) {
+		push_item(w, ITEM_ROOT, g_strdup(item->path));
+		return;
+	}
+	for (i = 0; i < hits->len; i++) {
+		LogIndexHit *hit = g_ptr_array_index(hits, i);
+
+		push_item(&search->workers[i % search->n_workers], ITEM_FILE, hit->path);
+		hit->path = NULL;
+	}
+	g_ptr_array_free(hits, TRUE);
+
+	w->list.calls++;
+	w->list.wall += log_stats_now() - start;
+}
+
+/*
+ * With a cache, the log is looked at before it is read: if it is as the last
+ * scan for the query saw it, the answer from then stands.  A packed log is in
+ * archive at entry.  Returns whether found was settled that way, with where
+ * the query was in a hit as the cache has it.
+ */
+static gboolean
+log_known(Worker *w, ScanLog *log, const LogArchive *archive, guint entry,
+          gboolean *found, const char **snippet,
+          const LogMatchPos **positions, guint *n_positions)
+{
+	LogSearch *search = w->search;
+
+	w->n_scanned++;
+	if (search->cache == NULL)
+		return FALSE;
+
+	if (archive != NULL) {
+		log->size = log_archive_get_size(archive, entry);
+		log->mtime = log_archive_get_mtime(archive, entry);
+		log->have_stat = TRUE;
+	} else {
+		log->have_stat = log_file_stat(log->path, &log->size, &log->mtime);
+	}
+	return log->have_stat && search->prior != NULL &&
+	       log_cache_result_check(search->prior, log->path, log->size,
+	                              log->mtime, found, snippet, positions,
+	                              n_positions);
+}
+
+/*
+ * Records a hit on log, found at the n_positions places at positions, with
+ * snippet, which is taken; they are NULL and 0 if it is not known where
+ */
+static void
+add_hit(Worker *w, const ScanLog *log, char *snippet,
+        const LogMatchPos *positions, guint n_positions)
+{
+	LogSearch *search = w->search;
+	LogSearchHit *hit;
+
+	if (log->have_stat) {
+		g_mutex_lock(&search->lock);
+		log_cache_result_add(search->fresh, log->path, log->size, log->mtime,
+		                     snippet, positions, n_positions);
+		g_mutex_unlock(&search->lock);
+	} else if (search->cache != NULL) {
+		g_atomic_int_set(&search->uncacheable, 1);
+	}
+
+	hit = g_new(LogSearchHit, 1);
+	hit->path = g_strdup(log->path);
+	hit->time = log->time;
+	hit->format = log->format;
+	hit->snippet = snippet;
+	hit->positions = NULL;
+	if (n_positions > 0) {
+		hit->positions = g_array_sized_new(FALSE, FALSE, sizeof(LogMatchPos),
+		                                   n_positions);
+		g_array_append_vals(hit->positions, positions, n_positions);
+	}
+	g_ptr_array_add(w->hits, hit);
+	w->n_hits++;
+}
+
+/* Records a hit on log, just matched as bytes with its places in w->positions */
+static void
+add_match(Worker *w, const ScanLog *log, GBytes *bytes)
+{
+	char *snippet = NULL;
+
+	if (w->positions->len > 0)
+		snippet = log_matcher_snippet(g_bytes_get_data(bytes, NULL),
+		                              g_bytes_get_size(bytes), log->format,
+		                              &g_array_index(w->positions, LogMatchPos, 0));
+	add_hit(w, log, snippet, (const LogMatchPos *)w->positions->data,
+	        w->positions->len);
+}
+
+static void
+scan_log_free(ScanLog *log)
+{
+	g_free(log->path);
+	g_free(log->buddy);
+	g_free(log);
+}
+
+/* Settles the log at path from the cache, or has it read */
+static void
+queue_file(Worker *w, const char *path)
+{
+	char *name = g_path_get_basename(path);
+	ScanLog *log = g_new0(ScanLog, 1);
+	const LogMatchPos *positions;
+	const char *snippet;
+	guint n_positions;
+	gboolean ok, found;
+
+	ok = log_file_parse_name(name, &log->time, &log->format);
+	g_free(name);
+	log->path = g_strdup(path);
+
+	if (!ok) {
+		scan_log_free(log);
+		return;
+	}
+	if (log_known(w, log, NULL, 0, &found, &snippet, &positions, &n_positions)) {
+		if (found)
+			add_hit(w, log, g_strdup(snippet), positions, n_positions);
+		scan_log_free(log);
+		return;
+	}
+	if (!log_wanted(w->search->matcher, path, &log->buddy)) {
+		scan_log_free(log);
+		return;
+	}
+	log_reader_add(w->reader, path, log);
+}
+
+static WorkItem *
+pop_file_item(Worker *w)
+{
+	WorkItem *item;
+
+	g_mutex_lock(&w->lock);
+	item = g_queue_peek_head(&w->items);
+	if (item != NULL && item->type == ITEM_FILE)
+		g_queue_pop_head(&w->items);
+	else
+		item = NULL;
+	g_mutex_unlock(&w->lock);
+
+	return item;
+}
+
+/*
+ * Scans first and the log files queued after it together, so that many of
+ * them are being read at once while those already read are matched.
+ */
+static void
+scan_files(Worker *w, WorkItem *first)
+{
+	LogSearch *search = w->search;
+	WorkItem *item;
+	ScanLog *log;
+	GBytes *bytes;
+	gint n_more = 0;
+	gint64 start;
+
+	queue_file(w, first->path);
+	while (n_more + 1 < READ_BATCH && (item = pop_file_item(w)) != NULL) {
+		queue_file(w, item->path);
+		work_item_free(item);
+		n_more++;
+	}
+
+	for (start = log_stats_now();
+	     log_reader_next(w->reader, (gpointer *)&log, &bytes);
+	     start = log_stats_now()) {
+		count_read(w, start, bytes);
+		/* A log that could not be read must not be cached as a miss */
+		if (bytes == NULL && search->cache != NULL)
+			g_atomic_int_set(&search->uncacheable, 1);
+		/* Once cancelled, what is in flight is only waited for */
+		if (bytes != NULL && !g_atomic_int_get(&search->cancelled) &&
+		    bytes_match(w, log->buddy, bytes, log->format))
+			add_match(w, log, bytes);
+		if (bytes != NULL)
+			g_bytes_unref(bytes);
+		scan_log_free(log);
+	}
+
+	/* The caller accounts for first */
+	g_atomic_int_add(&search->pending, -n_more);
+}
+
+/* Reads and matches the log packed in archive at entry */
+static void
+scan_packed_log(Worker *w, ScanLog *log, const LogArchive *archive, guint entry)
+{
+	GBytes *bytes;
+	char *buddy;
+	gint64 start;
+
+	if (log_wanted(w->search->matcher, log->path, &buddy)) {
+		start = log_stats_now();
+		bytes = log_archive_read(archive, entry);
+		count_read(w, start, bytes);
+		if (bytes != NULL) {
+			if (bytes_match(w, buddy, bytes, log->format))
+				add_match(w, log, bytes);
+			g_bytes_unref(bytes);
+		} else if (w->search->cache != NULL) {
+			g_atomic_int_set(&w->search->uncacheable, 1);
+		}
+	}
+	g_free(buddy);
+}
+
+static void
+scan_packed(Worker *w, const char *path, time_t time, LogFormat format,
+            const LogArchive *archive, guint entry)
+{
+	ScanLog log;
+	const LogMatchPos *positions;
+	const char *snippet;
+	guint n_positions;
+	gboolean found;
+
+	memset(&log, 0, sizeof(log));
+	log.path = (char *)path;
+	log.time = time;
+	log.format = format;
+	if (!log_known(w, &log, archive, entry, &found, &snippet, &positions,
+	               &n_positions))
+		scan_packed_log(w, &log, archive, entry);
+	else if (found)
+		add_hit(w, &log, g_strdup(snippet), positions, n_positions);
+}
+
+/*
+ * Goes through every log of an archive with it opened once.  A log also found
+ * loose, left over from packing cut short, is scanned as a file instead.
+ */
+static void
+scan_archive(Worker *w, WorkItem *item)
+{
+	LogArchive *archive = log_archive_open(item->path);
+	char *dir = g_path_get_dirname(item->path);
+	guint i;
+
+	for (i = 0; archive != NULL && i < log_archive_get_n_logs(archive); i++) {
+		const char *name = log_archive_get_name(archive, i);
+		char *path = g_build_filename(dir, name, NULL);
+		LogFormat format;
+
+		if (log_file_parse_name(name, NULL, &format) &&
+		    !g_file_test(path, G_FILE_TEST_EXISTS))
+			scan_packed(w, path, log_archive_get_time(archive, i), format,
+			            archive, i);
+		g_free(path);
+
+		if (g_atomic_int_get(&w->search->cancelled))
+			break;
+	}
+	log_archive_close(archive);
+	g_free(dir);
+}
+
+static gpointer
+worker_thread(gpointer data)
+{
+	Worker *w = data;
+	LogSearch *search = w->search;
+	gint64 cpu = log_stats_cpu_now();
+
+	w->reader = log_reader_new(READ_DEPTH);
+
+	while (!g_atomic_int_get(&search->cancelled)) {
+		WorkItem *item = pop_item(w);
+
+		if (item == NULL)
+			item = steal_item(w);
+
+		if (item == NULL) {
+			/* Someone may still be expanding a directory into new work */
+			g_mutex_lock(&search->lock);
+			if (g_atomic_int_get(&search->pending) == 0) {
+				g_mutex_unlock(&search->lock);
+				break;
+			}
+			g_cond_wait_until(&search->wakeup, &search->lock,
+			                  g_get_monotonic_time() + 1000);
+			g_mutex_unlock(&search->lock);
+			continue;
+		}
+
+		if (item->type == ITEM_FILE)
+			scan_files(w, item);
+		else if (item->type == ITEM_ARCHIVE)
+			scan_archive(w, item);
+		else if (item->type == ITEM_INDEX)
+			expand_index(w, item);
+		else
+			expand_dir(w, item);
+		work_item_free(item);
+
+		if (g_atomic_int_dec_and_test(&search->pending)) {
+			g_mutex_lock(&search->lock);
+			g_cond_broadcast(&search->wakeup);
+			g_mutex_unlock(&search->lock);
+		}
+		flush_hits(w, FALSE);
+	}
+
+	flush_hits(w, TRUE);
+	log_reader_free(w->reader);
+	w->reader = NULL;
+
+	log_stats_add(LOG_STATS_LIST, &w->list);
+	log_stats_add(LOG_STATS_READ, &w->read);
+	log_stats_add(LOG_STATS_MATCH, &w->match);
+	g_mutex_lock(&search->lock);
+	search->stats.cpu += log_stats_cpu_now() - cpu;
+	search->stats.bytes += w->read.bytes;
+	search->stats.logs += w->n_scanned;
+	search->stats.hits += w->n_hits;
+	g_mutex_unlock(&search->lock);
+
+	if (g_atomic_int_dec_and_test(&search->running)) {
+		/*
+		 * Only a scan that got through every log is worth keeping; one
+		 * cancelled near the end still drains its items without matching
+		 */
+		if (search->cache != NULL && g_atomic_int_get(&search->pending) == 0 &&
+		    !g_atomic_int_get(&search->cancelled) &&
+		    !g_atomic_int_get(&search->uncacheable)) {
+			log_cache_store(search->cache, search->query, search->fresh);
+			search->fresh = NULL;
+		}
+
+		g_mutex_lock(&search->lock);
+		search->finished = TRUE;
+		schedule_delivery(search);
+		g_mutex_unlock(&search->lock);
+	}
+	log_search_unref(search);
+
+	return NULL;
+}
+
+static LogSearch *
+log_search_new(const char *query, LogSearchHitsFunc hits_cb,
+               LogSearchDoneFunc done_cb, gpointer data)
+{
+	LogSearch *search = g_new0(LogSearch, 1);
+	guint i;
+
+	search->ref = 1;
+	search->started = log_stats_now();
+	search->matcher = log_matcher_new(query);
+	search->hits_cb = hits_cb;
+	search->done_cb = done_cb;
+	search->data = data;
+	search->hits = g_ptr_array_new_with_free_func((GDestroyNotify)log_search_hit_free);
+	g_mutex_init(&search->lock);
+	g_cond_init(&search->wakeup);
+
+	search->n_workers = CLAMP(g_get_num_processors(), 1, MAX_WORKERS);
+	search->workers = g_new0(Worker, search->n_workers);
+	for (i = 0; i < search->n_workers; i++) {
+		Worker *w = &search->workers[i];
+
+		w->search = search;
+		g_mutex_init(&w->lock);
+		g_queue_init(&w->items);
+		w->hits = g_ptr_array_new_with_free_func((GDestroyNotify)log_search_hit_free);
+		w->positions = g_array_new(FALSE, FALSE, sizeof(LogMatchPos));
+		w->last_flush = g_get_monotonic_time();
+		w->rand = i + 1;
+	}
+
+	return search;
+}
+
+static void
+log_search_run(LogSearch *search)
+{
+	guint i;
+
+	search->running = search->n_workers;
+	for (i = 0; i < search->n_workers; i++) {
+		char *name = g_strdup_printf("logsearch-%u", i);
+
+		g_thread_unref(g_thread_new(name, worker_thread,
+		                            &log_search_ref(search)->workers[i]));
+		g_free(name);
+	}
+}
+
+LogSearch *
+log_search_start(const char *logdir, const char *query, LogCache *cache,
+                 LogIndex *index, LogSearchHitsFunc hits_cb,
+                 LogSearchDoneFunc done_cb, gpointer data)
+{
+	LogSearch *search = log_search_new(query, hits_cb, done_cb, data);
+	LogQuery *parsed;
+
+	if (cache != NULL && search->matcher != NULL) {
+		search->cache = log_cache_ref(cache);
+		search->query = g_strdup(query);
+		search->prior = log_cache_lookup(cache, query);
+		search->fresh = log_cache_result_new(time(NULL));
+	}
+	/* Only a single word or phrase can be looked up */
+	if (index != NULL && search->matcher != NULL &&
+	    (parsed = log_query_parse(query)) != NULL) {
+		if (log_query_get_literal(parsed) != NULL) {
+			search->index = log_index_ref(index);
+			search->literal = g_strdup(log_query_get_literal(parsed));
+		}
+		log_query_free(parsed);
+	}
+	push_item(&search->workers[0], search->index != NULL ? ITEM_INDEX : ITEM_ROOT,
+	          g_strdup(logdir));
+	log_search_run(search);
+
+	return search;
+}
+
+LogSearch *
+log_search_start_files(GPtrArray *paths, const char *query,
+                       LogSearchHitsFunc hits_cb, LogSearchDoneFunc done_cb,
+                       gpointer data)
+{
+	LogSearch *search = log_search_new(query, hits_cb, done_cb, data);
+	guint i;
+
+	/* Dealt out evenly; stealing evens out the rest */
+	for (i = 0; i < paths->len; i++)
+		push_item(&search->workers[i % search->n_workers], ITEM_FILE,
+		          g_strdup(g_ptr_array_index(paths, i)));
+	log_search_run(search);
+
+	return search;
+}
+
+void
+log_search_free(LogSearch *search)
+{
+	if (search == NULL)
+		return;
+
+	g_atomic_int_set(&search->cancelled, 1);
+
+	g_mutex_lock(&search->lock);
+	if (search->idle_id != 0) {
+		g_source_remove(search->idle_id);
+		search->idle_id = 0;
+	}
+	g_cond_broadcast(&search->wakeup);
+	g_mutex_unlock(&search->lock);
+
+	log_search_unref(search);
+}
+
+void
+log_search_get_stats(LogSearch *search, LogStatsCounters *stats)
+{
+	g_mutex_lock(&search->lock);
+	*stats = search->stats;
+	g_mutex_unlock(&search->lock);
+}
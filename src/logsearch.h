@@ -0,0 +1,75 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGSEARCH_H_
+#define _LOGVIEWER_LOGSEARCH_H_
+
+#include <time.h>
+#include <glib.h>
+
+#include "logcache.h"
+#include "logfile.h"
+#include "logindex.h"
+#include "logstats.h"
+
+typedef struct _LogSearch LogSearch;
+typedef struct _LogSearchHit LogSearchHit;
+
+struct _LogSearchHit {
+	char     *path;     /**< The log file the query was found in        */
+	time_t    time;     /**< When the conversation in that file started  */
+	LogFormat format;
+	char     *snippet;  /**< Markup of a line the query is on, or NULL   */
+	GArray   *positions; /**< LogMatchPos of its words, or NULL if it is
+	                         not known where they are                 */
+};
+
+/** Receives a batch of hits on the main loop.  The array is freed afterwards. */
+typedef void (*LogSearchHitsFunc)(LogSearch *search, GPtrArray *hits, gpointer data);
+
+/** Called on the main loop once every log has been scanned. */
+typedef void (*LogSearchDoneFunc)(LogSearch *search, gpointer data);
+
+/**
+ * Starts scanning every IM log under logdir for query, in the syntax of
+ * logquery.h, on a set of worker threads, one per core.  Work is split by
+ * buddy directory and then by log file, and idle workers steal from busy
+ * ones.  Hits are handed to hits_cb in batches from the main loop.
+ *
+ * If cache is given, logs unchanged since the last complete scan for the
+ * same query are not read again, and the outcome of this scan is stored in
+ * it once every log has been looked at.
+ *
+ * If index is given and query is a single word or phrase, only the logs the
+ * index names as ones it may be in are read, if the index is ready.
+ */
+LogSearch *log_search_start(const char *logdir, const char *query, LogCache *cache,
+                            LogIndex *index, LogSearchHitsFunc hits_cb,
+                            LogSearchDoneFunc done_cb, gpointer data);
+
+/**
+ * Like log_search_start(), but looks only through the given log files, as
+ * when narrowing down the hits of an earlier search.
+ */
+LogSearch *log_search_start_files(GPtrArray *paths, const char *query,
+                                  LogSearchHitsFunc hits_cb, LogSearchDoneFunc done_cb,
+                                  gpointer data);
+
+/**
+ * Stops the search if it is still running and releases it.  No callback is
+ * made for it once this returns; the workers wind down on their own.
+ */
+void log_search_free(LogSearch *search);
+
+void log_search_hit_free(LogSearchHit *hit);
+
+/**
+ * What the search has cost so far: wall time from start to done, the CPU
+ * time of its workers, and the logs looked at, bytes read and hits found.
+ * Complete once done_cb has been called.
+ */
+void log_search_get_stats(LogSearch *search, LogStatsCounters *stats);
+
+#endif /* _LOGVIEWER_LOGSEARCH_H_ */
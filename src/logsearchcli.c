@@ -0,0 +1,222 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+/*
+ * Searches a Pidgin log tree from the command line, without Pidgin:
+ *
+ *   pidgin-logsearch [--logdir DIR] [--json] [--max-count N] [--stats] QUERY...
+ *
+ * The words of the query are joined as they would be typed into the log
+ * viewer's search box, so AND, OR, NOT, "phrases", from:, with: and fuzzy
+ * words like teh~1 all work.
+ * Matching logs are printed as they are found, one per line, as text or as
+ * JSON objects; --stats adds where the time went, on stderr.  Like grep,
+ * exits with 0 if something was found, 1 if not and 2 on error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logquery.h"
+#include "logsearch.h"
+
+typedef struct {
+	GMainLoop *loop;
+	gboolean   json;
+	guint      max_count;   /**< Stop after this many hits, or 0    */
+	guint      n_hits;
+} Output;
+
+static void
+usage(FILE *out, const char *argv0)
+{
+	fprintf(out,
+		"usage: %s [--logdir DIR] [--json] [--max-count N] [--stats] QUERY...\n"
+		"\n"
+		"Searches every IM log under DIR (~/.purple/logs by default).  Terms are\n"
+		"ANDed; AND, OR, NOT, parentheses, \"phrases\", from:NAME and with:NAME\n"
+		"are understood.  A word or phrase with ~N after it, or just ~, also\n"
+		"matches text up to N (or 1) typos away from it.\n"
+		"\n"
+		"  --logdir DIR     the log directory to search\n"
+		"  --json           print one JSON object per matching log\n"
+		"  --max-count N    stop after N matching logs\n"
+		"  --stats          print how long each stage took to stderr\n",
+		argv0);
+}
+
+/* Directory names are escaped the way purple_escape_filename() does it */
+static char *
+unescape(const char *name)
+{
+	char *s = g_uri_unescape_string(name, NULL);
+
+	return s != NULL ? s : g_strdup(name);
+}
+
+static void
+print_json_string(const char *key, const char *s, gboolean last)
+{
+	printf("\"%s\":\"", key);
+	for (; *s != '\0'; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c == '\n')
+			fputs("\\n", stdout);
+		else if (c == '\t')
+			fputs("\\t", stdout);
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	printf(last ? "\"" : "\",");
+}
+
+static void
+print_hit(Output *out, LogSearchHit *hit)
+{
+	char *dir = g_path_get_dirname(hit->path);
+	char *adir = g_path_get_dirname(dir);
+	char *pdir = g_path_get_dirname(adir);
+	char *buddy_name = g_path_get_basename(dir);
+	char *account_name = g_path_get_basename(adir);
+	char *protocol = g_path_get_basename(pdir);
+	char *buddy = unescape(buddy_name);
+	char *account = unescape(account_name);
+	char when[64];
+	struct tm tm;
+
+	localtime_r(&hit->time, &tm);
+
+	if (out->json) {
+		strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S%z", &tm);
+		putchar('{');
+		print_json_string("time", when, FALSE);
+		printf("\"timestamp\":%" G_GINT64_FORMAT ",", (gint64)hit->time);
+		print_json_string("protocol", protocol, FALSE);
+		print_json_string("account", account, FALSE);
+		print_json_string("buddy", buddy, FALSE);
+		print_json_string("format", hit->format == LOG_FORMAT_TXT ? "txt" : "html", FALSE);
+		print_json_string("path", hit->path, TRUE);
+		printf("}\n");
+	} else {
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+		printf("%s\t%s\t%s\t%s\t%s\n", when, protocol, account, buddy, hit->path);
+	}
+
+	g_free(dir);
+	g_free(adir);
+	g_free(pdir);
+	g_free(buddy_name);
+	g_free(account_name);
+	g_free(protocol);
+	g_free(buddy);
+	g_free(account);
+}
+
+static void
+hits_cb(LogSearch *search, GPtrArray *hits, gpointer data)
+{
+	Output *out = data;
+	guint i;
+
+	for (i = 0; i < hits->len; i++) {
+		if (out->max_count != 0 && out->n_hits >= out->max_count)
+			break;
+		print_hit(out, g_ptr_array_index(hits, i));
+		out->n_hits++;
+	}
+	fflush(stdout);
+
+	if (out->max_count != 0 && out->n_hits >= out->max_count)
+		g_main_loop_quit(out->loop);
+}
+
+static void
+done_cb(LogSearch *search, gpointer data)
+{
+	Output *out = data;
+
+	g_main_loop_quit(out->loop);
+}
+
+int
+main(int argc, char **argv)
+{
+	Output out = { NULL, FALSE, 0, 0 };
+	char *logdir = NULL, *text;
+	gboolean stats = FALSE;
+	GPtrArray *words = g_ptr_array_new();
+	LogQuery *query;
+	LogSearch *search;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--logdir") == 0 && i + 1 < argc) {
+			g_free(logdir);
+			logdir = g_strdup(argv[++i]);
+		} else if (strcmp(argv[i], "--json") == 0)
+			out.json = TRUE;
+		else if (strcmp(argv[i], "--max-count") == 0 && i + 1 < argc)
+			out.max_count = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--stats") == 0)
+			stats = TRUE;
+		else if (strcmp(argv[i], "--help") == 0) {
+			usage(stdout, argv[0]);
+			return 0;
+		} else if (strcmp(argv[i], "--") == 0) {
+			for (i++; i < argc; i++)
+				g_ptr_array_add(words, argv[i]);
+		} else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+			usage(stderr, argv[0]);
+			return 2;
+		} else
+			g_ptr_array_add(words, argv[i]);
+	}
+	g_ptr_array_add(words, NULL);
+	text = g_strjoinv(" ", (char **)words->pdata);
+	g_ptr_array_free(words, TRUE);
+
+	if ((query = log_query_parse(text)) == NULL) {
+		if (*text != '\0')
+			fprintf(stderr, "%s: nothing to search for, or too many terms\n", argv[0]);
+		else
+			usage(stderr, argv[0]);
+		g_free(text);
+		return 2;
+	}
+	log_query_free(query);
+
+	if (logdir == NULL)
+		logdir = g_build_filename(g_get_home_dir(), ".purple", "logs", NULL);
+	if (!g_file_test(logdir, G_FILE_TEST_IS_DIR)) {
+		fprintf(stderr, "%s: %s is not a directory\n", argv[0], logdir);
+		g_free(logdir);
+		g_free(text);
+		return 2;
+	}
+
+	out.loop = g_main_loop_new(NULL, FALSE);
+	search = log_search_start(logdir, text, NULL, NULL, hits_cb, done_cb, &out);
+	g_main_loop_run(out.loop);
+	log_search_free(search);
+	g_main_loop_unref(out.loop);
+
+	if (stats) {
+		char *table = log_stats_to_table();
+
+		fputs(table, stderr);
+		g_free(table);
+	}
+
+	g_free(logdir);
+	g_free(text);
+	return out.n_hits > 0 ? 0 : 1;
+}
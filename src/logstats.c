@@ -0,0 +1,159 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "logstats.h"
+
+static GMutex stats_lock;
+static LogStatsCounters stats[LOG_STATS_N_STAGES];
+
+static const char *stage_names[LOG_STATS_N_STAGES] = {
+	"list",
+	"read",
+	"match",
+	"decode",
+	"search",
+	"buddies",
+	"calendar",
+	"rows",
+	"render"
+};
+
+static gint64
+clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts) != 0)
+		return 0;
+	return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+gint64
+log_stats_now(void)
+{
+	return clock_ns(CLOCK_MONOTONIC);
+}
+
+gint64
+log_stats_cpu_now(void)
+{
+	return clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void
+log_stats_add(LogStatsStage stage, const LogStatsCounters *counters)
+{
+	LogStatsCounters *total = &stats[stage];
+
+	g_mutex_lock(&stats_lock);
+	total->calls += counters->calls;
+	total->wall += counters->wall;
+	total->cpu += counters->cpu;
+	total->bytes += counters->bytes;
+	total->logs += counters->logs;
+	total->hits += counters->hits;
+	g_mutex_unlock(&stats_lock);
+}
+
+void
+log_stats_timer_start(LogStatsTimer *timer)
+{
+	timer->wall = log_stats_now();
+	timer->cpu = log_stats_cpu_now();
+}
+
+void
+log_stats_timer_stop(LogStatsTimer *timer, LogStatsStage stage,
+                     gint64 bytes, gint64 logs, gint64 hits)
+{
+	LogStatsCounters counters;
+
+	counters.calls = 1;
+	counters.wall = log_stats_now() - timer->wall;
+	counters.cpu = log_stats_cpu_now() - timer->cpu;
+	counters.bytes = bytes;
+	counters.logs = logs;
+	counters.hits = hits;
+	log_stats_add(stage, &counters);
+}
+
+void
+log_stats_get(LogStatsStage stage, LogStatsCounters *counters)
+{
+	g_mutex_lock(&stats_lock);
+	*counters = stats[stage];
+	g_mutex_unlock(&stats_lock);
+}
+
+void
+log_stats_reset(void)
+{
+	g_mutex_lock(&stats_lock);
+	memset(stats, 0, sizeof(stats));
+	g_mutex_unlock(&stats_lock);
+}
+
+const char *
+log_stats_stage_name(LogStatsStage stage)
+{
+	return stage_names[stage];
+}
+
+char *
+log_stats_to_table(void)
+{
+	GString *out = g_string_new(NULL);
+	LogStatsCounters all[LOG_STATS_N_STAGES];
+	guint i;
+
+	g_mutex_lock(&stats_lock);
+	memcpy(all, stats, sizeof(all));
+	g_mutex_unlock(&stats_lock);
+
+	g_string_append_printf(out, "%-9s %8s %10s %10s %10s %10s %8s %8s\n",
+	                       "stage", "calls", "wall ms", "cpu ms", "avg us",
+	                       "MB", "logs", "hits");
+	for (i = 0; i < LOG_STATS_N_STAGES; i++) {
+		const LogStatsCounters *c = &all[i];
+
+		g_string_append_printf(out,
+			"%-9s %8" G_GINT64_FORMAT " %10.1f %10.1f %10.1f %10.2f %8"
+			G_GINT64_FORMAT " %8" G_GINT64_FORMAT "\n",
+			stage_names[i], c->calls, c->wall / 1e6, c->cpu / 1e6,
+			c->calls > 0 ? c->wall / 1e3 / c->calls : 0.0,
+			c->bytes / (double)(1 << 20), c->logs, c->hits);
+	}
+
+	return g_string_free(out, FALSE);
+}
+
+char *
+log_stats_to_tsv(const char *version)
+{
+	GString *out = g_string_new(NULL);
+	LogStatsCounters all[LOG_STATS_N_STAGES];
+	guint i;
+
+	g_mutex_lock(&stats_lock);
+	memcpy(all, stats, sizeof(all));
+	g_mutex_unlock(&stats_lock);
+
+	g_string_append_printf(out, "# logviewer %s, %u cores\n",
+	                       version, g_get_num_processors());
+	g_string_append(out, "stage\tcalls\twall_ns\tcpu_ns\tbytes\tlogs\thits\n");
+	for (i = 0; i < LOG_STATS_N_STAGES; i++) {
+		const LogStatsCounters *c = &all[i];
+
+		g_string_append_printf(out,
+			"%s\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT
+			"\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\n",
+			stage_names[i], c->calls, c->wall, c->cpu, c->bytes, c->logs, c->hits);
+	}
+
+	return g_string_free(out, FALSE);
+}
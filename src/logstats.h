@@ -0,0 +1,76 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGSTATS_H_
+#define _LOGVIEWER_LOGSTATS_H_
+
+#include <glib.h>
+
+/**
+ * Running totals of where the viewer's time goes, by stage, kept for the
+ * life of the process.  Any thread may add to them.  Stages timed once per
+ * log on worker threads only record wall time, as asking for a thread's CPU
+ * time costs a system call; their CPU time shows up under the operation they
+ * are part of.
+ */
+typedef enum {
+	LOG_STATS_LIST,       /**< Listing log directories                   */
+	LOG_STATS_READ,       /**< Getting a log's bytes: mapped or unpacked */
+	LOG_STATS_MATCH,      /**< Looking for a query in a log; a mapped log
+	                       *   is paged in here                          */
+	LOG_STATS_DECODE,     /**< Turning a log into the text shown         */
+	LOG_STATS_SEARCH,     /**< Whole searches, from start to done        */
+	LOG_STATS_BUDDIES,    /**< Filling the list of buddies               */
+	LOG_STATS_CALENDAR,   /**< A contact's timeline and calendar marks   */
+	LOG_STATS_ROWS,       /**< Adding rows for search hits               */
+	LOG_STATS_RENDER,     /**< Putting text into the conversation view   */
+	LOG_STATS_N_STAGES
+} LogStatsStage;
+
+typedef struct {
+	gint64 calls;
+	gint64 wall;          /**< Nanoseconds                                */
+	gint64 cpu;           /**< Nanoseconds, where it is measured          */
+	gint64 bytes;
+	gint64 logs;
+	gint64 hits;
+} LogStatsCounters;
+
+typedef struct {
+	gint64 wall;
+	gint64 cpu;
+} LogStatsTimer;
+
+/** Monotonic wall time, in nanoseconds. */
+gint64 log_stats_now(void);
+
+/** The calling thread's CPU time, in nanoseconds. */
+gint64 log_stats_cpu_now(void);
+
+/** Adds counters to the totals of stage. */
+void log_stats_add(LogStatsStage stage, const LogStatsCounters *counters);
+
+void log_stats_timer_start(LogStatsTimer *timer);
+
+/** Adds one call, with the wall and CPU time since the timer was started. */
+void log_stats_timer_stop(LogStatsTimer *timer, LogStatsStage stage,
+                          gint64 bytes, gint64 logs, gint64 hits);
+
+void log_stats_get(LogStatsStage stage, LogStatsCounters *counters);
+
+void log_stats_reset(void);
+
+const char *log_stats_stage_name(LogStatsStage stage);
+
+/** The totals as a table for people to read. */
+char *log_stats_to_table(void);
+
+/**
+ * The totals as tab-separated values with a header naming version, for
+ * comparing one build against another.
+ */
+char *log_stats_to_tsv(const char *version);
+
+#endif /* _LOGVIEWER_LOGSTATS_H_ */
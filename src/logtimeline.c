@@ -0,0 +1,216 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#include <string.h>
+
+#include "logtimeline.h"
+
+typedef struct {
+	time_t   time;
+	gint32   date;     /**< year * 10000 + (month + 1) * 100 + day, local */
+	gpointer data;
+} TimelineEntry;
+
+struct _LogTimeline {
+	GArray        *entries;   /**< TimelineEntry, by date once sorted   */
+	GHashTable    *months;    /**< year * 12 + month -> day bitmap      */
+	gboolean       dirty;     /**< Entries added since the last sort    */
+	GDestroyNotify free_func;
+};
+
+#define DATE_YEAR(d)  ((d) / 10000)
+#define DATE_MONTH(d) ((d) / 100 % 100 - 1)
+#define DATE_DAY(d)   ((d) % 100)
+
+static gint32
+make_date(int year, int month, int day)
+{
+	return year * 10000 + (month + 1) * 100 + day;
+}
+
+static int
+entry_compare(gconstpointer a, gconstpointer b)
+{
+	const TimelineEntry *e1 = a, *e2 = b;
+
+	/*
+	 * Logs carrying their own time zone can put the date slightly out of
+	 * step with the time, so order by date first to keep lookups exact.
+	 */
+	if (e1->date != e2->date)
+		return e1->date < e2->date ? -1 : 1;
+	if (e1->time != e2->time)
+		return e1->time < e2->time ? -1 : 1;
+	return 0;
+}
+
+static void
+rebuild(LogTimeline *timeline)
+{
+	guint i;
+
+	if (!timeline->dirty)
+		return;
+
+	g_array_sort(timeline->entries, entry_compare);
+	g_hash_table_remove_all(timeline->months);
+	for (i = 0; i < timeline->entries->len; i++) {
+		gint32 date = g_array_index(timeline->entries, TimelineEntry, i).date;
+		gpointer key = GINT_TO_POINTER(DATE_YEAR(date) * 12 + DATE_MONTH(date));
+		guint32 mask = GPOINTER_TO_UINT(g_hash_table_lookup(timeline->months, key));
+
+		mask |= 1u << DATE_DAY(date);
+		g_hash_table_insert(timeline->months, key, GUINT_TO_POINTER(mask));
+	}
+	timeline->dirty = FALSE;
+}
+
+LogTimeline *
+log_timeline_new(GDestroyNotify free_func)
+{
+	LogTimeline *timeline = g_new0(LogTimeline, 1);
+
+	timeline->entries = g_array_new(FALSE, FALSE, sizeof(TimelineEntry));
+	timeline->months = g_hash_table_new(g_direct_hash, g_direct_equal);
+	timeline->free_func = free_func;
+
+	return timeline;
+}
+
+void
+log_timeline_free(LogTimeline *timeline)
+{
+	guint i;
+
+	if (timeline == NULL)
+		return;
+
+	if (timeline->free_func != NULL)
+		for (i = 0; i < timeline->entries->len; i++)
+			timeline->free_func(g_array_index(timeline->entries, TimelineEntry, i).data);
+
+	g_array_free(timeline->entries, TRUE);
+	g_hash_table_destroy(timeline->months);
+	g_free(timeline);
+}
+
+void
+log_timeline_add(LogTimeline *timeline, time_t time, const struct tm *tm,
+                 gpointer data)
+{
+	TimelineEntry entry;
+	struct tm local;
+
+	if (tm == NULL) {
+#ifdef _WIN32
+		localtime_s(&local, &time);
+#else
+		localtime_r(&time, &local);
+#endif
+		tm = &local;
+	}
+
+	entry.time = time;
+	entry.date = make_date(tm->tm_year + 1900, tm->tm_mon, tm->tm_mday);
+	entry.data = data;
+	g_array_append_val(timeline->entries, entry);
+	timeline->dirty = TRUE;
+}
+
+void
+log_timeline_remove(LogTimeline *timeline, gpointer data)
+{
+	guint i;
+
+	for (i = 0; i < timeline->entries->len; i++) {
+		if (g_array_index(timeline->entries, TimelineEntry, i).data != data)
+			continue;
+
+		if (timeline->free_func != NULL)
+			timeline->free_func(data);
+		g_array_remove_index(timeline->entries, i);
+		/* Removal keeps the order but the month may have lost its last log */
+		timeline->dirty = TRUE;
+		return;
+	}
+}
+
+guint32
+log_timeline_month_mask(LogTimeline *timeline, int year, int month)
+{
+	rebuild(timeline);
+	return GPOINTER_TO_UINT(g_hash_table_lookup(timeline->months,
+	                                            GINT_TO_POINTER(year * 12 + month)));
+}
+
+gboolean
+log_timeline_latest(LogTimeline *timeline, int *year, int *month, int *day)
+{
+	gint32 date;
+
+	rebuild(timeline);
+	if (timeline->entries->len == 0)
+		return FALSE;
+
+	date = g_array_index(timeline->entries, TimelineEntry,
+	                     timeline->entries->len - 1).date;
+	*year = DATE_YEAR(date);
+	*month = DATE_MONTH(date);
+	*day = DATE_DAY(date);
+	return TRUE;
+}
+
+/* The first entry dated on or after date */
+static guint
+lower_bound(LogTimeline *timeline, gint32 date)
+{
+	guint lo = 0, hi = timeline->entries->len;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+
+		if (g_array_index(timeline->entries, TimelineEntry, mid).date < date)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+guint
+log_timeline_day(LogTimeline *timeline, int year, int month, int day,
+                 guint *first)
+{
+	gint32 date = make_date(year, month, day);
+	guint start, end;
+
+	rebuild(timeline);
+	start = lower_bound(timeline, date);
+	end = lower_bound(timeline, date + 1);
+
+	if (first != NULL)
+		*first = start;
+	return end - start;
+}
+
+guint
+log_timeline_length(LogTimeline *timeline)
+{
+	return timeline->entries->len;
+}
+
+gpointer
+log_timeline_get(LogTimeline *timeline, guint i)
+{
+	rebuild(timeline);
+	return g_array_index(timeline->entries, TimelineEntry, i).data;
+}
+
+time_t
+log_timeline_get_time(LogTimeline *timeline, guint i)
+{
+	rebuild(timeline);
+	return g_array_index(timeline->entries, TimelineEntry, i).time;
+}
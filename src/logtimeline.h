@@ -0,0 +1,47 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGTIMELINE_H_
+#define _LOGVIEWER_LOGTIMELINE_H_
+
+#include <time.h>
+#include <glib.h>
+
+/**
+ * A contact's logs sorted by time, with a bitmap of the days that have logs
+ * for every month.  Dates are in local time and worked out once per log.
+ */
+typedef struct _LogTimeline LogTimeline;
+
+/** free_func, if not NULL, is called on the data of every entry when it goes. */
+LogTimeline *log_timeline_new(GDestroyNotify free_func);
+
+void log_timeline_free(LogTimeline *timeline);
+
+/** Adds a log.  tm may be NULL, in which case time is converted here. */
+void log_timeline_add(LogTimeline *timeline, time_t time, const struct tm *tm,
+                      gpointer data);
+
+/** Removes the entry holding data, freeing it. */
+void log_timeline_remove(LogTimeline *timeline, gpointer data);
+
+/** Bit d (1..31) is set when there are logs on that day; month is 0..11. */
+guint32 log_timeline_month_mask(LogTimeline *timeline, int year, int month);
+
+/** The date of the most recent log.  Returns FALSE if there are no logs. */
+gboolean log_timeline_latest(LogTimeline *timeline, int *year, int *month, int *day);
+
+/**
+ * Finds the logs of one day.  Returns how many there are and points first at
+ * the position of the earliest one, for use with log_timeline_get().
+ */
+guint log_timeline_day(LogTimeline *timeline, int year, int month, int day,
+                       guint *first);
+
+guint log_timeline_length(LogTimeline *timeline);
+gpointer log_timeline_get(LogTimeline *timeline, guint i);
+time_t log_timeline_get_time(LogTimeline *timeline, guint i);
+
+#endif /* _LOGVIEWER_LOGTIMELINE_H_ */
@@ -0,0 +1,164 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#include "logwarmup.h"
+
+#define SLICE_USEC      (20 * 1000)   /* work done before sleeping at all */
+#define IDLE_SHARE      4             /* 1 in this much of the time, while away */
+#define ACTIVE_SHARE    20            /* and while the user is about */
+
+typedef struct {
+	LogWarmupFunc  func;
+	gpointer       data;
+	GDestroyNotify destroy;
+} Step;
+
+struct _LogWarmup {
+	GThread  *thread;
+	GMutex    lock;      /**< Guards the rest */
+	GCond     wakeup;
+	GQueue    steps;     /**< Step, yet to be run */
+	gboolean  paused;
+	gboolean  stopped;
+};
+
+static void
+step_free(Step *step)
+{
+	if (step->destroy != NULL)
+		step->destroy(step->data);
+	g_free(step);
+}
+
+static gpointer
+warmup_thread(gpointer data)
+{
+	LogWarmup *warmup = data;
+	Step *step;
+
+	for (;;) {
+		g_mutex_lock(&warmup->lock);
+		while (!warmup->stopped &&
+		       (warmup->paused || g_queue_is_empty(&warmup->steps)))
+			g_cond_wait(&warmup->wakeup, &warmup->lock);
+		step = warmup->stopped ? NULL : g_queue_pop_head(&warmup->steps);
+		g_mutex_unlock(&warmup->lock);
+
+		if (step == NULL)
+			break;
+		step->func(warmup, step->data);
+		step_free(step);
+	}
+
+	return NULL;
+}
+
+LogWarmup *
+log_warmup_new(void)
+{
+	LogWarmup *warmup = g_new0(LogWarmup, 1);
+
+	g_mutex_init(&warmup->lock);
+	g_cond_init(&warmup->wakeup);
+	g_queue_init(&warmup->steps);
+	warmup->paused = TRUE;
+	warmup->thread = g_thread_new("logwarmup", warmup_thread, warmup);
+
+	return warmup;
+}
+
+void
+log_warmup_stop(LogWarmup *warmup)
+{
+	if (warmup->thread == NULL)
+		return;
+
+	g_mutex_lock(&warmup->lock);
+	warmup->stopped = TRUE;
+	g_cond_broadcast(&warmup->wakeup);
+	g_mutex_unlock(&warmup->lock);
+
+	g_thread_join(warmup->thread);
+	warmup->thread = NULL;
+}
+
+void
+log_warmup_free(LogWarmup *warmup)
+{
+	Step *step;
+
+	if (warmup == NULL)
+		return;
+
+	log_warmup_stop(warmup);
+	while ((step = g_queue_pop_head(&warmup->steps)) != NULL)
+		step_free(step);
+	g_cond_clear(&warmup->wakeup);
+	g_mutex_clear(&warmup->lock);
+	g_free(warmup);
+}
+
+void
+log_warmup_add(LogWarmup *warmup, LogWarmupFunc func, gpointer data,
+               GDestroyNotify destroy)
+{
+	Step *step = g_new(Step, 1);
+
+	step->func = func;
+	step->data = data;
+	step->destroy = destroy;
+
+	g_mutex_lock(&warmup->lock);
+	g_queue_push_tail(&warmup->steps, step);
+	g_cond_broadcast(&warmup->wakeup);
+	g_mutex_unlock(&warmup->lock);
+}
+
+void
+log_warmup_set_paused(LogWarmup *warmup, gboolean paused)
+{
+	g_mutex_lock(&warmup->lock);
+	if (warmup->paused != paused) {
+		warmup->paused = paused;
+		g_cond_broadcast(&warmup->wakeup);
+	}
+	g_mutex_unlock(&warmup->lock);
+}
+
+gboolean
+log_warmup_yield(LogWarmup *warmup, gint64 *busy_since)
+{
+	gint64 now = g_get_monotonic_time(), busy;
+	gboolean going;
+
+	if (*busy_since == 0)
+		*busy_since = now;
+	busy = now - *busy_since;
+
+	g_mutex_lock(&warmup->lock);
+	if (busy >= SLICE_USEC && !warmup->stopped) {
+		/*
+		 * Sleep off the slice, waking early to be resumed or stopped.
+		 * Other threads' work only slows down when paused; stopping it
+		 * would hold up whatever they have queued behind it.
+		 */
+		gint64 until = now + busy * ((warmup->paused ? ACTIVE_SHARE : IDLE_SHARE) - 1);
+		gboolean paused = warmup->paused;
+
+		while (!warmup->stopped && warmup->paused == paused &&
+		       g_cond_wait_until(&warmup->wakeup, &warmup->lock, until))
+			;
+		*busy_since = 0;
+	}
+	while (!warmup->stopped && warmup->paused &&
+	       g_thread_self() == warmup->thread) {
+		g_cond_wait(&warmup->wakeup, &warmup->lock);
+		*busy_since = 0;
+	}
+	going = !warmup->stopped;
+	g_mutex_unlock(&warmup->lock);
+
+	return going;
+}
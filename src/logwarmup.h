@@ -0,0 +1,53 @@
+/* Improved Log Viewer for Pidgin.
+ * Tirtha Chatterjee
+ * This code is licensed under GPL v2
+ */
+
+#ifndef _LOGVIEWER_LOGWARMUP_H_
+#define _LOGVIEWER_LOGWARMUP_H_
+
+#include <glib.h>
+
+/**
+ * Work done ahead of time while the user is away.  A thread runs the steps
+ * added to it in order, but only while the warmup is not paused; a new
+ * warmup starts out paused.  Long running work, on that thread or on any
+ * other, calls log_warmup_yield() between small pieces of it, which keeps it
+ * to a small share of the time.  Paused, that share gets smaller still, and
+ * a step stops at log_warmup_yield() until the warmup is resumed.
+ *
+ * All calls but log_warmup_yield() are made from the main thread.
+ */
+typedef struct _LogWarmup LogWarmup;
+
+/** A step of the warmup, run on its thread. */
+typedef void (*LogWarmupFunc)(LogWarmup *warmup, gpointer data);
+
+LogWarmup *log_warmup_new(void);
+
+/**
+ * Stops the warmup: the step being run is woken and log_warmup_yield()
+ * returns FALSE from then on.  Returns once its thread has finished.  Work
+ * on other threads that yields to the warmup has to be stopped before it
+ * is freed.
+ */
+void log_warmup_stop(LogWarmup *warmup);
+
+/** Stops the warmup if need be, and frees it with the steps not yet run. */
+void log_warmup_free(LogWarmup *warmup);
+
+/** Runs func once the steps added before it are done; destroy frees data. */
+void log_warmup_add(LogWarmup *warmup, LogWarmupFunc func, gpointer data,
+                    GDestroyNotify destroy);
+
+void log_warmup_set_paused(LogWarmup *warmup, gboolean paused);
+
+/**
+ * Called between pieces of work, with busy_since kept by the caller and 0
+ * at first.  Once the work has gone on for a while, sleeps long enough to
+ * keep to the warmup's share of the time.  Returns FALSE once the warmup has
+ * been stopped, when the work should be given up.
+ */
+gboolean log_warmup_yield(LogWarmup *warmup, gint64 *busy_since);
+
+#endif /* _LOGVIEWER_LOGWARMUP_H_ */